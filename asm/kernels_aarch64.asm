@@ -0,0 +1,273 @@
+// Hand written kernels for printf.c on linux aarch64, built into it with
+// make asm (-DASM_KERNELS), see the "Runtime selection" part of printf.c.
+// NEON only, which every aarch64 has. AAPCS64: arguments in x0-x2, the
+// result in x0, x0-x18 and v0-v7 / v16-v31 can be overwritten, so v8-v15
+// are not used. kernels_x86_64.asm has the same routines for x86_64
+
+.section .text
+
+// size_t asm_strlen(const char *s)
+// Aligned 16 byte loads never cross a page, so the first one starts below
+// s and the bytes in front of s are shifted out of the mask. shrn turns
+// the 16 compare bytes into a 64-bit mask with 4 bits per byte, cheaper
+// than a umaxv reduction and it says where the 0 is
+.global asm_strlen
+.type asm_strlen, %function
+asm_strlen:
+    bic     x1, x0, #15             // Block that holds s
+    ld1     {v0.16b}, [x1]
+    cmeq    v0.16b, v0.16b, #0
+    shrn    v0.8b, v0.8h, #4
+    fmov    x2, d0
+    lsl     x3, x0, #2              // (s & 15) * 4, shifts are mod 64
+    lsr     x2, x2, x3              // Drop the bytes before s
+    cbz     x2, 1f
+    rbit    x2, x2
+    clz     x2, x2
+    lsr     x0, x2, #2
+    ret
+1:
+    ldr     q0, [x1, #16]!
+    cmeq    v0.16b, v0.16b, #0
+    shrn    v0.8b, v0.8h, #4
+    fmov    x2, d0
+    cbz     x2, 1b
+    rbit    x2, x2
+    clz     x2, x2
+    sub     x0, x1, x0
+    add     x0, x0, x2, lsr #2
+    ret
+.size asm_strlen, . - asm_strlen
+
+// char *asm_strchrnul(const char *s, int c), the literal text scan
+// Same as asm_strlen with the c and the 0 compares or-ed
+.global asm_strchrnul
+.type asm_strchrnul, %function
+asm_strchrnul:
+    dup     v1.16b, w1              // c in every byte
+    bic     x2, x0, #15
+    ld1     {v0.16b}, [x2]
+    cmeq    v2.16b, v0.16b, v1.16b
+    cmeq    v0.16b, v0.16b, #0
+    orr     v0.16b, v0.16b, v2.16b
+    shrn    v0.8b, v0.8h, #4
+    fmov    x3, d0
+    lsl     x4, x0, #2
+    lsr     x3, x3, x4
+    cbz     x3, 1f
+    rbit    x3, x3
+    clz     x3, x3
+    add     x0, x0, x3, lsr #2
+    ret
+1:
+    ldr     q0, [x2, #16]!
+    cmeq    v2.16b, v0.16b, v1.16b
+    cmeq    v0.16b, v0.16b, #0
+    orr     v0.16b, v0.16b, v2.16b
+    shrn    v0.8b, v0.8h, #4
+    fmov    x3, d0
+    cbz     x3, 1b
+    rbit    x3, x3
+    clz     x3, x3
+    add     x0, x2, x3, lsr #2
+    ret
+.size asm_strchrnul, . - asm_strchrnul
+
+// void *asm_memcpy(void *dest, const void *src, size_t n)
+// No loop below 64 bytes: the first and the last bytes are moved with two
+// loads that overlap in the middle. Above that the last 64 bytes are
+// loaded up front and stored after the 64 byte loop, so the loop does not
+// need a tail
+.global asm_memcpy
+.type asm_memcpy, %function
+asm_memcpy:
+    add     x4, x1, x2              // End of src
+    add     x5, x0, x2              // End of dest
+    cmp     x2, #16
+    b.lo    4f
+    cmp     x2, #32
+    b.hi    2f
+    ldr     q0, [x1]                // 16 to 32
+    ldr     q1, [x4, #-16]
+    str     q0, [x0]
+    str     q1, [x5, #-16]
+    ret
+2:
+    cmp     x2, #64
+    b.hi    3f
+    ldp     q0, q1, [x1]            // 33 to 64
+    ldp     q2, q3, [x4, #-32]
+    stp     q0, q1, [x0]
+    stp     q2, q3, [x5, #-32]
+    ret
+3:
+    ldp     q4, q5, [x4, #-64]
+    ldp     q6, q7, [x4, #-32]
+    mov     x3, x0
+    sub     x2, x2, #64             // Bytes the loop has to cover
+1:
+    ldp     q0, q1, [x1]
+    ldp     q2, q3, [x1, #32]
+    add     x1, x1, #64
+    stp     q0, q1, [x3]
+    stp     q2, q3, [x3, #32]
+    add     x3, x3, #64
+    subs    x2, x2, #64
+    b.gt    1b
+    stp     q4, q5, [x5, #-64]
+    stp     q6, q7, [x5, #-32]
+    ret
+4:
+    cmp     x2, #8                  // Below 16: 8, 4 or 2 bytes twice, or 1
+    b.lo    5f
+    ldr     x6, [x1]
+    ldr     x7, [x4, #-8]
+    str     x6, [x0]
+    str     x7, [x5, #-8]
+    ret
+5:
+    cmp     x2, #4
+    b.lo    6f
+    ldr     w6, [x1]
+    ldr     w7, [x4, #-4]
+    str     w6, [x0]
+    str     w7, [x5, #-4]
+    ret
+6:
+    cmp     x2, #2
+    b.lo    7f
+    ldrh    w6, [x1]
+    ldrh    w7, [x4, #-2]
+    strh    w6, [x0]
+    strh    w7, [x5, #-2]
+    ret
+7:
+    cbz     x2, 8f
+    ldrb    w6, [x1]
+    strb    w6, [x0]
+8:
+    ret
+.size asm_memcpy, . - asm_memcpy
+
+// void *asm_memset(void *s, int c, size_t n)
+// The same size classes as asm_memcpy, with c in every byte of v0 / x6
+.global asm_memset
+.type asm_memset, %function
+asm_memset:
+    dup     v0.16b, w1
+    fmov    x6, d0
+    add     x5, x0, x2              // End of s
+    cmp     x2, #16
+    b.lo    4f
+    cmp     x2, #32
+    b.hi    2f
+    str     q0, [x0]                // 16 to 32
+    str     q0, [x5, #-16]
+    ret
+2:
+    cmp     x2, #64
+    b.hi    3f
+    stp     q0, q0, [x0]            // 33 to 64
+    stp     q0, q0, [x5, #-32]
+    ret
+3:
+    mov     x3, x0
+    sub     x2, x2, #64
+1:
+    stp     q0, q0, [x3]
+    stp     q0, q0, [x3, #32]
+    add     x3, x3, #64
+    subs    x2, x2, #64
+    b.gt    1b
+    stp     q0, q0, [x5, #-64]
+    stp     q0, q0, [x5, #-32]
+    ret
+4:
+    cmp     x2, #8
+    b.lo    5f
+    str     x6, [x0]
+    str     x6, [x5, #-8]
+    ret
+5:
+    cmp     x2, #4
+    b.lo    6f
+    str     w6, [x0]
+    str     w6, [x5, #-4]
+    ret
+6:
+    cmp     x2, #2
+    b.lo    7f
+    strh    w6, [x0]
+    strh    w6, [x5, #-2]
+    ret
+7:
+    cbz     x2, 8f
+    strb    w6, [x0]
+8:
+    ret
+.size asm_memset, . - asm_memset
+
+// void asm_write_decimal(char *end, uint64_t num)
+// The decimal digits of num right to left, the last one just before end,
+// like write_digits() in printf.c. Two digits per division by 100, done
+// as a multiply by the reciprocal. While num needs more than 32 bits that
+// is umulh (num / 4 * 0x28f5c28f5c28f5c3 >> 66), after that the cheaper
+// umull num * 0x51eb851f >> 37 is exact
+.global asm_write_decimal
+.type asm_write_decimal, %function
+asm_write_decimal:
+    adrp    x2, digit_pairs
+    add     x2, x2, :lo12:digit_pairs
+    mov     w4, #100
+    lsr     x5, x1, #32
+    cbz     x5, 2f
+    mov     x3, #0xf5c3
+    movk    x3, #0x5c28, lsl #16
+    movk    x3, #0xc28f, lsl #32
+    movk    x3, #0x28f5, lsl #48
+1:
+    lsr     x5, x1, #2
+    umulh   x5, x5, x3
+    lsr     x5, x5, #2              // num / 100
+    msub    x6, x5, x4, x1          // num % 100
+    ldrh    w6, [x2, x6, lsl #1]
+    strh    w6, [x0, #-2]!
+    mov     x1, x5
+    lsr     x5, x1, #32
+    cbnz    x5, 1b
+2:
+    mov     w3, #0x851f
+    movk    w3, #0x51eb, lsl #16
+    cmp     w1, #100
+    b.lo    4f
+3:
+    umull   x5, w1, w3
+    lsr     x5, x5, #37             // num / 100
+    msub    w6, w5, w4, w1          // num % 100
+    ldrh    w6, [x2, w6, uxtw #1]
+    strh    w6, [x0, #-2]!
+    mov     w1, w5
+    cmp     w1, #100
+    b.hs    3b
+4:
+    cmp     w1, #10
+    b.lo    5f
+    ldrh    w6, [x2, w1, uxtw #1]
+    strh    w6, [x0, #-2]
+    ret
+5:
+    add     w1, w1, #48             // '0'
+    strb    w1, [x0, #-1]
+    ret
+.size asm_write_decimal, . - asm_write_decimal
+
+.section .rodata
+
+digit_pairs:
+    .ascii "00010203040506070809101112131415161718192021222324252627282930"
+    .ascii "31323334353637383940414243444546474849505152535455565758596061"
+    .ascii "62636465666768697071727374757677787980818283848586878889909192"
+    .ascii "93949596979899"
+
+// No executable stack
+.section .note.GNU-stack, "", %progbits
@@ -0,0 +1,332 @@
+# Hand written kernels for printf.c on linux x86_64, the same routines as
+# kernels_aarch64.asm. Built into printf.c with make asm (-DASM_KERNELS),
+# see the "Runtime selection" part of printf.c. Only SSE2, which every
+# x86_64 has. System V calling convention: arguments in rdi, rsi, rdx,
+# the result in rax, rax rcx rdx rsi rdi r8-r11 and all xmm registers can
+# be overwritten
+
+.section .text
+
+# size_t asm_strlen(const char *s)
+# Aligned 16 byte loads never cross a page, so the first one starts below
+# s and the bytes in front of s are shifted out of the mask
+.global asm_strlen
+.type asm_strlen, @function
+asm_strlen:
+    mov      %rdi, %rax
+    and      $-16, %rax         # Block that holds s
+    pxor     %xmm0, %xmm0
+    movdqa   (%rax), %xmm1
+    pcmpeqb  %xmm0, %xmm1
+    pmovmskb %xmm1, %edx        # Bit i set: byte i is 0
+    mov      %edi, %ecx
+    and      $15, %ecx
+    shr      %cl, %edx          # Drop the bytes before s
+    test     %edx, %edx
+    jz       1f
+    bsf      %edx, %eax
+    ret
+1:
+    # One more block alone if needed, the pairs below must not cross a
+    # 32 byte boundary or the second load could be on the next page
+    test     $16, %eax
+    jnz      2f
+    add      $16, %rax
+    movdqa   (%rax), %xmm1
+    pcmpeqb  %xmm0, %xmm1
+    pmovmskb %xmm1, %edx
+    test     %edx, %edx
+    jz       2f
+    bsf      %edx, %edx
+    sub      %rdi, %rax
+    add      %rdx, %rax
+    ret
+2:
+    # 32 bytes per iteration, pminub folds the two blocks so one compare
+    # tells if either has a 0
+    movdqa   16(%rax), %xmm1
+    movdqa   32(%rax), %xmm2
+    add      $32, %rax
+    movdqa   %xmm1, %xmm3
+    pminub   %xmm2, %xmm3
+    pcmpeqb  %xmm0, %xmm3
+    pmovmskb %xmm3, %edx
+    test     %edx, %edx
+    jz       2b
+
+    # Which of the two, rax points at the second one
+    pcmpeqb  %xmm0, %xmm1
+    pmovmskb %xmm1, %ecx
+    pcmpeqb  %xmm0, %xmm2
+    pmovmskb %xmm2, %edx
+    shl      $16, %edx
+    or       %ecx, %edx         # 32 bit mask of both, in memory order
+    bsf      %edx, %edx
+    sub      %rdi, %rax
+    lea      -16(%rax,%rdx), %rax
+    ret
+.size asm_strlen, . - asm_strlen
+
+# char *asm_strchrnul(const char *s, int c), the literal text scan
+# min(x, x ^ c) is 0 exactly where x is 0 or c, one compare for both
+.global asm_strchrnul
+.type asm_strchrnul, @function
+asm_strchrnul:
+    movd      %esi, %xmm2
+    punpcklbw %xmm2, %xmm2
+    punpcklwd %xmm2, %xmm2
+    pshufd    $0, %xmm2, %xmm2  # c in every byte
+    pxor      %xmm0, %xmm0
+    mov       %rdi, %rax
+    and       $-16, %rax
+    movdqa    (%rax), %xmm1
+    movdqa    %xmm1, %xmm3
+    pxor      %xmm2, %xmm3
+    pminub    %xmm3, %xmm1
+    pcmpeqb   %xmm0, %xmm1
+    pmovmskb  %xmm1, %edx
+    mov       %edi, %ecx
+    and       $15, %ecx
+    shr       %cl, %edx
+    test      %edx, %edx
+    jz        1f
+    bsf       %edx, %edx
+    lea       (%rdi,%rdx), %rax
+    ret
+1:
+    add       $16, %rax
+    movdqa    (%rax), %xmm1
+    movdqa    %xmm1, %xmm3
+    pxor      %xmm2, %xmm3
+    pminub    %xmm3, %xmm1
+    pcmpeqb   %xmm0, %xmm1
+    pmovmskb  %xmm1, %edx
+    test      %edx, %edx
+    jz        1b
+    bsf       %edx, %edx
+    add       %rdx, %rax
+    ret
+.size asm_strchrnul, . - asm_strchrnul
+
+# void *asm_memcpy(void *dest, const void *src, size_t n)
+# No loop below 64 bytes: the first and the last bytes are moved with two
+# loads that overlap in the middle. Above that the last 64 bytes are
+# loaded up front and stored after the 64 byte loop, so the loop does not
+# need a tail
+.global asm_memcpy
+.type asm_memcpy, @function
+asm_memcpy:
+    mov      %rdi, %rax
+    cmp      $16, %rdx
+    jb       4f
+    cmp      $32, %rdx
+    ja       2f
+    movdqu   (%rsi), %xmm0       # 16 to 32
+    movdqu   -16(%rsi,%rdx), %xmm1
+    movdqu   %xmm0, (%rdi)
+    movdqu   %xmm1, -16(%rdi,%rdx)
+    ret
+2:
+    cmp      $64, %rdx
+    ja       3f
+    movdqu   (%rsi), %xmm0       # 33 to 64
+    movdqu   16(%rsi), %xmm1
+    movdqu   -32(%rsi,%rdx), %xmm2
+    movdqu   -16(%rsi,%rdx), %xmm3
+    movdqu   %xmm0, (%rdi)
+    movdqu   %xmm1, 16(%rdi)
+    movdqu   %xmm2, -32(%rdi,%rdx)
+    movdqu   %xmm3, -16(%rdi,%rdx)
+    ret
+3:
+    movdqu   -64(%rsi,%rdx), %xmm4
+    movdqu   -48(%rsi,%rdx), %xmm5
+    movdqu   -32(%rsi,%rdx), %xmm6
+    movdqu   -16(%rsi,%rdx), %xmm7
+    lea      -64(%rdi,%rdx), %r8 # Where they go
+    mov      %rdi, %rcx
+    sub      $64, %rdx           # Bytes the loop has to cover
+1:
+    movdqu   (%rsi), %xmm0
+    movdqu   16(%rsi), %xmm1
+    movdqu   32(%rsi), %xmm2
+    movdqu   48(%rsi), %xmm3
+    movdqu   %xmm0, (%rcx)
+    movdqu   %xmm1, 16(%rcx)
+    movdqu   %xmm2, 32(%rcx)
+    movdqu   %xmm3, 48(%rcx)
+    add      $64, %rsi
+    add      $64, %rcx
+    sub      $64, %rdx
+    jg       1b
+    movdqu   %xmm4, (%r8)
+    movdqu   %xmm5, 16(%r8)
+    movdqu   %xmm6, 32(%r8)
+    movdqu   %xmm7, 48(%r8)
+    ret
+4:
+    cmp      $8, %rdx            # Below 16: 8, 4 or 2 bytes twice, or 1
+    jb       5f
+    mov      (%rsi), %rcx
+    mov      -8(%rsi,%rdx), %r8
+    mov      %rcx, (%rdi)
+    mov      %r8, -8(%rdi,%rdx)
+    ret
+5:
+    cmp      $4, %rdx
+    jb       6f
+    mov      (%rsi), %ecx
+    mov      -4(%rsi,%rdx), %r8d
+    mov      %ecx, (%rdi)
+    mov      %r8d, -4(%rdi,%rdx)
+    ret
+6:
+    cmp      $2, %rdx
+    jb       7f
+    movzwl   (%rsi), %ecx
+    movzwl   -2(%rsi,%rdx), %r8d
+    mov      %cx, (%rdi)
+    mov      %r8w, -2(%rdi,%rdx)
+    ret
+7:
+    test     %rdx, %rdx
+    jz       8f
+    movzbl   (%rsi), %ecx
+    mov      %cl, (%rdi)
+8:
+    ret
+.size asm_memcpy, . - asm_memcpy
+
+# void *asm_memset(void *s, int c, size_t n)
+# The same size classes as asm_memcpy, with c in every byte of rcx / xmm0
+.global asm_memset
+.type asm_memset, @function
+asm_memset:
+    mov      %rdi, %rax
+    movzbl   %sil, %ecx
+    movabs   $0x0101010101010101, %r8
+    imul     %r8, %rcx
+    cmp      $16, %rdx
+    jb       4f
+    movq     %rcx, %xmm0
+    punpcklqdq %xmm0, %xmm0
+    cmp      $32, %rdx
+    ja       2f
+    movdqu   %xmm0, (%rdi)       # 16 to 32
+    movdqu   %xmm0, -16(%rdi,%rdx)
+    ret
+2:
+    cmp      $64, %rdx
+    ja       3f
+    movdqu   %xmm0, (%rdi)       # 33 to 64
+    movdqu   %xmm0, 16(%rdi)
+    movdqu   %xmm0, -32(%rdi,%rdx)
+    movdqu   %xmm0, -16(%rdi,%rdx)
+    ret
+3:
+    lea      -64(%rdi,%rdx), %r8
+    mov      %rdi, %rcx
+    sub      $64, %rdx
+1:
+    movdqu   %xmm0, (%rcx)
+    movdqu   %xmm0, 16(%rcx)
+    movdqu   %xmm0, 32(%rcx)
+    movdqu   %xmm0, 48(%rcx)
+    add      $64, %rcx
+    sub      $64, %rdx
+    jg       1b
+    movdqu   %xmm0, (%r8)
+    movdqu   %xmm0, 16(%r8)
+    movdqu   %xmm0, 32(%r8)
+    movdqu   %xmm0, 48(%r8)
+    ret
+4:
+    cmp      $8, %rdx
+    jb       5f
+    mov      %rcx, (%rdi)
+    mov      %rcx, -8(%rdi,%rdx)
+    ret
+5:
+    cmp      $4, %rdx
+    jb       6f
+    mov      %ecx, (%rdi)
+    mov      %ecx, -4(%rdi,%rdx)
+    ret
+6:
+    cmp      $2, %rdx
+    jb       7f
+    mov      %cx, (%rdi)
+    mov      %cx, -2(%rdi,%rdx)
+    ret
+7:
+    test     %rdx, %rdx
+    jz       8f
+    mov      %cl, (%rdi)
+8:
+    ret
+.size asm_memset, . - asm_memset
+
+# void asm_write_decimal(char *end, uint64_t num)
+# The decimal digits of num right to left, the last one just before end,
+# like write_digits() in printf.c. Two digits per division by 100, done
+# as a multiply by the reciprocal. While num needs more than 32 bits that
+# is a 64x64 bit mul (num / 4 * 0x28f5c28f5c28f5c3 >> 66), after that the
+# cheaper num * 0x51eb851f >> 37 is exact
+.global asm_write_decimal
+.type asm_write_decimal, @function
+asm_write_decimal:
+    lea      digit_pairs(%rip), %r8
+    mov      %rsi, %rcx
+    shr      $32, %rcx
+    jz       2f
+    movabs   $0x28f5c28f5c28f5c3, %r9
+1:
+    mov      %rsi, %rax
+    shr      $2, %rax
+    mul      %r9
+    shr      $2, %rdx            # num / 100
+    imul     $100, %rdx, %rax
+    sub      %rax, %rsi          # num % 100
+    movzwl   (%r8,%rsi,2), %eax
+    sub      $2, %rdi
+    mov      %ax, (%rdi)
+    mov      %rdx, %rsi
+    mov      %rsi, %rcx
+    shr      $32, %rcx
+    jnz      1b
+2:
+    cmp      $100, %esi
+    jb       4f
+3:
+    imul     $0x51eb851f, %rsi, %rcx
+    shr      $37, %rcx           # num / 100
+    imul     $100, %ecx, %eax
+    sub      %eax, %esi          # num % 100
+    movzwl   (%r8,%rsi,2), %eax
+    sub      $2, %rdi
+    mov      %ax, (%rdi)
+    mov      %ecx, %esi
+    cmp      $100, %esi
+    jae      3b
+4:
+    cmp      $10, %esi
+    jb       5f
+    movzwl   (%r8,%rsi,2), %eax
+    mov      %ax, -2(%rdi)
+    ret
+5:
+    add      $48, %esi           # '0'
+    mov      %sil, -1(%rdi)
+    ret
+.size asm_write_decimal, . - asm_write_decimal
+
+.section .rodata
+
+digit_pairs:
+    .ascii "00010203040506070809101112131415161718192021222324252627282930"
+    .ascii "31323334353637383940414243444546474849505152535455565758596061"
+    .ascii "62636465666768697071727374757677787980818283848586878889909192"
+    .ascii "93949596979899"
+
+# No executable stack
+.section .note.GNU-stack, "", @progbits
@@ -0,0 +1,78 @@
+# this asm is linux riscv64, the same program as write.asm
+
+.global _start
+.section .text
+
+strlen:
+    li a0, 0
+    mv a3, a1
+.loop:
+    lbu a2, 0(a3)
+    beqz a2, .done
+    addi a3, a3, 1
+    addi a0, a0, 1
+    j .loop
+.done:
+    ret
+
+exit_success:
+    # exit(0)
+    li a0, 0        # exit 0 for success
+    li a7, 93       # syscall exit is 93, the same table as aarch64
+
+    ecall
+
+exit_failure:
+    # exit(1)
+    li a0, 1        # exit 1 for failure
+    li a7, 93
+
+    ecall
+
+write:
+    li a0, 1        # stdout
+    li a7, 64       # syscall write is 64
+    ecall
+
+    ret             # return a0
+
+_start:
+    # gp first, the linker may turn la into gp relative addressing
+    .option push
+    .option norelax
+    la gp, __global_pointer$
+    .option pop
+
+    ##################################
+    # msg1
+    la a1, msg1
+    call strlen
+    mv a2, a0
+    la a1, msg1
+    call write
+
+    bltz a0, exit_failure # if (a0 < 0) exit(1);
+    # end of msg1
+    ##################################
+
+    ##################################
+    # msg2
+    la a1, msg2
+    call strlen
+    mv a2, a0
+    la a1, msg2
+    call write
+
+    bltz a0, exit_failure
+    # end of msg2
+    ##################################
+
+    j exit_success
+
+.section .rodata
+
+msg1:
+    .asciz "Hello World\n" # asciz make the string have null terminator
+
+msg2:
+    .asciz "Hello Everybody\n"
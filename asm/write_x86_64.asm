@@ -0,0 +1,75 @@
+# this asm is linux x86_64, the same program as write.asm
+
+.global _start
+.section .text
+
+strlen:
+    xor %rax, %rax
+    mov %rsi, %rcx
+.loop:
+    movzbl (%rcx), %edx
+    test %edx, %edx
+    jz .done
+    inc %rcx
+    inc %rax
+    jmp .loop
+.done:
+    ret
+
+exit_success:
+    # exit(0)
+    mov $0, %edi        # exit 0 for success
+    mov $60, %eax       # syscall exit is 60
+
+    syscall
+
+exit_failure:
+    # exit(1)
+    mov $1, %edi        # exit 1 for failure
+    mov $60, %eax
+
+    syscall
+
+write:
+    mov $1, %edi        # stdout
+    mov $1, %eax        # syscall write is 1
+    syscall
+
+    ret                 # return rax
+
+_start:
+    ##################################
+    # msg1
+    lea msg1(%rip), %rsi
+    call strlen
+    mov %rax, %rdx
+    lea msg1(%rip), %rsi
+    call write
+
+    cmp $0, %rax        # if (rax < 0) exit(1);
+    jl exit_failure
+    # end of msg1
+    ##################################
+
+    ##################################
+    # msg2
+    lea msg2(%rip), %rsi
+    call strlen
+    mov %rax, %rdx
+    lea msg2(%rip), %rsi
+    call write
+
+    cmp $0, %rax
+    jl exit_failure
+    # end of msg2
+    ##################################
+
+    jmp exit_success
+
+.section .rodata
+
+msg1:
+    .asciz "Hello World\n" # asciz make the string have null terminator
+
+msg2:
+    .asciz "Hello Everybody\n"
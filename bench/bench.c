@@ -0,0 +1,1102 @@
+// Benchmarks for printf.c, built as a separate freestanding binary
+// The whole of printf.c is included so static routines can be measured
+// directly, only its demo main() is left out
+
+#define PRINTF_NO_MAIN
+#include "../printf.c"
+
+/*
+ * Timer
+ * The architecture's counter from printf.c: the generic timer on aarch64,
+ * the time stamp counter on x86_64 and the time CSR on riscv64
+ */
+static inline uint64_t read_counter(void) {
+    return arch_counter();
+}
+
+static inline uint64_t counter_frequency(void) {
+    return arch_counter_frequency();
+}
+
+static double ticks_to_ns(uint64_t ticks) {
+    return (double)ticks * 1e9 / (double)counter_frequency();
+}
+
+// Results are added here so the compiler cannot drop the measured calls
+static volatile size_t bench_sink;
+
+/*
+ * Results file
+ * With -o every measurement is also written as one tab separated line:
+ * suite, case, parameter, ns per call, bytes per second (0 when it does
+ * not apply). Diff two of them to spot regressions between builds
+ */
+static int results_fd = -1;
+
+// Open for writing, returns the fd or a negative errno
+static int open_write(const char *path) {
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+static int open_results(const char *path) {
+    int fd = open_write(path);
+    if (fd < 0) {
+        return -1;
+    }
+
+    results_fd = fd;
+    dprintf(results_fd, "# suite\tcase\tparam\tns_per_call\tbytes_per_sec\n");
+    return 0;
+}
+
+static void record(const char *suite,
+                   const char *name,
+                   long param,
+                   double ns,
+                   double bytes_per_sec) {
+    if (results_fd >= 0) {
+        dprintf(results_fd,
+                "%s\t%s\t%ld\t%.3f\t%.0f\n",
+                suite,
+                name,
+                param,
+                ns,
+                bytes_per_sec);
+    }
+}
+
+/*
+ * String and memory routines
+ * The byte loops are the original printf.c versions, kept as reference,
+ * next to every kernel of printf.c this CPU can run. This file is built
+ * with -fno-tree-loop-distribute-patterns so GCC does not turn them back
+ * into memcpy()/memset() calls
+ */
+__attribute__((noinline)) static size_t strlen_byte(const char *s) {
+    const char *p = s;
+    while (*p != '\0') {
+        p++;
+    }
+    return (size_t)(p - s);
+}
+
+__attribute__((noinline)) static char *strchrnul_byte(const char *s, int c) {
+    while (*s != '\0' && *s != (char)c) {
+        s++;
+    }
+    return (char *)s;
+}
+
+__attribute__((noinline)) static void *
+memcpy_byte(void *dest, const void *src, size_t n) {
+    char *d = (char *)dest;
+    const char *s = (const char *)src;
+    for (size_t i = 0; i < n; i++) {
+        d[i] = s[i];
+    }
+    return dest;
+}
+
+__attribute__((noinline)) static void *memset_byte(void *s, int c, size_t n) {
+    unsigned char *p = (unsigned char *)s;
+    for (size_t i = 0; i < n; i++) {
+        p[i] = (unsigned char)c;
+    }
+    return s;
+}
+
+static const string_impl string_byte = {
+    "byte", 0, strlen_byte, strchrnul_byte, memcpy_byte, memset_byte};
+
+#define STRING_MAX 65536
+
+static char string_src[STRING_MAX + 64] __attribute__((aligned(64)));
+static char string_dst[STRING_MAX + 64] __attribute__((aligned(64)));
+
+// Enough calls to move about 16MB per measurement, at least 1000
+static size_t string_iterations(size_t len) {
+    size_t iters = ((size_t)16 << 20) / len;
+    return iters < 1000 ? 1000 : iters;
+}
+
+static void string_report(const char *routine,
+                          const char *impl,
+                          size_t len,
+                          size_t iters,
+                          uint64_t ticks) {
+    double ns = ticks_to_ns(ticks) / (double)iters;
+    printf("%-10s %-6s %8zu %12.2f ns %10.2f GB/s\n",
+           routine,
+           impl,
+           len,
+           ns,
+           (double)len / ns);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%s/%s", routine, impl);
+    record("string", name, (long)len, ns, (double)len / ns * 1e9);
+}
+
+static void bench_string(void) {
+    // The reference loops, then what this CPU runs of printf.c's kernels
+    const string_impl *impls[1 + STRING_IMPLS];
+    size_t count = 0;
+    impls[count++] = &string_byte;
+    for (size_t i = 0; i < STRING_IMPLS; i++) {
+        if (string_impl_supported(&string_impls[i])) {
+            impls[count++] = &string_impls[i];
+        }
+    }
+
+    printf("selected: %s\n", string_kernels->name);
+    printf("%-10s %-6s %8s %15s %15s\n",
+           "routine",
+           "impl",
+           "bytes",
+           "time/call",
+           "throughput");
+
+    for (size_t len = 1; len <= STRING_MAX; len *= 4) {
+        size_t iters = string_iterations(len);
+
+        memset_byte(string_src, 'a', len);
+        string_src[len] = '\0';
+
+        for (size_t i = 0; i < count; i++) {
+            const string_impl *impl = impls[i];
+
+            uint64_t start = read_counter();
+            for (size_t n = 0; n < iters; n++) {
+                bench_sink += impl->strlen(string_src);
+            }
+            string_report("strlen",
+                          impl->name,
+                          len,
+                          iters,
+                          read_counter() - start);
+
+            // Literal text scan, no '%' so the whole string is walked
+            start = read_counter();
+            for (size_t n = 0; n < iters; n++) {
+                bench_sink += (size_t)impl->strchrnul(string_src, '%');
+            }
+            string_report("strchrnul",
+                          impl->name,
+                          len,
+                          iters,
+                          read_counter() - start);
+
+            start = read_counter();
+            for (size_t n = 0; n < iters; n++) {
+                impl->memcpy(string_dst, string_src, len);
+            }
+            string_report("memcpy",
+                          impl->name,
+                          len,
+                          iters,
+                          read_counter() - start);
+
+            start = read_counter();
+            for (size_t n = 0; n < iters; n++) {
+                impl->memset(string_dst, (int)n, len);
+            }
+            string_report("memset",
+                          impl->name,
+                          len,
+                          iters,
+                          read_counter() - start);
+        }
+
+        // Sanity check, a wrong fast path is worse than a slow one
+        for (size_t i = 0; i < count; i++) {
+            const string_impl *impl = impls[i];
+            memset_byte(string_dst, 0, len + 1);
+            impl->memcpy(string_dst, string_src, len);
+            if (impl->strlen(string_src) != len ||
+                impl->strlen(string_dst) != len ||
+                impl->strchrnul(string_src, '%') != string_src + len) {
+                printf("%s: wrong result at length %zu\n", impl->name, len);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+/*
+ * Integer conversion
+ * uitoa_legacy() is the original division-per-digit version with the
+ * reversal pass, kept as reference
+ */
+__attribute__((noinline)) static char *
+uitoa_legacy(uint64_t num, char *buffer, int base, int uppercase) {
+    char digits_lower[] = "0123456789abcdef";
+    char digits_upper[] = "0123456789ABCDEF";
+    const char *digits = uppercase ? digits_upper : digits_lower;
+
+    char *ptr = buffer;
+    char *start = buffer;
+
+    if (num == 0) {
+        *ptr++ = '0';
+    } else {
+        while (num > 0) {
+            *ptr++ = digits[num % base];
+            num /= base;
+        }
+
+        char *end = ptr - 1;
+        while (start < end) {
+            char tmp = *start;
+            *start = *end;
+            *end = tmp;
+            start++;
+            end--;
+        }
+    }
+
+    *ptr = '\0';
+    return ptr;
+}
+
+__attribute__((noinline)) static char *
+uitoa_current(uint64_t num, char *buffer, int base, int uppercase) {
+    return uitoa(num, buffer, base, uppercase);
+}
+
+#define UITOA_VALUES 1024
+
+static uint64_t uitoa_values[UITOA_VALUES];
+
+// xorshift64, deterministic so runs are comparable
+static uint64_t bench_random(void) {
+    static uint64_t state = 88172645463325252UL;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static void bench_uitoa(void) {
+    static const int bases[] = {10, 16, 8};
+    // Values below 10^digits, so each row has a known typical length
+    static const int magnitudes[] = {1, 3, 5, 10, 20};
+    char *(*impls[])(uint64_t, char *, int, int) = {uitoa_legacy,
+                                                    uitoa_current};
+    static const char *names[] = {"legacy", "current"};
+    char buffer[72];
+
+    printf("%-4s %-6s %-8s %12s\n", "base", "digits", "impl", "time/call");
+
+    for (size_t m = 0; m < sizeof(magnitudes) / sizeof(*magnitudes); m++) {
+        for (size_t i = 0; i < UITOA_VALUES; i++) {
+            uint64_t value = bench_random();
+            if (magnitudes[m] < 20) {
+                value %= powers_of_10[magnitudes[m]];
+            }
+            uitoa_values[i] = value;
+        }
+
+        for (size_t b = 0; b < sizeof(bases) / sizeof(*bases); b++) {
+            for (size_t impl = 0; impl < 2; impl++) {
+                size_t iters = 4096;
+
+                uint64_t start = read_counter();
+                for (size_t n = 0; n < iters; n++) {
+                    for (size_t i = 0; i < UITOA_VALUES; i++) {
+                        char *end = impls[impl](uitoa_values[i],
+                                                buffer,
+                                                bases[b],
+                                                0);
+                        bench_sink += (size_t)(end - buffer);
+                    }
+                }
+                uint64_t ticks = read_counter() - start;
+                double ns =
+                    ticks_to_ns(ticks) / (double)(iters * UITOA_VALUES);
+
+                printf("%-4d %-6d %-8s %9.2f ns\n",
+                       bases[b],
+                       magnitudes[m],
+                       names[impl],
+                       ns);
+
+                char name[32];
+                snprintf(
+                    name, sizeof(name), "base%d/%s", bases[b], names[impl]);
+                record("uitoa", name, magnitudes[m], ns, 0);
+            }
+        }
+    }
+}
+
+/*
+ * Formatter
+ * Each family formats into a memory sink through format_to_buffer(), the
+ * arguments cycle through a table of random values so one value cannot be
+ * learned by the branch predictor. "compiled" is the mixed format again
+ * through printf_compile_cached(), the "typed" ones go through the C++
+ * front end (typed.cpp) with the format resolved at compile time. The
+ * "array" ones print a row of ARRAY_ROW values every ARRAY_ROW calls, so
+ * the time is per element like "%d" and "%f" next to them
+ */
+#define FORMAT_VALUES 256 // Power of two, indexes are masked
+#define FORMAT_CALLS  200000
+
+#define ARRAY_ROW     16
+
+static int format_ints[FORMAT_VALUES];
+static int64_t format_longs[FORMAT_VALUES]; // format_ints again
+static double format_doubles[FORMAT_VALUES];
+static const char *format_strings[FORMAT_VALUES];
+static char format_out[512];
+
+static const char *const string_pool[] = {
+    "",
+    "ok",
+    "worker",
+    "connection reset",
+    "/usr/local/share/applications",
+    "the quick brown fox jumps over the lazy dog, again and again",
+};
+
+static size_t format_into(const char *format, ...) {
+    memory_sink mem = {format_out, sizeof(format_out) - 1, 0};
+    sink out = {memory_put_char, memory_put_span, NULL, &mem, 0, 0};
+
+    va_list ap;
+    va_start(ap, format);
+    format_to_buffer(&out, format, ap);
+    va_end(ap);
+    return out.count;
+}
+
+static size_t format_compiled_into(const printf_format *compiled, ...) {
+    memory_sink mem = {format_out, sizeof(format_out) - 1, 0};
+    sink out = {memory_put_char, memory_put_span, NULL, &mem, 0, 0};
+
+    va_list ap;
+    va_start(ap, compiled);
+    format_compiled(&out, compiled, ap);
+    va_end(ap);
+    return out.count;
+}
+
+static size_t run_int(const char *format, size_t i) {
+    return format_into(format, format_ints[i]);
+}
+
+static size_t run_unsigned(const char *format, size_t i) {
+    return format_into(format, (unsigned int)format_ints[i]);
+}
+
+static size_t run_string(const char *format, size_t i) {
+    return format_into(format, format_strings[i]);
+}
+
+static size_t run_double(const char *format, size_t i) {
+    return format_into(format, format_doubles[i]);
+}
+
+static size_t run_mixed(const char *format, size_t i) {
+    return format_into(
+        format, format_strings[i], format_ints[i], format_doubles[i]);
+}
+
+static size_t run_compiled(const char *format, size_t i) {
+    return format_compiled_into(printf_compile_cached(format),
+                                format_strings[i],
+                                format_ints[i],
+                                format_doubles[i]);
+}
+
+// A round of 64 requests between resets, no syscalls once warm
+static size_t run_asprintf(const char *format, size_t i) {
+    char *s;
+    int len = asprintf(
+        &s, format, format_strings[i], format_ints[i], format_doubles[i]);
+    if (i % 64 == 63) {
+        arena_reset(thread_arena());
+    }
+    return len < 0 ? 0 : (size_t)len;
+}
+
+static size_t run_int_array(const char *format, size_t i) {
+    if (i % ARRAY_ROW != 0) {
+        return 0;
+    }
+
+    memory_sink mem = {format_out, sizeof(format_out) - 1, 0};
+    sink out = {memory_put_char, memory_put_span, NULL, &mem, 0, 0};
+    format_int_array(&out, &format_longs[i], ARRAY_ROW, format, ",");
+    return out.count;
+}
+
+static size_t run_double_array(const char *format, size_t i) {
+    if (i % ARRAY_ROW != 0) {
+        return 0;
+    }
+
+    memory_sink mem = {format_out, sizeof(format_out) - 1, 0};
+    sink out = {memory_put_char, memory_put_span, NULL, &mem, 0, 0};
+    format_double_array(&out, &format_doubles[i], ARRAY_ROW, format, ",");
+    return out.count;
+}
+
+// In typed.cpp, the format is part of the function
+size_t typed_int(char *buf, size_t n, int value);
+size_t typed_double(char *buf, size_t n, double value);
+size_t typed_mixed(char *buf, size_t n, const char *s, int d, double f);
+
+static size_t run_typed_int(const char *format, size_t i) {
+    (void)format;
+    return typed_int(format_out, sizeof(format_out), format_ints[i]);
+}
+
+static size_t run_typed_double(const char *format, size_t i) {
+    (void)format;
+    return typed_double(format_out, sizeof(format_out), format_doubles[i]);
+}
+
+static size_t run_typed_mixed(const char *format, size_t i) {
+    (void)format;
+    return typed_mixed(format_out,
+                       sizeof(format_out),
+                       format_strings[i],
+                       format_ints[i],
+                       format_doubles[i]);
+}
+
+#define MIXED_FORMAT "[%s] id=%d load=%.2f%%\n"
+
+typedef struct {
+    const char *name;
+    const char *format;
+    size_t (*run)(const char *format, size_t i);
+} format_family;
+
+static const format_family format_families[] = {
+    {"%d", "%d", run_int},
+    {"%x", "%x", run_unsigned},
+    {"%s", "%s", run_string},
+    {"%f", "%f", run_double},
+    {"%e", "%e", run_double},
+    {"%g", "%g", run_double},
+    {"%.17g", "%.17g", run_double},
+    {"mixed", MIXED_FORMAT, run_mixed},
+    {"compiled", MIXED_FORMAT, run_compiled},
+    {"asprintf", MIXED_FORMAT, run_asprintf},
+    {"typed %d", "%d", run_typed_int},
+    {"typed %f", "%f", run_typed_double},
+    {"typed mix", MIXED_FORMAT, run_typed_mixed},
+    {"array %d", "%d", run_int_array},
+    {"array %f", "%f", run_double_array},
+};
+
+static void bench_format(void) {
+    for (size_t i = 0; i < FORMAT_VALUES; i++) {
+        // Random sign and number of digits
+        uint64_t r = bench_random();
+        int value = (int)(bench_random() % powers_of_10[1 + r % 9]);
+        format_ints[i] = (r >> 8) & 1 ? -value : value;
+        format_longs[i] = format_ints[i];
+
+        // Up to 6 digits after the point, magnitudes 1e-3 to 1e6
+        int64_t mantissa = (int64_t)(bench_random() % 2000000000) - 1000000000;
+        format_doubles[i] = (double)mantissa / (double)powers_of_10[r % 13];
+
+        size_t pool = sizeof(string_pool) / sizeof(*string_pool);
+        format_strings[i] = string_pool[(r >> 16) % pool];
+    }
+
+    printf("%-10s %12s %15s\n", "family", "time/call", "throughput");
+
+    for (size_t f = 0; f < sizeof(format_families) / sizeof(*format_families);
+         f++) {
+        const format_family *family = &format_families[f];
+        size_t bytes = 0;
+
+        uint64_t start = read_counter();
+        for (size_t n = 0; n < FORMAT_CALLS; n++) {
+            bytes += family->run(family->format, n & (FORMAT_VALUES - 1));
+        }
+        uint64_t ticks = read_counter() - start;
+        bench_sink += bytes;
+
+        double ns = ticks_to_ns(ticks) / FORMAT_CALLS;
+        double bytes_per_sec = (double)bytes / (ticks_to_ns(ticks) / 1e9);
+
+        printf("%-10s %9.2f ns %10.2f MB/s\n",
+               family->name,
+               ns,
+               bytes_per_sec / 1e6);
+        record("format", family->name, 0, ns, bytes_per_sec);
+    }
+}
+
+/*
+ * Threads
+ * Every thread prints the same number of lines through its own stdout
+ * buffer into /dev/null. With perfect scaling the time stays flat and the
+ * throughput grows with the thread count
+ */
+#define THREAD_LINES 200000
+#define THREAD_MAX   16
+
+static int null_fd = -1;
+
+static int thread_body(void *arg) {
+    long id = (long)arg;
+    int bytes = 0;
+
+    stdout->fd = null_fd;
+    for (int i = 0; i < THREAD_LINES; i++) {
+        bytes += printf("thread %ld line %d hash %08x\n",
+                        id,
+                        i,
+                        (unsigned int)i * 2654435761U);
+    }
+    return bytes;
+}
+
+static void bench_threads(void) {
+    null_fd = open_write("/dev/null");
+    if (null_fd < 0) {
+        printf("cannot open /dev/null\n");
+        return;
+    }
+
+    printf("%-7s %12s %15s\n", "threads", "time/line", "throughput");
+
+    for (int count = 1; count <= THREAD_MAX; count *= 2) {
+        thread *threads[THREAD_MAX];
+        size_t bytes = 0;
+
+        uint64_t start = read_counter();
+        for (int i = 0; i < count; i++) {
+            threads[i] = thread_create(thread_body, (void *)(long)i);
+            if (threads[i] == NULL) {
+                printf("thread_create failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            bytes += (size_t)thread_join(threads[i]);
+        }
+        uint64_t ticks = read_counter() - start;
+
+        // Wall time per line over all threads, so it shrinks as they scale
+        double ns = ticks_to_ns(ticks) / ((double)count * THREAD_LINES);
+        double bytes_per_sec = (double)bytes / (ticks_to_ns(ticks) / 1e9);
+
+        printf("%-7d %9.2f ns %10.2f MB/s\n",
+               count,
+               ns,
+               bytes_per_sec / 1e6);
+        record("threads", "printf", count, ns, bytes_per_sec);
+    }
+
+    close(null_fd);
+}
+
+/*
+ * Asynchronous logging
+ * Caller side cost of async_printf() (formats on the caller) and
+ * async_logf() (only captures the arguments, rendered by the flusher or
+ * written as a binary log) against printf() into the stdout buffer, all
+ * ending up in /dev/null. Messages are sent in bursts that fit the ring
+ * with a pause in between, so the flusher keeps up and the numbers are
+ * not about dropping. Drops are still reported, bytes written shows the
+ * log volume
+ */
+#define ASYNC_BURSTS 2000
+#define ASYNC_FORMAT "burst %d message %zu load %.3f hash %08x\n"
+
+enum { ASYNC_TEXT, ASYNC_DEFERRED, ASYNC_BINARY };
+
+// Caller side time of all bursts, in ns per message
+static double async_run(int fd, int mode, async_stats *stats) {
+    size_t burst = ASYNC_SLOTS / 2;
+    uint64_t ticks = 0;
+
+    if (mode == ASYNC_BINARY) {
+        async_start_binary(fd);
+    } else {
+        async_start(fd);
+    }
+    for (int b = 0; b < ASYNC_BURSTS; b++) {
+        uint64_t start = read_counter();
+        for (size_t i = 0; i < burst; i++) {
+            unsigned int hash = (unsigned int)i * 2654435761U;
+            double load = (double)hash / 4294967296.0;
+            if (mode != ASYNC_TEXT) {
+                async_logf(ASYNC_FORMAT, b, i, load, hash);
+            } else {
+                async_printf(ASYNC_FORMAT, b, i, load, hash);
+            }
+        }
+        ticks += read_counter() - start;
+
+        // Let the flusher empty the ring
+        do {
+            async_get_stats(stats);
+        } while (stats->depth > 0);
+    }
+    async_stop();
+    async_get_stats(stats);
+
+    return ticks_to_ns(ticks) / ((double)ASYNC_BURSTS * (double)burst);
+}
+
+static void bench_async(void) {
+    int fd = open_write("/dev/null");
+    if (fd < 0) {
+        printf("cannot open /dev/null\n");
+        return;
+    }
+
+    static const char *names[] = {"async_printf", "async_logf", "binary"};
+    for (int mode = ASYNC_TEXT; mode <= ASYNC_BINARY; mode++) {
+        async_stats stats;
+        double ns = async_run(fd, mode, &stats);
+
+        printf("%-13s %9.2f ns/call  %10zu bytes  dropped %zu wakes %zu\n",
+               names[mode],
+               ns,
+               stats.bytes,
+               stats.dropped,
+               stats.wakes);
+        record("async", names[mode], (long)stats.bytes, ns, 0);
+    }
+
+    // Same messages through the stdout buffer
+    size_t burst = ASYNC_SLOTS / 2;
+    fflush(stdout);
+    int saved_fd = stdout->fd;
+    stdout->fd = fd;
+    uint64_t start = read_counter();
+    for (int b = 0; b < ASYNC_BURSTS; b++) {
+        for (size_t i = 0; i < burst; i++) {
+            unsigned int hash = (unsigned int)i * 2654435761U;
+            double load = (double)hash / 4294967296.0;
+            printf(ASYNC_FORMAT, b, i, load, hash);
+        }
+    }
+    fflush(stdout);
+    uint64_t ticks = read_counter() - start;
+    stdout->fd = saved_fd;
+
+    double ns = ticks_to_ns(ticks) / ((double)ASYNC_BURSTS * (double)burst);
+    printf("%-13s %9.2f ns/call\n", "printf", ns);
+    record("async", "printf", 0, ns, 0);
+
+    close(fd);
+}
+
+/*
+ * Parsing
+ * A file of about 100MB, lines of an integer and a double the way a
+ * program would log them, read back three ways: fscanf(), fgets() with
+ * strtol() and strtod(), and a naive parser of one digit at a time as a
+ * baseline (its doubles are not correctly rounded). The first two must
+ * agree on every value. It is written twice, the doubles as %.6f (what
+ * most logs have, strtod() gets them from one multiply or divide) and
+ * as %.17g (full precision, which needs the 128-bit products). The file
+ * is removed afterwards
+ */
+#define PARSE_FILE  "bin/numbers.txt"
+#define PARSE_BYTES (100 * 1000 * 1000)
+#define PARSE_LINE  64
+
+#ifdef __x86_64__
+#define __NR_unlinkat 263
+#else
+#define __NR_unlinkat 35
+#endif
+
+static int unlink(const char *path) {
+    return (int)syscall6(__NR_unlinkat, AT_FDCWD, (long)path, 0, 0, 0, 0);
+}
+
+// Writes the file, returns its size or 0 if it cannot be written
+static size_t parse_write(const char *format) {
+    FILE *f = fopen(PARSE_FILE, "w");
+    if (f == NULL) {
+        return 0;
+    }
+
+    size_t bytes = 0;
+    while (bytes < PARSE_BYTES) {
+        uint64_t r = bench_random();
+        long value = (long)(bench_random() % powers_of_10[1 + r % 18]);
+        int64_t mantissa = (int64_t)(bench_random() % 2000000000) - 1000000000;
+        double x = (double)mantissa / (double)powers_of_10[r % 13];
+
+        int len = fprintf(f, format, (r >> 8) & 1 ? -value : value, x);
+        if (len < 0) {
+            break;
+        }
+        bytes += (size_t)len;
+    }
+    return fclose(f) == 0 ? bytes : 0;
+}
+
+// Sum of all values, the bits of the doubles so any difference shows
+typedef struct {
+    uint64_t ints;
+    uint64_t doubles;
+    size_t lines;
+} parse_sums;
+
+static inline void parse_add(parse_sums *sums, long value, double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(double));
+    sums->ints += (uint64_t)value;
+    sums->doubles += bits;
+    sums->lines++;
+}
+
+static void parse_fscanf(FILE *f, parse_sums *sums) {
+    long value;
+    double x;
+    while (fscanf(f, "%ld %lf", &value, &x) == 2) {
+        parse_add(sums, value, x);
+    }
+}
+
+static void parse_strto(FILE *f, parse_sums *sums) {
+    char line[PARSE_LINE];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *end;
+        long value = strtol(line, &end, 10);
+        parse_add(sums, value, strtod(end, NULL));
+    }
+}
+
+// Digits straight into the result, the fraction divided out at the end
+static const char *naive_number(const char *p, long *value, double *x) {
+    int negative = *p == '-';
+    p += negative;
+
+    long v = 0;
+    while (*p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+    }
+
+    double scale = 1.0;
+    double d = (double)v;
+    if (*p == '.') {
+        for (p++; *p >= '0' && *p <= '9'; p++) {
+            d = d * 10.0 + (*p - '0');
+            scale *= 10.0;
+        }
+    }
+
+    *value = negative ? -v : v;
+    *x = negative ? -d / scale : d / scale;
+    return p;
+}
+
+static void parse_naive(FILE *f, parse_sums *sums) {
+    char line[PARSE_LINE];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        long value;
+        long unused;
+        double x;
+        const char *p = naive_number(line, &value, &x);
+        naive_number(p + 1, &unused, &x);
+        parse_add(sums, value, x);
+    }
+}
+
+static void bench_parse(void) {
+    static const struct {
+        const char *name;
+        void (*run)(FILE *, parse_sums *);
+    } readers[] = {
+        {"fscanf", parse_fscanf},
+        {"strtol/strtod", parse_strto},
+        {"naive", parse_naive},
+    };
+    static const struct {
+        const char *name;
+        const char *format;
+    } doubles[] = {
+        {"%.6f", "%ld %.6f\n"},
+        {"%.17g", "%ld %.17g\n"},
+    };
+
+    printf("%-7s %-14s %12s %15s\n",
+           "doubles",
+           "reader",
+           "time/line",
+           "throughput");
+
+    for (size_t d = 0; d < sizeof(doubles) / sizeof(*doubles); d++) {
+        size_t bytes = parse_write(doubles[d].format);
+        if (bytes == 0) {
+            printf("cannot write %s\n", PARSE_FILE);
+            break;
+        }
+
+        parse_sums first = {0, 0, 0};
+        for (size_t i = 0; i < sizeof(readers) / sizeof(*readers); i++) {
+            FILE *f = fopen(PARSE_FILE, "r");
+            if (f == NULL) {
+                printf("cannot open %s\n", PARSE_FILE);
+                break;
+            }
+
+            parse_sums sums = {0, 0, 0};
+            uint64_t start = read_counter();
+            readers[i].run(f, &sums);
+            uint64_t ticks = read_counter() - start;
+            fclose(f);
+
+            double ns = ticks_to_ns(ticks) / (double)sums.lines;
+            double bytes_per_sec = (double)bytes / (ticks_to_ns(ticks) / 1e9);
+
+            printf("%-7s %-14s %9.2f ns %10.2f MB/s\n",
+                   doubles[d].name,
+                   readers[i].name,
+                   ns,
+                   bytes_per_sec / 1e6);
+
+            char name[32];
+            snprintf(
+                name, sizeof(name), "%s/%s", doubles[d].name, readers[i].name);
+            record("parse", name, (long)sums.lines, ns, bytes_per_sec);
+
+            // The naive doubles are allowed to be off
+            if (i == 0) {
+                first = sums;
+            } else if (readers[i].run != parse_naive &&
+                       (sums.lines != first.lines || sums.ints != first.ints ||
+                        sums.doubles != first.doubles)) {
+                printf("%s does not match fscanf\n", readers[i].name);
+            }
+        }
+    }
+
+    unlink(PARSE_FILE);
+}
+
+/*
+ * Large files
+ * The same 100MB report written with fprintf() to a FILE (write() copies
+ * each buffer into the page cache), the same with the flushes queued on
+ * an io_uring, and through a mapped file sink, which formats into the
+ * page cache directly. The files are removed afterwards
+ */
+#define FILE_PATH  "bin/report.txt"
+#define FILE_LINES 2000000
+
+#define FILE_FORMAT "%8zu %-12s load %.6f hash %08x\n"
+
+// One line to the sink, or to f when out is NULL, returns its length
+static size_t file_line(sink *out, FILE *f, size_t i) {
+    unsigned int hash = (unsigned int)i * 2654435761U;
+    double load = (double)hash / 4294967296.0;
+    size_t pool = sizeof(string_pool) / sizeof(*string_pool);
+    const char *name = string_pool[i % pool];
+
+    if (out != NULL) {
+        // The sink counts all of its output
+        size_t before = out->count;
+        sink_printf(out, FILE_FORMAT, i, name, load, hash);
+        return out->count - before;
+    }
+    return (size_t)fprintf(f, FILE_FORMAT, i, name, load, hash);
+}
+
+static void bench_file(void) {
+    printf("%-8s %12s %15s\n", "writer", "time/line", "throughput");
+
+    static const char *names[] = {"fprintf", "uring", "mapped"};
+    for (int writer = 0; writer < 3; writer++) {
+        int mapped = writer == 2;
+        if (writer == 1 && uring_start() != 0) {
+            printf("%-8s not available\n", names[writer]);
+            continue;
+        }
+
+        sink out;
+        map_sink ms;
+        FILE *f = NULL;
+        if (mapped ? map_sink_open(&out, &ms, FILE_PATH) != 0
+                   : (f = fopen(FILE_PATH, "w")) == NULL) {
+            printf("cannot open %s\n", FILE_PATH);
+            uring_stop();
+            return;
+        }
+
+        size_t bytes = 0;
+        uint64_t start = read_counter();
+        for (size_t i = 0; i < FILE_LINES; i++) {
+            bytes += file_line(mapped ? &out : NULL, f, i);
+        }
+        int failed = mapped ? map_sink_close(&out, &ms) < 0 : fclose(f) != 0;
+        uint64_t ticks = read_counter() - start;
+        uring_stop();
+        unlink(FILE_PATH);
+
+        const char *name = names[writer];
+        if (failed) {
+            printf("%s failed\n", name);
+            continue;
+        }
+
+        double ns = ticks_to_ns(ticks) / FILE_LINES;
+        double bytes_per_sec = (double)bytes / (ticks_to_ns(ticks) / 1e9);
+        printf("%-8s %9.2f ns %10.2f MB/s\n", name, ns, bytes_per_sec / 1e6);
+        record("file", name, (long)bytes, ns, bytes_per_sec);
+    }
+}
+
+/*
+ * Startup
+ * What a short-lived tool pays from execve() to exit, for the demo as
+ * built (make build) and as shipped (make release). Each run has stdin
+ * and stdout on /dev/null, so the demo prints everything and stops at the
+ * prompt. The time includes the fork and the wait, the parameter is the
+ * size of the file. Binaries that are not built are skipped
+ */
+#define STARTUP_RUNS 500
+
+#define SIGCHLD  17
+#define SEEK_END 2
+
+#ifdef __x86_64__
+#define __NR_lseek  8
+#define __NR_execve 59
+#define __NR_wait4  61
+#else
+#define __NR_lseek  62
+#define __NR_execve 221
+#define __NR_wait4  260
+#endif
+
+// Bytes in the file at path, 0 when it cannot be opened
+static size_t file_size(const char *path) {
+    int fd = open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return 0;
+    }
+
+    long size = syscall6(__NR_lseek, fd, 0, SEEK_END, 0, 0, 0);
+    close(fd);
+    return size < 0 ? 0 : (size_t)size;
+}
+
+// Runs path once, returns its exit status or -1 when it did not run
+static int startup_run(const char *path) {
+    // clone() with nothing but the exit signal is fork()
+    long pid = syscall6(__NR_clone, SIGCHLD, 0, 0, 0, 0, 0);
+    if (pid == 0) {
+        // The lowest free fds are taken, 0 and then 1
+        close(STDIN_FILENO);
+        close(STDOUT_FILENO);
+        open("/dev/null", O_RDONLY, 0);
+        open("/dev/null", O_WRONLY, 0);
+
+        char *argv[] = {(char *)path, NULL};
+        syscall6(__NR_execve, (long)path, (long)argv, (long)environ, 0, 0, 0);
+        exit(127);
+    }
+
+    int status = 0;
+    if (pid < 0 ||
+        syscall6(__NR_wait4, pid, (long)&status, 0, 0, 0, 0) != pid) {
+        return -1;
+    }
+
+    // Not killed by a signal, and not the child's exit(127) above
+    int code = (status >> 8) & 0xff;
+    return (status & 0x7f) == 0 && code != 127 ? code : -1;
+}
+
+static void bench_startup(void) {
+    printf("%-16s %10s %14s\n", "binary", "size", "exec to exit");
+
+    static const char *paths[] = {"bin/out", "bin/out-release"};
+    for (size_t i = 0; i < sizeof(paths) / sizeof(*paths); i++) {
+        const char *path = paths[i];
+        size_t size = file_size(path);
+        if (size == 0 || startup_run(path) < 0) { // The first run warms up
+            printf("%-16s not available\n", path);
+            continue;
+        }
+
+        int failed = 0;
+        uint64_t start = read_counter();
+        for (int run = 0; run < STARTUP_RUNS; run++) {
+            failed |= startup_run(path) < 0;
+        }
+        uint64_t ticks = read_counter() - start;
+        if (failed) {
+            printf("%-16s failed\n", path);
+            continue;
+        }
+
+        double ns = ticks_to_ns(ticks) / STARTUP_RUNS;
+        printf("%-16s %8zu B %11.1f us\n", path, size, ns / 1e3);
+        record("startup", path, (long)size, ns, 0);
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} bench_suite;
+
+static const bench_suite suites[] = {
+    {"string", bench_string},
+    {"uitoa", bench_uitoa},
+    {"format", bench_format},
+    {"threads", bench_threads},
+    {"async", bench_async},
+    {"parse", bench_parse},
+    {"file", bench_file},
+    {"startup", bench_startup},
+};
+
+#define SUITE_COUNT (sizeof(suites) / sizeof(*suites))
+
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/*
+ * Usage: bench [-o results-file] [suite...]
+ * Runs every suite when none is named
+ */
+int main(int argc, char **argv) {
+    int first = 1;
+    if (argc > 2 && streq(argv[1], "-o")) {
+        if (open_results(argv[2]) != 0) {
+            printf("cannot open %s\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        first = 3;
+    }
+
+    for (size_t i = 0; i < SUITE_COUNT; i++) {
+        int selected = argc <= first;
+        for (int a = first; a < argc; a++) {
+            selected |= streq(argv[a], suites[i].name);
+        }
+
+        if (selected) {
+            printf("== %s ==\n", suites[i].name);
+            suites[i].run();
+        }
+    }
+
+    if (results_fd >= 0) {
+        close(results_fd);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,20 @@
+// Typed formatting (printf.hpp) for the formatter suite in bench.c
+// Built with the C++ compiler and linked into the bench binary, each
+// function formats one line the same way as the family it is compared to
+
+#include "../printf.hpp"
+
+#define MIXED_FORMAT "[%s] id=%d load=%.2f%%\n"
+
+extern "C" size_t typed_int(char *buf, size_t n, int value) {
+    return pf::format<"%d">(buf, n, value);
+}
+
+extern "C" size_t typed_double(char *buf, size_t n, double value) {
+    return pf::format<"%f">(buf, n, value);
+}
+
+extern "C" size_t
+typed_mixed(char *buf, size_t n, const char *s, int d, double f) {
+    return pf::format<MIXED_FORMAT>(buf, n, s, d, f);
+}
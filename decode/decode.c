@@ -0,0 +1,189 @@
+// Turns binary log files (see log_writer in printf.c) back into text
+// Built as its own freestanding binary like bench/, the whole of printf.c
+// is included so records go through the same formatter that wrote them
+
+#define PRINTF_NO_MAIN
+#include "../printf.c"
+
+/*
+ * Input
+ * The file is read in large pieces into one buffer, an entry is only
+ * used once it is in there completely
+ */
+#define INPUT_SIZE (2 * LOG_BUFSIZ)
+
+static struct {
+    int fd;
+    int eof;
+    size_t start; // First unused byte
+    size_t end;   // End of the data read so far
+    char buf[INPUT_SIZE];
+} input;
+
+// Make sure n bytes are buffered, returns 0 if the file ends first
+static int input_need(size_t n) {
+    while (input.end - input.start < n) {
+        if (input.eof) {
+            return 0;
+        }
+
+        // Keep the unused tail at the front
+        size_t left = input.end - input.start;
+        memcpy(input.buf, input.buf + input.start, left);
+        input.start = 0;
+        input.end = left;
+
+        ssize_t got = read(input.fd, input.buf + input.end, INPUT_SIZE - left);
+        if (got <= 0) {
+            input.eof = 1;
+        } else {
+            input.end += (size_t)got;
+        }
+    }
+    return 1;
+}
+
+// Entry header at the start of the unused input, returns 0 or EOF
+static int input_entry(uint64_t *type, uint64_t *size) {
+    input_need(2 * VARINT_MAX); // Less is fine at the end of the file
+
+    const char *p = input.buf + input.start;
+    const char *end = input.buf + input.end;
+    if (varint_get(&p, end, type) != 0 || varint_get(&p, end, size) != 0) {
+        return EOF;
+    }
+
+    input.start = p - input.buf;
+    return 0;
+}
+
+/*
+ * String table
+ * Formats are copied out of the input buffer, records refer to them by id
+ * for the rest of the file
+ */
+#define STRINGS_SIZE (1 << 20)
+
+static char strings[STRINGS_SIZE];
+static size_t strings_used;
+static const char *formats[LOG_FORMATS];
+static uint32_t format_count;
+
+static int add_format(const char *payload, size_t size) {
+    if (format_count == LOG_FORMATS || strings_used + size + 1 > STRINGS_SIZE) {
+        return EOF;
+    }
+
+    char *format = strings + strings_used;
+    memcpy(format, payload, size);
+    format[size] = '\0';
+    strings_used += size + 1;
+
+    formats[format_count++] = format;
+    return 0;
+}
+
+// Room for a record rebuilt from any entry that fits the input buffer
+static uint64_t record[(sizeof(log_record) + LOG_MAX_ARGS * 8 + INPUT_SIZE) /
+                      sizeof(uint64_t)];
+
+static int render_record(sink *out, const char *payload, size_t size) {
+    const char *p = payload;
+    uint64_t id;
+    if (varint_get(&p, payload + size, &id) != 0 || id >= format_count) {
+        return EOF;
+    }
+
+    log_record *rec = (log_record *)record;
+    if (log_unpack(rec,
+                   sizeof(record),
+                   formats[id],
+                   p,
+                   size - (p - payload)) == 0) {
+        return EOF;
+    }
+    log_render(out, rec);
+    return 0;
+}
+
+static void fail(const char *name, const char *what) {
+    fflush(stdout);
+    fprintf(stderr, "decode: %s: %s\n", name, what);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Usage: decode [file]
+ * Reads stdin when no file is given, the text goes to stdout
+ */
+int main(int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "stdin";
+
+    input.fd = STDIN_FILENO;
+    if (argc > 1) {
+        input.fd = open(argv[1], O_RDONLY, 0);
+        if (input.fd < 0) {
+            fail(name, "cannot open");
+        }
+    }
+
+    log_file_header header;
+    if (!input_need(sizeof(header))) {
+        fail(name, "not a log file");
+    }
+    memcpy(&header, input.buf + input.start, sizeof(header));
+
+    int magic = 1;
+    for (size_t i = 0; i < sizeof(header.magic); i++) {
+        magic &= header.magic[i] == LOG_MAGIC[i];
+    }
+    if (!magic || header.header_size < sizeof(header)) {
+        fail(name, "not a log file");
+    }
+    if (header.version != LOG_VERSION) {
+        fail(name, "unsupported version");
+    }
+    if (!input_need(header.header_size)) {
+        fail(name, "truncated header");
+    }
+    input.start += header.header_size;
+
+    stream_sink ss;
+    sink out;
+    stream_sink_init(&out, &ss, stdout);
+
+    while (input_need(1)) {
+        uint64_t type, size;
+        if (input_entry(&type, &size) != 0 || size > LOG_ENTRY_MAX) {
+            fail(name, "corrupt entry");
+        }
+        if (!input_need(size)) {
+            fail(name, "truncated entry");
+        }
+
+        const char *payload = input.buf + input.start;
+        switch (type) {
+        case LOG_ENTRY_FORMAT:
+            if (add_format(payload, size) != 0) {
+                fail(name, "string table full");
+            }
+            break;
+        case LOG_ENTRY_TEXT:
+            sink_write(&out, payload, size);
+            break;
+        case LOG_ENTRY_RECORD:
+            if (render_record(&out, payload, size) != 0) {
+                fail(name, "corrupt record");
+            }
+            break;
+        default:
+            break; // Newer entry type, skipped
+        }
+
+        input.start += size;
+    }
+
+    int ret = stream_sink_finish(&out, &ss);
+    fflush(stdout);
+    return ret == EOF ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,34 +1,24 @@
-// printf without any header or library only works on Linux aarch64
+// printf without any header or library, on Linux aarch64, x86_64 and
+// riscv64
 
 /*
- * Conditional compilation: Ensures this code only runs on Linux aarch64 LP64
+ * Conditional compilation: Ensures this code only runs on a Linux LP64
+ * target with a backend in the architecture layer below
  * __linux__ : Defined when compiling for Linux
- * __aarch64__ : Defined when compiling for ARM64 architecture
+ * __aarch64__, __x86_64__, __riscv : Defined for the three architectures
  * __LP64__ : Defined when using LP64 data model (long and pointer are 64-bit)
  * NOTE: This also works on Android since Android uses Linux kernel
  */
-#if defined(__linux__) && defined(__aarch64__) && defined(__LP64__)
-/* Linux aarch64 */
+#if defined(__linux__) && defined(__LP64__) &&                                 \
+    (defined(__aarch64__) || defined(__x86_64__) ||                            \
+     (defined(__riscv) && __riscv_xlen == 64))
+/* Linux aarch64, x86_64 or riscv64 */
 #else
-#error "This code is only work in linux aarch64 LP64 (including Android)"
+#error "This code only works on Linux aarch64, x86_64 or riscv64 LP64"
 #endif
 
-// Define basic data types
-typedef unsigned long int size_t;
-typedef long ssize_t;
-typedef unsigned char uint8_t;
-typedef unsigned short uint16_t;
-typedef unsigned int uint32_t;
-typedef unsigned long uint64_t;
-typedef long int64_t;
-typedef double double_t;
-
-// Define va_list
-typedef __builtin_va_list va_list;
-
-#define va_start(ap, last) __builtin_va_start(ap, last)
-#define va_arg(ap, type)   __builtin_va_arg(ap, type)
-#define va_end(last)       __builtin_va_end(last)
+// Basic data types, va_list and the public declarations
+#include "printf.h"
 
 // File descriptor for standard output is 1 thats way 1> or 2> for stderr
 // see: https://en.wikipedia.org/wiki/Standard_streams
@@ -38,26 +28,92 @@ typedef __builtin_va_list va_list;
 #define STDOUT_FILENO 1
 #define STDERR_FILENO 2
 
-// System call number for write() on ARM64 Linux
+/*
+ * Architecture layer
+ * Everything that differs between the targets is in this section: the
+ * system call numbers, the system call stubs, the cycle counter, the
+ * thread pointer, the clone() trampoline, the CPU features and the entry
+ * point _start. The rest of the file only uses what is defined here. The
+ * string and memory routines have their own vector kernels per target,
+ * see there
+ */
+#if defined(__aarch64__) || defined(__riscv)
+// System call numbers on ARM64 and RISC-V Linux, both use the generic
+// table
 // You can find this in: /usr/include/asm-generic/unistd.h
 // or check with: grep "__NR_write" /usr/include/asm-generic/unistd.h
-#define __NR_write 64
-#define __NR_read  63
+#define __NR_write  64
+#define __NR_writev 66
+#define __NR_read   63
+#define __NR_ioctl 29
+// Files, with the same flags as <fcntl.h>
+#define __NR_openat    56
+#define __NR_close     57
+#define __NR_ftruncate 46
 // syscall for exit can also found in asm-generic/unistd.h
-#define __NR_exit 93
+// exit ends only the calling thread, exit_group the whole process
+#define __NR_exit       93
+#define __NR_exit_group 94
+// Threads: stack memory, clone(), futex() to wait and sched_yield()
+#define __NR_mmap        222
+#define __NR_munmap      215
+#define __NR_clone       220
+#define __NR_futex       98
+#define __NR_sched_yield 124
+// Mapped output files
+#define __NR_msync 227
+// Calibrating the cycle counter, see arch_counter_frequency()
+#define __NR_clock_gettime 113
+#elif defined(__x86_64__)
+// x86_64 has a table of its own
+// see: /usr/include/x86_64-linux-gnu/asm/unistd_64.h
+#define __NR_write         1
+#define __NR_writev        20
+#define __NR_read          0
+#define __NR_ioctl         16
+#define __NR_openat        257
+#define __NR_close         3
+#define __NR_ftruncate     77
+#define __NR_exit          60
+#define __NR_exit_group    231
+#define __NR_mmap          9
+#define __NR_munmap        11
+#define __NR_clone         56
+#define __NR_futex         202
+#define __NR_sched_yield   24
+#define __NR_msync         26
+#define __NR_clock_gettime 228
+// Sets the fs base for the main thread, see arch_start()
+#define __NR_arch_prctl 158
+#define ARCH_SET_FS     0x1002
+#endif
+
+// ioctl() request that reads terminal attributes, only used by isatty()
+// This and the open flags below are the same on all three targets
+// see: /usr/include/asm-generic/ioctls.h
+#define TCGETS 0x5401
+
+// openat() flags and the "relative to the current directory" fd
+#define O_RDONLY 00
+#define O_WRONLY 01
+#define O_RDWR   02
+#define O_CREAT  0100
+#define O_TRUNC  01000
+#define O_APPEND 02000
+#define AT_FDCWD -100
 
 // Exit status codes
 #define EXIT_FAILURE 1
 #define EXIT_SUCCESS 0
 
-#define NULL ((void *)0)
-
 // Math constants for floating point
 #define DBL_MAX  1.7976931348623157e+308
 #define DBL_MIN  2.2250738585072014e-308
 #define INFINITY (1.0 / 0.0)
-#define NAN      (0.0 / 0.0)
+// The positive quiet NaN, 0.0 / 0.0 has the sign bit set on x86_64
+#define NAN      __builtin_nan("")
 
+#if defined(__aarch64__)
 /*
  * System call convention for ARM64:
  * - x0: first argument (file descriptor)
@@ -89,1136 +145,7579 @@ syscall(int fd, long syscall_number, ssize_t buf, size_t count) {
     return x0; // Return value from system call (negative for error)
 }
 
-static ssize_t write(int fd, const void *buf, size_t count) {
-    return syscall(fd, __NR_write, (long)buf, count);
+// Same with all six argument registers (x0-x5), for calls like openat()
+// or mmap() that take more than three
+static inline long syscall6(long syscall_number,
+                            long a0,
+                            long a1,
+                            long a2,
+                            long a3,
+                            long a4,
+                            long a5) {
+    register long x0 asm("x0") = a0;
+    register long x1 asm("x1") = a1;
+    register long x2 asm("x2") = a2;
+    register long x3 asm("x3") = a3;
+    register long x4 asm("x4") = a4;
+    register long x5 asm("x5") = a5;
+    register long x8 asm("x8") = syscall_number;
+
+    asm volatile("svc 0"
+                 : "+r"(x0)
+                 : "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5), "r"(x8)
+                 : "memory");
+
+    return x0;
 }
 
-static inline ssize_t read(int fd, void *buf, size_t count) {
-    return syscall(fd, __NR_read, (long)buf, count);
+// The generic timer virtual count is readable from user space on every
+// aarch64 Linux system, isb keeps the read from being moved before
+// earlier instructions
+static inline uint64_t arch_counter(void) {
+    uint64_t ticks;
+    asm volatile("isb\n"
+                 "mrs %0, cntvct_el0"
+                 : "=r"(ticks)
+                 :
+                 : "memory");
+    return ticks;
 }
 
-// About __attribute__((noreturn)) see:
-// https://stackoverflow.com/questions/70683911/why-when-would-should-you-use-attribute-noreturn
-// About __attribute__ see:
-// https://gcc.gnu.org/onlinedocs/gcc-4.7.2/gcc/Function-Attributes.html
-__attribute__((noreturn)) static inline void exit(int exit_code) {
-    register long x0 asm("x0") = exit_code;
-    register long x8 asm("x8") = __NR_exit;
+static inline uint64_t arch_counter_frequency(void) {
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return freq;
+}
 
-    asm volatile( //
-        "svc 0"   // Make supervisor call (system call)
-        :         // empty, because not return anyting
-        : "r"(x0), "r"(x8)
-        : "memory"
+// The tls value given to clone(), kept in tpidr_el0 (0 in the main thread)
+static inline void *arch_thread_pointer(void) {
+    void *tp;
+    asm("mrs %0, tpidr_el0" : "=r"(tp));
+    return tp;
+}
 
-    );
+static inline void arch_start(void) {}
 
-    // trigger trap instruction if syscall fail
-    __builtin_trap();
-    // see:
-    // https://developer.arm.com/documentation/107976/20-1-0/Clang-reference/clang-built-in-functions/--builtin-trap
+// Optional CPU features as AT_HWCAP reports them, only the bits the
+// string kernels check (see arch/arm64/include/uapi/asm/hwcap.h)
+#define CPU_NEON (1UL << 1) // HWCAP_ASIMD
+#define CPU_SVE  (1UL << 22)
+
+static inline unsigned long arch_cpu_features(void) {
+    return getauxval(AT_HWCAP);
 }
 
 /*
- * Custom strlen() implementation
- * Since we're not using standard library, we need to implement this ourselves
- * Returns the length of a null-terminated string
+ * clone() has to be called from asm: the child comes back from svc on
+ * the new stack, where no C frame of the caller exists. It calls fn(arg)
+ * right away, fn must not return
+ * Returns the new thread id, or a negative errno
  */
-size_t strlen(const char *s) {
-    const char *format = s; // Start at beginning of string
+static long arch_clone(unsigned long flags,
+                       void *stack_top,
+                       int *parent_tid,
+                       void *tls,
+                       int *child_tid,
+                       void (*fn)(void *),
+                       void *arg) {
+    register long x0 asm("x0") = (long)flags;
+    register long x1 asm("x1") = (long)stack_top;
+    register long x2 asm("x2") = (long)parent_tid;
+    register long x3 asm("x3") = (long)tls; // Becomes tpidr_el0
+    register long x4 asm("x4") = (long)child_tid;
+    register long x5 asm("x5") = (long)fn;
+    register long x6 asm("x6") = (long)arg;
+    register long x8 asm("x8") = __NR_clone;
+
+    asm volatile("svc 0\n"
+                 "cbnz x0, 1f\n"
+                 // Child: registers are the parent's, except x0 and sp
+                 "mov x0, x6\n"
+                 "blr x5\n"
+                 "1:\n"
+                 : "+r"(x0)
+                 : "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5), "r"(x6),
+                   "r"(x8)
+                 : "x30", "memory");
+
+    return x0;
+}
 
-    // Loop until we find null terminator
-    while (*format != '\0') {
-        format++;
-    }
+// Relocation type of the R_*_RELATIVE entries, see relocate_self()
+#define ARCH_R_RELATIVE 1027
+
+// Entry point: the kernel leaves argc, argv and envp on the stack
+#define ARCH_START                                                             \
+    "    mov x0, sp\n" /* sp = stack */                                        \
+    "    bl _start_main\n"
+
+#elif defined(__x86_64__)
+/*
+ * System call convention for x86_64:
+ * - rdi, rsi, rdx, r10, r8, r9: arguments
+ * - rax: system call number, and the return value afterwards
+ * - syscall overwrites rcx and r11
+ */
+static inline ssize_t
+syscall(int fd, long syscall_number, ssize_t buf, size_t count) {
+    long ret;
+    asm volatile("syscall"
+                 : "=a"(ret)
+                 : "a"(syscall_number), "D"((long)fd), "S"(buf), "d"(count)
+                 : "rcx", "r11", "memory");
+    return ret;
+}
+
+static inline long syscall6(long syscall_number,
+                            long a0,
+                            long a1,
+                            long a2,
+                            long a3,
+                            long a4,
+                            long a5) {
+    register long r10 asm("r10") = a3;
+    register long r8 asm("r8") = a4;
+    register long r9 asm("r9") = a5;
+    long ret;
+
+    asm volatile("syscall"
+                 : "=a"(ret)
+                 : "a"(syscall_number),
+                   "D"(a0),
+                   "S"(a1),
+                   "d"(a2),
+                   "r"(r10),
+                   "r"(r8),
+                   "r"(r9)
+                 : "rcx", "r11", "memory");
+    return ret;
+}
 
-    // Calculate length: end pointer minus start pointer
-    return (size_t)(format - s);
+// The time stamp counter, lfence keeps it from being read before earlier
+// instructions are done
+static inline uint64_t arch_counter(void) {
+    uint32_t low, high;
+    asm volatile("lfence\n"
+                 "rdtsc"
+                 : "=a"(low), "=d"(high)
+                 :
+                 : "memory");
+    return ((uint64_t)high << 32) | low;
 }
 
 /*
- * Custom memcpy() implementation
- * Copies n bytes from src to dest
+ * The thread pointer is the fs base, which user space can only read
+ * through memory: %fs:0 is the first word of the block clone() was given
+ * as tls, so that word has to hold the block's address (see struct
+ * thread). The kernel starts the main thread with fs base 0, arch_start()
+ * points it at a NULL word instead
  */
-void *memcpy(void *dest, const void *src, size_t n) {
-    char *d = (char *)dest;
-    const char *s = (const char *)src;
+static void *main_thread_pointer;
 
-    for (size_t i = 0; i < n; i++) {
-        d[i] = s[i];
-    }
+static inline void *arch_thread_pointer(void) {
+    void *tp;
+    asm("mov %%fs:0, %0" : "=r"(tp));
+    return tp;
+}
 
-    return dest;
+static inline void arch_start(void) {
+    syscall6(
+        __NR_arch_prctl, ARCH_SET_FS, (long)&main_thread_pointer, 0, 0, 0, 0);
 }
 
 /*
- * Custom memset() implementation
- * Sets n bytes to value c
+ * AT_HWCAP on x86_64 is only edx of cpuid leaf 1, nothing newer than
+ * SSE2, so the features come from cpuid directly (the CPU_* bits are our
+ * own). AVX2 also needs the kernel to save the ymm registers: OSXSAVE and
+ * AVX in leaf 1, then SSE and AVX state enabled in XCR0
  */
-void *memset(void *s, int c, size_t n) {
-    unsigned char *p = (unsigned char *)s;
-    for (size_t i = 0; i < n; i++) {
-        p[i] = (unsigned char)c;
+#define CPU_AVX2 (1UL << 0)
+
+static inline unsigned long arch_cpu_features(void) {
+    uint32_t a, b, c, d;
+    asm("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1), "c"(0));
+    if ((c & (3U << 27)) != (3U << 27)) {
+        return 0;
     }
-    return s;
-}
 
-// Helper functions for floating point
-static inline int isinf(double x) {
-    uint64_t bits;
-    memcpy(&bits, &x, sizeof(double));
-    // Check if exponent is all 1s and mantissa is 0
-    return ((bits & 0x7FF0000000000000) == 0x7FF0000000000000) &&
-           ((bits & 0x000FFFFFFFFFFFFF) == 0);
+    uint32_t xcr0, xcr0_high;
+    asm("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+    if ((xcr0 & 6) != 6) {
+        return 0;
+    }
+
+    asm("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(7), "c"(0));
+    return b & (1U << 5) ? CPU_AVX2 : 0;
 }
 
-static inline int isnan(double x) {
-    uint64_t bits;
-    memcpy(&bits, &x, sizeof(double));
-    // Check if exponent is all 1s and mantissa is non-zero
-    return ((bits & 0x7FF0000000000000) == 0x7FF0000000000000) &&
-           ((bits & 0x000FFFFFFFFFFFFF) != 0);
+// See the aarch64 version, x86_64 takes child_tid before tls
+static long arch_clone(unsigned long flags,
+                       void *stack_top,
+                       int *parent_tid,
+                       void *tls,
+                       int *child_tid,
+                       void (*fn)(void *),
+                       void *arg) {
+    register long r10 asm("r10") = (long)child_tid;
+    register long r8 asm("r8") = (long)tls; // Becomes the fs base
+    register long r9 asm("r9") = (long)fn;
+    register long r12 asm("r12") = (long)arg;
+    long ret;
+
+    asm volatile("syscall\n"
+                 "test %%rax, %%rax\n"
+                 "jnz 1f\n"
+                 // Child: registers are the parent's, except rax and rsp
+                 "xor %%ebp, %%ebp\n"
+                 "mov %%r12, %%rdi\n"
+                 "call *%%r9\n"
+                 "1:\n"
+                 : "=a"(ret)
+                 : "a"(__NR_clone),
+                   "D"(flags),
+                   "S"(stack_top),
+                   "d"(parent_tid),
+                   "r"(r10),
+                   "r"(r8),
+                   "r"(r9),
+                   "r"(r12)
+                 : "rcx", "r11", "memory");
+    return ret;
 }
 
+#define ARCH_R_RELATIVE 8
+
+// rbp = 0 ends the frame chain, the call pushes the return address on a
+// 16 byte aligned stack as the ABI expects
+#define ARCH_START                                                             \
+    "    xor %ebp, %ebp\n"                                                     \
+    "    mov %rsp, %rdi\n"                                                     \
+    "    and $-16, %rsp\n"                                                     \
+    "    call _start_main\n"
+
+#elif defined(__riscv)
 /*
- * Number conversion functions
+ * System call convention for RISC-V:
+ * - a0-a5: arguments, a0 is also the return value
+ * - a7: system call number
+ * - ecall: environment call into the kernel
  */
+static inline ssize_t
+syscall(int fd, long syscall_number, ssize_t buf, size_t count) {
+    register long a0 asm("a0") = fd;
+    register long a1 asm("a1") = buf;
+    register long a2 asm("a2") = count;
+    register long a7 asm("a7") = syscall_number;
 
-// Convert unsigned integer to string with given base (2-16)
-// Return pointer to null terminator, not to buffer start
-static char *uitoa(uint64_t num, char *buffer, int base, int uppercase) {
-    char digits_lower[] = "0123456789abcdef";
-    char digits_upper[] = "0123456789ABCDEF";
-    const char *digits = uppercase ? digits_upper : digits_lower;
+    asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a2), "r"(a7) : "memory");
+    return a0;
+}
 
-    char *ptr = buffer;
-    char *start = buffer;
+static inline long syscall6(long syscall_number,
+                            long a0,
+                            long a1,
+                            long a2,
+                            long a3,
+                            long a4,
+                            long a5) {
+    register long r0 asm("a0") = a0;
+    register long r1 asm("a1") = a1;
+    register long r2 asm("a2") = a2;
+    register long r3 asm("a3") = a3;
+    register long r4 asm("a4") = a4;
+    register long r5 asm("a5") = a5;
+    register long r7 asm("a7") = syscall_number;
+
+    asm volatile("ecall"
+                 : "+r"(r0)
+                 : "r"(r1), "r"(r2), "r"(r3), "r"(r4), "r"(r5), "r"(r7)
+                 : "memory");
+    return r0;
+}
 
-    // Handle 0 explicitly
-    if (num == 0) {
-        *ptr++ = '0';
-    } else {
-        // Convert number to string (reverse order)
-        while (num > 0) {
-            *ptr++ = digits[num % base];
-            num /= base;
-        }
+// The time CSR, user access to cycle is turned off by Linux since 6.6
+static inline uint64_t arch_counter(void) {
+    uint64_t ticks;
+    asm volatile("rdtime %0" : "=r"(ticks) : : "memory");
+    return ticks;
+}
 
-        // Reverse the string
-        char *end = ptr - 1;
-        while (start < end) {
-            char tmp = *start;
-            *start = *end;
-            *end = tmp;
-            start++;
-            end--;
-        }
-    }
+// The tls value given to clone(), kept in tp (0 in the main thread)
+static inline void *arch_thread_pointer(void) {
+    void *tp;
+    asm("mv %0, tp" : "=r"(tp));
+    return tp;
+}
 
-    *ptr = '\0';
-    return ptr; // Return end pointer
+static inline void arch_start(void) {}
+
+// See the aarch64 version, the argument order is the same
+static long arch_clone(unsigned long flags,
+                       void *stack_top,
+                       int *parent_tid,
+                       void *tls,
+                       int *child_tid,
+                       void (*fn)(void *),
+                       void *arg) {
+    register long a0 asm("a0") = (long)flags;
+    register long a1 asm("a1") = (long)stack_top;
+    register long a2 asm("a2") = (long)parent_tid;
+    register long a3 asm("a3") = (long)tls; // Becomes tp
+    register long a4 asm("a4") = (long)child_tid;
+    register long a5 asm("a5") = (long)fn;
+    register long a6 asm("a6") = (long)arg;
+    register long a7 asm("a7") = __NR_clone;
+
+    asm volatile("ecall\n"
+                 "bnez a0, 1f\n"
+                 // Child: registers are the parent's, except a0 and sp
+                 "mv a0, a6\n"
+                 "jalr a5\n"
+                 "1:\n"
+                 : "+r"(a0)
+                 : "r"(a1), "r"(a2), "r"(a3), "r"(a4), "r"(a5), "r"(a6),
+                   "r"(a7)
+                 : "ra", "memory");
+    return a0;
 }
 
-// Convert double to string with fixed notation
-// Returns pointer to null terminator
-static char *ftoa(double value,
-                  char *buffer,
-                  int precision,
-                  int uppercase,
-                  int alternate_form) {
+#define ARCH_R_RELATIVE 3
 
-    char *ptr = buffer;
+// AT_HWCAP has a bit per single letter extension, 'A' is bit 0
+#define CPU_RVV (1UL << ('V' - 'A'))
 
-    // Handle special cases
-    if (isnan(value)) {
-        const char *nan_str = uppercase ? "NAN" : "nan";
-        while (*nan_str) {
-            *ptr++ = *nan_str++;
-        }
-        *ptr = '\0';
-        return ptr;
-    }
+static inline unsigned long arch_cpu_features(void) {
+    return getauxval(AT_HWCAP);
+}
 
-    if (isinf(value)) {
-        const char *inf_str = uppercase ? "INF" : "inf";
-        if (value < 0) {
-            *ptr++ = '-';
-        }
-        while (*inf_str) {
-            *ptr++ = *inf_str++;
-        }
-        *ptr = '\0';
-        return ptr;
-    }
+// gp must be set before any code the linker relaxed against it runs, lla
+// is pc-relative and works before a static-pie binary is relocated
+#define ARCH_START                                                             \
+    "    .option push\n"                                                       \
+    "    .option norelax\n"                                                    \
+    "    lla gp, __global_pointer$\n"                                          \
+    "    .option pop\n"                                                        \
+    "    mv a0, sp\n"                                                          \
+    "    andi sp, sp, -16\n"                                                   \
+    "    call _start_main\n"
+#endif
 
-    // Handle sign
-    if (value < 0) {
-        *ptr++ = '-';
-        value = -value;
-    }
+#if !defined(__aarch64__)
+/*
+ * The counter frequency is not published on x86_64 or riscv64, so it is
+ * measured once against CLOCK_MONOTONIC over about 10ms
+ */
+#define CLOCK_MONOTONIC 1
+
+typedef struct {
+    long tv_sec;
+    long tv_nsec;
+} timespec;
+
+static inline uint64_t monotonic_ns(void) {
+    timespec ts;
+    syscall(CLOCK_MONOTONIC, __NR_clock_gettime, (long)&ts, 0);
+    return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
 
-    // Default precision is 6 if not specified
-    if (precision < 0) {
-        precision = 6;
+static inline uint64_t arch_counter_frequency(void) {
+    static uint64_t freq;
+    uint64_t cached = __atomic_load_n(&freq, __ATOMIC_RELAXED);
+    if (cached != 0) {
+        return cached;
     }
 
-    // Round the number based on precision
-    double rounder = 0.5;
-    for (int i = 0; i < precision; i++) {
-        rounder *= 0.1;
+    uint64_t start_ns = monotonic_ns();
+    uint64_t start = arch_counter();
+    uint64_t ns;
+    while ((ns = monotonic_ns() - start_ns) < 10000000) {
     }
-    value += rounder;
+    uint64_t ticks = arch_counter() - start;
 
-    // Extract integer part
-    uint64_t int_part = (uint64_t)value;
-    double fractional = value - int_part;
+    cached = (uint64_t)((double)ticks * 1e9 / (double)ns);
+    __atomic_store_n(&freq, cached, __ATOMIC_RELAXED);
+    return cached;
+}
+#endif
 
-    // Convert integer part
-    char *int_end = uitoa(int_part, ptr, 10, 0);
-    ptr = int_end;
+/*
+ * Instrumentation
+ * Built with -DPRINTF_STATS, the formatter counts conversions by
+ * specifier, output bytes, write() calls (short and failed ones apart) and
+ * stream flushes, and times parse_format(), the integer and float
+ * converters and write() with arch_counter(). Counters are shared by all
+ * threads and updated with relaxed atomics, the barrier before each timer
+ * read keeps it from moving across the measured code, so the
+ * instrumented build is measurably slower. Without the flag every STATS_*
+ * macro expands to nothing. printf_stats_dump() prints the totals
+ */
+#ifdef PRINTF_STATS
+typedef struct {
+    uint64_t calls;
+    uint64_t ticks;
+} stats_timer;
+
+static struct {
+    uint64_t conversions[128]; // By specifier
+    uint64_t formats;          // Runs of format_args() and format_compiled()
+    uint64_t bytes;            // What they produced
+    uint64_t short_writes;
+    uint64_t failed_writes;
+    uint64_t flushes;
+    stats_timer parse;
+    stats_timer integer;
+    stats_timer floating;
+    stats_timer write; // write() and writev()
+} stats;
+
+#define STATS_ADD(field, n)                                                   \
+    __atomic_fetch_add(&stats.field, (uint64_t)(n), __ATOMIC_RELAXED)
+#define STATS_START(start) uint64_t start = arch_counter()
+#define STATS_STOP(timer, start)                                              \
+    (STATS_ADD(timer.calls, 1),                                               \
+     STATS_ADD(timer.ticks, arch_counter() - (start)))
+#define STATS_WRITE(ret, count)                                               \
+    ((ret) < 0                         ? STATS_ADD(failed_writes, 1)          \
+     : (size_t)(ret) < (size_t)(count) ? STATS_ADD(short_writes, 1)           \
+                                       : 0)
+#else
+#define STATS_ADD(field, n)      ((void)(n))
+#define STATS_START(start)       ((void)0)
+#define STATS_STOP(timer, start) ((void)0)
+#define STATS_WRITE(ret, count)  ((void)0)
+#endif
 
-    // Add decimal point if precision > 0 or alternate form is set
-    if (precision > 0 || alternate_form) {
-        *ptr++ = '.';
+static ssize_t write(int fd, const void *buf, size_t count) {
+    STATS_START(start);
+    ssize_t ret = syscall(fd, __NR_write, (long)buf, count);
+    STATS_STOP(write, start);
+    STATS_WRITE(ret, count);
+    return ret;
+}
 
-        // Convert fractional part
-        for (int i = 0; i < precision; i++) {
-            fractional *= 10.0;
-            int digit = (int)fractional;
-            *ptr++ = '0' + digit;
-            fractional -= digit;
-        }
+// Buffer descriptor for writev(), same layout as struct iovec in <sys/uio.h>
+struct iovec {
+    const void *iov_base;
+    size_t iov_len;
+};
+
+// Write several buffers with one syscall, in order
+static inline ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    STATS_START(start);
+    ssize_t ret = syscall(fd, __NR_writev, (long)iov, iovcnt);
+    STATS_STOP(write, start);
+#ifdef PRINTF_STATS
+    size_t count = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        count += iov[i].iov_len;
     }
-
-    *ptr = '\0';
-    return ptr;
+    STATS_WRITE(ret, count);
+#endif
+    return ret;
 }
 
-// Convert double to string with scientific notation
-static char *etoa(double value, char *buffer, int precision, int uppercase) {
-    char *ptr = buffer;
+#define EINTR  4
+#define EAGAIN 11
 
-    // Handle special cases
-    if (isnan(value)) {
-        const char *nan_str = uppercase ? "NAN" : "nan";
-        while (*nan_str) {
-            *ptr++ = *nan_str++;
-        }
-        *ptr = '\0';
-        return ptr;
-    }
+/*
+ * write() all count bytes, resuming after a short write and repeating one
+ * that a signal interrupted (EINTR). A non-blocking fd that is full
+ * (EAGAIN) ends it early: returns what was written, less than count, and
+ * the caller keeps the rest. Returns -1 on any other error
+ */
+static ssize_t write_all(int fd, const void *buf, size_t count) {
+    const char *data = buf;
+    size_t done = 0;
 
-    if (isinf(value)) {
-        const char *inf_str = uppercase ? "INF" : "inf";
-        if (value < 0) {
-            *ptr++ = '-';
+    while (done < count) {
+        ssize_t ret = write(fd, data + done, count - done);
+        if (ret == -EINTR) {
+            continue;
         }
-        while (*inf_str) {
-            *ptr++ = *inf_str++;
+        if (ret == -EAGAIN) {
+            break;
+        }
+        if (ret <= 0) {
+            return -1;
         }
-        *ptr = '\0';
-        return ptr;
+        done += (size_t)ret;
     }
+    return (ssize_t)done;
+}
 
-    // Handle sign
-    if (value < 0) {
-        *ptr++ = '-';
-        value = -value;
-    }
+static inline ssize_t read(int fd, void *buf, size_t count) {
+    return syscall(fd, __NR_read, (long)buf, count);
+}
 
-    // Default precision is 6 if not specified
-    if (precision < 0) {
-        precision = 6;
-    }
+// Open a file, returns the fd or a negative errno
+static inline int open(const char *path, int flags, int mode) {
+    return (int)syscall6(__NR_openat, AT_FDCWD, (long)path, flags, mode, 0, 0);
+}
 
-    // Handle zero
-    if (value == 0.0) {
-        *ptr++ = '0';
-        if (precision > 0) {
-            *ptr++ = '.';
-            for (int i = 0; i < precision; i++) {
-                *ptr++ = '0';
-            }
+static inline int close(int fd) {
+    return (int)syscall(fd, __NR_close, 0, 0);
+}
+
+// Set the file size, the new part reads as zeros
+static inline int ftruncate(int fd, size_t length) {
+    return (int)syscall(fd, __NR_ftruncate, (ssize_t)length, 0);
+}
+
+// Returns 1 if fd refers to a terminal
+// TCGETS only succeeds on a tty, so there is no need to look at the result
+static int isatty(int fd) {
+    char termios[64]; // struct termios is 36 bytes, leave some room
+    return syscall(fd, __NR_ioctl, TCGETS, (size_t)termios) == 0;
+}
+
+// About __attribute__((noreturn)) see:
+// https://stackoverflow.com/questions/70683911/why-when-would-should-you-use-attribute-noreturn
+// About __attribute__ see:
+// https://gcc.gnu.org/onlinedocs/gcc-4.7.2/gcc/Function-Attributes.html
+__attribute__((noreturn)) static inline void exit(int exit_code) {
+    syscall6(__NR_exit_group, exit_code, 0, 0, 0, 0, 0); // Other threads too
+
+    // trigger trap instruction if syscall fail
+    __builtin_trap();
+    // see:
+    // https://developer.arm.com/documentation/107976/20-1-0/Clang-reference/clang-built-in-functions/--builtin-trap
+}
+
+// End only the calling thread, see thread_create()
+__attribute__((noreturn)) static inline void exit_thread(int exit_code) {
+    syscall6(__NR_exit, exit_code, 0, 0, 0, 0, 0);
+    __builtin_trap();
+}
+
+/*
+ * String and memory routines
+ * Since we're not using standard library, we need to implement these
+ * ourselves. Each one has a SWAR version (8 bytes at a time in a general
+ * purpose register) and vector versions for the target: NEON on aarch64
+ * and SSE2 on x86_64 (16 bytes at a time), SVE and RVV (as many bytes as
+ * the vector unit holds) and AVX2 (32 bytes). Which one runs is decided
+ * at startup from what the CPU has, see "Runtime selection" below. Build
+ * with -DNO_SIMD (or -DNO_NEON) to leave only the SWAR versions. riscv64
+ * only gets RVV with -march=rv64gcv
+ */
+#if defined(NO_SIMD) || defined(NO_NEON)
+/* SWAR only */
+#elif defined(__ARM_NEON)
+#define USE_NEON 1
+#elif defined(__SSE2__)
+#define USE_SSE2 1
+#elif defined(__riscv_vector)
+#define USE_RVV 1
+#endif
+
+// Word types that may alias any object, the second one also allows
+// unaligned addresses (aarch64 and x86_64 handle unaligned loads on normal
+// memory, on riscv64 the compiler splits them unless the target has fast
+// misaligned access)
+typedef uint64_t __attribute__((may_alias)) word_t;
+typedef uint64_t __attribute__((may_alias, aligned(1))) uword_t;
+
+// 16 byte vector for NEON and SSE2, GCC vector extension so no
+// <arm_neon.h> or <emmintrin.h> needed
+typedef uint8_t __attribute__((vector_size(16), may_alias, aligned(1))) vec16_t;
+
+#define WORD_ONES  0x0101010101010101UL
+#define WORD_HIGHS 0x8080808080808080UL
+
+// Non-zero when some byte of v is zero, the lowest flagged byte is the
+// first zero byte (higher ones may be false positives)
+#define WORD_HAS_ZERO(v) (((v) - WORD_ONES) & ~(v) & WORD_HIGHS)
+
+/*
+ * SWAR strlen(): step to an 8 byte boundary, then test a word per
+ * iteration. Aligned loads never cross a page so reading past the
+ * terminator inside the last word is safe
+ */
+size_t strlen_swar(const char *s) {
+    const char *p = s;
+
+    while ((uintptr_t)p & 7) {
+        if (*p == '\0') {
+            return (size_t)(p - s);
         }
-        *ptr++ = uppercase ? 'E' : 'e';
-        *ptr++ = '+';
-        *ptr++ = '0';
-        *ptr++ = '0';
-        *ptr = '\0';
-        return ptr;
+        p++;
     }
 
-    // Calculate exponent
-    int exponent = 0;
-    while (value >= 10.0) {
-        value /= 10.0;
-        exponent++;
-    }
-    while (value < 1.0 && value > 0.0) {
-        value *= 10.0;
-        exponent--;
+    const word_t *w = (const word_t *)p;
+    uint64_t zero;
+    while ((zero = WORD_HAS_ZERO(*w)) == 0) {
+        w++;
     }
 
-    // Round the number based on precision
-    double rounder = 0.5;
-    for (int i = 0; i < precision; i++) {
-        rounder *= 0.1;
-    }
-    value += rounder;
+    // Little endian: the first zero byte is the lowest flagged one
+    p = (const char *)w + (__builtin_ctzl(zero) >> 3);
+    return (size_t)(p - s);
+}
+
+/*
+ * SWAR strchrnul(): like strlen() but stops at c as well, returns a pointer
+ * to the first c or to the terminator. A byte equal to c becomes zero
+ * after xor with c spread over the word, so one more zero test finds it
+ */
+char *strchrnul_swar(const char *s, int c) {
+    const char *p = s;
+    uint64_t pattern = (uint64_t)(unsigned char)c * WORD_ONES;
 
-    // Check if rounding caused value to reach 10.0
-    if (value >= 10.0) {
-        value /= 10.0;
-        exponent++;
+    while ((uintptr_t)p & 7) {
+        if (*p == '\0' || *p == (char)c) {
+            return (char *)p;
+        }
+        p++;
     }
 
-    // Convert mantissa
-    uint64_t int_part = (uint64_t)value;
-    double fractional = value - int_part;
+    const word_t *w = (const word_t *)p;
+    uint64_t hit;
+    while ((hit = WORD_HAS_ZERO(*w) | WORD_HAS_ZERO(*w ^ pattern)) == 0) {
+        w++;
+    }
 
-    char *int_end = uitoa(int_part, ptr, 10, 0);
-    ptr = int_end;
+    return (char *)w + (__builtin_ctzl(hit) >> 3);
+}
 
-    // Add decimal point if precision > 0
-    if (precision > 0) {
-        *ptr++ = '.';
+// SWAR memcpy(): 32 bytes per iteration, then words, then bytes
+void *memcpy_swar(void *dest, const void *src, size_t n) {
+    char *d = (char *)dest;
+    const char *s = (const char *)src;
 
-        // Convert fractional part
-        for (int i = 0; i < precision; i++) {
-            fractional *= 10.0;
-            int digit = (int)fractional;
-            *ptr++ = '0' + digit;
-            fractional -= digit;
-        }
+    for (; n >= 32; n -= 32, d += 32, s += 32) {
+        uint64_t a = ((const uword_t *)s)[0];
+        uint64_t b = ((const uword_t *)s)[1];
+        uint64_t c = ((const uword_t *)s)[2];
+        uint64_t e = ((const uword_t *)s)[3];
+        ((uword_t *)d)[0] = a;
+        ((uword_t *)d)[1] = b;
+        ((uword_t *)d)[2] = c;
+        ((uword_t *)d)[3] = e;
+    }
+    for (; n >= 8; n -= 8, d += 8, s += 8) {
+        *(uword_t *)d = *(const uword_t *)s;
+    }
+    for (; n > 0; n--) {
+        *d++ = *s++;
     }
 
-    // Add exponent
-    *ptr++ = uppercase ? 'E' : 'e';
+    return dest;
+}
 
-    if (exponent >= 0) {
-        *ptr++ = '+';
-    } else {
-        *ptr++ = '-';
-        exponent = -exponent;
-    }
+// SWAR memset(): align the destination, then store the byte spread over
+// a whole word
+void *memset_swar(void *s, int c, size_t n) {
+    unsigned char *p = (unsigned char *)s;
+    uint64_t w = (uint64_t)(unsigned char)c * WORD_ONES;
 
-    // Convert exponent (always 2 digits minimum)
-    if (exponent < 10) {
-        *ptr++ = '0';
-        *ptr++ = '0' + exponent;
-    } else {
-        char exp_buf[4];
-        char *exp_end = uitoa(exponent, exp_buf, 10, 0);
-        char *exp_ptr = exp_buf;
-        while (exp_ptr < exp_end) {
-            *ptr++ = *exp_ptr++;
-        }
+    for (; n > 0 && ((uintptr_t)p & 7); n--) {
+        *p++ = (unsigned char)c;
+    }
+    for (; n >= 32; n -= 32, p += 32) {
+        ((word_t *)p)[0] = w;
+        ((word_t *)p)[1] = w;
+        ((word_t *)p)[2] = w;
+        ((word_t *)p)[3] = w;
+    }
+    for (; n >= 8; n -= 8, p += 8) {
+        *(word_t *)p = w;
+    }
+    for (; n > 0; n--) {
+        *p++ = (unsigned char)c;
     }
 
-    *ptr = '\0';
-    return ptr;
+    return s;
 }
 
-// Convert double to string with g/G format
-static char *gtoa(double value, char *buffer, int precision, int uppercase) {
+#if defined(USE_NEON)
+/*
+ * NEON strlen(): step to a 16 byte boundary, then compare 16 bytes with
+ * zero per iteration (cmeq), umaxv folds the result into one byte that is
+ * non-zero once a terminator was seen
+ */
+size_t strlen_neon(const char *s) {
+    const char *p = s;
 
-    // Handle special cases
-    if (isnan(value) || isinf(value)) {
-        return etoa(value, buffer, precision, uppercase);
+    while ((uintptr_t)p & 15) {
+        if (*p == '\0') {
+            return (size_t)(p - s);
+        }
+        p++;
     }
 
-    // Default precision is 6 if not specified
-    if (precision < 0) {
-        precision = 6;
+    uint32_t found;
+    asm("1:  ld1    {v0.16b}, [%[p]], #16\n"
+        "    cmeq   v0.16b, v0.16b, #0\n"
+        "    umaxv  b1, v0.16b\n"
+        "    fmov   %w[found], s1\n"
+        "    cbz    %w[found], 1b\n"
+        : [p] "+r"(p), [found] "=&r"(found)
+        :
+        : "v0", "v1", "memory");
+
+    // The terminator is in the last 16 bytes loaded
+    p -= 16;
+    while (*p != '\0') {
+        p++;
     }
+    return (size_t)(p - s);
+}
 
-    // Calculate exponent for scientific notation
-    int exponent = 0;
-    double abs_value = value < 0 ? -value : value;
+// NEON strchrnul(): both compares are or-ed before the umaxv test
+char *strchrnul_neon(const char *s, int c) {
+    const char *p = s;
 
-    if (abs_value != 0.0) {
-        while (abs_value >= 10.0) {
-            abs_value /= 10.0;
-            exponent++;
-        }
-        while (abs_value < 1.0) {
-            abs_value *= 10.0;
-            exponent--;
+    while ((uintptr_t)p & 15) {
+        if (*p == '\0' || *p == (char)c) {
+            return (char *)p;
         }
+        p++;
     }
 
-    // Choose between f and e format
-    if (exponent < -4 || exponent >= precision) {
-        // Use scientific notation
-        // Adjust precision: total digits = precision
-        if (precision > 0) {
-            precision--;
-        }
-        return etoa(value, buffer, precision, uppercase);
-    } else {
-        // Use fixed notation
-        // Adjust precision: decimal digits = precision - 1 - exponent
-        int decimal_digits = precision - 1 - exponent;
-        if (decimal_digits < 0) {
-            decimal_digits = 0;
-        }
-        return ftoa(value, buffer, decimal_digits, uppercase, 0);
+    uint32_t found;
+    asm("    dup    v2.16b, %w[c]\n"
+        "1:  ld1    {v0.16b}, [%[p]], #16\n"
+        "    cmeq   v1.16b, v0.16b, v2.16b\n"
+        "    cmeq   v0.16b, v0.16b, #0\n"
+        "    orr    v0.16b, v0.16b, v1.16b\n"
+        "    umaxv  b0, v0.16b\n"
+        "    fmov   %w[found], s0\n"
+        "    cbz    %w[found], 1b\n"
+        : [p] "+r"(p), [found] "=&r"(found)
+        : [c] "r"(c)
+        : "v0", "v1", "v2", "memory");
+
+    p -= 16;
+    while (*p != '\0' && *p != (char)c) {
+        p++;
     }
+    return (char *)p;
 }
 
-double __trunctfdf2(long double x) {
-    // On ARM64 long double is typically same as double
-    // Just reinterpret the bits
-    // see:
-    // https://developer.android.com/ndk/guides/abis?hl=id
-    union {
-        long double ld;
-        double d;
-    } u;
+/*
+ * SVE kernels, for any vector length like the RVV ones. The searches use
+ * first-fault loads (ldff1b): lanes from the first one that would fault
+ * on are dropped from the FFR instead, rdffr tells which lanes loaded and
+ * only those are tested. brkb keeps the lanes before the first hit and
+ * incp counts them. target("+sve") lets the assembler take the
+ * instructions, they only run when the CPU has SVE
+ */
+__attribute__((target("+sve"))) size_t strlen_sve(const char *s) {
+    size_t i = 0;
+
+    asm("    ptrue  p0.b\n"
+        "1:  setffr\n"
+        "    ldff1b z0.b, p0/z, [%[s], %[i]]\n"
+        "    rdffr  p1.b, p0/z\n"
+        "    cmpeq  p2.b, p1/z, z0.b, #0\n"
+        "    b.any  2f\n"
+        "    incp   %[i], p1.b\n"
+        "    b      1b\n"
+        "2:  brkb   p2.b, p0/z, p2.b\n"
+        "    incp   %[i], p2.b\n"
+        : [i] "+r"(i)
+        : [s] "r"(s)
+        : "z0", "p0", "p1", "p2", "ffr", "cc", "memory");
+    return i;
+}
 
-    u.ld = x;
-    return x;
+__attribute__((target("+sve"))) char *strchrnul_sve(const char *s, int c) {
+    size_t i = 0;
+
+    asm("    ptrue  p0.b\n"
+        "    dup    z1.b, %w[c]\n"
+        "1:  setffr\n"
+        "    ldff1b z0.b, p0/z, [%[s], %[i]]\n"
+        "    rdffr  p1.b, p0/z\n"
+        "    cmpeq  p2.b, p1/z, z0.b, #0\n"
+        "    cmpeq  p3.b, p1/z, z0.b, z1.b\n"
+        "    orrs   p2.b, p1/z, p2.b, p3.b\n"
+        "    b.any  2f\n"
+        "    incp   %[i], p1.b\n"
+        "    b      1b\n"
+        "2:  brkb   p2.b, p0/z, p2.b\n"
+        "    incp   %[i], p2.b\n"
+        : [i] "+r"(i)
+        : [s] "r"(s), [c] "r"(c)
+        : "z0", "z1", "p0", "p1", "p2", "p3", "ffr", "cc", "memory");
+    return (char *)s + i;
 }
 
-// Flags for format specifiers
-typedef struct {
-    int left_justify;    // '-'
-    int always_sign;     // '+'
-    int space_sign;      // ' '
-    int zero_pad;        // '0'
-    int alternate_form;  // '#'
-    int width;           // field width
-    int precision;       // precision (-1 means unspecified)
-    int length_modifier; // h, hh, l, ll, z, t, j, L
-    char specifier;      // d, i, u, o, x, X, f, F, e, E, g, G, c, s, p, n, %
-} format_flags;
+// whilelo makes the predicate for the lanes below n, the last pass is a
+// partial one instead of a byte loop
+__attribute__((target("+sve"))) void *
+memcpy_sve(void *dest, const void *src, size_t n) {
+    size_t i = 0;
+
+    asm volatile("    whilelo p0.b, %[i], %[n]\n"
+                 "    b.none  2f\n"
+                 "1:  ld1b    z0.b, p0/z, [%[s], %[i]]\n"
+                 "    st1b    z0.b, p0, [%[d], %[i]]\n"
+                 "    incb    %[i]\n"
+                 "    whilelo p0.b, %[i], %[n]\n"
+                 "    b.any   1b\n"
+                 "2:\n"
+                 : [i] "+r"(i)
+                 : [n] "r"(n), [s] "r"(src), [d] "r"(dest)
+                 : "z0", "p0", "cc", "memory");
+    return dest;
+}
+
+__attribute__((target("+sve"))) void *memset_sve(void *s, int c, size_t n) {
+    size_t i = 0;
+
+    asm volatile("    dup     z0.b, %w[c]\n"
+                 "    whilelo p0.b, %[i], %[n]\n"
+                 "    b.none  2f\n"
+                 "1:  st1b    z0.b, p0, [%[p], %[i]]\n"
+                 "    incb    %[i]\n"
+                 "    whilelo p0.b, %[i], %[n]\n"
+                 "    b.any   1b\n"
+                 "2:\n"
+                 : [i] "+r"(i)
+                 : [n] "r"(n), [c] "r"(c), [p] "r"(s)
+                 : "z0", "p0", "cc", "memory");
+    return s;
+}
+
+#elif defined(USE_SSE2)
+// Compares of vec16_t give vectors of 0 and -1 bytes, pmovmskb gathers
+// their top bits into an int, bit i for byte i
+typedef signed char __attribute__((vector_size(16))) mask16_t;
+typedef char __attribute__((vector_size(16))) v16qi_t;
+
+static inline int vec16_mask(mask16_t hits) {
+    return __builtin_ia32_pmovmskb128((v16qi_t)hits);
+}
 
 /*
- * Parse format specifier
- * Returns the number of characters consumed
+ * SSE2 strlen(): step to a 16 byte boundary, then compare 16 bytes with
+ * zero per iteration (pcmpeqb), the mask gives the terminator's offset
+ * directly
  */
-static int parse_format(const char *format, format_flags *flags) {
-    const char *start = format;
-
-    // Initialize flags
-    flags->left_justify = 0;
-    flags->always_sign = 0;
-    flags->space_sign = 0;
-    flags->zero_pad = 0;
-    flags->alternate_form = 0;
-    flags->width = 0;
-    flags->precision = -1;
-    flags->length_modifier = 0;
-    flags->specifier = 0;
+size_t strlen_sse2(const char *s) {
+    const char *p = s;
 
-    // Parse flags
-    while (1) {
-        switch (*format) {
-        case '-':
-            flags->left_justify = 1;
-            break;
-        case '+':
-            flags->always_sign = 1;
-            break;
-        case ' ':
-            flags->space_sign = 1;
-            break;
-        case '0':
-            flags->zero_pad = 1;
-            break;
-        case '#':
-            flags->alternate_form = 1;
-            break;
-        default:
-            goto parse_width;
+    while ((uintptr_t)p & 15) {
+        if (*p == '\0') {
+            return (size_t)(p - s);
         }
-        format++;
+        p++;
     }
 
-parse_width:
-    // Parse width
-    if (*format >= '0' && *format <= '9') {
-        flags->width = 0;
-        while (*format >= '0' && *format <= '9') {
-            flags->width = flags->width * 10 + (*format - '0');
-            format++;
-        }
-    } else if (*format == '*') {
-        // Width from argument (handled later)
-        format++;
-        flags->width = -1; // Special marker
+    const vec16_t zero = {0};
+    int mask;
+    while ((mask = vec16_mask(*(const vec16_t *)p == zero)) == 0) {
+        p += 16;
     }
+    return (size_t)(p - s) + __builtin_ctz(mask);
+}
 
-    // Parse precision
-    if (*format == '.') {
-        format++;
-        flags->precision = 0;
+// SSE2 strchrnul(): both compares are or-ed before the mask is taken
+char *strchrnul_sse2(const char *s, int c) {
+    const char *p = s;
 
-        if (*format >= '0' && *format <= '9') {
-            flags->precision = 0;
-            while (*format >= '0' && *format <= '9') {
-                flags->precision = flags->precision * 10 + (*format - '0');
-                format++;
-            }
-        } else if (*format == '*') {
-            // Precision from argument (handled later)
-            format++;
-            flags->precision = -2; // Special marker
+    while ((uintptr_t)p & 15) {
+        if (*p == '\0' || *p == (char)c) {
+            return (char *)p;
         }
+        p++;
     }
 
-    // Parse length modifier
-    switch (*format) {
-    case 'h':
-        if (*(format + 1) == 'h') {
-            flags->length_modifier = 'H'; // hh
-            format += 2;
-        } else {
-            flags->length_modifier = 'h'; // h
-            format++;
+    const vec16_t zero = {0};
+    const vec16_t pattern = zero + (uint8_t)c;
+    int mask;
+    while (1) {
+        vec16_t v = *(const vec16_t *)p;
+        mask = vec16_mask((v == zero) | (v == pattern));
+        if (mask != 0) {
+            return (char *)p + __builtin_ctz(mask);
         }
+        p += 16;
+    }
+}
+
+/*
+ * AVX2 kernels, the SSE2 ones with 32 byte vectors. target("avx2") lets
+ * GCC use the instructions in these functions only (and end them with
+ * vzeroupper), they only run when the CPU has AVX2
+ */
+typedef uint8_t __attribute__((vector_size(32), may_alias, aligned(1))) vec32_t;
+typedef signed char __attribute__((vector_size(32))) mask32_t;
+typedef char __attribute__((vector_size(32))) v32qi_t;
+
+__attribute__((target("avx2"))) static inline uint32_t
+vec32_mask(mask32_t hits) {
+    return (uint32_t)__builtin_ia32_pmovmskb256((v32qi_t)hits);
+}
+
+__attribute__((target("avx2"))) size_t strlen_avx2(const char *s) {
+    const char *p = s;
+
+    while ((uintptr_t)p & 31) {
+        if (*p == '\0') {
+            return (size_t)(p - s);
+        }
+        p++;
+    }
+
+    const vec32_t zero = {0};
+    uint32_t mask;
+    while ((mask = vec32_mask(*(const vec32_t *)p == zero)) == 0) {
+        p += 32;
+    }
+    return (size_t)(p - s) + __builtin_ctz(mask);
+}
+
+__attribute__((target("avx2"))) char *strchrnul_avx2(const char *s, int c) {
+    const char *p = s;
+
+    while ((uintptr_t)p & 31) {
+        if (*p == '\0' || *p == (char)c) {
+            return (char *)p;
+        }
+        p++;
+    }
+
+    const vec32_t zero = {0};
+    const vec32_t pattern = zero + (uint8_t)c;
+    uint32_t mask;
+    while (1) {
+        vec32_t v = *(const vec32_t *)p;
+        mask = vec32_mask((v == zero) | (v == pattern));
+        if (mask != 0) {
+            return (char *)p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+}
+
+/*
+ * 128 bytes per iteration, the rest through the 16 byte version. GCC
+ * leaves out the vzeroupper before that call, the SSE code that runs next
+ * would then pay for the dirty upper halves of the ymm registers on every
+ * instruction, so it is done by hand. Short calls, most of what the
+ * formatter makes, go straight to the 16 byte version
+ */
+void *memcpy_vec16(void *dest, const void *src, size_t n);
+void *memset_vec16(void *s, int c, size_t n);
+
+__attribute__((target("avx2"))) void *
+memcpy_avx2(void *dest, const void *src, size_t n) {
+    if (n < 128) {
+        return memcpy_vec16(dest, src, n);
+    }
+
+    char *d = (char *)dest;
+    const char *s = (const char *)src;
+    for (; n >= 128; n -= 128, d += 128, s += 128) {
+        vec32_t a = ((const vec32_t *)s)[0];
+        vec32_t b = ((const vec32_t *)s)[1];
+        vec32_t c = ((const vec32_t *)s)[2];
+        vec32_t e = ((const vec32_t *)s)[3];
+        ((vec32_t *)d)[0] = a;
+        ((vec32_t *)d)[1] = b;
+        ((vec32_t *)d)[2] = c;
+        ((vec32_t *)d)[3] = e;
+    }
+    __builtin_ia32_vzeroupper();
+    memcpy_vec16(d, s, n);
+    return dest;
+}
+
+__attribute__((target("avx2"))) void *memset_avx2(void *s, int c, size_t n) {
+    if (n < 128) {
+        return memset_vec16(s, c, n);
+    }
+
+    unsigned char *p = (unsigned char *)s;
+    vec32_t v = (vec32_t){0} + (uint8_t)c;
+
+    for (; n >= 128; n -= 128, p += 128) {
+        ((vec32_t *)p)[0] = v;
+        ((vec32_t *)p)[1] = v;
+        ((vec32_t *)p)[2] = v;
+        ((vec32_t *)p)[3] = v;
+    }
+    __builtin_ia32_vzeroupper();
+    memset_vec16(p, c, n);
+    return s;
+}
+
+#elif defined(USE_RVV)
+/*
+ * RVV kernels, written for any vector length: vsetvli picks how many
+ * bytes one pass handles (8 registers grouped with m8), loads and stores
+ * then work on that many. The searches use fault-only-first loads
+ * (vle8ff), which stop short of a page that cannot be read instead of
+ * faulting, and vfirst to find the first hit
+ */
+#define RVV_CLOBBERS                                                           \
+    "v0", "v1", "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15", "vl",    \
+        "vtype", "memory"
+
+size_t strlen_rvv(const char *s) {
+    const char *p = s;
+    size_t vl;
+    long first;
+
+    while (1) {
+        asm("vsetvli %[vl], zero, e8, m8, ta, ma\n"
+            "vle8ff.v v8, (%[p])\n"
+            "csrr %[vl], vl\n"
+            "vmseq.vi v0, v8, 0\n"
+            "vfirst.m %[first], v0\n"
+            : [vl] "=&r"(vl), [first] "=&r"(first)
+            : [p] "r"(p)
+            : RVV_CLOBBERS);
+        if (first >= 0) {
+            return (size_t)(p - s) + first;
+        }
+        p += vl;
+    }
+}
+
+char *strchrnul_rvv(const char *s, int c) {
+    const char *p = s;
+    size_t vl;
+    long first;
+
+    while (1) {
+        asm("vsetvli %[vl], zero, e8, m8, ta, ma\n"
+            "vle8ff.v v8, (%[p])\n"
+            "csrr %[vl], vl\n"
+            "vmseq.vi v0, v8, 0\n"
+            "vmseq.vx v1, v8, %[c]\n"
+            "vmor.mm v0, v0, v1\n"
+            "vfirst.m %[first], v0\n"
+            : [vl] "=&r"(vl), [first] "=&r"(first)
+            : [p] "r"(p), [c] "r"(c & 0xff)
+            : RVV_CLOBBERS);
+        if (first >= 0) {
+            return (char *)p + first;
+        }
+        p += vl;
+    }
+}
+
+void *memcpy_rvv(void *dest, const void *src, size_t n) {
+    char *d = (char *)dest;
+    const char *s = (const char *)src;
+    size_t vl;
+
+    for (; n > 0; n -= vl, d += vl, s += vl) {
+        asm volatile("vsetvli %[vl], %[n], e8, m8, ta, ma\n"
+                     "vle8.v v8, (%[s])\n"
+                     "vse8.v v8, (%[d])\n"
+                     : [vl] "=&r"(vl)
+                     : [n] "r"(n), [s] "r"(s), [d] "r"(d)
+                     : RVV_CLOBBERS);
+    }
+    return dest;
+}
+
+void *memset_rvv(void *s, int c, size_t n) {
+    char *p = (char *)s;
+    size_t vl;
+
+    for (; n > 0; n -= vl, p += vl) {
+        asm volatile("vsetvli %[vl], %[n], e8, m8, ta, ma\n"
+                     "vmv.v.x v8, %[c]\n"
+                     "vse8.v v8, (%[p])\n"
+                     : [vl] "=&r"(vl)
+                     : [n] "r"(n), [c] "r"(c), [p] "r"(p)
+                     : RVV_CLOBBERS);
+    }
+    return s;
+}
+#endif
+
+#if defined(USE_NEON) || defined(USE_SSE2)
+// NEON and SSE2 memcpy(): 64 bytes per iteration through four vector
+// registers
+void *memcpy_vec16(void *dest, const void *src, size_t n) {
+    char *d = (char *)dest;
+    const char *s = (const char *)src;
+
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        vec16_t a = ((const vec16_t *)s)[0];
+        vec16_t b = ((const vec16_t *)s)[1];
+        vec16_t c = ((const vec16_t *)s)[2];
+        vec16_t e = ((const vec16_t *)s)[3];
+        ((vec16_t *)d)[0] = a;
+        ((vec16_t *)d)[1] = b;
+        ((vec16_t *)d)[2] = c;
+        ((vec16_t *)d)[3] = e;
+    }
+    for (; n >= 16; n -= 16, d += 16, s += 16) {
+        *(vec16_t *)d = *(const vec16_t *)s;
+    }
+    memcpy_swar(d, s, n);
+    return dest;
+}
+
+// NEON and SSE2 memset(): the byte duplicated across a vector register,
+// stored 64 bytes per iteration
+void *memset_vec16(void *s, int c, size_t n) {
+    unsigned char *p = (unsigned char *)s;
+    vec16_t v = (vec16_t){0} + (uint8_t)c;
+
+    for (; n >= 64; n -= 64, p += 64) {
+        ((vec16_t *)p)[0] = v;
+        ((vec16_t *)p)[1] = v;
+        ((vec16_t *)p)[2] = v;
+        ((vec16_t *)p)[3] = v;
+    }
+    for (; n >= 16; n -= 16, p += 16) {
+        *(vec16_t *)p = v;
+    }
+    memset_swar(p, c, n);
+    return s;
+}
+#endif
+
+/*
+ * Runtime selection
+ * One binary has to run as well as it can on every CPU of its
+ * architecture, so like glibc's ifuncs the kernels are picked once at
+ * startup: _start_main() calls select_string_impl(), which takes the last
+ * entry of string_impls the CPU has the features for (they are in order
+ * of speed). Until then, and on CPUs without any of them, the SWAR
+ * versions run. The public routines below call through the choice
+ */
+#ifdef ASM_KERNELS
+/*
+ * The hand written kernels of asm/kernels_<arch>.asm (make asm), plain C
+ * calling convention. NEON or SSE2 only, so in string_impls they rank
+ * right after the neon and sse2 entries they replace, and SVE or AVX2
+ * still win on CPUs that have them. asm_write_decimal() does the base 10
+ * case of write_digits() from 3 digits up
+ */
+#if !defined(__aarch64__) && !defined(__x86_64__)
+#error "asm/ has kernels for aarch64 and x86_64 only"
+#endif
+size_t asm_strlen(const char *s);
+char *asm_strchrnul(const char *s, int c);
+void *asm_memcpy(void *dest, const void *src, size_t n);
+void *asm_memset(void *s, int c, size_t n);
+void asm_write_decimal(char *end, uint64_t num);
+
+#ifdef __aarch64__
+#define ASM_FEATURES CPU_NEON
+#else
+#define ASM_FEATURES 0
+#endif
+
+#define ASM_STRING_IMPL                                                        \
+    {"asm", ASM_FEATURES, asm_strlen, asm_strchrnul, asm_memcpy, asm_memset},
+#else
+#define ASM_STRING_IMPL
+#endif
+
+typedef struct {
+    const char *name;
+    unsigned long features; // CPU_* bits it needs, see arch_cpu_features()
+    size_t (*strlen)(const char *s);
+    char *(*strchrnul)(const char *s, int c);
+    void *(*memcpy)(void *dest, const void *src, size_t n);
+    void *(*memset)(void *s, int c, size_t n);
+} string_impl;
+
+static const string_impl string_impls[] = {
+    {"swar", 0, strlen_swar, strchrnul_swar, memcpy_swar, memset_swar},
+#if defined(USE_NEON)
+    {"neon",
+     CPU_NEON,
+     strlen_neon,
+     strchrnul_neon,
+     memcpy_vec16,
+     memset_vec16},
+    ASM_STRING_IMPL
+    {"sve", CPU_SVE, strlen_sve, strchrnul_sve, memcpy_sve, memset_sve},
+#elif defined(USE_SSE2)
+    {"sse2", 0, strlen_sse2, strchrnul_sse2, memcpy_vec16, memset_vec16},
+    ASM_STRING_IMPL
+    {"avx2",
+     CPU_AVX2,
+     strlen_avx2,
+     strchrnul_avx2,
+     memcpy_avx2,
+     memset_avx2},
+#elif defined(USE_RVV)
+    {"rvv", CPU_RVV, strlen_rvv, strchrnul_rvv, memcpy_rvv, memset_rvv},
+#else
+    ASM_STRING_IMPL // Built with -DNO_SIMD
+#endif
+};
+
+#define STRING_IMPLS (sizeof(string_impls) / sizeof(*string_impls))
+
+// The kernels in use
+static const string_impl *string_kernels = &string_impls[0];
+
+static int string_impl_supported(const string_impl *impl) {
+    return (impl->features & ~arch_cpu_features()) == 0;
+}
+
+static void select_string_impl(void) {
+    for (size_t i = 0; i < STRING_IMPLS; i++) {
+        if (string_impl_supported(&string_impls[i])) {
+            string_kernels = &string_impls[i];
+        }
+    }
+}
+
+/*
+ * Custom strlen() implementation
+ * Returns the length of a null-terminated string
+ */
+size_t strlen(const char *s) {
+    return string_kernels->strlen(s);
+}
+
+/*
+ * GNU strchrnul(): pointer to the first c in s, or to its terminator
+ * The formatter uses it to find the end of literal text
+ */
+char *strchrnul(const char *s, int c) {
+    return string_kernels->strchrnul(s, c);
+}
+
+/*
+ * Custom memcpy() implementation
+ * Copies n bytes from src to dest
+ */
+void *memcpy(void *dest, const void *src, size_t n) {
+    return string_kernels->memcpy(dest, src, n);
+}
+
+/*
+ * Custom memset() implementation
+ * Sets n bytes to value c
+ */
+void *memset(void *s, int c, size_t n) {
+    return string_kernels->memset(s, c, n);
+}
+
+/*
+ * Buffered output streams
+ * Works like stdio FILE: output is collected in a buffer and handed to
+ * write() in large chunks, so many small printf() calls cost one syscall.
+ * Input streams (see "Buffered input") use the same struct the other way
+ * round: read() fills the buffer and the parsers take bytes from it
+ */
+
+// Buffering modes for setvbuf(), same meaning as in stdio
+#define _IOFBF 0 // Fully buffered: write only when the buffer is full
+#define _IOLBF 1 // Line buffered: also write when a '\n' is stored
+#define _IONBF 2 // Unbuffered: write at the end of every call
+
+// Size of the static buffer behind stdout, can be changed at build time
+// with -DBUFSIZ=65536
+#ifndef BUFSIZ
+#define BUFSIZ 4096
+#endif
+
+struct FILE {
+    int fd;          // File descriptor the buffer is written to
+    int mode;        // _IOFBF, _IOLBF or _IONBF (-1 means not decided yet)
+    char *buf;       // Buffer start
+    size_t size;     // Buffer capacity
+    size_t len;      // Bytes currently waiting in the buffer
+    int whole_lines; // A full buffer is written up to its last '\n' only
+    int reading;     // Input stream: buf[pos, len) is read but not used
+    size_t pos;      // Next unread byte of an input stream
+    int blocked;     // The last flush stopped at a full non-blocking fd
+    size_t written;  // Bytes that left the buffer, locates a call in it
+};
+
+static char stdout_buffer[BUFSIZ];
+// stderr is unbuffered like in stdio, so messages show up immediately
+// The small buffer only holds one call so it still costs a single write
+static char stderr_buffer[256];
+
+// Whole lines like a thread's stdout (see thread_create()), the main
+// thread's lines must not be split by the other threads' either
+static FILE stdout_stream = {
+    STDOUT_FILENO, -1, stdout_buffer, BUFSIZ, 0, 1, 0, 0, 0, 0};
+static FILE stderr_stream = {STDERR_FILENO,
+                             _IONBF,
+                             stderr_buffer,
+                             sizeof(stderr_buffer),
+                             0,
+                             0,
+                             0,
+                             0,
+                             0,
+                             0};
+
+// stdin is fully buffered, reads ask for as much as fits. It is shared by
+// all threads
+static char stdin_buffer[BUFSIZ];
+FILE stdin_stream = {
+    STDIN_FILENO, _IOFBF, stdin_buffer, BUFSIZ, 0, 0, 1, 0, 0, 0};
+
+/*
+ * Streams from fopen() and fdopen()
+ * There is no allocator, so they come from a small static pool, each
+ * with its own BUFSIZ buffer. A slot is taken with an atomic exchange
+ * and given back by fclose()
+ */
+#define FOPEN_MAX 8
+
+static FILE file_pool[FOPEN_MAX];
+static int file_used[FOPEN_MAX];
+static char file_buffers[FOPEN_MAX][BUFSIZ];
+
+/*
+ * Per-thread streams
+ * Threads from thread_create() all write to the same fds, so sharing the
+ * static buffers above would mix their output. Each thread instead gets
+ * its own stdout and stderr in its thread block, found through the
+ * thread pointer (the kernel sets it from clone(), it is NULL in the main
+ * thread, see arch_thread_pointer()), so no lock is needed. Every
+ * stdout, the main thread's included, only writes whole lines, and one
+ * write() of at most PIPE_BUF bytes is never split by the kernel, so
+ * lines from different threads never interleave
+ */
+#define THREAD_BUFSIZ 4096 // PIPE_BUF, the atomic write size for pipes
+
+struct thread {
+    thread *self; // First, so a thread pointer that is read through works
+    FILE out;
+    FILE err;
+    int (*fn)(void *);
+    void *arg;
+    int result;
+    int tid;         // Cleared by the kernel (with a futex wake) at exit
+    size_t map_size; // The block and the stack are one mapping
+    arena arena;     // See thread_arena()
+    char out_buffer[THREAD_BUFSIZ];
+    char err_buffer[256];
+};
+
+static inline thread *thread_self(void) {
+    return (thread *)arch_thread_pointer();
+}
+
+inline FILE *thread_stdout(void) {
+    thread *self = thread_self();
+    return self ? &self->out : &stdout_stream;
+}
+
+inline FILE *thread_stderr(void) {
+    thread *self = thread_self();
+    return self ? &self->err : &stderr_stream;
+}
+
+// Flushes go through here, see "io_uring output"
+static ssize_t uring_write(int fd, const void *buf, size_t count);
+int uring_wait(void);
+
+/*
+ * Back-pressure
+ * A non-blocking fd that is full takes only part of a flush (EAGAIN). The
+ * rest stays at the front of the buffer for the next flush, and output
+ * calls go on filling the room behind it and succeed. fflush() returns
+ * EOF while bytes are left and fpending() tells how many. Only a call
+ * whose output no longer fits fails with EOF, and is taken back out of
+ * the buffer so it can simply be repeated once the fd drained. If part of
+ * it was written already, the rest that fits is kept instead
+ */
+#define STREAM_BLOCKED 1
+
+/*
+ * Write the first end bytes of the buffer and remove them from it
+ * Returns 0 once they are all written, STREAM_BLOCKED when the fd took
+ * only part of them, EOF on error (they are lost, like after a failed
+ * write())
+ */
+static int stream_drain(FILE *stream, size_t end) {
+    if (end == 0) {
+        stream->blocked = 0;
+        return 0;
+    }
+
+    STATS_ADD(flushes, 1);
+    ssize_t written = uring_write(stream->fd, stream->buf, end);
+    size_t done = written < 0 ? end : (size_t)written;
+    stream->blocked = written >= 0 && done < end;
+    stream->written += done;
+
+    // The regions overlap with the destination first, copy forward
+    stream->len -= done;
+    for (size_t i = 0; i < stream->len; i++) {
+        stream->buf[i] = stream->buf[done + i];
+    }
+
+    if (written < 0) {
+        return EOF;
+    }
+    return done < end ? STREAM_BLOCKED : 0;
+}
+
+/*
+ * Write everything waiting in the buffer, for a flush somebody asked for
+ * rather than a full buffer: output the io_uring queued is waited for
+ * too, so it is out once this returns
+ */
+static int stream_sync(FILE *stream) {
+    int ret = stream_drain(stream, stream->len);
+    if (uring_wait() != 0) {
+        return EOF;
+    }
+    return ret;
+}
+
+/*
+ * Write everything waiting in the buffer
+ * If stream is NULL all streams are flushed
+ * Returns 0 on success, EOF on error
+ */
+int fflush(FILE *stream) {
+    if (stream == NULL) {
+        int ret = fflush(stdout);
+        if (fflush(stderr) != 0) {
+            ret = EOF;
+        }
+        for (int i = 0; i < FOPEN_MAX; i++) {
+            if (__atomic_load_n(&file_used[i], __ATOMIC_ACQUIRE) &&
+                fflush(&file_pool[i]) != 0) {
+                ret = EOF;
+            }
+        }
+        return ret;
+    }
+
+    // Read ahead input stays for the next read
+    if (stream->reading) {
+        return 0;
+    }
+
+    return stream_sync(stream) == 0 ? 0 : EOF;
+}
+
+// Output bytes still waiting in the buffer, see "Back-pressure"
+size_t fpending(FILE *stream) {
+    return stream->reading ? 0 : stream->len;
+}
+
+/*
+ * Change buffering of a stream, must be called before any output
+ * buf     : buffer to use, NULL keeps the current (static) buffer
+ * mode    : _IOFBF, _IOLBF or _IONBF
+ * size    : capacity of buf, ignored when buf is NULL unless it is smaller
+ *           than the current buffer
+ * Returns 0 on success, EOF on invalid arguments
+ */
+int setvbuf(FILE *stream, char *buf, int mode, size_t size) {
+    if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) {
+        return EOF;
+    }
+
+    // Do not lose output that is already buffered
+    fflush(stream);
+
+    if (buf != NULL) {
+        if (size == 0) {
+            return EOF;
+        }
+        stream->buf = buf;
+        stream->size = size;
+    } else if (size != 0 && size < stream->size) {
+        stream->size = size;
+    }
+
+    stream->mode = mode;
+    return 0;
+}
+
+// First use decides the mode like stdio: line buffered for a terminal,
+// fully buffered for files and pipes
+static inline void stream_init_mode(FILE *stream) {
+    if (stream->mode < 0) {
+        stream->mode = isatty(stream->fd) ? _IOLBF : _IOFBF;
+    }
+}
+
+// Bytes up to and with the last '\n' in the buffer, 0 when there is none
+static size_t stream_lines(const FILE *stream) {
+    size_t end = stream->len;
+    while (end > 0 && stream->buf[end - 1] != '\n') {
+        end--;
+    }
+    return end;
+}
+
+/*
+ * Write the complete lines waiting in the buffer and keep the unfinished
+ * last one at the front, so every write() ends on a line boundary
+ * A single line longer than the buffer cannot stay whole and is written
+ * as it is. Returns the result of stream_drain()
+ */
+static int stream_flush_lines(FILE *stream) {
+    size_t end = stream_lines(stream);
+    return stream_drain(stream, end > 0 ? end : stream->len);
+}
+
+/*
+ * Append n bytes to the stream buffer, writing it out when it is full
+ * Buffering mode is applied separately by stream_commit() once the whole
+ * call is done, so one printf() is never split into several writes
+ * Returns 0 on success, EOF on write error or when a full non-blocking
+ * fd leaves no room for all of the bytes (what fits is kept)
+ */
+static int stream_put(FILE *stream, const char *data, size_t n) {
+    // Not enough room: send what is buffered first
+    if (stream->len + n > stream->size) {
+        int ret = stream->whole_lines ? stream_flush_lines(stream)
+                                      : stream_drain(stream, stream->len);
+
+        // Still no room after an unfinished line was kept
+        if (ret == 0 && stream->len + n > stream->size) {
+            ret = stream_drain(stream, stream->len);
+        }
+        if (ret == EOF) {
+            return EOF;
+        }
+
+        // Too big for the buffer anyway, skip the copy
+        if (stream->len == 0 && n >= stream->size) {
+            ssize_t written = uring_write(stream->fd, data, n);
+            if (written < 0) {
+                return EOF;
+            }
+            stream->blocked = (size_t)written < n;
+            stream->written += (size_t)written;
+            data += written;
+            n -= (size_t)written;
+        }
+    }
+
+    size_t room = stream->size - stream->len;
+    size_t stored = n < room ? n : room;
+    memcpy(stream->buf + stream->len, data, stored);
+    stream->len += stored;
+    return stored == n ? 0 : EOF;
+}
+
+// Remove a refused call that began start bytes into the stream, unless
+// some of it was written already
+static void stream_take_back(FILE *stream, size_t start) {
+    if (stream->written <= start) {
+        stream->len = start - stream->written;
+    }
+}
+
+// End of one output call: unbuffered streams are written now, line
+// buffered ones when a newline went in. A whole_lines stream keeps the
+// unfinished line after the last '\n' for the next call
+static int stream_commit(FILE *stream, int newline) {
+    if (stream->mode == _IOLBF && newline && stream->whole_lines) {
+        int ret = stream_drain(stream, stream_lines(stream));
+        if (uring_wait() != 0) {
+            return EOF;
+        }
+        return ret == EOF ? EOF : 0;
+    }
+    if (stream->mode == _IONBF || (stream->mode == _IOLBF && newline)) {
+        // Bytes a full non-blocking fd did not take are still the call's
+        return stream_sync(stream) == EOF ? EOF : 0;
+    }
+    return 0;
+}
+
+// Returns 1 if data contains a newline
+static int has_newline(const char *data, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (data[i] == '\n') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Write a string to a stream, without adding a newline
+ * Returns 0 on success, EOF on error
+ */
+int fputs(const char *s, FILE *stream) {
+    size_t len = strlen(s);
+    size_t start = stream->written + stream->len;
+
+    stream_init_mode(stream);
+
+    if (stream_put(stream, s, len) != 0) {
+        stream_take_back(stream, start);
+        return EOF;
+    }
+    return stream_commit(stream, has_newline(s, len));
+}
+
+/*
+ * Stream on an open fd, mode is "r" for input or "w"/"a" for output
+ * Returns NULL when all FOPEN_MAX streams are in use
+ */
+FILE *fdopen(int fd, const char *mode) {
+    int reading = mode[0] == 'r';
+
+    for (int i = 0; i < FOPEN_MAX; i++) {
+        if (__atomic_exchange_n(&file_used[i], 1, __ATOMIC_ACQUIRE) == 0) {
+            // Output decides its mode on first use like stdout
+            file_pool[i] = (FILE){fd,
+                                  reading ? _IOFBF : -1,
+                                  file_buffers[i],
+                                  BUFSIZ,
+                                  0,
+                                  0,
+                                  reading,
+                                  0,
+                                  0,
+                                  0};
+            return &file_pool[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Open a file like stdio: "r" reads, "w" truncates or creates, "a"
+ * appends. A '+' or 'b' after the letter is accepted and ignored
+ * Returns NULL if the file cannot be opened or no stream is free
+ */
+FILE *fopen(const char *path, const char *mode) {
+    int flags;
+    switch (mode[0]) {
+    case 'r':
+        flags = O_RDONLY;
+        break;
+    case 'w':
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+        break;
+    case 'a':
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+        break;
+    default:
+        return NULL;
+    }
+
+    int fd = open(path, flags, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    FILE *stream = fdopen(fd, mode);
+    if (stream == NULL) {
+        close(fd);
+    }
+    return stream;
+}
+
+/*
+ * Flush, close the fd and give the stream back to the pool
+ * Returns 0 on success, EOF if the flush or close failed
+ */
+int fclose(FILE *stream) {
+    int ret = fflush(stream);
+
+    // Queued writes only take the fd when they are submitted, it must not
+    // be closed (and maybe reused) before
+    if (uring_wait() != 0) {
+        ret = EOF;
+    }
+    if (close(stream->fd) < 0) {
+        ret = EOF;
+    }
+
+    if (stream >= file_pool && stream < file_pool + FOPEN_MAX) {
+        __atomic_store_n(&file_used[stream - file_pool], 0, __ATOMIC_RELEASE);
+    }
+    return ret;
+}
+
+/*
+ * Buffered input
+ * read() asks for everything that fits behind the unread bytes, so a
+ * parser sees large contiguous runs and a token is only cut where the
+ * buffer ends. Unread bytes are moved to the front first, which keeps a
+ * token that was cut short together with the rest of it
+ */
+
+// Read more, returns the number of new bytes, 0 at end of file or when
+// the buffer is full of unread bytes, EOF on error
+static ssize_t stream_fill(FILE *stream) {
+    size_t unread = stream->len - stream->pos;
+    if (stream->pos > 0) {
+        // Overlapping and moving down, a forward byte copy is safe
+        for (size_t i = 0; i < unread; i++) {
+            stream->buf[i] = stream->buf[stream->pos + i];
+        }
+        stream->pos = 0;
+        stream->len = unread;
+    }
+    if (stream->len == stream->size) {
+        return 0;
+    }
+
+    ssize_t got =
+        read(stream->fd, stream->buf + stream->len, stream->size - stream->len);
+    if (got < 0) {
+        return EOF;
+    }
+    stream->len += got;
+    return got;
+}
+
+// Next byte as an unsigned char, or EOF
+int fgetc(FILE *stream) {
+    if (stream->pos == stream->len && stream_fill(stream) <= 0) {
+        return EOF;
+    }
+    return (unsigned char)stream->buf[stream->pos++];
+}
+
+// Push c back, only the byte fgetc() just returned can be pushed
+int ungetc(int c, FILE *stream) {
+    if (c == EOF || stream->pos == 0) {
+        return EOF;
+    }
+    stream->buf[--stream->pos] = (char)c;
+    return c;
+}
+
+/*
+ * Read a line of at most n - 1 bytes, with its '\n' and a terminator
+ * Returns s, or NULL if nothing was read before the end of the file
+ */
+char *fgets(char *s, int n, FILE *stream) {
+    size_t len = 0;
+
+    while (n > 1 && len < (size_t)n - 1) {
+        if (stream->pos == stream->len && stream_fill(stream) <= 0) {
+            break;
+        }
+
+        // Copy up to a newline straight from the buffer
+        size_t avail = stream->len - stream->pos;
+        size_t want = (size_t)n - 1 - len;
+        const char *src = stream->buf + stream->pos;
+        size_t take = 0;
+        int newline = 0;
+        while (take < avail && take < want && !newline) {
+            newline = src[take++] == '\n';
+        }
+
+        memcpy(s + len, src, take);
+        len += take;
+        stream->pos += take;
+        if (newline) {
+            break;
+        }
+    }
+
+    if (len == 0) {
+        return NULL;
+    }
+    s[len] = '\0';
+    return s;
+}
+
+/*
+ * Threads
+ * Raw clone() threads sharing everything with the caller, enough to run
+ * work in parallel without a libc. The thread block and the stack are one
+ * anonymous mapping, the block at the bottom and the stack growing down
+ * from the top. fn's return value is kept for thread_join()
+ */
+#ifndef THREAD_STACK_SIZE
+#define THREAD_STACK_SIZE (64 * 1024)
+#endif
+
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+#define MAP_POPULATE  0x8000
+#define MAP_STACK     0x20000
+
+#define CLONE_VM             0x00000100
+#define CLONE_FS             0x00000200
+#define CLONE_FILES          0x00000400
+#define CLONE_SIGHAND        0x00000800
+#define CLONE_THREAD         0x00010000
+#define CLONE_SYSVSEM        0x00040000
+#define CLONE_SETTLS         0x00080000
+#define CLONE_PARENT_SETTID  0x00100000
+#define CLONE_CHILD_CLEARTID 0x00200000
+
+#define CLONE_THREAD_FLAGS                                                     \
+    (CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD |        \
+     CLONE_SYSVSEM | CLONE_SETTLS | CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID)
+
+#define FUTEX_WAIT 0
+
+// First code of a new thread, on its own stack with its thread pointer
+// set to its block
+__attribute__((noreturn)) static void thread_start(void *arg) {
+    thread *self = (thread *)arg;
+    self->result = self->fn(self->arg);
+
+    // Nobody else flushes these
+    fflush(&self->out);
+    fflush(&self->err);
+    exit_thread(0);
+}
+
+// Returns the new thread id, or a negative errno
+static long thread_clone(thread *t, void *stack_top) {
+    return arch_clone(CLONE_THREAD_FLAGS,
+                      stack_top,
+                      &t->tid,
+                      t, // tls, see thread_self()
+                      &t->tid,
+                      thread_start,
+                      t);
+}
+
+/*
+ * Start fn(arg) in a new thread
+ * Its printf() output goes through its own buffers, see thread_stdout()
+ * Returns NULL if the stack cannot be allocated or clone() fails
+ */
+thread *thread_create(int (*fn)(void *), void *arg) {
+    size_t size = THREAD_STACK_SIZE + sizeof(thread);
+    size = (size + 4095) & ~(size_t)4095;
+
+    long map = syscall6(__NR_mmap,
+                        0,
+                        (long)size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+                        -1,
+                        0);
+    if (map < 0 && map > -4096) {
+        return NULL;
+    }
+
+    thread *t = (thread *)map;
+    t->self = t;
+    t->out = (FILE){
+        STDOUT_FILENO, -1, t->out_buffer, THREAD_BUFSIZ, 0, 1, 0, 0, 0, 0};
+    t->err = (FILE){STDERR_FILENO,
+                    _IONBF,
+                    t->err_buffer,
+                    sizeof(t->err_buffer),
+                    0,
+                    0,
+                    0,
+                    0,
+                    0,
+                    0};
+    t->fn = fn;
+    t->arg = arg;
+    t->map_size = size;
+    arena_init(&t->arena);
+
+    // Page aligned, so also 16 byte aligned as the ABI wants
+    void *stack_top = (char *)map + size;
+
+    if (thread_clone(t, stack_top) < 0) {
+        syscall6(__NR_munmap, map, (long)size, 0, 0, 0, 0);
+        return NULL;
+    }
+    return t;
+}
+
+/*
+ * Wait for a thread to finish and release its stack and arena
+ * Returns what its function returned
+ */
+int thread_join(thread *t) {
+    int tid;
+    while ((tid = __atomic_load_n(&t->tid, __ATOMIC_ACQUIRE)) != 0) {
+        syscall6(__NR_futex, (long)&t->tid, FUTEX_WAIT, tid, 0, 0, 0);
+    }
+
+    int result = t->result;
+    arena_release(&t->arena);
+    syscall6(__NR_munmap, (long)t, (long)t->map_size, 0, 0, 0, 0);
+    return result;
+}
+
+/*
+ * io_uring output
+ * After uring_start() a full stream buffer from the main thread does not
+ * wait for write(). The bytes are copied into one of URING_ENTRIES ring buffers
+ * and queued as a write SQE, and formatting goes on while the kernel
+ * writes. Buffers are used in order, each batch is submitted as one linked
+ * chain so its writes run one after the other, and the next batch is only
+ * submitted once the previous one completed, so output to an fd keeps its
+ * order. Small flushes to the same fd that wait for the next batch are
+ * merged into one buffer. Flushes that were asked for, fflush(), an
+ * unbuffered stream like stderr and a line on a line buffered one, still
+ * wait until the ring wrote everything (see stream_sync()), the caller
+ * may read, exec or exit right after
+ * A short write cancels the rest of its chain, the remainder and the
+ * cancelled writes go first in the next batch. A failed write loses its
+ * bytes like a failed write() would and is reported by the next flush or
+ * by uring_wait(). A full non-blocking fd (EAGAIN) counts as a short
+ * write of nothing, so the ring waits for it instead of giving
+ * back-pressure to the stream. Threads from thread_create() keep calling
+ * write() directly, the ring is not shared
+ */
+// New system calls have the same number on every architecture
+#define __NR_io_uring_setup 425
+#define __NR_io_uring_enter 426
+
+#define IORING_OFF_SQ_RING      0UL
+#define IORING_OFF_CQ_RING      0x8000000UL
+#define IORING_OFF_SQES         0x10000000UL
+#define IORING_FEAT_SINGLE_MMAP 1
+#define IORING_ENTER_GETEVENTS  1
+#define IORING_OP_WRITE         23
+#define IOSQE_IO_LINK           4
+
+#define ECANCELED 125
+
+// Same layouts as <linux/io_uring.h>
+struct io_sqring_offsets {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t flags;
+    uint32_t dropped;
+    uint32_t array;
+    uint32_t resv1;
+    uint64_t user_addr;
+};
+
+struct io_cqring_offsets {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t overflow;
+    uint32_t cqes;
+    uint32_t flags;
+    uint32_t resv1;
+    uint64_t user_addr;
+};
+
+struct io_uring_params {
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+    uint32_t sq_thread_cpu;
+    uint32_t sq_thread_idle;
+    uint32_t features;
+    uint32_t wq_fd;
+    uint32_t resv[3];
+    struct io_sqring_offsets sq_off;
+    struct io_cqring_offsets cq_off;
+};
+
+struct io_uring_sqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t ioprio;
+    int32_t fd;
+    uint64_t off;
+    uint64_t addr;
+    uint32_t len;
+    uint32_t rw_flags;
+    uint64_t user_data;
+    uint16_t buf_index;
+    uint16_t personality;
+    int32_t splice_fd_in;
+    uint64_t addr3;
+    uint64_t pad;
+};
+
+struct io_uring_cqe {
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+};
+
+#define URING_ENTRIES 32 // Power of two
+#define URING_BUFSIZ  BUFSIZ
+
+typedef struct {
+    int fd;
+    size_t len;  // Bytes to write
+    size_t done; // Bytes the kernel already took
+    char data[URING_BUFSIZ];
+} uring_buffer;
+
+static struct {
+    int fd; // Ring fd, -1 when not running
+    char *ring;
+    size_t ring_size;
+    struct io_uring_sqe *sqes;
+    uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Buffer counters, they only grow: [head, submitted) are in the
+    // running batch, [submitted, queued) wait for the next one
+    unsigned head;
+    unsigned submitted;
+    unsigned queued;
+    unsigned inflight; // Completions the running batch still owes
+    int error;         // A write failed since the last report
+    uring_buffer buffers[URING_ENTRIES];
+} uring = {.fd = -1};
+
+static inline uring_buffer *uring_buffer_at(unsigned i) {
+    return &uring.buffers[i & (URING_ENTRIES - 1)];
+}
+
+static void uring_close(void) {
+    syscall6(__NR_munmap, (long)uring.ring, (long)uring.ring_size, 0, 0, 0, 0);
+    syscall6(__NR_munmap,
+             (long)uring.sqes,
+             URING_ENTRIES * sizeof(struct io_uring_sqe),
+             0,
+             0,
+             0,
+             0);
+    close(uring.fd);
+    uring.fd = -1;
+}
+
+// The ring cannot be used any more: write what is left directly
+static void uring_fail(void) {
+    for (unsigned i = uring.head; i != uring.queued; i++) {
+        uring_buffer *b = uring_buffer_at(i);
+        size_t left = b->len - b->done;
+        if (left > 0 &&
+            write_all(b->fd, b->data + b->done, left) != (ssize_t)left) {
+            uring.error = 1;
+        }
+    }
+    uring.head = uring.submitted = uring.queued;
+    uring.inflight = 0;
+    uring_close();
+}
+
+// Submit the waiting buffers as one chain, nothing may be in flight
+static void uring_submit(void) {
+    uint32_t tail = *uring.sq_tail;
+    unsigned count = 0;
+    struct io_uring_sqe *last = NULL;
+
+    for (unsigned i = uring.submitted; i != uring.queued; i++) {
+        uring_buffer *b = uring_buffer_at(i);
+        if (b->done == b->len) {
+            continue;
+        }
+
+        last = &uring.sqes[tail++ & uring.sq_mask];
+        *last = (struct io_uring_sqe){
+            .opcode = IORING_OP_WRITE,
+            .flags = IOSQE_IO_LINK,
+            .fd = b->fd,
+            .off = ~0UL, // At the file position, like write()
+            .addr = (uint64_t)(b->data + b->done),
+            .len = (uint32_t)(b->len - b->done),
+            .user_data = i,
+        };
+        count++;
+    }
+    uring.submitted = uring.queued;
+    if (count == 0) {
+        return;
+    }
+
+    // The chain ends at the last write
+    last->flags = 0;
+    __atomic_store_n(uring.sq_tail, tail, __ATOMIC_RELEASE);
+    uring.inflight = count;
+
+    unsigned sent = 0;
+    while (sent < count) {
+        long ret =
+            syscall6(__NR_io_uring_enter, uring.fd, count - sent, 0, 0, 0, 0);
+        if (ret == -EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            uring_fail();
+            return;
+        }
+        sent += (unsigned)ret;
+    }
+}
+
+/*
+ * Take the completions that arrived, with wait until the running batch is
+ * done. Once it is, the finished buffers are freed and the next batch is
+ * submitted, starting with whatever the batch left unwritten
+ */
+static void uring_reap(int wait) {
+    while (uring.inflight > 0) {
+        uint32_t head = *uring.cq_head;
+        uint32_t tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            if (!wait) {
+                return;
+            }
+            long ret = syscall6(__NR_io_uring_enter,
+                                uring.fd,
+                                0,
+                                1,
+                                IORING_ENTER_GETEVENTS,
+                                0,
+                                0);
+            if (ret < 0 && ret != -EINTR) {
+                uring_fail();
+                return;
+            }
+            continue;
+        }
+
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &uring.cqes[head & uring.cq_mask];
+            uring_buffer *b = uring_buffer_at((unsigned)cqe->user_data);
+            // A full non-blocking fd (EAGAIN) is tried again with the
+            // next batch, like a cancelled write
+            if (cqe->res > 0) {
+                b->done += (size_t)cqe->res;
+            } else if (cqe->res != -ECANCELED && cqe->res != -EAGAIN &&
+                       cqe->res != -EINTR) {
+                // Lost, a 0 byte write would only repeat
+                uring.error = 1;
+                b->done = b->len;
+            }
+            uring.inflight--;
+        }
+        __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // A chain stops at its first unfinished write, everything after it
+    // is unfinished too
+    while (uring.head != uring.submitted &&
+           uring_buffer_at(uring.head)->done ==
+               uring_buffer_at(uring.head)->len) {
+        uring.head++;
+    }
+    uring.submitted = uring.head;
+    uring_submit();
+}
+
+/*
+ * Queue count bytes for fd, write() when the ring is not running or the
+ * caller is not the main thread
+ * Returns count, or -1 if this or an earlier queued write failed
+ */
+static ssize_t uring_write(int fd, const void *buf, size_t count) {
+    if (uring.fd < 0 || thread_self() != NULL) {
+        return write_all(fd, buf, count);
+    }
+
+    const char *data = buf;
+    size_t left = count;
+    while (left > 0 && uring.fd >= 0) {
+        // Merge with the last waiting buffer when it is for fd too
+        uring_buffer *b = NULL;
+        if (uring.queued != uring.submitted) {
+            b = uring_buffer_at(uring.queued - 1);
+            if (b->fd != fd || b->len == URING_BUFSIZ) {
+                b = NULL;
+            }
+        }
+
+        if (b == NULL) {
+            while (uring.queued - uring.head == URING_ENTRIES &&
+                   uring.fd >= 0) {
+                uring_reap(1);
+            }
+            if (uring.fd < 0) {
+                break;
+            }
+            b = uring_buffer_at(uring.queued++);
+            b->fd = fd;
+            b->len = 0;
+            b->done = 0;
+        }
+
+        size_t chunk = URING_BUFSIZ - b->len;
+        if (chunk > left) {
+            chunk = left;
+        }
+        memcpy(b->data + b->len, data, chunk);
+        b->len += chunk;
+        data += chunk;
+        left -= chunk;
+    }
+
+    // The ring failed on the way, the rest goes directly
+    if (left > 0) {
+        ssize_t written = write_all(fd, data, left);
+        if (written < 0) {
+            return -1;
+        }
+        count -= left - (size_t)written;
+    }
+
+    if (uring.fd >= 0) {
+        uring_reap(0);
+    }
+
+    int failed = uring.error;
+    uring.error = 0;
+    return failed ? -1 : (ssize_t)count;
+}
+
+/*
+ * Send flushed output through an io_uring from now on
+ * Returns 0 on success, EOF when io_uring is not available (old kernel,
+ * or disabled like for Android apps), output then keeps using write()
+ */
+int uring_start(void) {
+    if (uring.fd >= 0) {
+        return 0;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    long fd = syscall6(
+        __NR_io_uring_setup, URING_ENTRIES, (long)&params, 0, 0, 0, 0);
+    if (fd < 0) {
+        return EOF;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        // Kernels before 5.4, not worth a second mapping
+        close((int)fd);
+        return EOF;
+    }
+
+    // Both rings share one mapping, the SQEs are a second one
+    size_t sq_size = params.sq_off.array + params.sq_entries * 4;
+    size_t cq_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+
+    long ring = syscall6(__NR_mmap,
+                         0,
+                         (long)ring_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         fd,
+                         (long)IORING_OFF_SQ_RING);
+    long sqes = syscall6(__NR_mmap,
+                         0,
+                         URING_ENTRIES * sizeof(struct io_uring_sqe),
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         fd,
+                         (long)IORING_OFF_SQES);
+    if ((ring < 0 && ring > -4096) || (sqes < 0 && sqes > -4096)) {
+        close((int)fd);
+        return EOF;
+    }
+
+    char *base = (char *)ring;
+    uring.fd = (int)fd;
+    uring.ring = base;
+    uring.ring_size = ring_size;
+    uring.sqes = (struct io_uring_sqe *)sqes;
+    uring.sq_tail = (uint32_t *)(base + params.sq_off.tail);
+    uring.sq_mask = *(uint32_t *)(base + params.sq_off.ring_mask);
+    uring.cq_head = (uint32_t *)(base + params.cq_off.head);
+    uring.cq_tail = (uint32_t *)(base + params.cq_off.tail);
+    uring.cq_mask = *(uint32_t *)(base + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *)(base + params.cq_off.cqes);
+
+    // SQE i always sits in slot i, the index array never changes
+    uint32_t *array = (uint32_t *)(base + params.sq_off.array);
+    for (uint32_t i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    uring.head = uring.submitted = uring.queued = 0;
+    uring.inflight = 0;
+    uring.error = 0;
+    return 0;
+}
+
+/*
+ * Wait until everything queued is written
+ * Returns 0, or EOF if a queued write failed since the last report
+ */
+int uring_wait(void) {
+    if (thread_self() != NULL) {
+        return 0;
+    }
+
+    while (uring.fd >= 0 && uring.head != uring.queued) {
+        uring_reap(1);
+    }
+
+    int failed = uring.error;
+    uring.error = 0;
+    return failed ? EOF : 0;
+}
+
+// Wait for the queued output and go back to write()
+int uring_stop(void) {
+    int ret = uring_wait();
+    if (uring.fd >= 0) {
+        uring_close();
+    }
+    return ret;
+}
+
+/*
+ * Arenas
+ * A bump allocator for text built at run time. Memory comes from mmap()
+ * in blocks of at least ARENA_BLOCK_MIN bytes, each new block as large as
+ * all the previous ones together, so the number of blocks stays
+ * logarithmic in the peak use. Nothing is freed on its own: arena_reset()
+ * drops every allocation at once and keeps the memory, folding the blocks
+ * into one so the next round of the same size fits without a syscall.
+ * brk() is not used, there is only one per process and arenas come and go
+ * independently. Not locked, each thread has its own in thread_arena()
+ */
+#define ARENA_ALIGN     16
+#define ARENA_BLOCK_MIN (64 * 1024)
+
+struct arena_block {
+    arena_block *next;
+    size_t size; // Whole mapping, header included
+};
+
+// Allocations start past the header, still ARENA_ALIGN aligned
+#define ARENA_HEADER                                                          \
+    ((sizeof(arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static arena main_arena;
+
+void arena_init(arena *a) {
+    *a = (arena){NULL, NULL, NULL, 0};
+}
+
+// Map a block of size bytes and allocate from it from now on
+static int arena_map(arena *a, size_t size) {
+    long map = syscall6(__NR_mmap,
+                        0,
+                        (long)size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1,
+                        0);
+    if (map < 0 && map > -4096) {
+        return EOF;
+    }
+
+    arena_block *block = (arena_block *)map;
+    block->next = a->blocks;
+    block->size = size;
+    a->blocks = block;
+    a->ptr = (char *)map + ARENA_HEADER;
+    a->end = (char *)map + size;
+    a->size += size;
+    return 0;
+}
+
+// New block with room for n bytes, doubling what the arena holds
+static int arena_grow(arena *a, size_t n) {
+    size_t size = a->size > ARENA_BLOCK_MIN ? a->size : ARENA_BLOCK_MIN;
+    if (n > size - ARENA_HEADER) {
+        if (n > (size_t)-1 / 2) {
+            return EOF;
+        }
+        size = (n + ARENA_HEADER + ARENA_BLOCK_MIN - 1) &
+               ~(size_t)(ARENA_BLOCK_MIN - 1);
+    }
+    return arena_map(a, size);
+}
+
+/*
+ * n bytes aligned to ARENA_ALIGN, valid until the next arena_reset()
+ * Returns NULL if no memory can be mapped
+ */
+void *arena_alloc(arena *a, size_t n) {
+    n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if ((size_t)(a->end - a->ptr) < n && arena_grow(a, n) != 0) {
+        return NULL;
+    }
+    void *p = a->ptr;
+    a->ptr += n;
+    return p;
+}
+
+static void arena_unmap(arena *a) {
+    arena_block *block = a->blocks;
+    while (block != NULL) {
+        arena_block *next = block->next;
+        syscall6(__NR_munmap, (long)block, (long)block->size, 0, 0, 0, 0);
+        block = next;
+    }
+    arena_init(a);
+}
+
+/*
+ * Drop every allocation and keep the memory for the next ones
+ * With a single block this is two stores. Several blocks are replaced by
+ * one of their total size, which only happens while the peak use grows
+ */
+void arena_reset(arena *a) {
+    if (a->blocks != NULL && a->blocks->next == NULL) {
+        a->ptr = (char *)a->blocks + ARENA_HEADER;
+        return;
+    }
+
+    size_t size = a->size;
+    arena_unmap(a);
+    if (size > 0) {
+        arena_map(a, size);
+    }
+}
+
+// Give all the memory back
+void arena_release(arena *a) {
+    arena_unmap(a);
+}
+
+// The calling thread's arena, used by asprintf()
+arena *thread_arena(void) {
+    thread *self = thread_self();
+    return self ? &self->arena : &main_arena;
+}
+
+// Helper functions for floating point
+static inline int isinf(double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(double));
+    // Check if exponent is all 1s and mantissa is 0
+    return ((bits & 0x7FF0000000000000) == 0x7FF0000000000000) &&
+           ((bits & 0x000FFFFFFFFFFFFF) == 0);
+}
+
+static inline int isnan(double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(double));
+    // Check if exponent is all 1s and mantissa is non-zero
+    return ((bits & 0x7FF0000000000000) == 0x7FF0000000000000) &&
+           ((bits & 0x000FFFFFFFFFFFFF) != 0);
+}
+
+/*
+ * Number conversion functions
+ */
+
+// Digits for bases up to 16
+static const char digits_lower[] = "0123456789abcdef";
+static const char digits_upper[] = "0123456789ABCDEF";
+
+// "00" to "99", two decimal digits per division by 100
+static const char digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// 10^0 to 10^19, the largest power that fits in 64 bits
+static const uint64_t powers_of_10[20] = {
+    1UL,
+    10UL,
+    100UL,
+    1000UL,
+    10000UL,
+    100000UL,
+    1000000UL,
+    10000000UL,
+    100000000UL,
+    1000000000UL,
+    10000000000UL,
+    100000000000UL,
+    1000000000000UL,
+    10000000000000UL,
+    100000000000000UL,
+    1000000000000000UL,
+    10000000000000000UL,
+    100000000000000000UL,
+    1000000000000000000UL,
+    10000000000000000000UL,
+};
+
+// Number of decimal digits in num: bit length times log10(2)
+// (1233 / 4096) gives the digit count or one more, the table decides
+static inline int count_digits10(uint64_t num) {
+    if (num < 10) {
+        return 1;
+    }
+    int bits = 64 - __builtin_clzl(num);
+    int digits = (bits * 1233) >> 12;
+    return digits + (num >= powers_of_10[digits]);
+}
+
+// Number of digits of num in base (2-16), 1 for 0
+static inline int count_digits(uint64_t num, int base) {
+    if (base == 10) {
+        return count_digits10(num);
+    }
+
+    if ((base & (base - 1)) == 0) {
+        // Power of two base: each digit is a fixed group of bits
+        int shift = __builtin_ctz(base);
+        int bits = 64 - __builtin_clzl(num | 1);
+        return (bits + shift - 1) / shift;
+    }
+
+    int len = 1;
+    for (uint64_t n = num; n >= (uint64_t)base; n /= base) {
+        len++;
+    }
+    return len;
+}
+
+// Write the digits of num right to left so the last one lands just before
+// end, the caller knows the count from count_digits()
+static inline void write_digits(char *end,
+                                uint64_t num,
+                                int base,
+                                int uppercase) {
+    const char *digits = uppercase ? digits_upper : digits_lower;
+    char *ptr = end;
+
+#ifdef ASM_KERNELS
+    // Not worth a call for one or two digits
+    if (base == 10 && num >= 100) {
+        asm_write_decimal(end, num);
+        return;
+    }
+#endif
+
+    if (base == 10) {
+        while (num >= 100) {
+            uint64_t rest = num % 100;
+            num /= 100;
+            ptr -= 2;
+            ptr[0] = digit_pairs[rest * 2];
+            ptr[1] = digit_pairs[rest * 2 + 1];
+        }
+
+        if (num >= 10) {
+            ptr -= 2;
+            ptr[0] = digit_pairs[num * 2];
+            ptr[1] = digit_pairs[num * 2 + 1];
+        } else {
+            *--ptr = (char)('0' + num);
+        }
+    } else if ((base & (base - 1)) == 0) {
+        int shift = __builtin_ctz(base);
+        int mask = base - 1;
+        do {
+            *--ptr = digits[num & mask];
+            num >>= shift;
+        } while (num != 0);
+    } else {
+        do {
+            *--ptr = digits[num % base];
+            num /= base;
+        } while (num != 0);
+    }
+}
+
+// Convert unsigned integer to string with given base (2-16)
+// The digit count is known up front, so digits are written right to left
+// straight into place, no reversal pass
+// Return pointer to null terminator, not to buffer start
+static char *uitoa(uint64_t num, char *buffer, int base, int uppercase) {
+    char *end = buffer + count_digits(num, base);
+    write_digits(end, num, base, uppercase);
+    *end = '\0';
+    return end; // Return end pointer
+}
+
+/*
+ * SWAR digits the other way round: the 8 decimal digits of num < 10^8 in
+ * one word, first digit in the lowest byte. num is split into two 4 digit
+ * halves, one per 32-bit lane, then every lane into 2 digit and those into
+ * 1 digit numbers, each step dividing all lanes with one multiply and
+ * shift (x * 10486 >> 20 is x / 100 below 10^4, x * 103 >> 10 is x / 10
+ * below 100)
+ */
+static inline uint64_t swar_digits8(uint32_t num) {
+    uint64_t word = (num / 10000) | ((uint64_t)(num % 10000) << 32);
+    uint64_t high = ((word * 10486) >> 20) & 0x0000007F0000007FUL;
+    word = high | ((word - high * 100) << 16);
+    high = ((word * 103) >> 10) & 0x000F000F000F000FUL;
+    word = high | ((word - high * 10) << 8);
+    return word + 0x3030303030303030UL;
+}
+
+// Decimal digits of num at buf, 8 at a time. Whole words are stored, so
+// the caller must own 8 bytes at buf even for one digit (20 are enough
+// for any num). Returns the digit count
+static int swar_write_decimal(char *buf, uint64_t num) {
+    int len = 0;
+    if (num >= 100000000) {
+        len = swar_write_decimal(buf, num / 100000000);
+        num %= 100000000;
+    }
+
+    uint64_t word = swar_digits8((uint32_t)num);
+    if (len == 0) {
+        // Leading part: drop the zeros in front
+        int count = count_digits10(num);
+        word >>= (8 - count) * 8;
+        memcpy(buf, &word, sizeof(word));
+        return count;
+    }
+
+    memcpy(buf + len, &word, sizeof(word));
+    return len + 8;
+}
+
+/*
+ * The compiler calls this for long double to double where long double is
+ * IEEE quad (aarch64 and riscv64), there is no libgcc to provide it.
+ * x86_64 has the x87 80-bit format and converts inline. Rounds to nearest
+ * even like the hardware would: the top 60 fraction bits are kept, the
+ * rest only matters as a sticky bit below the rounding position
+ */
+#if __LDBL_MANT_DIG__ == 113
+double __trunctfdf2(long double x) {
+    uint64_t words[2]; // Little endian: low fraction bits first
+    memcpy(words, &x, sizeof(words));
+
+    uint64_t sign = words[1] & (1UL << 63);
+    int exp = (int)((words[1] >> 48) & 0x7fff);
+    uint64_t frac = ((words[1] & 0xffffffffffffUL) << 12) | (words[0] >> 52);
+    int sticky = (words[0] & ((1UL << 52) - 1)) != 0;
+    uint64_t bits;
+
+    if (exp == 0x7fff) {
+        // Infinity, or a NaN that stays quiet with its top payload bits
+        bits = 0x7ff0000000000000UL;
+        if (frac != 0 || sticky) {
+            bits |= (1UL << 51) | (frac >> 8);
+        }
+    } else if (exp < 16383 - 1075) {
+        // Zero, quad subnormals and anything below half the smallest
+        // double subnormal
+        bits = 0;
+    } else {
+        int e = exp - 16383 + 1023; // Biased double exponent
+        uint64_t mant = (1UL << 60) | frac;
+        int shift = 8; // 61 bits down to 53
+        if (e <= 0) {
+            shift += 1 - e; // Subnormal, the exponent field is 0
+        }
+
+        uint64_t kept = mant >> shift;
+        uint64_t rest = mant & ((1UL << shift) - 1);
+        uint64_t half = 1UL << (shift - 1);
+        if (rest > half || (rest == half && (sticky || (kept & 1)))) {
+            kept++;
+        }
+
+        // A carry out of the fraction moves into the exponent, up to
+        // infinity, and a subnormal rounding up becomes the smallest normal
+        if (e <= 0) {
+            bits = kept;
+        } else if (e >= 0x7ff) {
+            bits = 0x7ff0000000000000UL;
+        } else {
+            bits = ((uint64_t)(e - 1) << 52) + kept;
+        }
+    }
+
+    bits |= sign;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+#endif
+
+/*
+ * Byte classes for parse_format(), so each byte of a specifier costs one
+ * load from a table whose used part (ASCII) is two cache lines. A flag
+ * character's entry is its bit in the low five, in the order of the
+ * bitfields in format_flags
+ */
+#define FC_FLAGS     0x1f // - + space 0 #
+#define FC_DIGIT     0x20
+#define FC_LENGTH    0x40 // h l j z t L
+#define FC_SPECIFIER 0x80 // Conversions format_arg() knows
+
+static const uint8_t format_class[256] = {
+    ['-'] = 0x01,
+    ['+'] = 0x02,
+    [' '] = 0x04,
+    ['0'] = 0x08 | FC_DIGIT,
+    ['#'] = 0x10,
+    ['1'] = FC_DIGIT,
+    ['2'] = FC_DIGIT,
+    ['3'] = FC_DIGIT,
+    ['4'] = FC_DIGIT,
+    ['5'] = FC_DIGIT,
+    ['6'] = FC_DIGIT,
+    ['7'] = FC_DIGIT,
+    ['8'] = FC_DIGIT,
+    ['9'] = FC_DIGIT,
+    ['h'] = FC_LENGTH,
+    ['l'] = FC_LENGTH,
+    ['j'] = FC_LENGTH,
+    ['z'] = FC_LENGTH,
+    ['t'] = FC_LENGTH,
+    ['L'] = FC_LENGTH,
+    ['c'] = FC_SPECIFIER,
+    ['s'] = FC_SPECIFIER,
+    ['d'] = FC_SPECIFIER,
+    ['i'] = FC_SPECIFIER,
+    ['u'] = FC_SPECIFIER,
+    ['o'] = FC_SPECIFIER,
+    ['x'] = FC_SPECIFIER,
+    ['X'] = FC_SPECIFIER,
+    ['p'] = FC_SPECIFIER,
+    ['f'] = FC_SPECIFIER,
+    ['F'] = FC_SPECIFIER,
+    ['e'] = FC_SPECIFIER,
+    ['E'] = FC_SPECIFIER,
+    ['g'] = FC_SPECIFIER,
+    ['G'] = FC_SPECIFIER,
+    ['n'] = FC_SPECIFIER,
+};
+
+/*
+ * Parse format specifier
+ * Returns the number of characters consumed
+ */
+static int parse_format(const char *format, format_flags *flags) {
+    const char *start = format;
+    unsigned char c = (unsigned char)*format;
+
+    // Everything is kept in registers and stored once at the end
+    unsigned bits = 0;
+    int width = 0;
+    int precision = -1;
+    unsigned length = 0;
+
+    // Parse flags
+    while (format_class[c] & FC_FLAGS) {
+        bits |= format_class[c] & FC_FLAGS;
+        c = (unsigned char)*++format;
+    }
+
+    // Parse width
+    if (format_class[c] & FC_DIGIT) {
+        do {
+            width = width * 10 + (c - '0');
+            c = (unsigned char)*++format;
+        } while (format_class[c] & FC_DIGIT);
+    } else if (c == '*') {
+        // Width from argument (handled later)
+        width = -1; // Special marker
+        c = (unsigned char)*++format;
+    }
+
+    // Parse precision
+    if (c == '.') {
+        precision = 0;
+        c = (unsigned char)*++format;
+        if (c == '*') {
+            // Precision from argument (handled later)
+            precision = -2; // Special marker
+            c = (unsigned char)*++format;
+        } else {
+            while (format_class[c] & FC_DIGIT) {
+                precision = precision * 10 + (c - '0');
+                c = (unsigned char)*++format;
+            }
+        }
+    }
+
+    // Parse length modifier: hh and ll are stored as 'H' and 'L', and L
+    // (long double, printed as double) as 'B'
+    if (format_class[c] & FC_LENGTH) {
+        length = c;
+        c = (unsigned char)*++format;
+        if ((length == 'h' || length == 'l') && c == length) {
+            length = length == 'h' ? 'H' : 'L';
+            c = (unsigned char)*++format;
+        } else if (length == 'L') {
+            length = 'B';
+        }
+    }
+
+    // Parse specifier
+    format++;
+
+    *flags = (format_flags){
+        .left_justify = bits & 0x01,
+        .always_sign = (bits >> 1) & 1,
+        .space_sign = (bits >> 2) & 1,
+        .zero_pad = (bits >> 3) & 1,
+        .alternate_form = (bits >> 4) & 1,
+        .length_modifier = length,
+        .specifier = c,
+        .width = width,
+        .precision = precision,
+    };
+
+    return (int)(format - start);
+}
+
+/*
+ * Output sinks
+ * The formatter does not know where its output goes, it hands every run of
+ * bytes (literal text, converted numbers, padding) to put_span and single
+ * bytes to put_char. ctx is passed back untouched, so a sink can target a
+ * stream, a plain fd, memory, a ring buffer or anything else without an
+ * intermediate copy. put_char may be NULL, then single bytes go through
+ * put_span. put_ref is an optional variant of put_span for data that
+ * stays valid until the formatting call returns (literal text, string
+ * arguments, constant padding), so a sink may keep the pointer instead of
+ * copying; when it is NULL put_span is used. Callbacks return 0 on success,
+ * anything else marks the sink as failed but formatting goes on so count
+ * stays the full length
+ */
+static inline void sink_putc(sink *out, char c) {
+    int ret = out->put_char ? out->put_char(out->ctx, c)
+                            : out->put_span(out->ctx, &c, 1);
+    if (ret != 0) {
+        out->error = 1;
+    }
+    out->count++;
+}
+
+static inline void sink_write(sink *out, const char *data, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    if (out->put_span(out->ctx, data, n) != 0) {
+        out->error = 1;
+    }
+    out->count += n;
+}
+
+// Same as sink_write for data that outlives the formatting call
+static inline void sink_ref(sink *out, const char *data, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    int ret = out->put_ref ? out->put_ref(out->ctx, data, n)
+                           : out->put_span(out->ctx, data, n);
+    if (ret != 0) {
+        out->error = 1;
+    }
+    out->count += n;
+}
+
+// Constant padding runs, so padding is passed to put_span in large pieces
+#define PAD_RUN 64
+static const char pad_spaces[PAD_RUN + 1] =
+    "                                                                ";
+static const char pad_zeros[PAD_RUN + 1] =
+    "0000000000000000000000000000000000000000000000000000000000000000";
+
+// Write c n times, used for width and precision padding
+static void sink_fill(sink *out, char c, size_t n) {
+    const char *run = c == '0' ? pad_zeros : pad_spaces;
+
+    while (n > 0) {
+        size_t chunk = n < PAD_RUN ? n : PAD_RUN;
+        sink_ref(out, run, chunk);
+        n -= chunk;
+    }
+}
+
+/*
+ * Memory sink: bounded buffer, bytes past size are dropped
+ */
+static int memory_put_char(void *ctx, char c) {
+    memory_sink *mem = ctx;
+    if (mem->len < mem->size) {
+        mem->buf[mem->len++] = c;
+    }
+    return 0;
+}
+
+static int memory_put_span(void *ctx, const char *data, size_t n) {
+    memory_sink *mem = ctx;
+    size_t room = mem->size - mem->len;
+    if (n > room) {
+        n = room;
+    }
+    memcpy(mem->buf + mem->len, data, n);
+    mem->len += n;
+    return 0;
+}
+
+// Sink over buf of n bytes, with room for the terminator like snprintf()
+void memory_sink_init(sink *out, memory_sink *mem, char *buf, size_t n) {
+    mem->buf = n > 0 ? buf : NULL;
+    mem->size = n > 0 ? n - 1 : 0;
+    mem->len = 0;
+    *out = (sink){memory_put_char, memory_put_span, NULL, mem, 0, 0};
+}
+
+// Terminate the text, returns the length it would have had without a limit
+int memory_sink_finish(sink *out, memory_sink *mem) {
+    if (mem->buf != NULL) {
+        mem->buf[mem->len] = '\0';
+    }
+    return (int)out->count;
+}
+
+/*
+ * Stream sink: appends to a FILE buffer
+ * The newline flag lets the caller apply line buffering once at the end.
+ * Once a put was refused nothing more of the call goes in, later smaller
+ * pieces could fit again and would leave a hole in the output
+ */
+static int stream_sink_put(stream_sink *ss, const char *data, size_t n) {
+    if (ss->refused) {
+        return EOF;
+    }
+    if (stream_put(ss->stream, data, n) == 0) {
+        return 0;
+    }
+
+    stream_take_back(ss->stream, ss->start);
+    ss->refused = 1;
+    return EOF;
+}
+
+static int stream_put_char(void *ctx, char c) {
+    stream_sink *ss = ctx;
+    FILE *stream = ss->stream;
+
+    if (c == '\n') {
+        ss->newline = 1;
+    }
+
+    // A refused put leaves the buffer full (or empty after an error, when
+    // the bytes are lost anyway)
+    if (stream->len < stream->size) {
+        stream->buf[stream->len++] = c;
+        return 0;
+    }
+    return stream_sink_put(ss, &c, 1);
+}
+
+static int stream_put_span(void *ctx, const char *data, size_t n) {
+    stream_sink *ss = ctx;
+
+    if (ss->stream->mode == _IOLBF && !ss->newline) {
+        ss->newline = has_newline(data, n);
+    }
+    return stream_sink_put(ss, data, n);
+}
+
+void stream_sink_init(sink *out, stream_sink *ss, FILE *stream) {
+    ss->stream = stream;
+    ss->newline = 0;
+    ss->refused = 0;
+    ss->start = stream->written + stream->len;
+    *out = (sink){stream_put_char, stream_put_span, NULL, ss, 0, 0};
+    stream_init_mode(stream);
+}
+
+// Apply line buffering, returns the number of bytes or EOF on error
+// A refused call is not committed, a flush now could clear the blocked
+// state that explains why it failed
+int stream_sink_finish(sink *out, stream_sink *ss) {
+    if (!ss->refused && stream_commit(ss->stream, ss->newline) != 0) {
+        out->error = 1;
+    }
+    return out->error ? EOF : (int)out->count;
+}
+
+/*
+ * Vectored sink: collects output as a list of iovecs for writev()
+ * Long stable pieces (literal text, string arguments, padding) are sent
+ * straight from the caller's memory; converted numbers and pieces shorter
+ * than IOV_COPY_MAX are copied into a small area, next to each other so
+ * they share one iovec. When either the list or the copy area is full the
+ * batch is written and collecting starts over
+ */
+#define IOV_BATCH    64  // iovecs per writev() call
+#define IOV_COPY_MAX 64  // Shorter stable pieces are cheaper to copy
+#define IOV_COPY     512 // Copy area size
+
+typedef struct {
+    int fd;
+    int iovcnt;
+    int blocked;    // The fd is full, see iovec_submit()
+    size_t written; // Bytes the kernel took so far
+    struct iovec iov[IOV_BATCH];
+    size_t copy_len;
+    char copy[IOV_COPY];
+} iovec_sink;
+
+/*
+ * Write the collected batch, resuming after short and interrupted writes
+ * A full non-blocking fd (EAGAIN) or one that takes nothing is
+ * back-pressure like in write_all(), not an error: the entries may point
+ * into the caller's memory so the rest cannot be kept, the sink stops and
+ * the output ends with what was written. Returns 0 on success,
+ * STREAM_BLOCKED once the fd is full, EOF on write error
+ */
+static int iovec_submit(iovec_sink *vs) {
+    struct iovec *iov = vs->iov;
+    int iovcnt = vs->iovcnt;
+
+    vs->iovcnt = 0;
+    vs->copy_len = 0;
+
+    while (iovcnt > 0 && !vs->blocked) {
+        ssize_t written = writev(vs->fd, iov, iovcnt);
+        if (written == -EINTR) {
+            continue;
+        }
+        if (written == -EAGAIN || written == 0) {
+            vs->blocked = 1;
+            break;
+        }
+        if (written < 0) {
+            return EOF;
+        }
+        vs->written += (size_t)written;
+
+        // Skip what was fully written, trim the first partial entry
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (const char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return vs->blocked ? STREAM_BLOCKED : 0;
+}
+
+static int iovec_put_span(void *ctx, const char *data, size_t n) {
+    iovec_sink *vs = ctx;
+
+    while (n > 0) {
+        if (vs->copy_len == IOV_COPY || vs->iovcnt == IOV_BATCH) {
+            if (iovec_submit(vs) != 0) {
+                return EOF;
+            }
+        }
+
+        size_t room = IOV_COPY - vs->copy_len;
+        size_t chunk = n < room ? n : room;
+        char *dst = vs->copy + vs->copy_len;
+        memcpy(dst, data, chunk);
+
+        // Grow the last entry if it ends right where this copy starts
+        struct iovec *last = vs->iovcnt ? &vs->iov[vs->iovcnt - 1] : NULL;
+        if (last && (const char *)last->iov_base + last->iov_len == dst) {
+            last->iov_len += chunk;
+        } else {
+            vs->iov[vs->iovcnt].iov_base = dst;
+            vs->iov[vs->iovcnt].iov_len = chunk;
+            vs->iovcnt++;
+        }
+
+        vs->copy_len += chunk;
+        data += chunk;
+        n -= chunk;
+    }
+
+    return 0;
+}
+
+static int iovec_put_char(void *ctx, char c) {
+    return iovec_put_span(ctx, &c, 1);
+}
+
+static int iovec_put_ref(void *ctx, const char *data, size_t n) {
+    iovec_sink *vs = ctx;
+
+    if (n < IOV_COPY_MAX) {
+        return iovec_put_span(ctx, data, n);
+    }
+
+    if (vs->iovcnt == IOV_BATCH && iovec_submit(vs) != 0) {
+        return EOF;
+    }
+
+    vs->iov[vs->iovcnt].iov_base = data;
+    vs->iov[vs->iovcnt].iov_len = n;
+    vs->iovcnt++;
+    return 0;
+}
+
+/*
+ * Mapped file sink: formats straight into the page cache
+ * write() copies every buffer into the page cache once more. Here the
+ * file is mapped shared and the output lands in its pages directly. The
+ * file is grown with ftruncate() one window ahead and mapped in windows
+ * that double from MAP_WINDOW_MIN to MAP_WINDOW_MAX, so small files
+ * stay small and large ones need few remaps. A full window is unmapped
+ * (its pages stay dirty in the page cache) and the next one mapped behind
+ * it. Closing cuts the file to the bytes produced
+ * The file is sparse until written: when the disk fills up, touching a
+ * new page raises SIGBUS instead of returning an error
+ */
+#define MS_ASYNC 1
+
+// Multiples of 64K, so offsets are page aligned for 4K, 16K and 64K pages
+#define MAP_WINDOW_MIN (1UL << 20)
+#define MAP_WINDOW_MAX (64UL << 20)
+
+// Unmap the current window and map the next one, EOF on failure
+static int map_advance(map_sink *ms) {
+    size_t offset = ms->offset;
+    size_t window = ms->window;
+
+    if (ms->map != NULL) {
+        syscall6(__NR_munmap, (long)ms->map, (long)ms->window, 0, 0, 0, 0);
+        ms->map = NULL;
+        offset += ms->window;
+        if (window < MAP_WINDOW_MAX) {
+            window *= 2;
+        }
+    }
+
+    if (ftruncate(ms->fd, offset + window) < 0) {
+        return EOF;
+    }
+    long map = syscall6(__NR_mmap,
+                        0,
+                        (long)window,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED,
+                        ms->fd,
+                        (long)offset);
+    if (map < 0 && map > -4096) {
+        return EOF;
+    }
+
+    ms->map = (char *)map;
+    ms->offset = offset;
+    ms->window = window;
+    ms->len = 0;
+    return 0;
+}
+
+static int map_put_span(void *ctx, const char *data, size_t n) {
+    map_sink *ms = ctx;
+
+    while (n > 0) {
+        if (ms->map == NULL || ms->len == ms->window) {
+            if (ms->fd < 0 || map_advance(ms) != 0) {
+                return EOF;
+            }
+        }
+
+        size_t room = ms->window - ms->len;
+        size_t chunk = n < room ? n : room;
+        memcpy(ms->map + ms->len, data, chunk);
+        ms->len += chunk;
+        data += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+static int map_put_char(void *ctx, char c) {
+    map_sink *ms = ctx;
+    if (ms->map != NULL && ms->len < ms->window) {
+        ms->map[ms->len++] = c;
+        return 0;
+    }
+    return map_put_span(ctx, &c, 1);
+}
+
+/*
+ * Create or truncate path and map its first window
+ * Returns 0 on success, EOF if the file cannot be opened or mapped
+ */
+int map_sink_open(sink *out, map_sink *ms, const char *path) {
+    ms->map = NULL;
+    ms->offset = 0;
+    ms->window = MAP_WINDOW_MIN;
+    ms->len = 0;
+    *out = (sink){map_put_char, map_put_span, NULL, ms, 0, 0};
+
+    ms->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (ms->fd < 0 || map_advance(ms) != 0) {
+        out->error = 1;
+        return EOF;
+    }
+    return 0;
+}
+
+/*
+ * Queue the last window for writeback, unmap it, cut the file to its
+ * real size and close it. Like close() after write() nothing waits for
+ * the disk. Returns the file size, or EOF if anything failed on the way
+ */
+ssize_t map_sink_close(sink *out, map_sink *ms) {
+    int failed = out->error;
+
+    if (ms->map != NULL) {
+        long ret = syscall6(
+            __NR_msync, (long)ms->map, (long)ms->len, MS_ASYNC, 0, 0, 0);
+        if (ret < 0) {
+            failed = 1;
+        }
+        syscall6(__NR_munmap, (long)ms->map, (long)ms->window, 0, 0, 0, 0);
+        ms->map = NULL;
+    }
+
+    if (ms->fd >= 0) {
+        if (ftruncate(ms->fd, ms->offset + ms->len) < 0) {
+            failed = 1;
+        }
+        if (close(ms->fd) < 0) {
+            failed = 1;
+        }
+        ms->fd = -1;
+    }
+
+    return failed ? EOF : (ssize_t)out->count;
+}
+
+/*
+ * Arena sink: builds a string in an arena
+ * The string takes the whole free end of the arena's block and gives
+ * back what it did not use when it is finished, so the text is written
+ * in place with one bounds check per span. When the block runs out it
+ * moves to a new one of at least twice its size (the old copy stays
+ * until arena_reset()). Nothing else should be allocated from the arena
+ * before arena_sink_finish(), that would only waste the rest of the block
+ */
+static int arena_reserve(arena_sink *as, size_t need) {
+    arena *a = as->arena;
+    size_t cap = as->cap * 2 > need ? as->cap * 2 : need;
+    char *buf = arena_alloc(a, cap);
+    if (buf == NULL) {
+        return EOF;
+    }
+    if (as->len > 0) {
+        memcpy(buf, as->buf, as->len);
+    }
+    as->buf = buf;
+    as->cap = (size_t)(a->end - buf);
+    a->ptr = a->end;
+    return 0;
+}
+
+static int arena_put_span(void *ctx, const char *data, size_t n) {
+    arena_sink *as = ctx;
+    // One byte always stays free for the terminator
+    if (as->cap - as->len <= n && arena_reserve(as, as->len + n + 1) != 0) {
+        return EOF;
+    }
+    memcpy(as->buf + as->len, data, n);
+    as->len += n;
+    return 0;
+}
+
+static int arena_put_char(void *ctx, char c) {
+    arena_sink *as = ctx;
+    if (as->cap - as->len > 1) {
+        as->buf[as->len++] = c;
+        return 0;
+    }
+    return arena_put_span(ctx, &c, 1);
+}
+
+// Start an empty string in a
+void arena_sink_init(sink *out, arena_sink *as, arena *a) {
+    as->arena = a;
+    as->buf = NULL;
+    as->len = 0;
+    as->cap = 0;
+    if (a->ptr != a->end) {
+        as->buf = a->ptr;
+        as->cap = (size_t)(a->end - a->ptr);
+        a->ptr = a->end;
+    }
+    *out = (sink){arena_put_char, arena_put_span, NULL, as, 0, 0};
+}
+
+/*
+ * Terminate the string and return the unused room to the arena
+ * Returns NULL if memory ran out on the way
+ */
+char *arena_sink_finish(sink *out, arena_sink *as) {
+    if (as->buf == NULL && !out->error && arena_reserve(as, 1) != 0) {
+        out->error = 1;
+    }
+    if (as->buf == NULL) {
+        return NULL;
+    }
+
+    arena *a = as->arena;
+    if (a->ptr == as->buf + as->cap) {
+        size_t used = (as->len + ARENA_ALIGN) & ~(size_t)(ARENA_ALIGN - 1);
+        a->ptr = as->buf + used;
+    }
+    if (out->error) {
+        return NULL;
+    }
+    as->buf[as->len] = '\0';
+    return as->buf;
+}
+
+/*
+ * Floating point conversion
+ * Every finite double is m * 2^e with an integer m, and for e < 0 that is
+ * also m * 5^-e / 10^-e. So the full decimal expansion of any double is a
+ * big integer (m * 2^e or m * 5^-e) with the decimal point shifted. The
+ * big integer is built in base 10^9 limbs with integer multiplies only,
+ * which gives every digit exactly, and rounding is decided on the exact
+ * digits (ties to even, like glibc). The work depends on the number of
+ * limbs, not on looping over the exponent one decade at a time
+ */
+#define LIMB_BASE      1000000000UL
+#define DECIMAL_LIMBS  90 // m * 5^1074 has at most 767 digits
+#define DECIMAL_DIGITS (DECIMAL_LIMBS * 9 + 1)
+
+#define DBL_MANTISSA_BITS 52
+#define DBL_MANTISSA_MASK ((1UL << DBL_MANTISSA_BITS) - 1)
+
+// 5^0 to 5^13, the largest power of 5 that fits in 32 bits
+static const uint32_t powers_of_5[14] = {
+    1,
+    5,
+    25,
+    125,
+    625,
+    3125,
+    15625,
+    78125,
+    390625,
+    1953125,
+    9765625,
+    48828125,
+    244140625,
+    1220703125,
+};
+
+/*
+ * Decimal value: digits[0..len) times 10^(point - len)
+ * point is the number of digits before the decimal point, it can be <= 0
+ * (0.00123 is "123" with point -2) or larger than len (trailing zeros
+ * are never stored). Zero is len 0 with point 1
+ */
+typedef struct {
+    int len;
+    int point;
+    char digits[DECIMAL_DIGITS];
+} decimal;
+
+// Exact decimal expansion of m * 2^e
+static void decimal_from_binary(decimal *d, uint64_t m, int e) {
+    uint32_t limbs[DECIMAL_LIMBS];
+    int count = 0;
+    int shift10 = 0; // The big integer is the value times 10^shift10
+
+    d->len = 0;
+    d->point = 1;
+    if (m == 0) {
+        return;
+    }
+
+    // Trailing zero bits only make the big integer bigger
+    int zeros = __builtin_ctzl(m);
+    m >>= zeros;
+    e += zeros;
+
+    while (m != 0) {
+        limbs[count++] = (uint32_t)(m % LIMB_BASE);
+        m /= LIMB_BASE;
+    }
+
+    // m * 2^e: multiply by up to 2^29 at a time
+    // m * 2^-k = m * 5^k / 10^k: multiply by up to 5^13 at a time
+    // Either way limb * factor + carry fits in 64 bits
+    int remaining = e >= 0 ? e : -e;
+    int step = e >= 0 ? 29 : 13;
+    if (e < 0) {
+        shift10 = -e;
+    }
+
+    while (remaining > 0) {
+        int chunk = remaining < step ? remaining : step;
+        uint64_t factor = e >= 0 ? 1UL << chunk : powers_of_5[chunk];
+        uint64_t carry = 0;
+
+        for (int i = 0; i < count; i++) {
+            uint64_t x = limbs[i] * factor + carry;
+            limbs[i] = (uint32_t)(x % LIMB_BASE);
+            carry = x / LIMB_BASE;
+        }
+        while (carry != 0) {
+            limbs[count++] = (uint32_t)(carry % LIMB_BASE);
+            carry /= LIMB_BASE;
+        }
+
+        remaining -= chunk;
+    }
+
+    // Top limb without leading zeros, all others as 9 digits
+    char *ptr = uitoa(limbs[count - 1], d->digits, 10, 0);
+    for (int i = count - 2; i >= 0; i--) {
+        uint32_t limb = limbs[i];
+        for (int j = 8; j >= 0; j--) {
+            ptr[j] = (char)('0' + limb % 10);
+            limb /= 10;
+        }
+        ptr += 9;
+    }
+
+    d->len = (int)(ptr - d->digits);
+    d->point = d->len - shift10;
+
+    while (d->digits[d->len - 1] == '0') {
+        d->len--;
+    }
+}
+
+// Exact decimal expansion of the magnitude of a finite double
+static void decimal_from_double(decimal *d, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+
+    uint64_t mantissa = bits & DBL_MANTISSA_MASK;
+    int exponent = (int)((bits >> DBL_MANTISSA_BITS) & 0x7FF);
+
+    if (exponent == 0) {
+        // Subnormal: no implicit leading bit
+        decimal_from_binary(d, mantissa, -1074);
+    } else {
+        decimal_from_binary(
+            d, mantissa | (1UL << DBL_MANTISSA_BITS), exponent - 1075);
+    }
+}
+
+// Digit i of d, zeros outside the stored digits
+static inline char decimal_digit(const decimal *d, int i) {
+    return i >= 0 && i < d->len ? d->digits[i] : '0';
+}
+
+// Remove trailing zeros, zero becomes len 0 with point 1
+static void decimal_trim(decimal *d) {
+    while (d->len > 0 && d->digits[d->len - 1] == '0') {
+        d->len--;
+    }
+    if (d->len == 0) {
+        d->point = 1;
+    }
+}
+
+// Add one unit in the last place, 999 carries over to 1000
+static void decimal_increment(decimal *d) {
+    int i = d->len - 1;
+    while (i >= 0 && d->digits[i] == '9') {
+        i--;
+    }
+
+    if (i < 0) {
+        d->digits[0] = '1';
+        d->len = 1;
+        d->point++;
+        return;
+    }
+
+    d->digits[i]++;
+    d->len = i + 1;
+}
+
+// Round away the digits after the first keep ones, ties to even
+// Calling it again with the same keep changes nothing
+static void decimal_round(decimal *d, int keep) {
+    if (keep >= d->len) {
+        return;
+    }
+    if (keep < 0) {
+        // Below half a unit of the kept position, rounds to zero
+        d->len = 0;
+        decimal_trim(d);
+        return;
+    }
+
+    int up;
+    char next = d->digits[keep];
+    if (next != '5') {
+        up = next > '5';
+    } else if (keep + 1 < d->len) {
+        up = 1; // Something non-zero follows the 5, above halfway
+    } else {
+        up = keep > 0 && ((d->digits[keep - 1] - '0') & 1); // Exact tie
+    }
+
+    d->len = keep;
+    if (up) {
+        decimal_increment(d);
+    }
+    decimal_trim(d);
+}
+
+/*
+ * Digits in %f style (no sign): precision digits after the point
+ * The converters write to out, or only return the length when out is
+ * NULL. They round d in place, which is why measuring first and writing
+ * after gives the same text
+ */
+static size_t
+ftoa(sink *out, decimal *d, int precision, int alternate_form) {
+    decimal_round(d, d->point + precision);
+
+    int int_digits = d->point > 0 ? d->point : 1;
+    int dot = precision > 0 || alternate_form;
+    size_t length = (size_t)int_digits + dot + precision;
+
+    if (out == NULL) {
+        return length;
+    }
+
+    // Integer part, stored digits then zeros up to the point
+    if (d->len == 0 || d->point <= 0) {
+        sink_putc(out, '0');
+    } else {
+        int stored = d->point < d->len ? d->point : d->len;
+        sink_write(out, d->digits, stored);
+        sink_fill(out, '0', d->point - stored);
+    }
+
+    if (dot) {
+        sink_putc(out, '.');
+    }
+
+    // Fraction: zeros before the first digit, stored digits, zeros after
+    int leading = 0;
+    if (d->point < 0) {
+        leading = -d->point < precision ? -d->point : precision;
+    }
+    int start = d->point > 0 ? d->point : 0;
+    int stored = d->len - start;
+    if (stored < 0) {
+        stored = 0;
+    }
+    if (stored > precision - leading) {
+        stored = precision - leading;
+    }
+
+    sink_fill(out, '0', leading);
+    sink_write(out, d->digits + start, stored);
+    sink_fill(out, '0', precision - leading - stored);
+
+    return length;
+}
+
+// Digits in %e style (no sign): d.ddde+XX with precision fraction digits
+static size_t etoa(sink *out,
+                   decimal *d,
+                   int precision,
+                   int uppercase,
+                   int alternate_form) {
+    decimal_round(d, precision + 1);
+
+    int exponent = d->len ? d->point - 1 : 0;
+
+    // Exponent has at least 2 digits
+    char exp_buf[8];
+    char *ptr = exp_buf;
+    *ptr++ = uppercase ? 'E' : 'e';
+    *ptr++ = exponent < 0 ? '-' : '+';
+    if (exponent < 0) {
+        exponent = -exponent;
+    }
+    if (exponent < 10) {
+        *ptr++ = '0';
+    }
+    ptr = uitoa((uint64_t)exponent, ptr, 10, 0);
+    size_t exp_len = (size_t)(ptr - exp_buf);
+
+    int dot = precision > 0 || alternate_form;
+    size_t length = 1 + dot + (size_t)precision + exp_len;
+
+    if (out == NULL) {
+        return length;
+    }
+
+    sink_putc(out, decimal_digit(d, 0));
+    if (dot) {
+        sink_putc(out, '.');
+    }
+
+    int stored = d->len - 1;
+    if (stored < 0) {
+        stored = 0;
+    }
+    if (stored > precision) {
+        stored = precision;
+    }
+    sink_write(out, d->digits + 1, stored);
+    sink_fill(out, '0', precision - stored);
+    sink_write(out, exp_buf, exp_len);
+
+    return length;
+}
+
+// Digits in %g style (no sign): precision significant digits, %e style
+// for small and large exponents, trailing zeros removed unless '#'
+static size_t gtoa(sink *out,
+                   decimal *d,
+                   int precision,
+                   int uppercase,
+                   int alternate_form) {
+    if (precision == 0) {
+        precision = 1;
+    }
+
+    // The style depends on the exponent after rounding
+    decimal_round(d, precision);
+    int exponent = d->len ? d->point - 1 : 0;
+
+    if (exponent < -4 || exponent >= precision) {
+        int digits = precision - 1;
+        if (!alternate_form) {
+            digits = d->len > 1 ? d->len - 1 : 0;
+        }
+        return etoa(out, d, digits, uppercase, alternate_form);
+    }
+
+    int digits = precision - 1 - exponent;
+    if (!alternate_form) {
+        int stored = d->len - d->point;
+        digits = stored > 0 ? stored : 0;
+    }
+    return ftoa(out, d, digits, alternate_form);
+}
+
+// Compare two non-negative decimals, returns -1, 0 or 1
+static int decimal_compare(const decimal *a, const decimal *b) {
+    if (a->len == 0 || b->len == 0) {
+        return (a->len != 0) - (b->len != 0);
+    }
+    if (a->point != b->point) {
+        return a->point < b->point ? -1 : 1;
+    }
+
+    int len = a->len > b->len ? a->len : b->len;
+    for (int i = 0; i < len; i++) {
+        char da = decimal_digit(a, i);
+        char db = decimal_digit(b, i);
+        if (da != db) {
+            return da < db ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Shortest digits that still read back as the same double
+ * A double owns the interval of reals halfway to its neighbours, any
+ * decimal inside it reads back as the same value. For each length the
+ * digit string nearest to the value is tried first, then the one on the
+ * other side, both checked exactly against the interval ends. At most 17
+ * digits are ever needed. d gets the magnitude of a finite value
+ */
+static void decimal_shortest(decimal *d, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+
+    uint64_t mantissa = bits & DBL_MANTISSA_MASK;
+    int exponent = (int)((bits >> DBL_MANTISSA_BITS) & 0x7FF);
+    uint64_t m = exponent ? mantissa | (1UL << DBL_MANTISSA_BITS) : mantissa;
+    int e = exponent ? exponent - 1075 : -1074;
+
+    decimal_from_binary(d, m, e);
+    if (m == 0) {
+        return;
+    }
+
+    decimal low;
+    decimal high;
+    decimal_from_binary(&high, 2 * m + 1, e - 1);
+    if (mantissa == 0 && exponent > 1) {
+        // Just above a power of two the gap below is half as wide
+        decimal_from_binary(&low, 4 * m - 1, e - 2);
+    } else {
+        decimal_from_binary(&low, 2 * m - 1, e - 1);
+    }
+
+    // Reading a halfway point rounds to the even mantissa, so an even m
+    // also owns the interval ends
+    int inclusive = (m & 1) == 0;
+
+    decimal candidate;
+    for (int keep = 1; keep < d->len; keep++) {
+        // Digit string just below the value, then the one just above
+        memcpy(candidate.digits, d->digits, keep);
+        candidate.len = keep;
+        candidate.point = d->point;
+
+        decimal above = candidate;
+        decimal_increment(&above);
+        decimal_trim(&candidate);
+
+        // Nearest first, the tie rule does not matter here because both
+        // sides are checked
+        decimal *first = &candidate;
+        decimal *second = &above;
+        if (d->digits[keep] >= '5') {
+            first = &above;
+            second = &candidate;
+        }
+
+        decimal *tries[2] = {first, second};
+        for (int t = 0; t < 2; t++) {
+            int lo = decimal_compare(tries[t], &low);
+            int hi = decimal_compare(tries[t], &high);
+            if ((lo > 0 || (inclusive && lo == 0)) &&
+                (hi < 0 || (inclusive && hi == 0))) {
+                d->len = tries[t]->len;
+                d->point = tries[t]->point;
+                memcpy(d->digits, tries[t]->digits, tries[t]->len);
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * Shortest text that reads back as the same double
+ * 0.1 gives "0.1" where %.17g gives "0.10000000000000001". Plain notation
+ * for exponents -4 to 16, d.ddde+XX otherwise. buf needs 32 bytes
+ * Returns the length
+ */
+int dtoa_shortest(double value, char *buf) {
+    memory_sink mem = {buf, 31, 0};
+    sink out = {memory_put_char, memory_put_span, NULL, &mem, 0, 0};
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+    if (bits >> 63) {
+        sink_putc(&out, '-');
+    }
+
+    if (isnan(value) || isinf(value)) {
+        sink_write(&out, isnan(value) ? "nan" : "inf", 3);
+    } else {
+        decimal d;
+        decimal_shortest(&d, value);
+
+        int exponent = d.len ? d.point - 1 : 0;
+        if (exponent < -4 || exponent > 16) {
+            etoa(&out, &d, d.len > 1 ? d.len - 1 : 0, 0, 0);
+        } else {
+            int stored = d.len - d.point;
+            ftoa(&out, &d, stored > 0 ? stored : 0, 0);
+        }
+    }
+
+    buf[mem.len] = '\0';
+    return (int)out.count;
+}
+
+// Run the converter for a float specifier, see ftoa()
+static size_t float_convert(sink *out,
+                            decimal *d,
+                            const format_flags *flags,
+                            int precision) {
+    int uppercase = (flags->specifier >= 'A' && flags->specifier <= 'Z');
+
+    switch (flags->specifier) {
+    case 'f':
+    case 'F':
+        return ftoa(out, d, precision, flags->alternate_form);
+    case 'e':
+    case 'E':
+        return etoa(out, d, precision, uppercase, flags->alternate_form);
+    default:
+        return gtoa(out, d, precision, uppercase, flags->alternate_form);
+    }
+}
+
+/*
+ * Argument source for format_arg(): a va_list, or the words of a deferred
+ * record (see log_capture()). A word holds one argument widened to 64
+ * bits, doubles as their bit pattern, so reading it back only needs the
+ * kind of argument, the same one va_arg() is called with
+ */
+typedef struct {
+    va_list ap;
+    const uint64_t *words; // NULL: read from ap
+} arg_list;
+
+static inline int arg_int(arg_list *args) {
+    return args->words ? (int)*args->words++ : va_arg(args->ap, int);
+}
+
+static inline int64_t arg_long(arg_list *args) {
+    return args->words ? (int64_t)*args->words++ : va_arg(args->ap, int64_t);
+}
+
+static inline double arg_double(arg_list *args) {
+    if (args->words == NULL) {
+        return va_arg(args->ap, double);
+    }
+
+    double value;
+    memcpy(&value, args->words++, sizeof(double));
+    return value;
+}
+
+// %Lf and friends: long double is read at its own size and printed as a
+// double. Deferred records keep it as a double already, see log_capture()
+static inline double arg_long_double(arg_list *args) {
+    if (args->words != NULL) {
+        return arg_double(args);
+    }
+    return (double)va_arg(args->ap, long double);
+}
+
+static inline void *arg_pointer(arg_list *args) {
+    return args->words ? (void *)*args->words++ : va_arg(args->ap, void *);
+}
+
+/*
+ * Conversions
+ * One per family, taking the value that was already read and flags with
+ * the '*' markers resolved (width >= 0, precision >= -1). format_arg()
+ * reads the argument and calls one of them, typed front ends such as
+ * printf.hpp call them directly
+ */
+
+/*
+ * Start a field: width padding, the prefix (sign, "0x") and zeros, all
+ * before a body of len bytes that the caller writes next. With zero_fill
+ * the width is made up with zeros after the prefix, otherwise with spaces
+ * in front, or behind the body for '-'. Returns the spaces still owed
+ * after the body, for field_end()
+ */
+static size_t field_begin(sink *out,
+                          const format_flags *flags,
+                          const char *prefix,
+                          size_t prefix_len,
+                          size_t zeros,
+                          size_t len,
+                          int zero_fill) {
+    size_t total = prefix_len + zeros + len;
+    size_t pad = (size_t)flags->width > total ? flags->width - total : 0;
+
+    if (flags->left_justify) {
+        sink_write(out, prefix, prefix_len);
+        sink_fill(out, '0', zeros);
+        return pad;
+    }
+
+    if (zero_fill) {
+        zeros += pad;
+    } else {
+        sink_fill(out, ' ', pad);
+    }
+    sink_write(out, prefix, prefix_len);
+    sink_fill(out, '0', zeros);
+    return 0;
+}
+
+static inline void field_end(sink *out, size_t pad) {
+    sink_fill(out, ' ', pad);
+}
+
+void format_char(sink *out, const format_flags *flags, int c) {
+    size_t pad = field_begin(out, flags, NULL, 0, 0, 1, 0);
+    sink_putc(out, (char)c);
+    field_end(out, pad);
+}
+
+void format_string(sink *out, const format_flags *flags, const char *str) {
+    if (str == NULL) {
+        str = "(null)";
+    }
+
+    size_t len = strlen(str);
+    if (flags->precision >= 0 && (size_t)flags->precision < len) {
+        len = flags->precision;
+    }
+
+    size_t pad = field_begin(out, flags, NULL, 0, 0, len, 0);
+    sink_ref(out, str, len);
+    field_end(out, pad);
+}
+
+/*
+ * All integer conversions end up here with the magnitude and the sign
+ * character (0 for none). The field length comes from the digit count, so
+ * nothing is measured after the fact, and the field is laid out once in
+ * field[] (spaces, sign or "0x", zeros, digits) and handed to the sink in
+ * one piece. Only fields wider than field[] go through sink_fill()
+ */
+#define INTEGER_FIELD 128
+
+static void format_integer(sink *out,
+                           const format_flags *flags,
+                           uint64_t value,
+                           char sign) {
+    STATS_START(start);
+    char field[INTEGER_FIELD];
+    int base = 10;
+    int uppercase = 0;
+    int alternate_form = flags->alternate_form;
+
+    switch (flags->specifier) {
+    case 'o':
+        base = 8;
+        break;
+    case 'x':
+        base = 16;
+        break;
+    case 'X':
+        base = 16;
+        uppercase = 1;
+        break;
+    case 'p':
+        base = 16;
+        alternate_form = 1;
+        break;
+    }
+
+    // %.0d of 0 prints no digits at all, %p always prints
+    size_t len = 0;
+    if (value != 0 || flags->precision != 0 || flags->specifier == 'p') {
+        len = count_digits(value, base);
+    }
+
+    char prefix[2] = {sign, 0};
+    size_t prefix_len = sign ? 1 : 0;
+
+    // '#' makes octal start with a 0 even when %.0o prints no digits
+    if (alternate_form && base == 8 && (value != 0 || len == 0)) {
+        prefix[0] = '0';
+        prefix_len = 1;
+    } else if (alternate_form && base == 16 && value != 0) {
+        prefix[0] = '0';
+        prefix[1] = uppercase ? 'X' : 'x';
+        prefix_len = 2;
+    }
+
+    // Precision counts digits, only the octal '0' can stand in for one
+    size_t digits = base == 8 ? len + prefix_len : len;
+    size_t zeros =
+        flags->precision > (int)digits ? flags->precision - digits : 0;
+
+    size_t body = prefix_len + zeros + len;
+    size_t pad = (size_t)flags->width > body ? flags->width - body : 0;
+    size_t total = body + pad;
+    if (flags->zero_pad && flags->precision < 0 && !flags->left_justify) {
+        zeros += pad;
+        pad = 0;
+    }
+
+    if (total <= INTEGER_FIELD) {
+        char *ptr = field;
+        if (!flags->left_justify) {
+            memset(ptr, ' ', pad);
+            ptr += pad;
+        }
+        memcpy(ptr, prefix, prefix_len);
+        ptr += prefix_len;
+        memset(ptr, '0', zeros);
+        ptr += zeros;
+        if (len != 0) {
+            ptr += len;
+            write_digits(ptr, value, base, uppercase);
+        }
+        if (flags->left_justify) {
+            memset(ptr, ' ', pad);
+            ptr += pad;
+        }
+        sink_write(out, field, ptr - field);
+    } else {
+        if (!flags->left_justify) {
+            sink_fill(out, ' ', pad);
+        }
+        sink_write(out, prefix, prefix_len);
+        sink_fill(out, '0', zeros);
+        if (len != 0) {
+            write_digits(field + len, value, base, uppercase);
+            sink_write(out, field, len);
+        }
+        if (flags->left_justify) {
+            sink_fill(out, ' ', pad);
+        }
+    }
+    STATS_STOP(integer, start);
+}
+
+// %d and %i
+void format_signed(sink *out, const format_flags *flags, int64_t value) {
+    // Negate as unsigned so INT64_MIN does not overflow
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+
+    char sign = 0;
+    if (value < 0) {
+        sign = '-';
+    } else if (flags->always_sign) {
+        sign = '+';
+    } else if (flags->space_sign) {
+        sign = ' ';
+    }
+
+    format_integer(out, flags, magnitude, sign);
+}
+
+// %u, %o, %x, %X and %p
+void format_unsigned(sink *out, const format_flags *flags, uint64_t value) {
+    format_integer(out, flags, value, 0);
+}
+
+// %f, %F, %e, %E, %g and %G
+void format_double(sink *out, const format_flags *flags, double value) {
+    STATS_START(start);
+    // The three notations only differ in the converter, sign and padding
+    // work the same way
+    int uppercase = (flags->specifier >= 'A' && flags->specifier <= 'Z');
+    int precision = flags->precision < 0 ? 6 : flags->precision;
+
+    // The sign bit decides, so -0.0 and negative NaN keep their '-'
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+
+    char sign = 0;
+    if (bits >> 63) {
+        sign = '-';
+    } else if (flags->always_sign) {
+        sign = '+';
+    } else if (flags->space_sign) {
+        sign = ' ';
+    }
+
+    decimal dec;
+    const char *special = NULL;
+    size_t len = 3;
+    if (isnan(value)) {
+        special = uppercase ? "NAN" : "nan";
+    } else if (isinf(value)) {
+        special = uppercase ? "INF" : "inf";
+    } else {
+        decimal_from_double(&dec, value);
+        len = float_convert(NULL, &dec, flags, precision);
+    }
+
+    // Zero padding goes after the sign, inf and nan get spaces
+    int zero_fill = flags->zero_pad && special == NULL;
+
+    size_t pad =
+        field_begin(out, flags, &sign, sign ? 1 : 0, 0, len, zero_fill);
+    if (special != NULL) {
+        sink_write(out, special, len);
+    } else {
+        float_convert(out, &dec, flags, precision);
+    }
+    field_end(out, pad);
+    STATS_STOP(floating, start);
+}
+
+/*
+ * Convert one parsed specifier, reading its arguments from args
+ * args is passed by pointer so the caller sees the arguments as consumed
+ * Returns 0 for an unknown specifier (nothing is written), 1 otherwise
+ */
+static int format_arg(sink *out, const format_flags *spec, arg_list *args) {
+    format_flags flags = *spec;
+
+    // Handle width from argument
+    if (flags.width == -1) {
+        flags.width = arg_int(args);
+        if (flags.width < 0) {
+            flags.left_justify = 1;
+            flags.width = -flags.width;
+        }
+    }
+
+    // Handle precision from argument
+    if (flags.precision == -2) {
+        flags.precision = arg_int(args);
+        if (flags.precision < 0) {
+            flags.precision = -1; // Unspecified
+        }
+    }
+
+    // Handle different specifiers
+    switch (flags.specifier) {
+    case 'c':
+        format_char(out, &flags, arg_int(args));
         break;
-    case 'l':
-        if (*(format + 1) == 'l') {
-            flags->length_modifier = 'L'; // ll
+
+    case 's':
+        format_string(out, &flags, (const char *)arg_pointer(args));
+        break;
+
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X': {
+        // One read for all integer conversions: the argument is fetched at
+        // its promoted size and cut down to the length modifier's width,
+        // sign extended for %d and %i
+        uint64_t value;
+        int bits;
+
+        switch (flags.length_modifier) {
+        case 'H': // char
+            value = (uint64_t)arg_int(args);
+            bits = 8;
+            break;
+        case 'h': // short
+            value = (uint64_t)arg_int(args);
+            bits = 16;
+            break;
+        case 'l': // long
+        case 'L': // long long
+        case 'j': // intmax_t
+        case 'z': // size_t
+        case 't': // ptrdiff_t
+            value = (uint64_t)arg_long(args);
+            bits = 64;
+            break;
+        default: // int
+            value = (uint64_t)arg_int(args);
+            bits = 32;
+            break;
+        }
+
+        int shift = 64 - bits;
+        if (flags.specifier == 'd' || flags.specifier == 'i') {
+            format_signed(out, &flags, (int64_t)(value << shift) >> shift);
+        } else {
+            format_unsigned(out, &flags, (value << shift) >> shift);
+        }
+        break;
+    }
+
+    case 'p':
+        format_unsigned(out, &flags, (uint64_t)arg_pointer(args));
+        break;
+
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+        // Floating point
+        format_double(out,
+                      &flags,
+                      flags.length_modifier == 'B' ? arg_long_double(args)
+                                                   : arg_double(args));
+        break;
+
+    case 'n': {
+        // Store number of characters written so far
+        // Deferred records do not keep the pointer (see log_capture()),
+        // and one read from a file must never write through its words
+        int *count_ptr = (int *)arg_pointer(args);
+        if (count_ptr != NULL && args->words == NULL) {
+            *count_ptr = (int)out->count;
+        }
+        break;
+    }
+
+    default:
+        // Unknown specifier, the caller decides what to do
+        return 0;
+    }
+
+    STATS_ADD(conversions[flags.specifier & 127], 1);
+    return 1;
+}
+
+/*
+ * Write formatted output to a sink, arguments from args
+ * Returns the number of bytes produced
+ */
+static int format_args(sink *out, const char *format, arg_list *args) {
+    STATS_ADD(formats, 1);
+    size_t start_count = out->count;
+
+    while (*format) {
+        if (*format != '%') {
+            // Pass the whole literal run up to the next '%' at once, it is
+            // found a word or vector at a time
+            const char *run = format;
+            format = strchrnul(format, '%');
+            sink_ref(out, run, (size_t)(format - run));
+            continue;
+        }
+
+        // Handle %%
+        if (*(format + 1) == '%') {
+            sink_putc(out, '%');
             format += 2;
+            continue;
+        }
+
+        // Parse format specifier
+        format_flags flags;
+        STATS_START(start);
+        int consumed = parse_format(format + 1, &flags);
+        STATS_STOP(parse, start);
+
+        // A lone '%' at the end of the string, stop before the terminator
+        if (flags.specifier == '\0') {
+            break;
+        }
+
+        format += consumed + 1;
+
+        if (!format_arg(out, &flags, args)) {
+            // Unknown specifier, just copy the format
+            format -= consumed;
+            sink_putc(out, *format++);
+        }
+    }
+
+    STATS_ADD(bytes, out->count - start_count);
+    return (int)out->count;
+}
+
+/*
+ * Write formatted output to a sink
+ * Returns the number of bytes produced
+ */
+static int format_to_buffer(sink *out, const char *format, va_list ap) {
+    arg_list args = {.words = NULL};
+    va_copy(args.ap, ap);
+
+    int len = format_args(out, format, &args);
+
+    va_end(args.ap);
+    return len;
+}
+
+/*
+ * Pre-compiled formats
+ * printf_compile() splits a format string once into op records, each one
+ * a literal span followed by an already parsed specifier, so running it
+ * later skips scanning and parse_format() completely. Literal spans point
+ * into the original string, which has to outlive the compiled format
+ * (string literals always do). The types are in printf.h
+ */
+
+// Specifiers format_arg() knows, anything else is printed as text
+static int is_specifier(char c) {
+    return format_class[(unsigned char)c] & FC_SPECIFIER;
+}
+
+static int compile_op(printf_format *compiled,
+                      const char *literal,
+                      size_t literal_len,
+                      const format_flags *flags) {
+    if (compiled->count == FORMAT_MAX_OPS) {
+        return EOF;
+    }
+
+    format_op *op = &compiled->ops[compiled->count++];
+    op->literal = literal;
+    op->literal_len = literal_len;
+    op->flags = *flags;
+    return 0;
+}
+
+/*
+ * Compile format into op records
+ * Returns 0 on success, EOF if it needs more than FORMAT_MAX_OPS ops
+ */
+int printf_compile(printf_format *compiled, const char *format) {
+    format_flags none = {0};
+    const char *run = format; // Start of the pending literal text
+    const char *p = format;
+
+    compiled->count = 0;
+
+    while (1) {
+        p = strchrnul(p, '%');
+
+        if (*p == '\0') {
+            return compile_op(compiled, run, (size_t)(p - run), &none);
+        }
+
+        format_flags flags;
+        int consumed = parse_format(p + 1, &flags);
+
+        // A lone '%' at the end of the string, same as format_to_buffer()
+        if (flags.specifier == '\0') {
+            return compile_op(compiled, run, (size_t)(p - run), &none);
+        }
+
+        if (p[1] == '%' || !is_specifier(flags.specifier)) {
+            // "%%" and unknown specifiers print the byte after '%', so the
+            // next literal simply starts there. An unknown one keeps its
+            // flags: format_arg() still takes its '*' arguments and prints
+            // nothing, as in format_args()
+            const format_flags *op = p[1] == '%' ? &none : &flags;
+            if (compile_op(compiled, run, (size_t)(p - run), op) != 0) {
+                return EOF;
+            }
+            run = p + 1;
+            p += 2;
+            continue;
+        }
+
+        if (compile_op(compiled, run, (size_t)(p - run), &flags) != 0) {
+            return EOF;
+        }
+        p += consumed + 1;
+        run = p;
+    }
+}
+
+// Run compiled ops, the counterpart of format_to_buffer()
+static int format_compiled(sink *out,
+                           const printf_format *compiled,
+                           va_list ap) {
+    arg_list args = {.words = NULL};
+    va_copy(args.ap, ap);
+
+    STATS_ADD(formats, 1);
+    size_t start_count = out->count;
+
+    for (int i = 0; i < compiled->count; i++) {
+        const format_op *op = &compiled->ops[i];
+
+        sink_ref(out, op->literal, op->literal_len);
+        if (op->flags.specifier) {
+            format_arg(out, &op->flags, &args);
+        }
+    }
+
+    STATS_ADD(bytes, out->count - start_count);
+    va_end(args.ap);
+    return (int)out->count;
+}
+
+/*
+ * Small cache of compiled formats keyed by the format pointer, for callers
+ * that cannot keep a printf_format around. The key is the address, so it
+ * only makes sense for formats that never change (string literals)
+ * Threads share it, so a slot is written once: claimed with a CAS,
+ * compiled into, then published by a release store of the key. Whoever
+ * sees the key sees finished ops, and nobody rewrites them under a reader.
+ * A format whose slots are all taken by others is not cached
+ * Returns NULL if the format cannot be compiled or cached
+ */
+#define FORMAT_CACHE_BITS  5
+#define FORMAT_CACHE_PROBE 4 // Slots tried per format
+
+// Key of a slot a thread is compiling into
+#define FORMAT_CACHE_BUSY ((const char *)1)
+
+static struct {
+    const char *format; // Set last, see above
+    int usable;         // The format compiled
+    printf_format compiled;
+} format_cache[1 << FORMAT_CACHE_BITS];
+
+const printf_format *printf_compile_cached(const char *format) {
+    // Fibonacci hashing spreads nearby addresses over the slots
+    size_t hash =
+        ((uintptr_t)format * 0x9E3779B97F4A7C15UL) >> (64 - FORMAT_CACHE_BITS);
+
+    for (size_t i = 0; i < FORMAT_CACHE_PROBE; i++) {
+        size_t slot = (hash + i) & ((1 << FORMAT_CACHE_BITS) - 1);
+        const char *key =
+            __atomic_load_n(&format_cache[slot].format, __ATOMIC_ACQUIRE);
+
+        if (key == NULL &&
+            __atomic_compare_exchange_n(&format_cache[slot].format,
+                                        &key,
+                                        FORMAT_CACHE_BUSY,
+                                        0,
+                                        __ATOMIC_ACQUIRE,
+                                        __ATOMIC_ACQUIRE)) {
+            format_cache[slot].usable =
+                printf_compile(&format_cache[slot].compiled, format) == 0;
+            __atomic_store_n(
+                &format_cache[slot].format, format, __ATOMIC_RELEASE);
+            key = format;
+        }
+
+        if (key == format) {
+            return format_cache[slot].usable ? &format_cache[slot].compiled
+                                             : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Deferred formatting
+ * log_capture() keeps what a printf() call needs to be replayed later:
+ * the format pointer and the arguments as raw words, read with the same
+ * kinds format_arg() reads them with (see format_arg_kind()). Nothing is
+ * converted, so the calling side is a walk over the format and a few
+ * stores. log_render() turns the record into text through format_args(),
+ * later and in another thread or program. The format has to outlive the
+ * record (string literals do), %s strings are copied into the record
+ * because the caller's buffer may be gone by then
+ */
+#define LOG_MAX_ARGS 64
+
+typedef struct {
+    const char *format;
+    uint64_t string_mask; // Bit i: word i is the offset of a copied string
+    uint64_t double_mask; // Bit i: word i holds the bits of a double
+    uint32_t size;        // Whole record with strings, a multiple of 8
+    uint16_t argc;        // Number of words
+    uint16_t reserved;
+    uint64_t words[];
+} log_record;
+
+// How format_arg() reads the argument of a specifier
+typedef enum {
+    ARG_NONE, // Unknown specifier, only '*' width and precision are read
+    ARG_INT,
+    ARG_LONG,
+    ARG_DOUBLE,
+    ARG_POINTER,
+    ARG_STRING,
+} arg_kind;
+
+static arg_kind format_arg_kind(const format_flags *flags) {
+    switch (flags->specifier) {
+    case 'c':
+        return ARG_INT;
+    case 's':
+        return ARG_STRING;
+    case 'p':
+    case 'n':
+        return ARG_POINTER;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+        return ARG_DOUBLE;
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        switch (flags->length_modifier) {
+        case 'l':
+        case 'L':
+        case 'j':
+        case 'z':
+        case 't':
+            return ARG_LONG;
+        default: // hh and h are passed as int
+            return ARG_INT;
+        }
+    default:
+        return ARG_NONE;
+    }
+}
+
+/*
+ * Find the next conversion the same way format_args() walks a format
+ * Returns where the walk goes on, or NULL at the end. flags gets the
+ * parsed conversion; for an unknown specifier only its '*' arguments are
+ * read, and the walk goes on at the byte after '%' which is printed as
+ * text
+ */
+static const char *next_conversion(const char *p, format_flags *flags) {
+    while (*(p = strchrnul(p, '%')) != '\0') {
+        if (p[1] == '%') {
+            p += 2;
+            continue;
+        }
+
+        int consumed = parse_format(p + 1, flags);
+        if (flags->specifier == '\0') {
+            return NULL; // A lone '%' at the end
+        }
+        if (format_arg_kind(flags) == ARG_NONE) {
+            return p + 2;
+        }
+        return p + 1 + consumed;
+    }
+    return NULL;
+}
+
+// Length of s, reading at most max bytes when max >= 0 (like %.*s does)
+static size_t string_length(const char *s, int max) {
+    if (max < 0) {
+        return strlen(s);
+    }
+
+    size_t len = 0;
+    while ((int)len < max && s[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+/*
+ * Record format and its arguments into rec, using at most capacity bytes
+ * (a multiple of 8)
+ * Returns the record size, or 0 if it does not fit
+ */
+static size_t log_capture(log_record *rec,
+                          size_t capacity,
+                          const char *format,
+                          va_list ap) {
+    if (capacity < sizeof(log_record)) {
+        return 0;
+    }
+
+    size_t max_words = (capacity - sizeof(log_record)) / sizeof(uint64_t);
+    if (max_words > LOG_MAX_ARGS) {
+        max_words = LOG_MAX_ARGS;
+    }
+
+    uint32_t string_len[LOG_MAX_ARGS];
+    uint64_t string_mask = 0;
+    uint64_t double_mask = 0;
+    size_t argc = 0;
+
+    va_list args;
+    va_copy(args, ap);
+
+    // Read what format_arg() would read
+    format_flags flags;
+    const char *p = format;
+    while ((p = next_conversion(p, &flags)) != NULL) {
+        arg_kind kind = format_arg_kind(&flags);
+        size_t needed = (flags.width == -1) + (flags.precision == -2) +
+                        (kind != ARG_NONE);
+        if (argc + needed > max_words) {
+            va_end(args);
+            return 0;
+        }
+
+        int precision = flags.precision;
+        if (flags.width == -1) {
+            rec->words[argc++] = (uint64_t)(int64_t)va_arg(args, int);
+        }
+        if (flags.precision == -2) {
+            precision = va_arg(args, int);
+            rec->words[argc++] = (uint64_t)(int64_t)precision;
+        }
+
+        switch (kind) {
+        case ARG_NONE:
+            break;
+        case ARG_INT:
+            rec->words[argc++] = (uint64_t)(int64_t)va_arg(args, int);
+            break;
+        case ARG_LONG:
+            rec->words[argc++] = (uint64_t)va_arg(args, int64_t);
+            break;
+        case ARG_DOUBLE: {
+            double value = flags.length_modifier == 'B'
+                               ? (double)va_arg(args, long double)
+                               : va_arg(args, double);
+            double_mask |= 1UL << argc;
+            memcpy(&rec->words[argc++], &value, sizeof(double));
+            break;
+        }
+        case ARG_POINTER: {
+            // %n cannot store into the caller's int any more
+            void *ptr = va_arg(args, void *);
+            rec->words[argc++] = flags.specifier == 'n' ? 0 : (uint64_t)ptr;
+            break;
+        }
+        case ARG_STRING: {
+            const char *str = va_arg(args, const char *);
+            if (str != NULL) {
+                string_mask |= 1UL << argc;
+                string_len[argc] = (uint32_t)string_length(str, precision);
+            }
+            rec->words[argc++] = (uint64_t)str; // NULL stays "(null)"
+            break;
+        }
+        }
+    }
+
+    va_end(args);
+
+    // Strings go after the words, each with a terminator
+    size_t size = sizeof(log_record) + argc * sizeof(uint64_t);
+    for (size_t i = 0; i < argc; i++) {
+        if (!(string_mask & (1UL << i))) {
+            continue;
+        }
+
+        size_t len = string_len[i];
+        if (size + len + 1 > capacity) {
+            return 0;
+        }
+
+        char *copy = (char *)rec + size;
+        memcpy(copy, (const char *)rec->words[i], len);
+        copy[len] = '\0';
+        rec->words[i] = size;
+        size += len + 1;
+    }
+
+    rec->format = format;
+    rec->string_mask = string_mask;
+    rec->double_mask = double_mask;
+    rec->size = (uint32_t)((size + 7) & ~(size_t)7);
+    rec->argc = (uint16_t)argc;
+    rec->reserved = 0;
+    return rec->size;
+}
+
+/*
+ * Format a captured record
+ * Returns the number of bytes produced
+ */
+static int log_render(sink *out, const log_record *rec) {
+    uint64_t words[LOG_MAX_ARGS];
+
+    // String words become pointers to the copies again
+    for (int i = 0; i < rec->argc; i++) {
+        words[i] = rec->words[i];
+        if (rec->string_mask & (1UL << i)) {
+            words[i] = (uint64_t)((const char *)rec + rec->words[i]);
+        }
+    }
+
+    arg_list args = {.words = words};
+    return format_args(out, rec->format, &args);
+}
+
+/*
+ * Format into a caller provided sink
+ * Returns the number of bytes produced, or EOF if a callback failed
+ */
+int sink_vprintf(sink *out, const char *format, va_list ap) {
+    format_to_buffer(out, format, ap);
+    return out->error ? EOF : (int)out->count;
+}
+
+__attribute__((format(printf, 2, 3))) //
+int sink_printf(sink *out, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = sink_vprintf(out, format, ap);
+    va_end(ap);
+    return len;
+}
+
+/*
+ * Arrays of numbers: spec is one conversion ("%d", "%8.3f") parsed once for
+ * the whole array, sep (NULL for none) goes between the elements. Output
+ * is gathered in a chunk on the stack and reaches the sink a few KiB at a
+ * time rather than field by field. Plain %d, %i and %u skip the converters
+ * and write SWAR digits straight into the chunk
+ * Return the bytes produced like sink_printf(), or EOF if spec is not a
+ * single conversion for the element type (no '*') or a callback failed
+ */
+#define ARRAY_CHUNK 4096
+
+typedef struct {
+    sink *target;
+    size_t len;
+    char buf[ARRAY_CHUNK];
+} array_chunk;
+
+static void array_flush(array_chunk *chunk) {
+    sink_write(chunk->target, chunk->buf, chunk->len);
+    chunk->len = 0;
+}
+
+static int array_put_span(void *ctx, const char *data, size_t n) {
+    array_chunk *chunk = ctx;
+
+    if (n > ARRAY_CHUNK - chunk->len) {
+        array_flush(chunk);
+        if (n > ARRAY_CHUNK) {
+            sink_write(chunk->target, data, n);
+            return chunk->target->error ? -1 : 0;
+        }
+    }
+
+    memcpy(chunk->buf + chunk->len, data, n);
+    chunk->len += n;
+    return chunk->target->error ? -1 : 0;
+}
+
+static int array_put_char(void *ctx, char c) {
+    return array_put_span(ctx, &c, 1);
+}
+
+// Parse spec into flags, EOF unless it is one conversion out of kinds
+static int array_spec(const char *spec, const char *kinds, format_flags *f) {
+    if (spec[0] != '%' || spec[1] == '\0') {
+        return EOF;
+    }
+
+    int n = parse_format(spec + 1, f);
+    if (spec[1 + n] != '\0' || f->width == -1 || f->precision == -2 ||
+        f->specifier == '\0' || *strchrnul(kinds, f->specifier) == '\0') {
+        return EOF;
+    }
+    return 0;
+}
+
+// Element i cut down to hh or h like format_arg() cuts arguments, sign
+// extended for %d and %i. Without them it stays 64 bits, the element type
+static int64_t array_int(const int64_t *values,
+                         size_t i,
+                         int shift,
+                         int is_signed) {
+    uint64_t bits = (uint64_t)values[i] << shift;
+    return is_signed ? (int64_t)bits >> shift : (int64_t)(bits >> shift);
+}
+
+int format_int_array(sink *out,
+                     const int64_t *values,
+                     size_t n,
+                     const char *spec,
+                     const char *sep) {
+    format_flags flags;
+    if (array_spec(spec, "diuoxX", &flags) != 0) {
+        return EOF;
+    }
+
+    STATS_ADD(formats, 1);
+    STATS_ADD(conversions[flags.specifier], n);
+    size_t start_count = out->count;
+    size_t sep_len = sep != NULL ? strlen(sep) : 0;
+    int is_signed = flags.specifier == 'd' || flags.specifier == 'i';
+    int shift = flags.length_modifier == 'H'   ? 56
+                : flags.length_modifier == 'h' ? 48
+                                               : 0;
+
+    array_chunk chunk;
+    chunk.target = out;
+    chunk.len = 0;
+
+    int plain = (is_signed || flags.specifier == 'u') && flags.width == 0 &&
+                flags.precision < 0 && !flags.always_sign &&
+                !flags.space_sign && sep_len <= ARRAY_CHUNK / 2;
+
+    if (plain) {
+        // Room for a separator, a '-' and 20 digits
+        size_t room = sep_len + 21;
+
+        for (size_t i = 0; i < n && !out->error; i++) {
+            if (ARRAY_CHUNK - chunk.len < room) {
+                array_flush(&chunk);
+            }
+
+            char *ptr = chunk.buf + chunk.len;
+            if (i != 0) {
+                memcpy(ptr, sep, sep_len);
+                ptr += sep_len;
+            }
+
+            int64_t element = array_int(values, i, shift, is_signed);
+            uint64_t value = (uint64_t)element;
+            if (is_signed && element < 0) {
+                *ptr++ = '-';
+                value = 0 - value;
+            }
+            ptr += swar_write_decimal(ptr, value);
+            chunk.len = ptr - chunk.buf;
+        }
+    } else {
+        sink buffered = {array_put_char, array_put_span, NULL, &chunk, 0, 0};
+
+        for (size_t i = 0; i < n && !out->error; i++) {
+            if (i != 0) {
+                sink_write(&buffered, sep, sep_len);
+            }
+            int64_t element = array_int(values, i, shift, is_signed);
+            if (is_signed) {
+                format_signed(&buffered, &flags, element);
+            } else {
+                format_unsigned(&buffered, &flags, (uint64_t)element);
+            }
+        }
+    }
+
+    array_flush(&chunk);
+    STATS_ADD(bytes, out->count - start_count);
+    return out->error ? EOF : (int)out->count;
+}
+
+int format_double_array(sink *out,
+                        const double *values,
+                        size_t n,
+                        const char *spec,
+                        const char *sep) {
+    format_flags flags;
+    if (array_spec(spec, "fFeEgG", &flags) != 0) {
+        return EOF;
+    }
+
+    STATS_ADD(formats, 1);
+    STATS_ADD(conversions[flags.specifier], n);
+    size_t start_count = out->count;
+    size_t sep_len = sep != NULL ? strlen(sep) : 0;
+
+    array_chunk chunk;
+    chunk.target = out;
+    chunk.len = 0;
+    sink buffered = {array_put_char, array_put_span, NULL, &chunk, 0, 0};
+
+    for (size_t i = 0; i < n && !out->error; i++) {
+        if (i != 0) {
+            sink_write(&buffered, sep, sep_len);
+        }
+        format_double(&buffered, &flags, values[i]);
+    }
+
+    array_flush(&chunk);
+    STATS_ADD(bytes, out->count - start_count);
+    return out->error ? EOF : (int)out->count;
+}
+
+/*
+ * Format into a stream buffer, from a format string or a compiled format
+ * The buffer is written when it fills up, and once more at the end for
+ * unbuffered streams or when a newline went into a line buffered one
+ * Returns the number of bytes produced, or EOF on write error
+ */
+static int stream_format(FILE *stream,
+                         const char *format,
+                         const printf_format *compiled,
+                         va_list ap) {
+    stream_sink ss;
+    sink out;
+    stream_sink_init(&out, &ss, stream);
+
+    if (compiled != NULL) {
+        format_compiled(&out, compiled, ap);
+    } else {
+        format_to_buffer(&out, format, ap);
+    }
+
+    return stream_sink_finish(&out, &ss);
+}
+
+int vfprintf(FILE *stream, const char *format, va_list ap) {
+    return stream_format(stream, format, NULL, ap);
+}
+
+__attribute__((format(printf, 2, 3))) //
+int fprintf(FILE *stream, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = vfprintf(stream, format, ap);
+    va_end(ap);
+    return len;
+}
+
+/*
+ * Format straight to a file descriptor (socket, pipe, file)
+ * Not related to stdout buffering, it goes through a temporary unbuffered
+ * stream on the stack so short output still costs a single write
+ */
+int vdprintf(int fd, const char *format, va_list ap) {
+    char buf[512];
+    FILE stream = {fd, _IONBF, buf, sizeof(buf), 0, 0, 0, 0, 0, 0};
+    return vfprintf(&stream, format, ap);
+}
+
+__attribute__((format(printf, 2, 3))) //
+int dprintf(int fd, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = vdprintf(fd, format, ap);
+    va_end(ap);
+    return len;
+}
+
+/*
+ * Same as dprintf() but long strings and literal text are not copied, the
+ * output is handed to the kernel as an iovec list with a single writev()
+ * (more only for very long output). Pays off when %s arguments are large
+ * Pending stdout output is flushed first when fd is stdout, so the order
+ * of the two is kept. A full non-blocking fd ends the output early like
+ * a short write(): the return value is then the bytes that made it there
+ */
+int vdprintfv(int fd, const char *format, va_list ap) {
+    iovec_sink vs;
+    vs.fd = fd;
+    vs.iovcnt = 0;
+    vs.blocked = 0;
+    vs.written = 0;
+    vs.copy_len = 0;
+    sink out = {iovec_put_char, iovec_put_span, iovec_put_ref, &vs, 0, 0};
+
+    if (fd == stdout->fd && fflush(stdout) != 0) {
+        return EOF;
+    }
+
+    format_to_buffer(&out, format, ap);
+
+    if (iovec_submit(&vs) == EOF) {
+        out.error = 1;
+    }
+
+    if (vs.blocked) {
+        return (int)vs.written;
+    }
+    return out.error ? EOF : (int)out.count;
+}
+
+__attribute__((format(printf, 2, 3))) //
+int dprintfv(int fd, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = vdprintfv(fd, format, ap);
+    va_end(ap);
+    return len;
+}
+
+/*
+ * Bounded formatting into memory
+ * At most n - 1 bytes are stored followed by a terminator (nothing is
+ * stored when n is 0). Returns the length the full output would have, so
+ * a result >= n means it was truncated
+ */
+int vsnprintf(char *buf, size_t n, const char *format, va_list ap) {
+    memory_sink mem;
+    sink out;
+    memory_sink_init(&out, &mem, buf, n);
+
+    format_to_buffer(&out, format, ap);
+
+    return memory_sink_finish(&out, &mem);
+}
+
+__attribute__((format(printf, 3, 4))) //
+int snprintf(char *buf, size_t n, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = vsnprintf(buf, n, format, ap);
+    va_end(ap);
+    return len;
+}
+
+// Unbounded version, the caller guarantees buf is large enough
+int vsprintf(char *buf, const char *format, va_list ap) {
+    return vsnprintf(buf, (size_t)-1, format, ap);
+}
+
+__attribute__((format(printf, 2, 3))) //
+int sprintf(char *buf, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = vsprintf(buf, format, ap);
+    va_end(ap);
+    return len;
+}
+
+/*
+ * Formatting into an arena, the string lives until arena_reset(a)
+ * Returns NULL if memory ran out
+ */
+char *arena_vprintf(arena *a, const char *format, va_list ap) {
+    arena_sink as;
+    sink out;
+    arena_sink_init(&out, &as, a);
+
+    format_to_buffer(&out, format, ap);
+
+    return arena_sink_finish(&out, &as);
+}
+
+__attribute__((format(printf, 2, 3))) //
+char *arena_printf(arena *a, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    char *s = arena_vprintf(a, format, ap);
+    va_end(ap);
+    return s;
+}
+
+/*
+ * Allocating formatting
+ * The string goes in thread_arena() and there is no free(): it stays
+ * valid until arena_reset(thread_arena()), which frees all of them at
+ * once (for a thread from thread_create(), at the latest thread_join()).
+ * Returns the length, or -1 with *strp undefined if memory ran out
+ */
+int vasprintf(char **strp, const char *format, va_list ap) {
+    arena_sink as;
+    sink out;
+    arena_sink_init(&out, &as, thread_arena());
+
+    format_to_buffer(&out, format, ap);
+
+    *strp = arena_sink_finish(&out, &as);
+    return *strp != NULL ? (int)out.count : -1;
+}
+
+__attribute__((format(printf, 2, 3))) //
+int asprintf(char **strp, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = vasprintf(strp, format, ap);
+    va_end(ap);
+    return len;
+}
+
+#ifdef PRINTF_STATS
+static void stats_timer_line(sink *out, const char *name, stats_timer t) {
+    double ns = (double)t.ticks * 1e9 / (double)arch_counter_frequency();
+    sink_printf(out,
+                "%-9s %12lu calls %12.3f ms %9.1f ns/call\n",
+                name,
+                (unsigned long)t.calls,
+                ns / 1e6,
+                t.calls ? ns / (double)t.calls : 0.0);
+}
+#endif
+
+/*
+ * Print the PRINTF_STATS counters to fd in one write()
+ * They are copied first, so the dump does not count itself. Returns the
+ * bytes written or EOF. Without PRINTF_STATS nothing is counted and
+ * nothing is written, it returns 0
+ */
+int printf_stats_dump(int fd) {
+#ifdef PRINTF_STATS
+    char buf[4096];
+    memory_sink mem;
+    sink out;
+    memory_sink_init(&out, &mem, buf, sizeof(buf));
+
+    __typeof__(stats) snap;
+    memcpy(&snap, &stats, sizeof(snap));
+
+    sink_printf(&out, "conversion       calls\n");
+    for (int c = 0; c < 128; c++) {
+        if (snap.conversions[c] != 0) {
+            sink_printf(
+                &out, "%%%c %19lu\n", c, (unsigned long)snap.conversions[c]);
+        }
+    }
+    sink_printf(&out,
+                "formats   %12lu (%lu bytes)\n"
+                "writes    %12lu (%lu short, %lu failed)\n"
+                "flushes   %12lu\n",
+                (unsigned long)snap.formats,
+                (unsigned long)snap.bytes,
+                (unsigned long)snap.write.calls,
+                (unsigned long)snap.short_writes,
+                (unsigned long)snap.failed_writes,
+                (unsigned long)snap.flushes);
+    stats_timer_line(&out, "parse", snap.parse);
+    stats_timer_line(&out, "integer", snap.integer);
+    stats_timer_line(&out, "float", snap.floating);
+    stats_timer_line(&out, "write", snap.write);
+
+    ssize_t len = mem.len;
+    return write(fd, buf, len) == len ? (int)len : EOF;
+#else
+    (void)fd;
+    return 0;
+#endif
+}
+
+/*
+ * printf() with a compiled format, see printf_compile()
+ */
+int printf_compiled(const printf_format *compiled, ...) {
+    va_list ap;
+    va_start(ap, compiled);
+    int len = stream_format(stdout, NULL, compiled, ap);
+    va_end(ap);
+    return len;
+}
+
+int sink_printf_compiled(sink *out, const printf_format *compiled, ...) {
+    va_list ap;
+    va_start(ap, compiled);
+    format_compiled(out, compiled, ap);
+    va_end(ap);
+    return out->error ? EOF : (int)out->count;
+}
+
+/*
+ * printf() for a constant format, compiled on the first call at each call
+ * site and reused after that. Falls back to plain printf() if the format
+ * has too many specifiers, and while another thread is compiling it: the
+ * one that wins the CAS compiles, the release store of the state makes
+ * the ops visible before anyone runs them
+ */
+#define PRINTF_COMPILED(format, ...)                                           \
+    ({                                                                         \
+        static printf_format _compiled;                                        \
+        /* 0 not compiled yet, 1 ready, -1 too complex, 2 compiling */         \
+        static int _state;                                                     \
+        int _seen = __atomic_load_n(&_state, __ATOMIC_ACQUIRE);                \
+        if (_seen == 0 && __atomic_compare_exchange_n(&_state,                 \
+                                                      &_seen,                  \
+                                                      2,                       \
+                                                      0,                       \
+                                                      __ATOMIC_ACQUIRE,        \
+                                                      __ATOMIC_ACQUIRE)) {     \
+            _seen = printf_compile(&_compiled, format) == 0 ? 1 : -1;          \
+            __atomic_store_n(&_state, _seen, __ATOMIC_RELEASE);                \
+        }                                                                      \
+        _seen == 1 ? printf_compiled(&_compiled, ##__VA_ARGS__)                \
+                   : (int)printf(format, ##__VA_ARGS__);                       \
+    })
+
+/*
+ * Complete printf() function with full format support
+ */
+__attribute__((format(printf, 1, 2))) //
+ssize_t printf(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+
+    // Output goes into the stdout buffer, the actual write() happens when
+    // it fills up, on a newline for terminals, on fflush() or at exit
+    int len = vfprintf(stdout, format, ap);
+
+    va_end(ap);
+
+    // A full non-blocking stdout is back-pressure, see fpending(), only a
+    // failed write() is fatal
+    if (len < 0 && !stdout->blocked) {
+        exit(EXIT_FAILURE);
+    }
+
+    return len;
+}
+
+/*
+ * Number parsing
+ * The parsers take a pointer and a bound and return how many bytes form
+ * the number, 0 when there is none. The bound is a scanf() width or what
+ * is left in a stream buffer, strtol() and friends pass SIZE_MAX and
+ * stop at the terminator like at any other byte that does not fit
+ */
+#define SIZE_MAX  (~(size_t)0)
+#define LONG_MAX  0x7FFFFFFFFFFFFFFFL
+#define LONG_MIN  (-LONG_MAX - 1)
+#define ULONG_MAX (~0UL)
+
+static inline int is_space(int c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline int is_digit(int c) {
+    return c >= '0' && c <= '9';
+}
+
+// Value of c as a digit in bases up to 36, 36 for anything else
+static inline unsigned digit_value(int c) {
+    if (is_digit(c)) {
+        return (unsigned)(c - '0');
+    }
+    c |= 0x20; // 'A' to 'a'
+    if (c >= 'a' && c <= 'z') {
+        return (unsigned)(c - 'a' + 10);
+    }
+    return 36;
+}
+
+/*
+ * SWAR digits: 8 bytes in one load, first byte lowest (little endian)
+ * A byte is a digit when subtracting '0' does not borrow and adding
+ * 0x46 does not reach 0x80, so the lowest flagged byte is the first one
+ * that is not a digit. Borrows and carries only travel upwards, past
+ * that byte, so they cannot hide it
+ */
+static inline int swar_digit_count(uint64_t word) {
+    uint64_t flags = ((word - 0x3030303030303030UL) |
+                      (word + 0x4646464646464646UL)) &
+                     0x8080808080808080UL;
+    return flags ? __builtin_ctzl(flags) >> 3 : 8;
+}
+
+/*
+ * Value of the first count (1 to 8) digits of word
+ * Shorter runs are moved to the top and padded with '0' in front. Then
+ * neighbouring digits are merged into 2, 4 and 8 digit numbers with one
+ * multiply each (Lemire's parse_eight_digits)
+ */
+static inline uint32_t swar_digit_value(uint64_t word, int count) {
+    if (count < 8) {
+        int shift = (8 - count) * 8;
+        word = (word << shift) | (0x3030303030303030UL >> (64 - shift));
+    }
+
+    word -= 0x3030303030303030UL;
+    word = word * 10 + (word >> 8);
+    word = (((word & 0x000000FF000000FFUL) * (100 + (1000000UL << 32))) +
+            (((word >> 16) & 0x000000FF000000FFUL) * (1 + (10000UL << 32)))) >>
+           32;
+    return (uint32_t)word;
+}
+
+/*
+ * Decimal digits at s, at most max of them
+ * 19 digits always fit in 64 bits, those go 8 at a time. A load is only
+ * done when it stays inside the page, so it cannot fault past the end of
+ * a string (the same rule as strlen_swar()). Longer numbers continue
+ * one digit at a time with an overflow check, overflow sets *overflow
+ * and the digits are still consumed. Returns the number of digits
+ */
+static size_t
+parse_decimal(const char *s, size_t max, uint64_t *value, int *overflow) {
+    uint64_t v = 0;
+    size_t n = 0;
+
+    while (n < max && n < 19 && ((uintptr_t)(s + n) & 4095) <= 4088) {
+        uint64_t word;
+        memcpy(&word, s + n, sizeof(word));
+
+        size_t count = (size_t)swar_digit_count(word);
+        if (count > max - n) {
+            count = max - n;
+        }
+        if (count > 19 - n) {
+            count = 19 - n;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        v = v * powers_of_10[count] + swar_digit_value(word, (int)count);
+        n += count;
+        if (count < 8) {
+            break;
+        }
+    }
+
+    while (n < max && is_digit(s[n])) {
+        unsigned digit = (unsigned)(s[n] - '0');
+        if (v > (ULONG_MAX - digit) / 10) {
+            *overflow = 1;
         } else {
-            flags->length_modifier = 'l'; // l
-            format++;
+            v = v * 10 + digit;
+        }
+        n++;
+    }
+
+    *value = v;
+    return n;
+}
+
+// Digits in base 2 to 36 at s, one at a time, see parse_decimal()
+static size_t parse_digits(
+    const char *s, size_t max, unsigned base, uint64_t *value, int *overflow) {
+    uint64_t v = 0;
+    size_t n = 0;
+    unsigned digit;
+
+    while (n < max && (digit = digit_value(s[n])) < base) {
+        if (v > (ULONG_MAX - digit) / base) {
+            *overflow = 1;
+        } else {
+            v = v * base + digit;
+        }
+        n++;
+    }
+
+    *value = v;
+    return n;
+}
+
+/*
+ * Integer in strtol() syntax without the leading whitespace: a sign,
+ * then digits, base 16 allows "0x", base 0 picks 16 for "0x", 8 for a
+ * leading 0 and 10 otherwise. *value gets the magnitude
+ */
+static size_t parse_integer(const char *s,
+                            size_t max,
+                            int base,
+                            uint64_t *value,
+                            int *negative,
+                            int *overflow) {
+    size_t n = 0;
+
+    *negative = 0;
+    *overflow = 0;
+    if (n < max && (s[n] == '+' || s[n] == '-')) {
+        *negative = s[n] == '-';
+        n++;
+    }
+
+    // "0x" is only a prefix when a hex digit follows, "0xg" is a 0
+    if ((base == 0 || base == 16) && n + 2 < max && s[n] == '0' &&
+        (s[n + 1] | 0x20) == 'x' && digit_value(s[n + 2]) < 16) {
+        n += 2;
+        base = 16;
+    } else if (base == 0) {
+        base = n < max && s[n] == '0' ? 8 : 10;
+    }
+
+    size_t digits;
+    if (base == 10) {
+        digits = parse_decimal(s + n, max - n, value, overflow);
+    } else {
+        digits = parse_digits(s + n, max - n, (unsigned)base, value, overflow);
+    }
+
+    // A sign alone is not a number
+    return digits ? n + digits : 0;
+}
+
+// Leading whitespace, then parse_integer() on a terminated string
+static size_t string_integer(const char *s,
+                             int base,
+                             uint64_t *value,
+                             int *negative,
+                             int *overflow) {
+    size_t space = 0;
+    while (is_space(s[space])) {
+        space++;
+    }
+
+    if (base != 0 && (base < 2 || base > 36)) {
+        return 0;
+    }
+    size_t n =
+        parse_integer(s + space, SIZE_MAX, base, value, negative, overflow);
+    return n ? space + n : 0;
+}
+
+// Clamp a parsed magnitude to long like strtol()
+static long integer_to_long(uint64_t magnitude, int negative, int overflow) {
+    uint64_t limit = negative ? 1UL << 63 : (uint64_t)LONG_MAX;
+    if (overflow || magnitude > limit) {
+        return negative ? LONG_MIN : LONG_MAX;
+    }
+    return negative ? (long)(0 - magnitude) : (long)magnitude;
+}
+
+/*
+ * String to long, same rules as the C library but errno does not exist
+ * here, so out of range values are only clamped to LONG_MIN or LONG_MAX
+ * end gets the first byte after the number, or s when there is none
+ */
+long strtol(const char *s, char **end, int base) {
+    uint64_t magnitude = 0;
+    int negative;
+    int overflow;
+
+    size_t n = string_integer(s, base, &magnitude, &negative, &overflow);
+    if (end != NULL) {
+        *end = (char *)s + n;
+    }
+    return n ? integer_to_long(magnitude, negative, overflow) : 0;
+}
+
+// String to unsigned long, "-1" wraps to ULONG_MAX like in C
+unsigned long strtoul(const char *s, char **end, int base) {
+    uint64_t magnitude = 0;
+    int negative;
+    int overflow;
+
+    size_t n = string_integer(s, base, &magnitude, &negative, &overflow);
+    if (end != NULL) {
+        *end = (char *)s + n;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    if (overflow) {
+        return ULONG_MAX;
+    }
+    return negative ? 0 - magnitude : magnitude;
+}
+
+/*
+ * Decimal to double, correctly rounded
+ * Most inputs have at most 19 digits and a small exponent, then the
+ * digits and the power of ten are both exact doubles and one multiply or
+ * divide rounds correctly (Clinger's fast path). Full precision ones
+ * (%.17g output) do not, for them the first 19 digits are multiplied by
+ * a 128-bit power of 5 (Eisel-Lemire, see eisel_lemire()), which decides
+ * the rounding for all but the inputs within a hair of a halfway point
+ * (or, past 19 digits, where the digits left out could decide it). Only
+ * those go the slow way: the first 19 digits scaled by powers of ten give
+ * a result within a few units in the last place, and that is fixed
+ * exactly: the input is compared with the halfway points to the
+ * neighbouring doubles, built with decimal_from_binary(), and moved one
+ * step at a time until it lies between them. Halfway inputs go to the
+ * even mantissa. Digits past DECIMAL_DIGITS cannot change the rounding
+ * except for breaking a tie, sticky says whether any of them was not 0
+ */
+static const double powers_of_10_double[23] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/*
+ * 5^q for q from POW5_128_MIN to POW5_128_MAX, shifted so the top bit is
+ * set and cut to 128 bits (high word first), always rounded down. That
+ * range is every power decimal_to_double() can ask for: 19 digits times
+ * 10^-342 is below half the smallest subnormal, 10^309 is past DBL_MAX
+ */
+#define POW5_128_MIN -342
+#define POW5_128_MAX 308
+
+static const uint64_t powers_of_5_128[POW5_128_MAX - POW5_128_MIN + 1][2] = {
+    {0xeef453d6923bd65a, 0x113faa2906a13b3f},
+    {0x9558b4661b6565f8, 0x4ac7ca59a424c507},
+    {0xbaaee17fa23ebf76, 0x5d79bcf00d2df649},
+    {0xe95a99df8ace6f53, 0xf4d82c2c107973dc},
+    {0x91d8a02bb6c10594, 0x79071b9b8a4be869},
+    {0xb64ec836a47146f9, 0x9748e2826cdee284},
+    {0xe3e27a444d8d98b7, 0xfd1b1b2308169b25},
+    {0x8e6d8c6ab0787f72, 0xfe30f0f5e50e20f7},
+    {0xb208ef855c969f4f, 0xbdbd2d335e51a935},
+    {0xde8b2b66b3bc4723, 0xad2c788035e61382},
+    {0x8b16fb203055ac76, 0x4c3bcb5021afcc31},
+    {0xaddcb9e83c6b1793, 0xdf4abe242a1bbf3d},
+    {0xd953e8624b85dd78, 0xd71d6dad34a2af0d},
+    {0x87d4713d6f33aa6b, 0x8672648c40e5ad68},
+    {0xa9c98d8ccb009506, 0x680efdaf511f18c2},
+    {0xd43bf0effdc0ba48, 0x0212bd1b2566def2},
+    {0x84a57695fe98746d, 0x014bb630f7604b57},
+    {0xa5ced43b7e3e9188, 0x419ea3bd35385e2d},
+    {0xcf42894a5dce35ea, 0x52064cac828675b9},
+    {0x818995ce7aa0e1b2, 0x7343efebd1940993},
+    {0xa1ebfb4219491a1f, 0x1014ebe6c5f90bf8},
+    {0xca66fa129f9b60a6, 0xd41a26e077774ef6},
+    {0xfd00b897478238d0, 0x8920b098955522b4},
+    {0x9e20735e8cb16382, 0x55b46e5f5d5535b0},
+    {0xc5a890362fddbc62, 0xeb2189f734aa831d},
+    {0xf712b443bbd52b7b, 0xa5e9ec7501d523e4},
+    {0x9a6bb0aa55653b2d, 0x47b233c92125366e},
+    {0xc1069cd4eabe89f8, 0x999ec0bb696e840a},
+    {0xf148440a256e2c76, 0xc00670ea43ca250d},
+    {0x96cd2a865764dbca, 0x380406926a5e5728},
+    {0xbc807527ed3e12bc, 0xc605083704f5ecf2},
+    {0xeba09271e88d976b, 0xf7864a44c633682e},
+    {0x93445b8731587ea3, 0x7ab3ee6afbe0211d},
+    {0xb8157268fdae9e4c, 0x5960ea05bad82964},
+    {0xe61acf033d1a45df, 0x6fb92487298e33bd},
+    {0x8fd0c16206306bab, 0xa5d3b6d479f8e056},
+    {0xb3c4f1ba87bc8696, 0x8f48a4899877186c},
+    {0xe0b62e2929aba83c, 0x331acdabfe94de87},
+    {0x8c71dcd9ba0b4925, 0x9ff0c08b7f1d0b14},
+    {0xaf8e5410288e1b6f, 0x07ecf0ae5ee44dd9},
+    {0xdb71e91432b1a24a, 0xc9e82cd9f69d6150},
+    {0x892731ac9faf056e, 0xbe311c083a225cd2},
+    {0xab70fe17c79ac6ca, 0x6dbd630a48aaf406},
+    {0xd64d3d9db981787d, 0x092cbbccdad5b108},
+    {0x85f0468293f0eb4e, 0x25bbf56008c58ea5},
+    {0xa76c582338ed2621, 0xaf2af2b80af6f24e},
+    {0xd1476e2c07286faa, 0x1af5af660db4aee1},
+    {0x82cca4db847945ca, 0x50d98d9fc890ed4d},
+    {0xa37fce126597973c, 0xe50ff107bab528a0},
+    {0xcc5fc196fefd7d0c, 0x1e53ed49a96272c8},
+    {0xff77b1fcbebcdc4f, 0x25e8e89c13bb0f7a},
+    {0x9faacf3df73609b1, 0x77b191618c54e9ac},
+    {0xc795830d75038c1d, 0xd59df5b9ef6a2417},
+    {0xf97ae3d0d2446f25, 0x4b0573286b44ad1d},
+    {0x9becce62836ac577, 0x4ee367f9430aec32},
+    {0xc2e801fb244576d5, 0x229c41f793cda73f},
+    {0xf3a20279ed56d48a, 0x6b43527578c1110f},
+    {0x9845418c345644d6, 0x830a13896b78aaa9},
+    {0xbe5691ef416bd60c, 0x23cc986bc656d553},
+    {0xedec366b11c6cb8f, 0x2cbfbe86b7ec8aa8},
+    {0x94b3a202eb1c3f39, 0x7bf7d71432f3d6a9},
+    {0xb9e08a83a5e34f07, 0xdaf5ccd93fb0cc53},
+    {0xe858ad248f5c22c9, 0xd1b3400f8f9cff68},
+    {0x91376c36d99995be, 0x23100809b9c21fa1},
+    {0xb58547448ffffb2d, 0xabd40a0c2832a78a},
+    {0xe2e69915b3fff9f9, 0x16c90c8f323f516c},
+    {0x8dd01fad907ffc3b, 0xae3da7d97f6792e3},
+    {0xb1442798f49ffb4a, 0x99cd11cfdf41779c},
+    {0xdd95317f31c7fa1d, 0x40405643d711d583},
+    {0x8a7d3eef7f1cfc52, 0x482835ea666b2572},
+    {0xad1c8eab5ee43b66, 0xda3243650005eecf},
+    {0xd863b256369d4a40, 0x90bed43e40076a82},
+    {0x873e4f75e2224e68, 0x5a7744a6e804a291},
+    {0xa90de3535aaae202, 0x711515d0a205cb36},
+    {0xd3515c2831559a83, 0x0d5a5b44ca873e03},
+    {0x8412d9991ed58091, 0xe858790afe9486c2},
+    {0xa5178fff668ae0b6, 0x626e974dbe39a872},
+    {0xce5d73ff402d98e3, 0xfb0a3d212dc8128f},
+    {0x80fa687f881c7f8e, 0x7ce66634bc9d0b99},
+    {0xa139029f6a239f72, 0x1c1fffc1ebc44e80},
+    {0xc987434744ac874e, 0xa327ffb266b56220},
+    {0xfbe9141915d7a922, 0x4bf1ff9f0062baa8},
+    {0x9d71ac8fada6c9b5, 0x6f773fc3603db4a9},
+    {0xc4ce17b399107c22, 0xcb550fb4384d21d3},
+    {0xf6019da07f549b2b, 0x7e2a53a146606a48},
+    {0x99c102844f94e0fb, 0x2eda7444cbfc426d},
+    {0xc0314325637a1939, 0xfa911155fefb5308},
+    {0xf03d93eebc589f88, 0x793555ab7eba27ca},
+    {0x96267c7535b763b5, 0x4bc1558b2f3458de},
+    {0xbbb01b9283253ca2, 0x9eb1aaedfb016f16},
+    {0xea9c227723ee8bcb, 0x465e15a979c1cadc},
+    {0x92a1958a7675175f, 0x0bfacd89ec191ec9},
+    {0xb749faed14125d36, 0xcef980ec671f667b},
+    {0xe51c79a85916f484, 0x82b7e12780e7401a},
+    {0x8f31cc0937ae58d2, 0xd1b2ecb8b0908810},
+    {0xb2fe3f0b8599ef07, 0x861fa7e6dcb4aa15},
+    {0xdfbdcece67006ac9, 0x67a791e093e1d49a},
+    {0x8bd6a141006042bd, 0xe0c8bb2c5c6d24e0},
+    {0xaecc49914078536d, 0x58fae9f773886e18},
+    {0xda7f5bf590966848, 0xaf39a475506a899e},
+    {0x888f99797a5e012d, 0x6d8406c952429603},
+    {0xaab37fd7d8f58178, 0xc8e5087ba6d33b83},
+    {0xd5605fcdcf32e1d6, 0xfb1e4a9a90880a64},
+    {0x855c3be0a17fcd26, 0x5cf2eea09a55067f},
+    {0xa6b34ad8c9dfc06f, 0xf42faa48c0ea481e},
+    {0xd0601d8efc57b08b, 0xf13b94daf124da26},
+    {0x823c12795db6ce57, 0x76c53d08d6b70858},
+    {0xa2cb1717b52481ed, 0x54768c4b0c64ca6e},
+    {0xcb7ddcdda26da268, 0xa9942f5dcf7dfd09},
+    {0xfe5d54150b090b02, 0xd3f93b35435d7c4c},
+    {0x9efa548d26e5a6e1, 0xc47bc5014a1a6daf},
+    {0xc6b8e9b0709f109a, 0x359ab6419ca1091b},
+    {0xf867241c8cc6d4c0, 0xc30163d203c94b62},
+    {0x9b407691d7fc44f8, 0x79e0de63425dcf1d},
+    {0xc21094364dfb5636, 0x985915fc12f542e4},
+    {0xf294b943e17a2bc4, 0x3e6f5b7b17b2939d},
+    {0x979cf3ca6cec5b5a, 0xa705992ceecf9c42},
+    {0xbd8430bd08277231, 0x50c6ff782a838353},
+    {0xece53cec4a314ebd, 0xa4f8bf5635246428},
+    {0x940f4613ae5ed136, 0x871b7795e136be99},
+    {0xb913179899f68584, 0x28e2557b59846e3f},
+    {0xe757dd7ec07426e5, 0x331aeada2fe589cf},
+    {0x9096ea6f3848984f, 0x3ff0d2c85def7621},
+    {0xb4bca50b065abe63, 0x0fed077a756b53a9},
+    {0xe1ebce4dc7f16dfb, 0xd3e8495912c62894},
+    {0x8d3360f09cf6e4bd, 0x64712dd7abbbd95c},
+    {0xb080392cc4349dec, 0xbd8d794d96aacfb3},
+    {0xdca04777f541c567, 0xecf0d7a0fc5583a0},
+    {0x89e42caaf9491b60, 0xf41686c49db57244},
+    {0xac5d37d5b79b6239, 0x311c2875c522ced5},
+    {0xd77485cb25823ac7, 0x7d633293366b828b},
+    {0x86a8d39ef77164bc, 0xae5dff9c02033197},
+    {0xa8530886b54dbdeb, 0xd9f57f830283fdfc},
+    {0xd267caa862a12d66, 0xd072df63c324fd7b},
+    {0x8380dea93da4bc60, 0x4247cb9e59f71e6d},
+    {0xa46116538d0deb78, 0x52d9be85f074e608},
+    {0xcd795be870516656, 0x67902e276c921f8b},
+    {0x806bd9714632dff6, 0x00ba1cd8a3db53b6},
+    {0xa086cfcd97bf97f3, 0x80e8a40eccd228a4},
+    {0xc8a883c0fdaf7df0, 0x6122cd128006b2cd},
+    {0xfad2a4b13d1b5d6c, 0x796b805720085f81},
+    {0x9cc3a6eec6311a63, 0xcbe3303674053bb0},
+    {0xc3f490aa77bd60fc, 0xbedbfc4411068a9c},
+    {0xf4f1b4d515acb93b, 0xee92fb5515482d44},
+    {0x991711052d8bf3c5, 0x751bdd152d4d1c4a},
+    {0xbf5cd54678eef0b6, 0xd262d45a78a0635d},
+    {0xef340a98172aace4, 0x86fb897116c87c34},
+    {0x9580869f0e7aac0e, 0xd45d35e6ae3d4da0},
+    {0xbae0a846d2195712, 0x8974836059cca109},
+    {0xe998d258869facd7, 0x2bd1a438703fc94b},
+    {0x91ff83775423cc06, 0x7b6306a34627ddcf},
+    {0xb67f6455292cbf08, 0x1a3bc84c17b1d542},
+    {0xe41f3d6a7377eeca, 0x20caba5f1d9e4a93},
+    {0x8e938662882af53e, 0x547eb47b7282ee9c},
+    {0xb23867fb2a35b28d, 0xe99e619a4f23aa43},
+    {0xdec681f9f4c31f31, 0x6405fa00e2ec94d4},
+    {0x8b3c113c38f9f37e, 0xde83bc408dd3dd04},
+    {0xae0b158b4738705e, 0x9624ab50b148d445},
+    {0xd98ddaee19068c76, 0x3badd624dd9b0957},
+    {0x87f8a8d4cfa417c9, 0xe54ca5d70a80e5d6},
+    {0xa9f6d30a038d1dbc, 0x5e9fcf4ccd211f4c},
+    {0xd47487cc8470652b, 0x7647c3200069671f},
+    {0x84c8d4dfd2c63f3b, 0x29ecd9f40041e073},
+    {0xa5fb0a17c777cf09, 0xf468107100525890},
+    {0xcf79cc9db955c2cc, 0x7182148d4066eeb4},
+    {0x81ac1fe293d599bf, 0xc6f14cd848405530},
+    {0xa21727db38cb002f, 0xb8ada00e5a506a7c},
+    {0xca9cf1d206fdc03b, 0xa6d90811f0e4851c},
+    {0xfd442e4688bd304a, 0x908f4a166d1da663},
+    {0x9e4a9cec15763e2e, 0x9a598e4e043287fe},
+    {0xc5dd44271ad3cdba, 0x40eff1e1853f29fd},
+    {0xf7549530e188c128, 0xd12bee59e68ef47c},
+    {0x9a94dd3e8cf578b9, 0x82bb74f8301958ce},
+    {0xc13a148e3032d6e7, 0xe36a52363c1faf01},
+    {0xf18899b1bc3f8ca1, 0xdc44e6c3cb279ac1},
+    {0x96f5600f15a7b7e5, 0x29ab103a5ef8c0b9},
+    {0xbcb2b812db11a5de, 0x7415d448f6b6f0e7},
+    {0xebdf661791d60f56, 0x111b495b3464ad21},
+    {0x936b9fcebb25c995, 0xcab10dd900beec34},
+    {0xb84687c269ef3bfb, 0x3d5d514f40eea742},
+    {0xe65829b3046b0afa, 0x0cb4a5a3112a5112},
+    {0x8ff71a0fe2c2e6dc, 0x47f0e785eaba72ab},
+    {0xb3f4e093db73a093, 0x59ed216765690f56},
+    {0xe0f218b8d25088b8, 0x306869c13ec3532c},
+    {0x8c974f7383725573, 0x1e414218c73a13fb},
+    {0xafbd2350644eeacf, 0xe5d1929ef90898fa},
+    {0xdbac6c247d62a583, 0xdf45f746b74abf39},
+    {0x894bc396ce5da772, 0x6b8bba8c328eb783},
+    {0xab9eb47c81f5114f, 0x066ea92f3f326564},
+    {0xd686619ba27255a2, 0xc80a537b0efefebd},
+    {0x8613fd0145877585, 0xbd06742ce95f5f36},
+    {0xa798fc4196e952e7, 0x2c48113823b73704},
+    {0xd17f3b51fca3a7a0, 0xf75a15862ca504c5},
+    {0x82ef85133de648c4, 0x9a984d73dbe722fb},
+    {0xa3ab66580d5fdaf5, 0xc13e60d0d2e0ebba},
+    {0xcc963fee10b7d1b3, 0x318df905079926a8},
+    {0xffbbcfe994e5c61f, 0xfdf17746497f7052},
+    {0x9fd561f1fd0f9bd3, 0xfeb6ea8bedefa633},
+    {0xc7caba6e7c5382c8, 0xfe64a52ee96b8fc0},
+    {0xf9bd690a1b68637b, 0x3dfdce7aa3c673b0},
+    {0x9c1661a651213e2d, 0x06bea10ca65c084e},
+    {0xc31bfa0fe5698db8, 0x486e494fcff30a62},
+    {0xf3e2f893dec3f126, 0x5a89dba3c3efccfa},
+    {0x986ddb5c6b3a76b7, 0xf89629465a75e01c},
+    {0xbe89523386091465, 0xf6bbb397f1135823},
+    {0xee2ba6c0678b597f, 0x746aa07ded582e2c},
+    {0x94db483840b717ef, 0xa8c2a44eb4571cdc},
+    {0xba121a4650e4ddeb, 0x92f34d62616ce413},
+    {0xe896a0d7e51e1566, 0x77b020baf9c81d17},
+    {0x915e2486ef32cd60, 0x0ace1474dc1d122e},
+    {0xb5b5ada8aaff80b8, 0x0d819992132456ba},
+    {0xe3231912d5bf60e6, 0x10e1fff697ed6c69},
+    {0x8df5efabc5979c8f, 0xca8d3ffa1ef463c1},
+    {0xb1736b96b6fd83b3, 0xbd308ff8a6b17cb2},
+    {0xddd0467c64bce4a0, 0xac7cb3f6d05ddbde},
+    {0x8aa22c0dbef60ee4, 0x6bcdf07a423aa96b},
+    {0xad4ab7112eb3929d, 0x86c16c98d2c953c6},
+    {0xd89d64d57a607744, 0xe871c7bf077ba8b7},
+    {0x87625f056c7c4a8b, 0x11471cd764ad4972},
+    {0xa93af6c6c79b5d2d, 0xd598e40d3dd89bcf},
+    {0xd389b47879823479, 0x4aff1d108d4ec2c3},
+    {0x843610cb4bf160cb, 0xcedf722a585139ba},
+    {0xa54394fe1eedb8fe, 0xc2974eb4ee658828},
+    {0xce947a3da6a9273e, 0x733d226229feea32},
+    {0x811ccc668829b887, 0x0806357d5a3f525f},
+    {0xa163ff802a3426a8, 0xca07c2dcb0cf26f7},
+    {0xc9bcff6034c13052, 0xfc89b393dd02f0b5},
+    {0xfc2c3f3841f17c67, 0xbbac2078d443ace2},
+    {0x9d9ba7832936edc0, 0xd54b944b84aa4c0d},
+    {0xc5029163f384a931, 0x0a9e795e65d4df11},
+    {0xf64335bcf065d37d, 0x4d4617b5ff4a16d5},
+    {0x99ea0196163fa42e, 0x504bced1bf8e4e45},
+    {0xc06481fb9bcf8d39, 0xe45ec2862f71e1d6},
+    {0xf07da27a82c37088, 0x5d767327bb4e5a4c},
+    {0x964e858c91ba2655, 0x3a6a07f8d510f86f},
+    {0xbbe226efb628afea, 0x890489f70a55368b},
+    {0xeadab0aba3b2dbe5, 0x2b45ac74ccea842e},
+    {0x92c8ae6b464fc96f, 0x3b0b8bc90012929d},
+    {0xb77ada0617e3bbcb, 0x09ce6ebb40173744},
+    {0xe55990879ddcaabd, 0xcc420a6a101d0515},
+    {0x8f57fa54c2a9eab6, 0x9fa946824a12232d},
+    {0xb32df8e9f3546564, 0x47939822dc96abf9},
+    {0xdff9772470297ebd, 0x59787e2b93bc56f7},
+    {0x8bfbea76c619ef36, 0x57eb4edb3c55b65a},
+    {0xaefae51477a06b03, 0xede622920b6b23f1},
+    {0xdab99e59958885c4, 0xe95fab368e45eced},
+    {0x88b402f7fd75539b, 0x11dbcb0218ebb414},
+    {0xaae103b5fcd2a881, 0xd652bdc29f26a119},
+    {0xd59944a37c0752a2, 0x4be76d3346f0495f},
+    {0x857fcae62d8493a5, 0x6f70a4400c562ddb},
+    {0xa6dfbd9fb8e5b88e, 0xcb4ccd500f6bb952},
+    {0xd097ad07a71f26b2, 0x7e2000a41346a7a7},
+    {0x825ecc24c873782f, 0x8ed400668c0c28c8},
+    {0xa2f67f2dfa90563b, 0x728900802f0f32fa},
+    {0xcbb41ef979346bca, 0x4f2b40a03ad2ffb9},
+    {0xfea126b7d78186bc, 0xe2f610c84987bfa8},
+    {0x9f24b832e6b0f436, 0x0dd9ca7d2df4d7c9},
+    {0xc6ede63fa05d3143, 0x91503d1c79720dbb},
+    {0xf8a95fcf88747d94, 0x75a44c6397ce912a},
+    {0x9b69dbe1b548ce7c, 0xc986afbe3ee11aba},
+    {0xc24452da229b021b, 0xfbe85badce996168},
+    {0xf2d56790ab41c2a2, 0xfae27299423fb9c3},
+    {0x97c560ba6b0919a5, 0xdccd879fc967d41a},
+    {0xbdb6b8e905cb600f, 0x5400e987bbc1c920},
+    {0xed246723473e3813, 0x290123e9aab23b68},
+    {0x9436c0760c86e30b, 0xf9a0b6720aaf6521},
+    {0xb94470938fa89bce, 0xf808e40e8d5b3e69},
+    {0xe7958cb87392c2c2, 0xb60b1d1230b20e04},
+    {0x90bd77f3483bb9b9, 0xb1c6f22b5e6f48c2},
+    {0xb4ecd5f01a4aa828, 0x1e38aeb6360b1af3},
+    {0xe2280b6c20dd5232, 0x25c6da63c38de1b0},
+    {0x8d590723948a535f, 0x579c487e5a38ad0e},
+    {0xb0af48ec79ace837, 0x2d835a9df0c6d851},
+    {0xdcdb1b2798182244, 0xf8e431456cf88e65},
+    {0x8a08f0f8bf0f156b, 0x1b8e9ecb641b58ff},
+    {0xac8b2d36eed2dac5, 0xe272467e3d222f3f},
+    {0xd7adf884aa879177, 0x5b0ed81dcc6abb0f},
+    {0x86ccbb52ea94baea, 0x98e947129fc2b4e9},
+    {0xa87fea27a539e9a5, 0x3f2398d747b36224},
+    {0xd29fe4b18e88640e, 0x8eec7f0d19a03aad},
+    {0x83a3eeeef9153e89, 0x1953cf68300424ac},
+    {0xa48ceaaab75a8e2b, 0x5fa8c3423c052dd7},
+    {0xcdb02555653131b6, 0x3792f412cb06794d},
+    {0x808e17555f3ebf11, 0xe2bbd88bbee40bd0},
+    {0xa0b19d2ab70e6ed6, 0x5b6aceaeae9d0ec4},
+    {0xc8de047564d20a8b, 0xf245825a5a445275},
+    {0xfb158592be068d2e, 0xeed6e2f0f0d56712},
+    {0x9ced737bb6c4183d, 0x55464dd69685606b},
+    {0xc428d05aa4751e4c, 0xaa97e14c3c26b886},
+    {0xf53304714d9265df, 0xd53dd99f4b3066a8},
+    {0x993fe2c6d07b7fab, 0xe546a8038efe4029},
+    {0xbf8fdb78849a5f96, 0xde98520472bdd033},
+    {0xef73d256a5c0f77c, 0x963e66858f6d4440},
+    {0x95a8637627989aad, 0xdde7001379a44aa8},
+    {0xbb127c53b17ec159, 0x5560c018580d5d52},
+    {0xe9d71b689dde71af, 0xaab8f01e6e10b4a6},
+    {0x9226712162ab070d, 0xcab3961304ca70e8},
+    {0xb6b00d69bb55c8d1, 0x3d607b97c5fd0d22},
+    {0xe45c10c42a2b3b05, 0x8cb89a7db77c506a},
+    {0x8eb98a7a9a5b04e3, 0x77f3608e92adb242},
+    {0xb267ed1940f1c61c, 0x55f038b237591ed3},
+    {0xdf01e85f912e37a3, 0x6b6c46dec52f6688},
+    {0x8b61313bbabce2c6, 0x2323ac4b3b3da015},
+    {0xae397d8aa96c1b77, 0xabec975e0a0d081a},
+    {0xd9c7dced53c72255, 0x96e7bd358c904a21},
+    {0x881cea14545c7575, 0x7e50d64177da2e54},
+    {0xaa242499697392d2, 0xdde50bd1d5d0b9e9},
+    {0xd4ad2dbfc3d07787, 0x955e4ec64b44e864},
+    {0x84ec3c97da624ab4, 0xbd5af13bef0b113e},
+    {0xa6274bbdd0fadd61, 0xecb1ad8aeacdd58e},
+    {0xcfb11ead453994ba, 0x67de18eda5814af2},
+    {0x81ceb32c4b43fcf4, 0x80eacf948770ced7},
+    {0xa2425ff75e14fc31, 0xa1258379a94d028d},
+    {0xcad2f7f5359a3b3e, 0x096ee45813a04330},
+    {0xfd87b5f28300ca0d, 0x8bca9d6e188853fc},
+    {0x9e74d1b791e07e48, 0x775ea264cf55347d},
+    {0xc612062576589dda, 0x95364afe032a819d},
+    {0xf79687aed3eec551, 0x3a83ddbd83f52204},
+    {0x9abe14cd44753b52, 0xc4926a9672793542},
+    {0xc16d9a0095928a27, 0x75b7053c0f178293},
+    {0xf1c90080baf72cb1, 0x5324c68b12dd6338},
+    {0x971da05074da7bee, 0xd3f6fc16ebca5e03},
+    {0xbce5086492111aea, 0x88f4bb1ca6bcf584},
+    {0xec1e4a7db69561a5, 0x2b31e9e3d06c32e5},
+    {0x9392ee8e921d5d07, 0x3aff322e62439fcf},
+    {0xb877aa3236a4b449, 0x09befeb9fad487c2},
+    {0xe69594bec44de15b, 0x4c2ebe687989a9b3},
+    {0x901d7cf73ab0acd9, 0x0f9d37014bf60a10},
+    {0xb424dc35095cd80f, 0x538484c19ef38c94},
+    {0xe12e13424bb40e13, 0x2865a5f206b06fb9},
+    {0x8cbccc096f5088cb, 0xf93f87b7442e45d3},
+    {0xafebff0bcb24aafe, 0xf78f69a51539d748},
+    {0xdbe6fecebdedd5be, 0xb573440e5a884d1b},
+    {0x89705f4136b4a597, 0x31680a88f8953030},
+    {0xabcc77118461cefc, 0xfdc20d2b36ba7c3d},
+    {0xd6bf94d5e57a42bc, 0x3d32907604691b4c},
+    {0x8637bd05af6c69b5, 0xa63f9a49c2c1b10f},
+    {0xa7c5ac471b478423, 0x0fcf80dc33721d53},
+    {0xd1b71758e219652b, 0xd3c36113404ea4a8},
+    {0x83126e978d4fdf3b, 0x645a1cac083126e9},
+    {0xa3d70a3d70a3d70a, 0x3d70a3d70a3d70a3},
+    {0xcccccccccccccccc, 0xcccccccccccccccc},
+    {0x8000000000000000, 0x0000000000000000},
+    {0xa000000000000000, 0x0000000000000000},
+    {0xc800000000000000, 0x0000000000000000},
+    {0xfa00000000000000, 0x0000000000000000},
+    {0x9c40000000000000, 0x0000000000000000},
+    {0xc350000000000000, 0x0000000000000000},
+    {0xf424000000000000, 0x0000000000000000},
+    {0x9896800000000000, 0x0000000000000000},
+    {0xbebc200000000000, 0x0000000000000000},
+    {0xee6b280000000000, 0x0000000000000000},
+    {0x9502f90000000000, 0x0000000000000000},
+    {0xba43b74000000000, 0x0000000000000000},
+    {0xe8d4a51000000000, 0x0000000000000000},
+    {0x9184e72a00000000, 0x0000000000000000},
+    {0xb5e620f480000000, 0x0000000000000000},
+    {0xe35fa931a0000000, 0x0000000000000000},
+    {0x8e1bc9bf04000000, 0x0000000000000000},
+    {0xb1a2bc2ec5000000, 0x0000000000000000},
+    {0xde0b6b3a76400000, 0x0000000000000000},
+    {0x8ac7230489e80000, 0x0000000000000000},
+    {0xad78ebc5ac620000, 0x0000000000000000},
+    {0xd8d726b7177a8000, 0x0000000000000000},
+    {0x878678326eac9000, 0x0000000000000000},
+    {0xa968163f0a57b400, 0x0000000000000000},
+    {0xd3c21bcecceda100, 0x0000000000000000},
+    {0x84595161401484a0, 0x0000000000000000},
+    {0xa56fa5b99019a5c8, 0x0000000000000000},
+    {0xcecb8f27f4200f3a, 0x0000000000000000},
+    {0x813f3978f8940984, 0x4000000000000000},
+    {0xa18f07d736b90be5, 0x5000000000000000},
+    {0xc9f2c9cd04674ede, 0xa400000000000000},
+    {0xfc6f7c4045812296, 0x4d00000000000000},
+    {0x9dc5ada82b70b59d, 0xf020000000000000},
+    {0xc5371912364ce305, 0x6c28000000000000},
+    {0xf684df56c3e01bc6, 0xc732000000000000},
+    {0x9a130b963a6c115c, 0x3c7f400000000000},
+    {0xc097ce7bc90715b3, 0x4b9f100000000000},
+    {0xf0bdc21abb48db20, 0x1e86d40000000000},
+    {0x96769950b50d88f4, 0x1314448000000000},
+    {0xbc143fa4e250eb31, 0x17d955a000000000},
+    {0xeb194f8e1ae525fd, 0x5dcfab0800000000},
+    {0x92efd1b8d0cf37be, 0x5aa1cae500000000},
+    {0xb7abc627050305ad, 0xf14a3d9e40000000},
+    {0xe596b7b0c643c719, 0x6d9ccd05d0000000},
+    {0x8f7e32ce7bea5c6f, 0xe4820023a2000000},
+    {0xb35dbf821ae4f38b, 0xdda2802c8a800000},
+    {0xe0352f62a19e306e, 0xd50b2037ad200000},
+    {0x8c213d9da502de45, 0x4526f422cc340000},
+    {0xaf298d050e4395d6, 0x9670b12b7f410000},
+    {0xdaf3f04651d47b4c, 0x3c0cdd765f114000},
+    {0x88d8762bf324cd0f, 0xa5880a69fb6ac800},
+    {0xab0e93b6efee0053, 0x8eea0d047a457a00},
+    {0xd5d238a4abe98068, 0x72a4904598d6d880},
+    {0x85a36366eb71f041, 0x47a6da2b7f864750},
+    {0xa70c3c40a64e6c51, 0x999090b65f67d924},
+    {0xd0cf4b50cfe20765, 0xfff4b4e3f741cf6d},
+    {0x82818f1281ed449f, 0xbff8f10e7a8921a4},
+    {0xa321f2d7226895c7, 0xaff72d52192b6a0d},
+    {0xcbea6f8ceb02bb39, 0x9bf4f8a69f764490},
+    {0xfee50b7025c36a08, 0x02f236d04753d5b4},
+    {0x9f4f2726179a2245, 0x01d762422c946590},
+    {0xc722f0ef9d80aad6, 0x424d3ad2b7b97ef5},
+    {0xf8ebad2b84e0d58b, 0xd2e0898765a7deb2},
+    {0x9b934c3b330c8577, 0x63cc55f49f88eb2f},
+    {0xc2781f49ffcfa6d5, 0x3cbf6b71c76b25fb},
+    {0xf316271c7fc3908a, 0x8bef464e3945ef7a},
+    {0x97edd871cfda3a56, 0x97758bf0e3cbb5ac},
+    {0xbde94e8e43d0c8ec, 0x3d52eeed1cbea317},
+    {0xed63a231d4c4fb27, 0x4ca7aaa863ee4bdd},
+    {0x945e455f24fb1cf8, 0x8fe8caa93e74ef6a},
+    {0xb975d6b6ee39e436, 0xb3e2fd538e122b44},
+    {0xe7d34c64a9c85d44, 0x60dbbca87196b616},
+    {0x90e40fbeea1d3a4a, 0xbc8955e946fe31cd},
+    {0xb51d13aea4a488dd, 0x6babab6398bdbe41},
+    {0xe264589a4dcdab14, 0xc696963c7eed2dd1},
+    {0x8d7eb76070a08aec, 0xfc1e1de5cf543ca2},
+    {0xb0de65388cc8ada8, 0x3b25a55f43294bcb},
+    {0xdd15fe86affad912, 0x49ef0eb713f39ebe},
+    {0x8a2dbf142dfcc7ab, 0x6e3569326c784337},
+    {0xacb92ed9397bf996, 0x49c2c37f07965404},
+    {0xd7e77a8f87daf7fb, 0xdc33745ec97be906},
+    {0x86f0ac99b4e8dafd, 0x69a028bb3ded71a3},
+    {0xa8acd7c0222311bc, 0xc40832ea0d68ce0c},
+    {0xd2d80db02aabd62b, 0xf50a3fa490c30190},
+    {0x83c7088e1aab65db, 0x792667c6da79e0fa},
+    {0xa4b8cab1a1563f52, 0x577001b891185938},
+    {0xcde6fd5e09abcf26, 0xed4c0226b55e6f86},
+    {0x80b05e5ac60b6178, 0x544f8158315b05b4},
+    {0xa0dc75f1778e39d6, 0x696361ae3db1c721},
+    {0xc913936dd571c84c, 0x03bc3a19cd1e38e9},
+    {0xfb5878494ace3a5f, 0x04ab48a04065c723},
+    {0x9d174b2dcec0e47b, 0x62eb0d64283f9c76},
+    {0xc45d1df942711d9a, 0x3ba5d0bd324f8394},
+    {0xf5746577930d6500, 0xca8f44ec7ee36479},
+    {0x9968bf6abbe85f20, 0x7e998b13cf4e1ecb},
+    {0xbfc2ef456ae276e8, 0x9e3fedd8c321a67e},
+    {0xefb3ab16c59b14a2, 0xc5cfe94ef3ea101e},
+    {0x95d04aee3b80ece5, 0xbba1f1d158724a12},
+    {0xbb445da9ca61281f, 0x2a8a6e45ae8edc97},
+    {0xea1575143cf97226, 0xf52d09d71a3293bd},
+    {0x924d692ca61be758, 0x593c2626705f9c56},
+    {0xb6e0c377cfa2e12e, 0x6f8b2fb00c77836c},
+    {0xe498f455c38b997a, 0x0b6dfb9c0f956447},
+    {0x8edf98b59a373fec, 0x4724bd4189bd5eac},
+    {0xb2977ee300c50fe7, 0x58edec91ec2cb657},
+    {0xdf3d5e9bc0f653e1, 0x2f2967b66737e3ed},
+    {0x8b865b215899f46c, 0xbd79e0d20082ee74},
+    {0xae67f1e9aec07187, 0xecd8590680a3aa11},
+    {0xda01ee641a708de9, 0xe80e6f4820cc9495},
+    {0x884134fe908658b2, 0x3109058d147fdcdd},
+    {0xaa51823e34a7eede, 0xbd4b46f0599fd415},
+    {0xd4e5e2cdc1d1ea96, 0x6c9e18ac7007c91a},
+    {0x850fadc09923329e, 0x03e2cf6bc604ddb0},
+    {0xa6539930bf6bff45, 0x84db8346b786151c},
+    {0xcfe87f7cef46ff16, 0xe612641865679a63},
+    {0x81f14fae158c5f6e, 0x4fcb7e8f3f60c07e},
+    {0xa26da3999aef7749, 0xe3be5e330f38f09d},
+    {0xcb090c8001ab551c, 0x5cadf5bfd3072cc5},
+    {0xfdcb4fa002162a63, 0x73d9732fc7c8f7f6},
+    {0x9e9f11c4014dda7e, 0x2867e7fddcdd9afa},
+    {0xc646d63501a1511d, 0xb281e1fd541501b8},
+    {0xf7d88bc24209a565, 0x1f225a7ca91a4226},
+    {0x9ae757596946075f, 0x3375788de9b06958},
+    {0xc1a12d2fc3978937, 0x0052d6b1641c83ae},
+    {0xf209787bb47d6b84, 0xc0678c5dbd23a49a},
+    {0x9745eb4d50ce6332, 0xf840b7ba963646e0},
+    {0xbd176620a501fbff, 0xb650e5a93bc3d898},
+    {0xec5d3fa8ce427aff, 0xa3e51f138ab4cebe},
+    {0x93ba47c980e98cdf, 0xc66f336c36b10137},
+    {0xb8a8d9bbe123f017, 0xb80b0047445d4184},
+    {0xe6d3102ad96cec1d, 0xa60dc059157491e5},
+    {0x9043ea1ac7e41392, 0x87c89837ad68db2f},
+    {0xb454e4a179dd1877, 0x29babe4598c311fb},
+    {0xe16a1dc9d8545e94, 0xf4296dd6fef3d67a},
+    {0x8ce2529e2734bb1d, 0x1899e4a65f58660c},
+    {0xb01ae745b101e9e4, 0x5ec05dcff72e7f8f},
+    {0xdc21a1171d42645d, 0x76707543f4fa1f73},
+    {0x899504ae72497eba, 0x6a06494a791c53a8},
+    {0xabfa45da0edbde69, 0x0487db9d17636892},
+    {0xd6f8d7509292d603, 0x45a9d2845d3c42b6},
+    {0x865b86925b9bc5c2, 0x0b8a2392ba45a9b2},
+    {0xa7f26836f282b732, 0x8e6cac7768d7141e},
+    {0xd1ef0244af2364ff, 0x3207d795430cd926},
+    {0x8335616aed761f1f, 0x7f44e6bd49e807b8},
+    {0xa402b9c5a8d3a6e7, 0x5f16206c9c6209a6},
+    {0xcd036837130890a1, 0x36dba887c37a8c0f},
+    {0x802221226be55a64, 0xc2494954da2c9789},
+    {0xa02aa96b06deb0fd, 0xf2db9baa10b7bd6c},
+    {0xc83553c5c8965d3d, 0x6f92829494e5acc7},
+    {0xfa42a8b73abbf48c, 0xcb772339ba1f17f9},
+    {0x9c69a97284b578d7, 0xff2a760414536efb},
+    {0xc38413cf25e2d70d, 0xfef5138519684aba},
+    {0xf46518c2ef5b8cd1, 0x7eb258665fc25d69},
+    {0x98bf2f79d5993802, 0xef2f773ffbd97a61},
+    {0xbeeefb584aff8603, 0xaafb550ffacfd8fa},
+    {0xeeaaba2e5dbf6784, 0x95ba2a53f983cf38},
+    {0x952ab45cfa97a0b2, 0xdd945a747bf26183},
+    {0xba756174393d88df, 0x94f971119aeef9e4},
+    {0xe912b9d1478ceb17, 0x7a37cd5601aab85d},
+    {0x91abb422ccb812ee, 0xac62e055c10ab33a},
+    {0xb616a12b7fe617aa, 0x577b986b314d6009},
+    {0xe39c49765fdf9d94, 0xed5a7e85fda0b80b},
+    {0x8e41ade9fbebc27d, 0x14588f13be847307},
+    {0xb1d219647ae6b31c, 0x596eb2d8ae258fc8},
+    {0xde469fbd99a05fe3, 0x6fca5f8ed9aef3bb},
+    {0x8aec23d680043bee, 0x25de7bb9480d5854},
+    {0xada72ccc20054ae9, 0xaf561aa79a10ae6a},
+    {0xd910f7ff28069da4, 0x1b2ba1518094da04},
+    {0x87aa9aff79042286, 0x90fb44d2f05d0842},
+    {0xa99541bf57452b28, 0x353a1607ac744a53},
+    {0xd3fa922f2d1675f2, 0x42889b8997915ce8},
+    {0x847c9b5d7c2e09b7, 0x69956135febada11},
+    {0xa59bc234db398c25, 0x43fab9837e699095},
+    {0xcf02b2c21207ef2e, 0x94f967e45e03f4bb},
+    {0x8161afb94b44f57d, 0x1d1be0eebac278f5},
+    {0xa1ba1ba79e1632dc, 0x6462d92a69731732},
+    {0xca28a291859bbf93, 0x7d7b8f7503cfdcfe},
+    {0xfcb2cb35e702af78, 0x5cda735244c3d43e},
+    {0x9defbf01b061adab, 0x3a0888136afa64a7},
+    {0xc56baec21c7a1916, 0x088aaa1845b8fdd0},
+    {0xf6c69a72a3989f5b, 0x8aad549e57273d45},
+    {0x9a3c2087a63f6399, 0x36ac54e2f678864b},
+    {0xc0cb28a98fcf3c7f, 0x84576a1bb416a7dd},
+    {0xf0fdf2d3f3c30b9f, 0x656d44a2a11c51d5},
+    {0x969eb7c47859e743, 0x9f644ae5a4b1b325},
+    {0xbc4665b596706114, 0x873d5d9f0dde1fee},
+    {0xeb57ff22fc0c7959, 0xa90cb506d155a7ea},
+    {0x9316ff75dd87cbd8, 0x09a7f12442d588f2},
+    {0xb7dcbf5354e9bece, 0x0c11ed6d538aeb2f},
+    {0xe5d3ef282a242e81, 0x8f1668c8a86da5fa},
+    {0x8fa475791a569d10, 0xf96e017d694487bc},
+    {0xb38d92d760ec4455, 0x37c981dcc395a9ac},
+    {0xe070f78d3927556a, 0x85bbe253f47b1417},
+    {0x8c469ab843b89562, 0x93956d7478ccec8e},
+    {0xaf58416654a6babb, 0x387ac8d1970027b2},
+    {0xdb2e51bfe9d0696a, 0x06997b05fcc0319e},
+    {0x88fcf317f22241e2, 0x441fece3bdf81f03},
+    {0xab3c2fddeeaad25a, 0xd527e81cad7626c3},
+    {0xd60b3bd56a5586f1, 0x8a71e223d8d3b074},
+    {0x85c7056562757456, 0xf6872d5667844e49},
+    {0xa738c6bebb12d16c, 0xb428f8ac016561db},
+    {0xd106f86e69d785c7, 0xe13336d701beba52},
+    {0x82a45b450226b39c, 0xecc0024661173473},
+    {0xa34d721642b06084, 0x27f002d7f95d0190},
+    {0xcc20ce9bd35c78a5, 0x31ec038df7b441f4},
+    {0xff290242c83396ce, 0x7e67047175a15271},
+    {0x9f79a169bd203e41, 0x0f0062c6e984d386},
+    {0xc75809c42c684dd1, 0x52c07b78a3e60868},
+    {0xf92e0c3537826145, 0xa7709a56ccdf8a82},
+    {0x9bbcc7a142b17ccb, 0x88a66076400bb691},
+    {0xc2abf989935ddbfe, 0x6acff893d00ea435},
+    {0xf356f7ebf83552fe, 0x0583f6b8c4124d43},
+    {0x98165af37b2153de, 0xc3727a337a8b704a},
+    {0xbe1bf1b059e9a8d6, 0x744f18c0592e4c5c},
+    {0xeda2ee1c7064130c, 0x1162def06f79df73},
+    {0x9485d4d1c63e8be7, 0x8addcb5645ac2ba8},
+    {0xb9a74a0637ce2ee1, 0x6d953e2bd7173692},
+    {0xe8111c87c5c1ba99, 0xc8fa8db6ccdd0437},
+    {0x910ab1d4db9914a0, 0x1d9c9892400a22a2},
+    {0xb54d5e4a127f59c8, 0x2503beb6d00cab4b},
+    {0xe2a0b5dc971f303a, 0x2e44ae64840fd61d},
+    {0x8da471a9de737e24, 0x5ceaecfed289e5d2},
+    {0xb10d8e1456105dad, 0x7425a83e872c5f47},
+    {0xdd50f1996b947518, 0xd12f124e28f77719},
+    {0x8a5296ffe33cc92f, 0x82bd6b70d99aaa6f},
+    {0xace73cbfdc0bfb7b, 0x636cc64d1001550b},
+    {0xd8210befd30efa5a, 0x3c47f7e05401aa4e},
+    {0x8714a775e3e95c78, 0x65acfaec34810a71},
+    {0xa8d9d1535ce3b396, 0x7f1839a741a14d0d},
+    {0xd31045a8341ca07c, 0x1ede48111209a050},
+    {0x83ea2b892091e44d, 0x934aed0aab460432},
+    {0xa4e4b66b68b65d60, 0xf81da84d5617853f},
+    {0xce1de40642e3f4b9, 0x36251260ab9d668e},
+    {0x80d2ae83e9ce78f3, 0xc1d72b7c6b426019},
+    {0xa1075a24e4421730, 0xb24cf65b8612f81f},
+    {0xc94930ae1d529cfc, 0xdee033f26797b627},
+    {0xfb9b7cd9a4a7443c, 0x169840ef017da3b1},
+    {0x9d412e0806e88aa5, 0x8e1f289560ee864e},
+    {0xc491798a08a2ad4e, 0xf1a6f2bab92a27e2},
+    {0xf5b5d7ec8acb58a2, 0xae10af696774b1db},
+    {0x9991a6f3d6bf1765, 0xacca6da1e0a8ef29},
+    {0xbff610b0cc6edd3f, 0x17fd090a58d32af3},
+    {0xeff394dcff8a948e, 0xddfc4b4cef07f5b0},
+    {0x95f83d0a1fb69cd9, 0x4abdaf101564f98e},
+    {0xbb764c4ca7a4440f, 0x9d6d1ad41abe37f1},
+    {0xea53df5fd18d5513, 0x84c86189216dc5ed},
+    {0x92746b9be2f8552c, 0x32fd3cf5b4e49bb4},
+    {0xb7118682dbb66a77, 0x3fbc8c33221dc2a1},
+    {0xe4d5e82392a40515, 0x0fabaf3feaa5334a},
+    {0x8f05b1163ba6832d, 0x29cb4d87f2a7400e},
+    {0xb2c71d5bca9023f8, 0x743e20e9ef511012},
+    {0xdf78e4b2bd342cf6, 0x914da9246b255416},
+    {0x8bab8eefb6409c1a, 0x1ad089b6c2f7548e},
+    {0xae9672aba3d0c320, 0xa184ac2473b529b1},
+    {0xda3c0f568cc4f3e8, 0xc9e5d72d90a2741e},
+    {0x8865899617fb1871, 0x7e2fa67c7a658892},
+    {0xaa7eebfb9df9de8d, 0xddbb901b98feeab7},
+    {0xd51ea6fa85785631, 0x552a74227f3ea565},
+    {0x8533285c936b35de, 0xd53a88958f87275f},
+    {0xa67ff273b8460356, 0x8a892abaf368f137},
+    {0xd01fef10a657842c, 0x2d2b7569b0432d85},
+    {0x8213f56a67f6b29b, 0x9c3b29620e29fc73},
+    {0xa298f2c501f45f42, 0x8349f3ba91b47b8f},
+    {0xcb3f2f7642717713, 0x241c70a936219a73},
+    {0xfe0efb53d30dd4d7, 0xed238cd383aa0110},
+    {0x9ec95d1463e8a506, 0xf4363804324a40aa},
+    {0xc67bb4597ce2ce48, 0xb143c6053edcd0d5},
+    {0xf81aa16fdc1b81da, 0xdd94b7868e94050a},
+    {0x9b10a4e5e9913128, 0xca7cf2b4191c8326},
+    {0xc1d4ce1f63f57d72, 0xfd1c2f611f63a3f0},
+    {0xf24a01a73cf2dccf, 0xbc633b39673c8cec},
+    {0x976e41088617ca01, 0xd5be0503e085d813},
+    {0xbd49d14aa79dbc82, 0x4b2d8644d8a74e18},
+    {0xec9c459d51852ba2, 0xddf8e7d60ed1219e},
+    {0x93e1ab8252f33b45, 0xcabb90e5c942b503},
+    {0xb8da1662e7b00a17, 0x3d6a751f3b936243},
+    {0xe7109bfba19c0c9d, 0x0cc512670a783ad4},
+    {0x906a617d450187e2, 0x27fb2b80668b24c5},
+    {0xb484f9dc9641e9da, 0xb1f9f660802dedf6},
+    {0xe1a63853bbd26451, 0x5e7873f8a0396973},
+    {0x8d07e33455637eb2, 0xdb0b487b6423e1e8},
+    {0xb049dc016abc5e5f, 0x91ce1a9a3d2cda62},
+    {0xdc5c5301c56b75f7, 0x7641a140cc7810fb},
+    {0x89b9b3e11b6329ba, 0xa9e904c87fcb0a9d},
+    {0xac2820d9623bf429, 0x546345fa9fbdcd44},
+    {0xd732290fbacaf133, 0xa97c177947ad4095},
+    {0x867f59a9d4bed6c0, 0x49ed8eabcccc485d},
+    {0xa81f301449ee8c70, 0x5c68f256bfff5a74},
+    {0xd226fc195c6a2f8c, 0x73832eec6fff3111},
+    {0x83585d8fd9c25db7, 0xc831fd53c5ff7eab},
+    {0xa42e74f3d032f525, 0xba3e7ca8b77f5e55},
+    {0xcd3a1230c43fb26f, 0x28ce1bd2e55f35eb},
+    {0x80444b5e7aa7cf85, 0x7980d163cf5b81b3},
+    {0xa0555e361951c366, 0xd7e105bcc332621f},
+    {0xc86ab5c39fa63440, 0x8dd9472bf3fefaa7},
+    {0xfa856334878fc150, 0xb14f98f6f0feb951},
+    {0x9c935e00d4b9d8d2, 0x6ed1bf9a569f33d3},
+    {0xc3b8358109e84f07, 0x0a862f80ec4700c8},
+    {0xf4a642e14c6262c8, 0xcd27bb612758c0fa},
+    {0x98e7e9cccfbd7dbd, 0x8038d51cb897789c},
+    {0xbf21e44003acdd2c, 0xe0470a63e6bd56c3},
+    {0xeeea5d5004981478, 0x1858ccfce06cac74},
+    {0x95527a5202df0ccb, 0x0f37801e0c43ebc8},
+    {0xbaa718e68396cffd, 0xd30560258f54e6ba},
+    {0xe950df20247c83fd, 0x47c6b82ef32a2069},
+    {0x91d28b7416cdd27e, 0x4cdc331d57fa5441},
+    {0xb6472e511c81471d, 0xe0133fe4adf8e952},
+    {0xe3d8f9e563a198e5, 0x58180fddd97723a6},
+    {0x8e679c2f5e44ff8f, 0x570f09eaa7ea7648},
+};
+
+/*
+ * w * 10^q through the product of w and the 128-bit 5^q (the power of 2
+ * in 10^q only moves the exponent). c is the top 128 bits of the 192-bit
+ * product, the table and the cut both round down, so the exact value is
+ * in [c, c + 2) units of c. Unless those two units cross a point where
+ * the rounding changes, or c is exactly on a tie, the bits of c decide
+ * the double, subnormals and overflow included. Returns 0 otherwise
+ * (about one input in 2^70), decimal_to_double() then takes the slow way
+ */
+static int eisel_lemire(uint64_t w, int q, double *result) {
+    if (w == 0 || q < POW5_128_MIN || q > POW5_128_MAX) {
+        return 0;
+    }
+
+    int lz = __builtin_clzl(w);
+    w <<= lz;
+    const uint64_t *power = powers_of_5_128[q - POW5_128_MIN];
+    unsigned __int128 c = (unsigned __int128)w * power[0] +
+                          (((unsigned __int128)w * power[1]) >> 64);
+
+    // The top bit of c is bit 127 or 126. 53 bits are kept and the r
+    // below them rounded off, a subnormal keeps fewer. 217706 / 2^16 is
+    // log2(10), exact enough over the table's range
+    int msb = (int)(c >> 127);
+    int exponent = ((217706 * q) >> 16) + 64 + 1023 - lz - (1 - msb);
+    int r = 74 + msb;
+    if (exponent <= 0) {
+        r += 1 - exponent;
+        exponent = 0;
+        if (r > 128) {
+            // The tie to the smallest subnormal is at or over 2^128 units,
+            // only c + 1 can reach it
+            if (r == 129 && c + 1 == 0) {
+                return 0;
+            }
+            *result = 0;
+            return 1;
+        }
+    }
+
+    unsigned __int128 half = (unsigned __int128)1 << (r - 1);
+    unsigned __int128 below = c & (half - 1);
+    uint64_t halves = (uint64_t)(c >> (r - 1)); // Odd: at or above a tie
+    if (below + 1 >= half || (below == 0 && (halves & 1))) {
+        return 0;
+    }
+
+    // Rounding a subnormal up to 2^52 makes it DBL_MIN, a normal one up
+    // to 2^53 carries into the exponent, past the largest one is inf
+    uint64_t mantissa = (halves + 1) >> 1;
+    uint64_t bits =
+        exponent ? ((uint64_t)(exponent - 1) << DBL_MANTISSA_BITS) + mantissa
+                 : mantissa;
+    if (bits >= 0x7FF0000000000000UL) {
+        bits = 0x7FF0000000000000UL;
+    }
+    memcpy(result, &bits, sizeof(double));
+    return 1;
+}
+
+// Compare the parsed input with a halfway point
+static int decimal_compare_sticky(const decimal *d,
+                                  int sticky,
+                                  const decimal *half) {
+    int c = decimal_compare(d, half);
+    return c == 0 && sticky ? 1 : c;
+}
+
+// d has no leading zeros, w is its first nw (at most 19) digits
+static double
+decimal_to_double(const decimal *d, int sticky, uint64_t w, int nw) {
+    if (d->len == 0 || d->point < -323) {
+        // Below 10^-324, under half the smallest subnormal
+        return 0.0;
+    }
+    if (d->point > 309) {
+        return INFINITY;
+    }
+
+    int k = d->point - nw; // The value is about w * 10^k
+    if (d->len <= 19 && w < (1UL << 53) && k >= -22 && k <= 22) {
+        return k >= 0 ? (double)w * powers_of_10_double[k]
+                      : (double)w / powers_of_10_double[-k];
+    }
+
+    // Digits after the first 19 put the input between w and w + 1, the
+    // result is known if both round the same
+    int truncated = sticky;
+    for (int i = nw; i < d->len && !truncated; i++) {
+        truncated = d->digits[i] != '0';
+    }
+    double x;
+    double upper;
+    if (eisel_lemire(w, k, &x) &&
+        (!truncated || (eisel_lemire(w + 1, k, &upper) && upper == x))) {
+        return x;
+    }
+
+    // Scaling moves towards the result, only the last steps can leave the
+    // normal range
+    x = (double)w;
+    for (; k > 22; k -= 22) {
+        x *= 1e22;
+    }
+    for (; k < -22; k += 22) {
+        x /= 1e22;
+    }
+    x = k >= 0 ? x * powers_of_10_double[k] : x / powers_of_10_double[-k];
+    if (isinf(x)) {
+        x = DBL_MAX;
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(double));
+
+    decimal half;
+    for (;;) {
+        uint64_t mantissa = bits & DBL_MANTISSA_MASK;
+        int exponent = (int)(bits >> DBL_MANTISSA_BITS);
+        uint64_t m =
+            exponent ? mantissa | (1UL << DBL_MANTISSA_BITS) : mantissa;
+        int e = exponent ? exponent - 1075 : -1074;
+
+        // Above the halfway point to the next double
+        decimal_from_binary(&half, 2 * m + 1, e - 1);
+        int c = decimal_compare_sticky(d, sticky, &half);
+        if (c > 0 || (c == 0 && (m & 1))) {
+            bits++;
+            if (bits == 0x7FF0000000000000UL) {
+                break; // Past DBL_MAX
+            }
+            continue;
+        }
+
+        // Below the halfway point to the previous one
+        if (bits == 0) {
+            break;
+        }
+        if (mantissa == 0 && exponent > 1) {
+            // Just above a power of two the gap below is half as wide
+            decimal_from_binary(&half, 4 * m - 1, e - 2);
+        } else {
+            decimal_from_binary(&half, 2 * m - 1, e - 1);
+        }
+        c = decimal_compare_sticky(d, sticky, &half);
+        if (c < 0 || (c == 0 && (m & 1))) {
+            bits--;
+            continue;
         }
         break;
-    case 'j':
-        flags->length_modifier = 'j';
-        format++;
+    }
+
+    memcpy(&x, &bits, sizeof(double));
+    return x;
+}
+
+// Length of the case insensitive match of word at s, at most max
+static size_t match_word(const char *s, size_t max, const char *word) {
+    size_t n = 0;
+    while (n < max && word[n] != '\0' && (s[n] | 0x20) == word[n]) {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Floating point number in strtod() syntax without the leading
+ * whitespace: a sign, decimal digits with an optional '.', an optional
+ * exponent, or inf, infinity and nan (with an optional "(chars)") in any
+ * case. Hex floats (0x1p3) are not supported, they read as the 0
+ */
+static size_t parse_double(const char *s, size_t max, double *value) {
+    size_t n = 0;
+    int negative = 0;
+
+    if (n < max && (s[n] == '+' || s[n] == '-')) {
+        negative = s[n] == '-';
+        n++;
+    }
+
+    size_t word = match_word(s + n, max - n, "infinity");
+    if (word >= 3) {
+        *value = negative ? -INFINITY : INFINITY;
+        return n + (word == 8 ? 8 : 3);
+    }
+    if (match_word(s + n, max - n, "nan") == 3) {
+        n += 3;
+        size_t close = n + 1;
+        if (n < max && s[n] == '(') {
+            while (close < max &&
+                   (digit_value(s[close]) < 36 || s[close] == '_')) {
+                close++;
+            }
+            if (close < max && s[close] == ')') {
+                n = close + 1;
+            }
+        }
+        *value = negative ? -NAN : NAN;
+        return n;
+    }
+
+    decimal d;
+    d.len = 0;
+    d.point = 0;
+    int sticky = 0;
+    uint64_t w = 0;
+    int nw = 0;
+    int seen = 0;  // Any digit at all, "." is not a number
+    int after = 0; // Past the '.'
+
+    for (; n < max; n++) {
+        char c = s[n];
+        if (c == '.' && !after) {
+            after = 1;
+            continue;
+        }
+        if (!is_digit(c)) {
+            break;
+        }
+
+        seen = 1;
+        if (d.len == 0 && c == '0') {
+            // Leading zeros only move the point
+            d.point -= after;
+            continue;
+        }
+        d.point += !after;
+        if (nw < 19) {
+            w = w * 10 + (uint64_t)(c - '0');
+            nw++;
+        }
+        if (d.len < DECIMAL_DIGITS) {
+            d.digits[d.len++] = c;
+        } else if (c != '0') {
+            sticky = 1;
+        }
+    }
+    if (!seen) {
+        return 0;
+    }
+
+    // The exponent only counts when a digit follows the 'e' and its sign
+    if (n < max && (s[n] | 0x20) == 'e') {
+        size_t m = n + 1;
+        int exp_negative = 0;
+        if (m < max && (s[m] == '+' || s[m] == '-')) {
+            exp_negative = s[m] == '-';
+            m++;
+        }
+        if (m < max && is_digit(s[m])) {
+            int exponent = 0;
+            for (; m < max && is_digit(s[m]); m++) {
+                // Past 10^5 the result is 0 or inf anyway
+                if (exponent < 100000) {
+                    exponent = exponent * 10 + (s[m] - '0');
+                }
+            }
+            d.point += exp_negative ? -exponent : exponent;
+            n = m;
+        }
+    }
+
+    double x = decimal_to_double(&d, sticky, w, nw);
+    *value = negative ? -x : x;
+    return n;
+}
+
+/*
+ * String to double, correctly rounded (see decimal_to_double())
+ * end gets the first byte after the number, or s when there is none
+ */
+double strtod(const char *s, char **end) {
+    size_t space = 0;
+    while (is_space(s[space])) {
+        space++;
+    }
+
+    double value = 0.0;
+    size_t n = parse_double(s + space, SIZE_MAX, &value);
+    if (end != NULL) {
+        *end = (char *)s + (n ? space + n : 0);
+    }
+    return value;
+}
+
+/*
+ * Formatted input
+ * scanf() reads straight from a stream buffer or a string through a
+ * scanner, no byte is copied before it is parsed. Numbers are parsed in
+ * place by the parsers above, bounded by the field width and by what is
+ * buffered. A number that runs into the end of the buffer may go on in
+ * the next read(), so it is parsed again after a refill, but only then:
+ * when a whitespace byte is in view the number is known to be complete
+ * and no read() is done that could block on a terminal
+ */
+typedef struct {
+    FILE *stream;    // NULL when scanning a string
+    const char *p;   // Next unread byte
+    const char *end; // End of the buffered bytes, unused for strings
+    size_t count;    // Bytes consumed so far, for %n
+} scanner;
+
+// Longest look ahead a number can need past its last byte: "inf" that
+// may go on to "infinity", or "1e+" that only counts with a digit
+#define SCAN_LOOKAHEAD 8
+
+static void scanner_init(scanner *sc, FILE *stream, const char *s) {
+    sc->stream = stream;
+    sc->count = 0;
+    if (stream != NULL) {
+        sc->p = stream->buf + stream->pos;
+        sc->end = stream->buf + stream->len;
+    } else {
+        sc->p = s;
+        sc->end = NULL;
+    }
+}
+
+// Hand the position back to the stream
+static void scanner_sync(scanner *sc) {
+    if (sc->stream != NULL) {
+        sc->stream->pos = (size_t)(sc->p - sc->stream->buf);
+    }
+}
+
+// Read more into the stream buffer, returns 0 when nothing came
+static int scanner_fill(scanner *sc) {
+    if (sc->stream == NULL) {
+        return 0;
+    }
+
+    scanner_sync(sc);
+    ssize_t got = stream_fill(sc->stream);
+    sc->p = sc->stream->buf + sc->stream->pos;
+    sc->end = sc->stream->buf + sc->stream->len;
+    return got > 0;
+}
+
+// Next byte without taking it, or EOF
+static int scanner_peek(scanner *sc) {
+    if (sc->stream == NULL) {
+        return *sc->p ? (unsigned char)*sc->p : EOF;
+    }
+    if (sc->p == sc->end && !scanner_fill(sc)) {
+        return EOF;
+    }
+    return (unsigned char)*sc->p;
+}
+
+static inline void scanner_skip(scanner *sc, size_t n) {
+    sc->p += n;
+    sc->count += n;
+}
+
+// Bytes that can be parsed without a refill, a string ends at its
+// terminator which stops every parser
+static inline size_t scanner_avail(const scanner *sc) {
+    return sc->stream ? (size_t)(sc->end - sc->p) : SIZE_MAX;
+}
+
+// After a number of n bytes was parsed, could more input change it?
+static int scanner_cut(const scanner *sc, size_t n, size_t max) {
+    if (sc->stream == NULL || n >= max) {
+        return 0;
+    }
+
+    const char *p = sc->p + n;
+    for (size_t i = 0; i < SCAN_LOOKAHEAD; i++, p++) {
+        if (p == sc->end) {
+            return 1;
+        }
+        if (is_space(*p)) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static void scanner_whitespace(scanner *sc) {
+    int c;
+    while ((c = scanner_peek(sc)) != EOF && is_space(c)) {
+        scanner_skip(sc, 1);
+    }
+}
+
+// Integer conversion, returns 0 on a matching failure
+static int scan_integer(scanner *sc,
+                        size_t max,
+                        int base,
+                        uint64_t *value,
+                        int *negative,
+                        int *overflow) {
+    size_t n;
+    do {
+        size_t avail = scanner_avail(sc);
+        n = parse_integer(sc->p,
+                          max < avail ? max : avail,
+                          base,
+                          value,
+                          negative,
+                          overflow);
+    } while (scanner_cut(sc, n, max) && scanner_fill(sc));
+
+    // The "x" of "0xg" goes with the 0, see scan_dangling()
+    size_t avail = scanner_avail(sc);
+    if ((base == 0 || base == 16) && n != 0 && n < max && n < avail &&
+        sc->p[n - 1] == '0' && n == 1 + !is_digit(*sc->p) &&
+        (sc->p[n] | 0x20) == 'x') {
+        n++;
+    }
+
+    scanner_skip(sc, n);
+    return n != 0;
+}
+
+/*
+ * The input item of a conversion is the longest prefix of a number (C11
+ * 7.21.6.2p9), so the "x" of "0xg" and the "e+" of "1e+x" are taken
+ * too, there is no way to hand back more than one byte. Like glibc and
+ * musl the digits before them are still converted, where the standard
+ * would call it a matching failure. n bytes at s were parsed
+ */
+static size_t scan_dangling(const char *s, size_t n, size_t limit) {
+    // Not after inf or nan, only digits or the '.' can go on to an 'e'
+    if (n == 0 || (!is_digit(s[n - 1]) && s[n - 1] != '.') || n >= limit ||
+        (s[n] | 0x20) != 'e') {
+        return n;
+    }
+    // Nor after a complete exponent
+    for (size_t i = 0; i < n; i++) {
+        if ((s[i] | 0x20) == 'e') {
+            return n;
+        }
+    }
+    n++;
+    if (n < limit && (s[n] == '+' || s[n] == '-')) {
+        n++;
+    }
+    return n;
+}
+
+static int scan_double(scanner *sc, size_t max, double *value) {
+    size_t n;
+    do {
+        size_t avail = scanner_avail(sc);
+        n = parse_double(sc->p, max < avail ? max : avail, value);
+    } while (scanner_cut(sc, n, max) && scanner_fill(sc));
+
+    size_t avail = scanner_avail(sc);
+    n = scan_dangling(sc->p, n, max < avail ? max : avail);
+    scanner_skip(sc, n);
+    return n != 0;
+}
+
+// Store through a pointer of the size the length modifier asks for
+static void scan_store(void *ptr, int length, uint64_t value) {
+    switch (length) {
+    case 'H':
+        *(char *)ptr = (char)value;
         break;
-    case 'z':
-        flags->length_modifier = 'z';
-        format++;
+    case 'h':
+        *(short *)ptr = (short)value;
         break;
+    case 'l':
+    case 'L':
+    case 'j':
+    case 'z':
     case 't':
-        flags->length_modifier = 't';
-        format++;
+        *(uint64_t *)ptr = value;
         break;
-    case 'L':
-        flags->length_modifier =
-            'B'; // Capital L for long double (we'll use double)
-        format++;
+    default:
+        *(int *)ptr = (int)value;
         break;
     }
+}
 
-    // Parse specifier
-    flags->specifier = *format;
-    format++;
+/*
+ * %[ set: one bit per byte value
+ * "]" right after "[" or "[^" is part of the set, a '-' between two
+ * bytes is a range, first or last it is itself
+ * Returns the format after the closing ']', or NULL if there is none
+ */
+static const char *scan_set(const char *format, uint64_t set[4]) {
+    int invert = *format == '^';
+    format += invert;
 
-    return (int)(format - start);
+    set[0] = set[1] = set[2] = set[3] = 0;
+    const char *start = format;
+    for (; *format && (*format != ']' || format == start); format++) {
+        unsigned char lo = (unsigned char)*format;
+        unsigned char hi = lo;
+        if (format[1] == '-' && format[2] && format[2] != ']') {
+            hi = (unsigned char)format[2];
+            format += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++) {
+            set[c >> 6] |= 1UL << (c & 63);
+        }
+    }
+    if (*format != ']') {
+        return NULL;
+    }
+
+    if (invert) {
+        for (int i = 0; i < 4; i++) {
+            set[i] = ~set[i];
+        }
+    }
+    return format + 1;
+}
+
+static inline int in_set(const uint64_t set[4], int c) {
+    return (int)((set[c >> 6] >> (c & 63)) & 1);
 }
 
 /*
- * Write formatted output to buffer
+ * The scanf() engine
+ * Conversions: d i u o x X p, f e g E F G a A, s c [set] n and %%, with
+ * '*' to skip the assignment, a width and the h hh l ll j z t length
+ * modifiers. A float conversion stores a float unless l is given, "L"
+ * (long double) is not supported and ends the scan like an unknown
+ * conversion. Floats are rounded twice (to double, then to float)
+ * Returns the number of assignments, EOF if the input ended before the
+ * first conversion
  */
-static int format_to_buffer(char *buffer, const char *format, va_list ap) {
-    char *ptr = buffer;
-    char temp_buffer[256]; // Larger buffer for floating point
+static int scan_format(scanner *sc, const char *format, va_list ap) {
+    int assigned = 0;
+    int converted = 0;
 
     while (*format) {
-        if (*format != '%') {
-            *ptr++ = *format++;
+        if (is_space(*format)) {
+            while (is_space(*format)) {
+                format++;
+            }
+            scanner_whitespace(sc);
             continue;
         }
 
-        // Handle %%
-        if (*(format + 1) == '%') {
-            *ptr++ = '%';
-            format += 2;
+        if (*format != '%' || format[1] == '%') {
+            // Literal byte, "%%" also skips whitespace before the '%'
+            if (*format == '%') {
+                scanner_whitespace(sc);
+                format++;
+            }
+            int c = scanner_peek(sc);
+            if (c == EOF) {
+                goto input_failure;
+            }
+            if (c != (unsigned char)*format) {
+                break;
+            }
+            scanner_skip(sc, 1);
+            format++;
             continue;
         }
 
-        // Parse format specifier
+        // parse_format() would read the '*' as a width from an argument
+        format++;
+        int suppress = *format == '*';
+        format += suppress;
+
         format_flags flags;
-        int consumed = parse_format(format + 1, &flags);
-        format += consumed + 1;
+        format += parse_format(format, &flags);
+        size_t max = flags.width > 0 ? (size_t)flags.width : SIZE_MAX;
+        void *ptr = NULL;
 
-        // Handle width from argument
-        if (flags.width == -1) {
-            flags.width = va_arg(ap, int);
-            if (flags.width < 0) {
-                flags.left_justify = 1;
-                flags.width = -flags.width;
+        char spec = flags.specifier;
+        if (spec != 'n' && spec != 'c' && spec != '[') {
+            scanner_whitespace(sc);
+        }
+        if (spec != 'n' && scanner_peek(sc) == EOF) {
+            goto input_failure;
+        }
+        if (!suppress && spec != '\0') {
+            ptr = va_arg(ap, void *);
+        }
+
+        switch (spec) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+        case 'p': {
+            int base = spec == 'd' || spec == 'u' ? 10
+                       : spec == 'i'              ? 0
+                       : spec == 'o'              ? 8
+                                                  : 16;
+            uint64_t value = 0;
+            int negative;
+            int overflow;
+            if (!scan_integer(sc, max, base, &value, &negative, &overflow)) {
+                goto done;
+            }
+
+            if (spec == 'd' || spec == 'i') {
+                value = (uint64_t)integer_to_long(value, negative, overflow);
+            } else if (overflow) {
+                value = ULONG_MAX;
+            } else if (negative) {
+                value = 0 - value;
+            }
+            if (ptr != NULL) {
+                int length = spec == 'p' ? 'l' : flags.length_modifier;
+                scan_store(ptr, length, value);
             }
+            break;
         }
 
-        // Handle precision from argument
-        if (flags.precision == -2) {
-            flags.precision = va_arg(ap, int);
-            if (flags.precision < 0) {
-                flags.precision = -1; // Unspecified
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            double value;
+            if (flags.length_modifier == 'B') {
+                goto done;
+            }
+            if (!scan_double(sc, max, &value)) {
+                goto done;
             }
+            if (ptr != NULL && flags.length_modifier == 'l') {
+                *(double *)ptr = value;
+            } else if (ptr != NULL) {
+                *(float *)ptr = (float)value;
+            }
+            break;
         }
 
-        // Handle different specifiers
-        switch (flags.specifier) {
-        case 'c': {
-            // Character
-            char c = (char)va_arg(ap, int);
-            *ptr++ = c;
+        case 's':
+        case 'c':
+        case '[': {
+            uint64_t set[4];
+            if (spec == '[') {
+                format = scan_set(format, set);
+                if (format == NULL) {
+                    goto done;
+                }
+            }
+            if (spec == 'c' && flags.width <= 0) {
+                max = 1;
+            }
+
+            // Copied as it arrives, these need no look ahead
+            char *dst = ptr;
+            size_t n = 0;
+            int c;
+            while (n < max && (c = scanner_peek(sc)) != EOF) {
+                if ((spec == 's' && is_space(c)) ||
+                    (spec == '[' && !in_set(set, c))) {
+                    break;
+                }
+                if (dst != NULL) {
+                    dst[n] = (char)c;
+                }
+                scanner_skip(sc, 1);
+                n++;
+            }
+
+            // A %c cut short by the end of the input still counts, like
+            // in glibc
+            if (n == 0) {
+                goto done;
+            }
+            if (dst != NULL && spec != 'c') {
+                dst[n] = '\0';
+            }
             break;
         }
 
-        case 's': {
-            // String
-            const char *str = va_arg(ap, const char *);
-            if (str == NULL) {
-                str = "(null)";
+        case 'n':
+            // Not a conversion, does not count as an assignment
+            if (ptr != NULL) {
+                scan_store(ptr, flags.length_modifier, sc->count);
             }
+            continue;
+
+        default:
+            goto done;
+        }
+
+        converted = 1;
+        assigned += ptr != NULL;
+    }
+
+done:
+    scanner_sync(sc);
+    return assigned;
+
+input_failure:
+    scanner_sync(sc);
+    return converted ? assigned : EOF;
+}
+
+int vfscanf(FILE *stream, const char *format, va_list ap) {
+    if (!stream->reading) {
+        return EOF;
+    }
+
+    scanner sc;
+    scanner_init(&sc, stream, NULL);
+    return scan_format(&sc, format, ap);
+}
+
+int vsscanf(const char *s, const char *format, va_list ap) {
+    scanner sc;
+    scanner_init(&sc, NULL, s);
+    return scan_format(&sc, format, ap);
+}
+
+int vscanf(const char *format, va_list ap) {
+    return vfscanf(stdin, format, ap);
+}
+
+int fscanf(FILE *stream, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int ret = vfscanf(stream, format, ap);
+    va_end(ap);
+    return ret;
+}
+
+int sscanf(const char *s, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int ret = vsscanf(s, format, ap);
+    va_end(ap);
+    return ret;
+}
+
+int scanf(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int ret = vfscanf(stdin, format, ap);
+    va_end(ap);
+    return ret;
+}
+
+/*
+ * Binary log files
+ * Records written as they are instead of as text, a decoder renders them
+ * later (make decode). Every format string is written once, records
+ * refer to it by id and only carry their arguments, packed: integers as
+ * zigzag varints, so small values (and -1) take a byte or two
+ *
+ * Layout, little endian:
+ *   header:  "PLOG", u16 version, u16 header size
+ *   entries: varint type, varint payload size, payload
+ *     LOG_ENTRY_FORMAT  the format bytes. Ids count from 0 in order,
+ *                       each one comes before the first record using it
+ *     LOG_ENTRY_TEXT    text that was already formatted
+ *     LOG_ENTRY_RECORD  varint format id, then the arguments in the
+ *                       order the format reads them (see log_capture()):
+ *                       doubles as 8 bytes, strings as varint length + 1
+ *                       and the bytes (0 is NULL), the rest as varints
+ * Unknown entry types are skipped by size, so new ones can be added
+ * without a version change
+ */
+#define LOG_MAGIC   "PLOG"
+#define LOG_VERSION 1
+
+#define LOG_ENTRY_FORMAT 0
+#define LOG_ENTRY_TEXT   1
+#define LOG_ENTRY_RECORD 2
+
+// log_writer and its sizes (LOG_FORMATS, LOG_BUFSIZ) are in printf.h
+#define LOG_RECORD_MAX 4096
+#define LOG_ENTRY_MAX  (LOG_BUFSIZ - 2 * VARINT_MAX)
+
+// Packed record: a word can grow by 2 bytes, a string by its length
+#define LOG_RECORD_PACKED_MAX (LOG_RECORD_MAX + 2 * LOG_MAX_ARGS + VARINT_MAX)
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+} log_file_header;
+
+/*
+ * Varints
+ * 7 bits per byte, low bits first, the top bit set on all but the last
+ */
+#define VARINT_MAX 10
+
+static inline size_t varint_put(char *buf, uint64_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (char)value;
+    return len;
+}
+
+// Read a varint from [*p, end), returns 0 or EOF if it is cut off
+static inline int varint_get(const char **p, const char *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        uint8_t byte = (uint8_t)*(*p)++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            *value = result;
+            return 0;
+        }
+    }
+    return EOF;
+}
+
+// Signed values as small unsigned ones: 0, -1, 1, -2, ...
+static inline uint64_t zigzag_encode(uint64_t word) {
+    return (word << 1) ^ (uint64_t)((int64_t)word >> 63);
+}
+
+static inline uint64_t zigzag_decode(uint64_t value) {
+    return (value >> 1) ^ -(value & 1);
+}
+
+/*
+ * Pack the arguments of a captured record into buf, which must hold
+ * LOG_RECORD_PACKED_MAX bytes
+ * Returns the packed size
+ */
+static size_t log_pack(char *buf, const log_record *rec) {
+    size_t len = 0;
+
+    for (int i = 0; i < rec->argc; i++) {
+        uint64_t word = rec->words[i];
+
+        if (rec->double_mask & (1UL << i)) {
+            memcpy(buf + len, &word, sizeof(word));
+            len += sizeof(word);
+        } else if (rec->string_mask & (1UL << i)) {
+            const char *str = (const char *)rec + word;
+            size_t str_len = strlen(str);
+            len += varint_put(buf + len, str_len + 1);
+            memcpy(buf + len, str, str_len);
+            len += str_len;
+        } else {
+            // A NULL string is word 0, which packs as 0 as well
+            len += varint_put(buf + len, zigzag_encode(word));
+        }
+    }
+    return len;
+}
+
+/*
+ * Rebuild a record from a packed one read from a file, walking format the
+ * way log_capture() does, using at most capacity bytes (a multiple of 8)
+ * Returns the record size, or 0 if the data does not match the format
+ */
+size_t log_unpack(log_record *rec,
+                  size_t capacity,
+                  const char *format,
+                  const char *data,
+                  size_t len) {
+    const char *p = data;
+    const char *end = data + len;
+    if (capacity < sizeof(log_record)) {
+        return 0;
+    }
+
+    size_t max_words = (capacity - sizeof(log_record)) / sizeof(uint64_t);
+    if (max_words > LOG_MAX_ARGS) {
+        max_words = LOG_MAX_ARGS;
+    }
 
-            size_t len = strlen(str);
-            if (flags.precision >= 0 && (size_t)flags.precision < len) {
-                len = flags.precision;
+    // Strings are only located here and copied once the words are known
+    const char *strings[LOG_MAX_ARGS];
+    uint64_t string_mask = 0;
+    uint64_t double_mask = 0;
+    size_t argc = 0;
+
+    format_flags flags;
+    const char *f = format;
+    while ((f = next_conversion(f, &flags)) != NULL) {
+        arg_kind kind = format_arg_kind(&flags);
+        size_t stars = (flags.width == -1) + (flags.precision == -2);
+        if (argc + stars + (kind != ARG_NONE) > max_words) {
+            return 0;
+        }
+
+        for (size_t i = 0; i < stars; i++) {
+            uint64_t value;
+            if (varint_get(&p, end, &value) != 0) {
+                return 0;
             }
+            rec->words[argc++] = zigzag_decode(value);
+        }
 
-            // Padding before string (right-justified)
-            if (!flags.left_justify && flags.width > (int)len) {
-                int pad = flags.width - (int)len;
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = ' ';
-                }
+        uint64_t value;
+        switch (kind) {
+        case ARG_NONE:
+            break;
+        case ARG_DOUBLE:
+            if ((size_t)(end - p) < sizeof(uint64_t)) {
+                return 0;
+            }
+            double_mask |= 1UL << argc;
+            memcpy(&rec->words[argc++], p, sizeof(uint64_t));
+            p += sizeof(uint64_t);
+            break;
+        case ARG_STRING:
+            if (varint_get(&p, end, &value) != 0 ||
+                value > (uint64_t)(end - p) + 1) {
+                return 0;
             }
+            if (value > 0) {
+                string_mask |= 1UL << argc;
+                strings[argc] = p;
+                p += value - 1;
+            }
+            rec->words[argc++] = value; // Length + 1 until copied
+            break;
+        default:
+            if (varint_get(&p, end, &value) != 0) {
+                return 0;
+            }
+            rec->words[argc++] = zigzag_decode(value);
+            break;
+        }
+    }
+    if (p != end) {
+        return 0;
+    }
 
-            // Copy string
-            for (size_t i = 0; i < len; i++) {
-                *ptr++ = str[i];
-            }
+    // Same layout as log_capture(): strings after the words
+    size_t size = sizeof(log_record) + argc * sizeof(uint64_t);
+    for (size_t i = 0; i < argc; i++) {
+        if (!(string_mask & (1UL << i))) {
+            continue;
+        }
 
-            // Padding after string (left-justified)
-            if (flags.left_justify && flags.width > (int)len) {
-                int pad = flags.width - (int)len;
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = ' ';
-                }
-            }
-            break;
+        size_t str_len = rec->words[i] - 1;
+        if (size + str_len + 1 > capacity) {
+            return 0;
         }
 
-        case 'd':
-        case 'i': {
-            // Properly handle signed integers
-            int64_t value;
-            int is_negative = 0;
-
-            // Get value based on length modifier
-            switch (flags.length_modifier) {
-            case 'H': // char
-                value = (signed char)va_arg(ap, int);
-                break;
-            case 'h': // short
-                value = (short)va_arg(ap, int);
-                break;
-            case 'l': // long
-                value = va_arg(ap, long);
-                break;
-            case 'L': // long long
-                value = va_arg(ap, long long);
-                break;
-            case 'j': // intmax_t
-                value = va_arg(ap, int64_t);
-                break;
-            case 'z': // size_t
-                value = (int64_t)va_arg(ap, size_t);
-                break;
-            case 't': // ptrdiff_t
-                value = (int64_t)va_arg(ap, long);
-                break;
-            default: // int
-                value = va_arg(ap, int);
-                break;
-            }
+        // A NUL inside would only end the string early, which is harmless
+        char *copy = (char *)rec + size;
+        memcpy(copy, strings[i], str_len);
+        copy[str_len] = '\0';
+        rec->words[i] = size;
+        size += str_len + 1;
+    }
 
-            // Store if negative and convert to positive for uitoa
-            if (value < 0) {
-                is_negative = 1;
-                value = -value;
-            }
+    rec->format = format;
+    rec->string_mask = string_mask;
+    rec->double_mask = double_mask;
+    rec->size = (uint32_t)((size + 7) & ~(size_t)7);
+    rec->argc = (uint16_t)argc;
+    rec->reserved = 0;
+    return rec->size;
+}
 
-            char *num_str = temp_buffer;
-            if (flags.precision == 0 && value == 0) {
-                // Handle zero precision with zero value
-                num_str[0] = '\0';
-            } else {
-                // Convert number to string
-                uitoa((uint64_t)value, num_str, 10, 0);
-            }
+// Write out what is buffered, returns 0 or EOF
+int log_writer_flush(log_writer *w) {
+    if (w->len > 0 && write_all(w->fd, w->buf, w->len) != (ssize_t)w->len) {
+        w->error = 1;
+    }
+    w->bytes += w->len;
+    w->len = 0;
+    return w->error ? EOF : 0;
+}
 
-            size_t len = strlen(num_str);
+// Room in the buffer for an entry of size payload bytes, NULL if too big
+static char *log_writer_entry(log_writer *w, unsigned type, size_t size) {
+    if (size > LOG_ENTRY_MAX) {
+        return NULL;
+    }
+    if (w->len + 2 * VARINT_MAX + size > LOG_BUFSIZ) {
+        log_writer_flush(w);
+    }
 
-            // Determine sign character properly
-            char sign = 0;
-            if (is_negative) {
-                sign = '-';
-            } else if (flags.always_sign) {
-                sign = '+';
-            } else if (flags.space_sign) {
-                sign = ' ';
-            }
+    char *ptr = w->buf + w->len;
+    ptr += varint_put(ptr, type);
+    ptr += varint_put(ptr, size);
+    w->len = ptr + size - w->buf;
+    return ptr;
+}
 
-            // Create final number string with sign
-            char final_buffer[128];
-            char *final_str = final_buffer;
-            size_t final_len = len;
+/*
+ * Start a log file on fd, the header is written with the first flush
+ * Returns 0
+ */
+int log_writer_open(log_writer *w, int fd) {
+    w->fd = fd;
+    w->error = 0;
+    w->bytes = 0;
+    w->format_count = 0;
+    w->len = 0;
+    memset(w->formats, 0, sizeof(w->formats));
+
+    log_file_header header = {{0}, LOG_VERSION, sizeof(log_file_header)};
+    memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+    memcpy(w->buf, &header, sizeof(header));
+    w->len = sizeof(header);
+    return 0;
+}
 
-            if (sign) {
-                *final_str++ = sign;
-                final_len++;
-            }
+// Id of format, writing its string table entry the first time
+// Returns -1 when the table is full
+static long log_writer_format_id(log_writer *w, const char *format) {
+    // Same hashing as the compiled format cache, linear probing after it
+    size_t slot = ((uintptr_t)format * 0x9E3779B97F4A7C15UL) >>
+                  (64 - LOG_FORMATS_BITS);
 
-            memcpy(final_str, num_str, len + 1);
-            final_str = final_buffer;
+    for (size_t i = 0; i < LOG_FORMATS; i++) {
+        size_t index = (slot + i) & (LOG_FORMATS - 1);
 
-            // Handle precision padding (zeros after sign, before number)
-            if (flags.precision > (int)len) {
-                int pad = flags.precision - (int)len;
-                char prec_buffer[128];
-                char *pb = prec_buffer;
+        if (w->formats[index].format == format) {
+            return w->formats[index].id;
+        }
+        if (w->formats[index].format != NULL) {
+            continue;
+        }
 
-                if (sign) {
-                    *pb++ = sign;
-                }
+        size_t len = strlen(format);
+        char *payload = log_writer_entry(w, LOG_ENTRY_FORMAT, len);
+        if (payload == NULL) {
+            return -1;
+        }
+        memcpy(payload, format, len);
 
-                for (int i = 0; i < pad; i++) {
-                    *pb++ = '0';
-                }
+        w->formats[index].format = format;
+        w->formats[index].id = w->format_count;
+        return w->format_count++;
+    }
+    return -1;
+}
 
-                memcpy(pb, num_str, len + 1);
-                final_str = prec_buffer;
-                final_len = strlen(prec_buffer);
-            }
+// Append already formatted text
+int log_writer_text(log_writer *w, const char *text, size_t len) {
+    char *payload = log_writer_entry(w, LOG_ENTRY_TEXT, len);
+    if (payload == NULL) {
+        return EOF;
+    }
 
-            // Width padding
-            if (!flags.left_justify && flags.width > (int)final_len) {
-                int pad = flags.width - (int)final_len;
-                char pad_char =
-                    (flags.zero_pad && flags.precision < 0) ? '0' : ' ';
-
-                // If zero padding with sign, print sign first
-                if (pad_char == '0' && sign) {
-                    *ptr++ = sign;
-                    final_str++; // Skip sign in final_str
-                    final_len--;
-                }
+    memcpy(payload, text, len);
+    return 0;
+}
 
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = pad_char;
-                }
-            }
+// Append a captured record, see log_capture()
+static int log_writer_record(log_writer *w, const log_record *rec) {
+    long id = log_writer_format_id(w, rec->format);
+    if (id < 0) {
+        // No id left, the text is written instead
+        char text[LOG_RECORD_MAX];
+        memory_sink mem = {text, sizeof(text), 0};
+        sink out = {memory_put_char, memory_put_span, NULL, &mem, 0, 0};
+        log_render(&out, rec);
+        return log_writer_text(w, text, mem.len);
+    }
 
-            // Copy number
-            for (size_t i = 0; i < final_len; i++) {
-                *ptr++ = final_str[i];
-            }
+    char packed[LOG_RECORD_PACKED_MAX];
+    size_t len = varint_put(packed, (uint64_t)id);
+    len += log_pack(packed + len, rec);
 
-            // Padding after number
-            if (flags.left_justify && flags.width > (int)final_len) {
-                int pad = flags.width - (int)final_len;
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = ' ';
-                }
-            }
-            break;
-        }
+    char *payload = log_writer_entry(w, LOG_ENTRY_RECORD, len);
+    if (payload == NULL) {
+        return EOF;
+    }
 
-        case 'u':
-        case 'o':
-        case 'x':
-        case 'X':
-        case 'p': {
-            // Unsigned integer formats
-            uint64_t value;
-            int base;
-            int uppercase = 0;
-
-            // Handle pointer separately
-            if (flags.specifier == 'p') {
-                value = (uint64_t)va_arg(ap, void *);
-                base = 16;
-                flags.alternate_form = 1;
-            } else {
-                // Get value based on length modifier
-                switch (flags.length_modifier) {
-                case 'H': // unsigned char
-                    value = (unsigned char)va_arg(ap, unsigned int);
-                    break;
-                case 'h': // unsigned short
-                    value = (unsigned short)va_arg(ap, unsigned int);
-                    break;
-                case 'l': // unsigned long
-                    value = va_arg(ap, unsigned long);
-                    break;
-                case 'L': // unsigned long long
-                    value = va_arg(ap, unsigned long long);
-                    break;
-                case 'j': // uintmax_t
-                    value = va_arg(ap, uint64_t);
-                    break;
-                case 'z': // size_t
-                    value = va_arg(ap, size_t);
-                    break;
-                case 't': // ptrdiff_t
-                    value = (uint64_t)va_arg(ap, long);
-                    break;
-                default: // unsigned int
-                    value = va_arg(ap, unsigned int);
-                    break;
-                }
+    memcpy(payload, packed, len);
+    return 0;
+}
 
-                // Determine base
-                switch (flags.specifier) {
-                case 'o':
-                    base = 8;
-                    break;
-                case 'x':
-                    base = 16;
-                    break;
-                case 'X':
-                    base = 16;
-                    uppercase = 1;
-                    break;
-                default:
-                    base = 10;
-                    break;
-                }
-            }
+/*
+ * printf() into a binary log, the arguments are stored instead of text
+ * Returns 0 on success, EOF on error
+ */
+int log_writer_vprintf(log_writer *w, const char *format, va_list ap) {
+    uint64_t rec[LOG_RECORD_MAX / sizeof(uint64_t)];
 
-            // Convert number to string
-            char *num_str = temp_buffer;
-            if (flags.precision == 0 && value == 0 && flags.specifier != 'p') {
-                // Handle zero precision with zero value
-                num_str[0] = '\0';
-            } else {
-                uitoa(value, num_str, base, uppercase);
-            }
+    if (log_capture((log_record *)rec, sizeof(rec), format, ap) > 0) {
+        return log_writer_record(w, (const log_record *)rec);
+    }
 
-            size_t len = strlen(num_str);
+    // Too many arguments or too much string data for one record: the text
+    // is formatted straight into the buffer, cut at LOG_ENTRY_MAX
+    int len = vsnprintf(NULL, 0, format, ap);
+    if (len < 0) {
+        return EOF;
+    }
+    if (len > LOG_ENTRY_MAX - 1) {
+        len = LOG_ENTRY_MAX - 1;
+    }
 
-            // Handle alternate form prefix
-            char prefix[3] = {0};
-            int prefix_len = 0;
+    char *payload = log_writer_entry(w, LOG_ENTRY_TEXT, (size_t)len);
+    memory_sink mem = {payload, (size_t)len, 0};
+    sink out = {memory_put_char, memory_put_span, NULL, &mem, 0, 0};
+    format_to_buffer(&out, format, ap);
+    return 0;
+}
 
-            if (flags.alternate_form && value != 0) {
-                if (base == 8) {
-                    prefix[0] = '0';
-                    prefix_len = 1;
-                } else if (base == 16) {
-                    prefix[0] = '0';
-                    prefix[1] = uppercase ? 'X' : 'x';
-                    prefix_len = 2;
-                }
-            }
+__attribute__((format(printf, 2, 3))) //
+int log_writer_printf(log_writer *w, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int ret = log_writer_vprintf(w, format, ap);
+    va_end(ap);
+    return ret;
+}
 
-            // Handle precision padding
-            if (flags.precision > (int)(len + prefix_len)) {
-                int pad = flags.precision - (int)(len + prefix_len);
-                char *new_str = temp_buffer + 64;
-                for (int i = 0; i < pad; i++) {
-                    new_str[i] = '0';
-                }
-                memcpy(new_str + pad, num_str, len + 1);
-                num_str = new_str;
-                len = strlen(num_str);
-            }
+/*
+ * Asynchronous logging
+ * async_printf() only formats: the text goes into a slot of a lock-free
+ * ring and a flusher thread started by async_start() writes batches of
+ * slots with one large write(). The caller never makes a syscall unless
+ * the flusher is asleep and needs a futex wake
+ *
+ * The ring is a bounded multi-producer queue (Vyukov's): every slot has a
+ * sequence number saying whose turn it is, producers claim a position
+ * with one compare-and-swap on tail and format straight into the slot.
+ * When the ring is full the message is dropped and counted, callers are
+ * never blocked. Messages longer than a slot are cut and counted
+ *
+ * async_logf() goes further and only captures the arguments (see
+ * log_capture()), the flusher renders them. After async_start_binary()
+ * the flusher does not even render, it writes a binary log file
+ */
+#ifndef ASYNC_SLOTS
+#define ASYNC_SLOTS 1024 // Power of two
+#endif
+#define ASYNC_SLOT_SIZE  256
+#define ASYNC_TEXT_SIZE  (ASYNC_SLOT_SIZE - 2 * sizeof(size_t))
+#define ASYNC_WRITE_SIZE 65536 // Flusher batch buffer
+#define ASYNC_SPINS      64    // Empty polls before the flusher sleeps
 
-            // Total length with prefix
-            int total_len = (int)len + prefix_len;
+#define FUTEX_PRIVATE_FLAG 128
+#define FUTEX_WAKE         1
 
-            // Padding before number
-            if (!flags.left_justify && flags.width > total_len) {
-                int pad = flags.width - total_len;
-                char pad_char =
-                    (flags.zero_pad && flags.precision < 0) ? '0' : ' ';
+typedef struct {
+    size_t seq;      // pos: free for producer pos, pos + 1: filled
+    uint32_t len;    // Bytes used in text
+    uint32_t record; // text holds a log_record, see async_logf()
+    char text[ASYNC_TEXT_SIZE] __attribute__((aligned(8)));
+} async_slot;
+
+static struct {
+    async_slot slots[ASYNC_SLOTS];
+    size_t tail; // Next position for producers
+    size_t head; // Next position for the flusher
+    int fd;
+    int running;
+    int stop;
+    int waiting;  // The flusher is about to sleep or asleep
+    int wake_seq; // Futex word, bumped to wake the flusher
+    int binary;   // Write a binary log through writer
+    thread *flusher;
+    async_stats stats;
+    log_writer writer;
+    char batch[ASYNC_WRITE_SIZE];
+} async_log;
+
+#define ASYNC_MASK (ASYNC_SLOTS - 1)
+
+// Counters are only statistics, relaxed is enough
+static inline void async_count(size_t *counter) {
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
 
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = pad_char;
-                }
+// Copy the ready slots in order into the batch and write it
+// Returns the number of messages taken from the ring
+static size_t async_drain(void) {
+    size_t taken = 0;
+    size_t used = 0;
+    size_t head = async_log.head;
+
+    for (;;) {
+        async_slot *slot = &async_log.slots[head & ASYNC_MASK];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + 1) {
+            break; // Empty, or a producer is still formatting into it
+        }
+        if (async_log.binary) {
+            if (slot->record) {
+                log_writer_record(&async_log.writer,
+                                  (const log_record *)slot->text);
+            } else {
+                log_writer_text(&async_log.writer, slot->text, slot->len);
             }
-
-            // Write prefix
-            for (int i = 0; i < prefix_len; i++) {
-                *ptr++ = prefix[i];
+        } else if (slot->record) {
+            // The text length is only known after rendering
+            size_t room = ASYNC_WRITE_SIZE - used;
+            memory_sink mem = {async_log.batch + used, room, 0};
+            sink out = {memory_put_char, memory_put_span, NULL, &mem, 0, 0};
+
+            log_render(&out, (const log_record *)slot->text);
+            if (out.count > room && used > 0) {
+                break; // Rendered again at the start of the next batch
             }
-
-            // Copy number
-            for (size_t i = 0; i < len; i++) {
-                *ptr++ = num_str[i];
+            used += mem.len;
+        } else {
+            if (used + slot->len > ASYNC_WRITE_SIZE) {
+                break; // Next batch
             }
 
-            // Padding after number
-            if (flags.left_justify && flags.width > total_len) {
-                int pad = flags.width - total_len;
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = ' ';
-                }
-            }
-            break;
+            memcpy(async_log.batch + used, slot->text, slot->len);
+            used += slot->len;
         }
 
-        case 'f':
-        case 'F': {
-            // Floating point fixed notation
-            double value = va_arg(ap, double);
-
-            // Convert to string
-            char *num_str = temp_buffer;
-            ftoa(value,
-                 num_str,
-                 flags.precision,
-                 (flags.specifier == 'F'),
-                 flags.alternate_form);
-
-            size_t len = strlen(num_str);
-
-            // Handle sign for positive numbers
-            char sign = 0;
-            int skip_first = 0;
-
-            // Check if the string already has a sign
-            if (num_str[0] == '-') {
-                sign = '-';
-                skip_first = 1; // Skip the minus that's already in string
-            } else if (num_str[0] == '+') {
-                sign = '+';
-                skip_first = 1;
-            } else {
-                // Add sign if needed for positive numbers
-                if (flags.always_sign) {
-                    sign = '+';
-                } else if (flags.space_sign) {
-                    sign = ' ';
-                }
-            }
+        // Hand the slot back for the producer one lap ahead
+        __atomic_store_n(&slot->seq, head + ASYNC_SLOTS, __ATOMIC_RELEASE);
+        head++;
+        taken++;
+    }
 
-            // Calculate effective length (without the sign we'll handle
-            // separately)
-            size_t effective_len = skip_first ? len - 1 : len;
-            int total_len = (int)effective_len + (sign ? 1 : 0);
+    __atomic_store_n(&async_log.head, head, __ATOMIC_RELEASE);
 
-            // Padding before number
-            if (!flags.left_justify && flags.width > total_len) {
-                int pad = flags.width - total_len;
-                char pad_char = (flags.zero_pad) ? '0' : ' ';
+    if (async_log.binary) {
+        if (taken > 0 && log_writer_flush(&async_log.writer) != 0) {
+            async_count(&async_log.stats.errors);
+        }
+        __atomic_store_n(
+            &async_log.stats.bytes, async_log.writer.bytes, __ATOMIC_RELAXED);
+    } else if (used > 0) {
+        if (write_all(async_log.fd, async_log.batch, used) != (ssize_t)used) {
+            async_count(&async_log.stats.errors);
+        }
+        __atomic_fetch_add(&async_log.stats.bytes, used, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&async_log.stats.written, taken, __ATOMIC_RELAXED);
+    return taken;
+}
 
-                // Special handling for zero padding with sign
-                if (pad_char == '0' && sign) {
-                    *ptr++ = sign;
-                    sign = 0; // Sign already printed
-                }
+static int async_ready(void) {
+    size_t head = async_log.head;
+    async_slot *slot = &async_log.slots[head & ASYNC_MASK];
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == head + 1;
+}
 
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = pad_char;
-                }
-            }
+static int async_flusher(void *arg) {
+    (void)arg;
 
-            // Add sign if not already printed
-            if (sign) {
-                *ptr++ = sign;
+    for (;;) {
+        if (async_drain() > 0) {
+            continue;
+        }
+        if (__atomic_load_n(&async_log.stop, __ATOMIC_ACQUIRE)) {
+            // Producers are done, take what is left
+            while (async_drain() > 0) {
             }
+            return 0;
+        }
 
-            // Copy number (skip sign if already in string)
-            const char *copy_start = skip_first ? num_str + 1 : num_str;
-            size_t copy_len = skip_first ? len - 1 : len;
-
-            for (size_t i = 0; i < copy_len; i++) {
-                *ptr++ = copy_start[i];
-            }
+        // Messages tend to come in bursts, look again a few times before
+        // sleeping so a busy producer does not pay a wake per message
+        int spins = 0;
+        while (!async_ready() && spins++ < ASYNC_SPINS) {
+            syscall(0, __NR_sched_yield, 0, 0);
+        }
+        if (async_ready()) {
+            continue;
+        }
 
-            // Padding after number
-            if (flags.left_justify && flags.width > total_len) {
-                int pad = flags.width - total_len;
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = ' ';
-                }
-            }
-            break;
+        // Read the futex word before checking again: a producer that
+        // publishes after the check also bumps it, so the wait returns
+        // at once instead of missing the wake
+        int seq = __atomic_load_n(&async_log.wake_seq, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&async_log.waiting, 1, __ATOMIC_SEQ_CST);
+
+        if (!async_ready() &&
+            !__atomic_load_n(&async_log.stop, __ATOMIC_SEQ_CST)) {
+            syscall6(__NR_futex,
+                     (long)&async_log.wake_seq,
+                     FUTEX_WAIT | FUTEX_PRIVATE_FLAG,
+                     seq,
+                     0,
+                     0,
+                     0);
         }
 
-        case 'e':
-        case 'E': {
-            // Floating point scientific notation
-            double value = va_arg(ap, double);
-
-            // Convert to string
-            char *num_str = temp_buffer;
-            etoa(value, num_str, flags.precision, (flags.specifier == 'E'));
-
-            size_t len = strlen(num_str);
-
-            // Handle sign for positive numbers
-            char sign = 0;
-            int skip_first = 0;
-
-            // Check if the string already has a sign
-            if (num_str[0] == '-') {
-                sign = '-';
-                skip_first = 1;
-            } else if (num_str[0] == '+') {
-                sign = '+';
-                skip_first = 1;
-            } else {
-                if (flags.always_sign) {
-                    sign = '+';
-                } else if (flags.space_sign) {
-                    sign = ' ';
-                }
-            }
+        __atomic_store_n(&async_log.waiting, 0, __ATOMIC_RELAXED);
+    }
+}
 
-            size_t effective_len = skip_first ? len - 1 : len;
-            int total_len = (int)effective_len + (sign ? 1 : 0);
+static void async_wake(void) {
+    async_count(&async_log.stats.wakes);
+    __atomic_fetch_add(&async_log.wake_seq, 1, __ATOMIC_SEQ_CST);
+    syscall6(__NR_futex,
+             (long)&async_log.wake_seq,
+             FUTEX_WAKE | FUTEX_PRIVATE_FLAG,
+             1,
+             0,
+             0,
+             0);
+}
 
-            // Padding before number
-            if (!flags.left_justify && flags.width > total_len) {
-                int pad = flags.width - total_len;
-                char pad_char = (flags.zero_pad) ? '0' : ' ';
+static int async_launch(int fd, int binary) {
+    if (async_log.running) {
+        return EOF;
+    }
 
-                if (pad_char == '0' && sign) {
-                    *ptr++ = sign;
-                    sign = 0;
-                }
+    for (size_t i = 0; i < ASYNC_SLOTS; i++) {
+        async_log.slots[i].seq = i;
+    }
+    async_log.tail = 0;
+    async_log.head = 0;
+    async_log.fd = fd;
+    async_log.stop = 0;
+    async_log.binary = binary;
+    async_log.stats = (async_stats){0};
+    if (binary) {
+        log_writer_open(&async_log.writer, fd);
+    }
 
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = pad_char;
-                }
-            }
+    async_log.flusher = thread_create(async_flusher, NULL);
+    if (async_log.flusher == NULL) {
+        return EOF;
+    }
 
-            if (sign) {
-                *ptr++ = sign;
-            }
+    async_log.running = 1;
+    return 0;
+}
 
-            const char *copy_start = skip_first ? num_str + 1 : num_str;
-            size_t copy_len = skip_first ? len - 1 : len;
+/*
+ * Start the flusher thread writing to fd
+ * Returns 0 on success, EOF if it is already running or cannot start
+ */
+int async_start(int fd) {
+    return async_launch(fd, 0);
+}
 
-            for (size_t i = 0; i < copy_len; i++) {
-                *ptr++ = copy_start[i];
-            }
+/*
+ * Same, but fd gets a binary log file of the records (see log_writer),
+ * make decode builds the tool that turns it into text
+ */
+int async_start_binary(int fd) {
+    return async_launch(fd, 1);
+}
 
-            if (flags.left_justify && flags.width > total_len) {
-                int pad = flags.width - total_len;
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = ' ';
-                }
+/*
+ * Write out everything queued and end the flusher thread
+ * Producers must be done before this is called. Also run at exit
+ */
+void async_stop(void) {
+    if (!async_log.running) {
+        return;
+    }
+
+    __atomic_store_n(&async_log.stop, 1, __ATOMIC_SEQ_CST);
+    async_wake();
+    thread_join(async_log.flusher);
+    async_log.running = 0;
+}
+
+// Claim a position whose slot the flusher has given back
+// Returns NULL when the ring is full
+static async_slot *async_claim(size_t *claimed) {
+    size_t pos = __atomic_load_n(&async_log.tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        async_slot *slot = &async_log.slots[pos & ASYNC_MASK];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)(seq - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&async_log.tail,
+                                            &pos,
+                                            pos + 1,
+                                            1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                *claimed = pos;
+                return slot;
             }
-            break;
+        } else if (diff < 0) {
+            // Still holding the message from one lap ago: full
+            async_count(&async_log.stats.dropped);
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&async_log.tail, __ATOMIC_RELAXED);
         }
+    }
+}
 
-        case 'g':
-        case 'G': {
-            // Floating point general notation
-            double value = va_arg(ap, double);
-
-            // Convert to string
-            char *num_str = temp_buffer;
-            gtoa(value, num_str, flags.precision, (flags.specifier == 'G'));
-
-            size_t len = strlen(num_str);
-
-            // Handle sign for positive numbers
-            char sign = 0;
-            int skip_first = 0;
-
-            // Check if the string already has a sign
-            if (num_str[0] == '-') {
-                sign = '-';
-                skip_first = 1;
-            } else if (num_str[0] == '+') {
-                sign = '+';
-                skip_first = 1;
-            } else {
-                if (flags.always_sign) {
-                    sign = '+';
-                } else if (flags.space_sign) {
-                    sign = ' ';
-                }
-            }
+// Hand a filled slot to the flusher
+static void async_publish(async_slot *slot, size_t pos) {
+    // Publish, then wake the flusher only if it went to sleep. Whoever
+    // clears waiting does the wake, the others skip the syscall
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&async_log.waiting, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&async_log.waiting, 0, __ATOMIC_SEQ_CST)) {
+        async_wake();
+    }
 
-            size_t effective_len = skip_first ? len - 1 : len;
-            int total_len = (int)effective_len + (sign ? 1 : 0);
+    // Best effort, a racing producer may overwrite a slightly larger value
+    size_t *high_water = &async_log.stats.high_water;
+    size_t depth = pos + 1 - __atomic_load_n(&async_log.head, __ATOMIC_RELAXED);
+    if (depth <= ASYNC_SLOTS && // The flusher may be past pos already
+        depth > __atomic_load_n(high_water, __ATOMIC_RELAXED)) {
+        __atomic_store_n(high_water, depth, __ATOMIC_RELAXED);
+    }
+}
 
-            // Padding before number
-            if (!flags.left_justify && flags.width > total_len) {
-                int pad = flags.width - total_len;
-                char pad_char = (flags.zero_pad) ? '0' : ' ';
+// Format as text into a claimed slot
+static size_t async_format(async_slot *slot, const char *format, va_list ap) {
+    memory_sink mem = {slot->text, ASYNC_TEXT_SIZE, 0};
+    sink out = {memory_put_char, memory_put_span, NULL, &mem, 0, 0};
 
-                if (pad_char == '0' && sign) {
-                    *ptr++ = sign;
-                    sign = 0;
-                }
+    format_to_buffer(&out, format, ap);
+    if (out.count > ASYNC_TEXT_SIZE) {
+        async_count(&async_log.stats.truncated);
+    }
 
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = pad_char;
-                }
-            }
+    slot->len = (uint32_t)mem.len;
+    slot->record = 0;
+    return mem.len;
+}
 
-            if (sign) {
-                *ptr++ = sign;
-            }
+/*
+ * Format into the ring, never blocks
+ * Returns the number of bytes queued, or EOF if the message was dropped
+ * (ring full, or async_start() not called)
+ */
+int async_vprintf(const char *format, va_list ap) {
+    if (!async_log.running) {
+        return EOF;
+    }
 
-            const char *copy_start = skip_first ? num_str + 1 : num_str;
-            size_t copy_len = skip_first ? len - 1 : len;
+    size_t pos; // Ring position of the claimed slot
+    async_slot *slot = async_claim(&pos);
+    if (slot == NULL) {
+        return EOF;
+    }
 
-            for (size_t i = 0; i < copy_len; i++) {
-                *ptr++ = copy_start[i];
-            }
+    size_t len = async_format(slot, format, ap);
+    async_publish(slot, pos);
+    return (int)len;
+}
 
-            if (flags.left_justify && flags.width > total_len) {
-                int pad = flags.width - total_len;
-                for (int i = 0; i < pad; i++) {
-                    *ptr++ = ' ';
-                }
-            }
-            break;
-        }
+/*
+ * Like async_vprintf() but without formatting on the calling thread: the
+ * arguments are captured into the slot and the flusher renders them. The
+ * format must stay valid until then, use string literals
+ * Returns the number of bytes queued, or EOF if the message was dropped
+ */
+int async_vlogf(const char *format, va_list ap) {
+    if (!async_log.running) {
+        return EOF;
+    }
 
-        case 'n': {
-            // Store number of characters written so far
-            int *count_ptr = va_arg(ap, int *);
-            *count_ptr = (int)(ptr - buffer);
-            break;
-        }
+    size_t pos; // Ring position of the claimed slot
+    async_slot *slot = async_claim(&pos);
+    if (slot == NULL) {
+        return EOF;
+    }
 
-        default: {
-            // Unknown specifier, just copy the format
-            format -= consumed;
-            *ptr++ = *format++;
-            break;
-        }
-        }
+    log_record *rec = (log_record *)slot->text;
+    size_t len = log_capture(rec, ASYNC_TEXT_SIZE, format, ap);
+    if (len > 0) {
+        slot->len = (uint32_t)len;
+        slot->record = 1;
+    } else {
+        // Too many arguments or too much string data, format it now
+        len = async_format(slot, format, ap);
     }
 
-    *ptr = '\0';
-    return (int)(ptr - buffer);
+    async_publish(slot, pos);
+    return (int)len;
 }
 
-/*
- * Complete printf() function with full format support
- */
 __attribute__((format(printf, 1, 2))) //
-ssize_t printf(const char *format, ...) {
+int async_logf(const char *format, ...) {
     va_list ap;
     va_start(ap, format);
-
-    // Buffer for formatted output
-    char buffer[4096];
-
-    // Format to buffer
-    int len = format_to_buffer(buffer, format, ap);
-
+    int len = async_vlogf(format, ap);
     va_end(ap);
+    return len;
+}
 
-    // Write to stdout
-    ssize_t written = write(STDOUT_FILENO, buffer, len);
-    if (written < 0) {
-        exit(EXIT_FAILURE);
-    }
+__attribute__((format(printf, 1, 2))) //
+int async_printf(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = async_vprintf(format, ap);
+    va_end(ap);
+    return len;
+}
 
-    return written;
+// Snapshot of the counters, depth is computed now
+void async_get_stats(async_stats *stats) {
+    // head first, tail can only have moved further since
+    size_t head = __atomic_load_n(&async_log.head, __ATOMIC_ACQUIRE);
+    *stats = async_log.stats;
+    stats->depth = __atomic_load_n(&async_log.tail, __ATOMIC_ACQUIRE) - head;
 }
 
+// Programs that include this file (see bench/) bring their own main()
+#ifndef PRINTF_NO_MAIN
 /*
  * Test program with floating point
  */
@@ -1234,7 +7733,9 @@ int main(int argc, char **argv) {
     printf("Hex lowercase: %x\n", 255);
     printf("Hex uppercase: %X\n", 255);
     printf("Pointer: %p\n", (void *)main);
-    printf("NULL str: %s\n", (char *)NULL);
+    // Through a volatile so GCC cannot see the NULL and warn about it
+    const char *volatile null_str = NULL;
+    printf("NULL str: %s\n", null_str);
 
     // Test flags
     printf("\nFlag tests:\n");
@@ -1273,6 +7774,7 @@ int main(int argc, char **argv) {
     printf("Fixed (zero): %f\n", 0.0);
     printf("Fixed (small): %f\n", 0.000123456);
     printf("Fixed (large): %f\n", 123456789.0);
+    printf("Fixed (long double): %Lf\n", 1.5L);
 
     // Scientific notation
     printf("\nScientific notation:\n");
@@ -1282,6 +7784,7 @@ int main(int argc, char **argv) {
     printf("Scientific (negative): %e\n", -123.456789);
     printf("Scientific (small): %e\n", 0.000123456);
     printf("Scientific (large): %e\n", 123456789.0);
+    printf("Scientific (long double): %.3Le\n", -2.25e300L);
 
     // General format
     printf("\nGeneral format:\n");
@@ -1326,6 +7829,7 @@ int main(int argc, char **argv) {
     while (1) {
 
         printf("Input something: ");
+        fflush(stdout); // Prompt has no newline, show it before blocking
         ssize_t len = read(STDIN_FILENO, buffer, sizeof(buffer));
 
         if (len <= 0) { // Handle EOF
@@ -1353,20 +7857,153 @@ int main(int argc, char **argv) {
 
     return EXIT_SUCCESS;
 }
+#endif
+
+/*
+ * Process startup
+ * The kernel leaves argc, the argv pointers, NULL, the envp pointers, NULL
+ * and then the auxiliary vector (type, value pairs up to AT_NULL) on the
+ * stack. _start_main() keeps envp as environ and the vector for
+ * getauxval(), which is how later code finds AT_HWCAP and friends
+ */
+#define AT_NULL 0
+
+char **environ;
+static const unsigned long *auxv;
+
+unsigned long getauxval(unsigned long type) {
+    for (const unsigned long *a = auxv; a != NULL && a[0] != AT_NULL;
+         a += 2) {
+        if (a[0] == type) {
+            return a[1];
+        }
+    }
+    return 0;
+}
 
-// setup stack
-void _start_main(long *stack) {
+char *getenv(const char *name) {
+    size_t len = strlen(name);
+    for (char **e = environ; e != NULL && *e != NULL; e++) {
+        size_t i = 0;
+        while (i < len && (*e)[i] == name[i]) {
+            i++;
+        }
+        if (i == len && (*e)[len] == '=') {
+            return *e + len + 1;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * A -static-pie binary is loaded at a random address with nobody to apply
+ * its relocations, so it does that itself: every R_*_RELATIVE entry adds
+ * the load address to one word. The linker only emits that kind for a
+ * static binary (no ifuncs here). Until this has run nothing may read a
+ * pointer out of initialised data, GOT entries included, so the dynamic
+ * section is found through the program headers and the load address
+ * through the pc-relative __ehdr_start. Dynamically linked builds were
+ * already relocated by ld.so (AT_BASE is its address) and non-PIE builds
+ * have no PT_DYNAMIC at all
+ */
+#define PT_DYNAMIC 2
+#define DT_NULL    0
+#define DT_RELA    7
+#define DT_RELASZ  8
+
+typedef struct {
+    uint32_t type;
+    uint32_t flags;
+    unsigned long offset;
+    unsigned long vaddr;
+    unsigned long paddr;
+    unsigned long filesz;
+    unsigned long memsz;
+    unsigned long align;
+} elf_phdr;
+
+typedef struct {
+    long tag;
+    unsigned long value;
+} elf_dyn;
+
+typedef struct {
+    unsigned long offset;
+    unsigned long info; // Symbol index << 32 | type
+    long addend;
+} elf_rela;
+
+// Defined by the linker, the ELF header is the first byte of the image
+extern const char __ehdr_start[] __attribute__((visibility("hidden")));
+
+static void relocate_self(void) {
+    const elf_phdr *phdr = (const elf_phdr *)getauxval(AT_PHDR);
+    unsigned long phnum = getauxval(AT_PHNUM);
+    if (phdr == NULL || getauxval(AT_BASE) != 0) {
+        return;
+    }
+
+    // A PIE is linked at 0, so the runtime header address is the offset
+    uintptr_t base = (uintptr_t)__ehdr_start;
+    const elf_dyn *d = NULL;
+    for (unsigned long i = 0; i < phnum; i++) {
+        if (phdr[i].type == PT_DYNAMIC) {
+            d = (const elf_dyn *)(base + phdr[i].vaddr);
+        }
+    }
+    if (d == NULL) {
+        return;
+    }
+
+    unsigned long rela = 0;
+    unsigned long size = 0;
+    for (; d->tag != DT_NULL; d++) {
+        if (d->tag == DT_RELA) {
+            rela = d->value;
+        } else if (d->tag == DT_RELASZ) {
+            size = d->value;
+        }
+    }
+
+    const elf_rela *r = (const elf_rela *)(base + rela);
+    const elf_rela *end = (const elf_rela *)(base + rela + size);
+    for (; r < end; r++) {
+        if ((uint32_t)r->info == ARCH_R_RELATIVE) {
+            *(uintptr_t *)(base + r->offset) = base + r->addend;
+        }
+    }
+}
+
+int main(int argc, char **argv);
+
+// setup stack, only called from the asm in _start: used keeps LTO from
+// dropping it
+__attribute__((used)) void _start_main(long *stack) {
     int argc = (int)stack[0];
     char **argv = (char **)(stack + 1);
-    // char **envp = argv + argc + 1;
+    char **envp = argv + argc + 1;
+    char **e = envp;
+    while (*e != NULL) {
+        e++;
+    }
+    // The two statics are plain stores, safe before relocation
+    environ = envp;
+    auxv = (const unsigned long *)(e + 1);
+    relocate_self();
+    select_string_impl();
+
+    arch_start();
     int ret = main(argc, argv);
+    // Buffered output must reach the fd before the process is gone
+    async_stop();
+    fflush(NULL);
+    uring_stop();
+#ifdef PRINTF_STATS
+    printf_stats_dump(STDERR_FILENO);
+#endif
     exit(ret);
 }
 
 __attribute__((naked, noreturn)) void _start(void) {
-    asm(                   //
-        "    mov x0, sp\n" // sp = stack
-        "    bl _start_main\n"
-
-    );
+    asm(ARCH_START);
 }
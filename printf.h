@@ -0,0 +1,314 @@
+// Declarations for code that is linked against printf.c instead of
+// including it, like the C++ front end in printf.hpp. printf.c includes
+// this file itself, so the two cannot drift apart
+
+#ifndef PRINTF_H
+#define PRINTF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define basic data types
+typedef unsigned long int size_t;
+typedef long ssize_t;
+typedef unsigned char uint8_t;
+typedef unsigned short uint16_t;
+typedef unsigned int uint32_t;
+typedef int int32_t;
+typedef unsigned long uint64_t;
+typedef long int64_t;
+typedef unsigned long uintptr_t;
+typedef double double_t;
+
+// Define va_list
+typedef __builtin_va_list va_list;
+
+#define va_start(ap, last) __builtin_va_start(ap, last)
+#define va_arg(ap, type)   __builtin_va_arg(ap, type)
+#define va_end(last)       __builtin_va_end(last)
+#define va_copy(dest, src) __builtin_va_copy(dest, src)
+
+#ifdef __cplusplus
+#define NULL nullptr
+#else
+#define NULL ((void *)0)
+#endif
+
+#define EOF (-1)
+
+/*
+ * Streams
+ * stdout and stderr belong to the calling thread (see thread_create()),
+ * stdin is shared
+ */
+typedef struct FILE FILE;
+
+FILE *thread_stdout(void);
+FILE *thread_stderr(void);
+extern FILE stdin_stream;
+
+#define stdout (thread_stdout())
+#define stderr (thread_stderr())
+#define stdin  (&stdin_stream)
+
+int fflush(FILE *stream);
+size_t fpending(FILE *stream);
+int setvbuf(FILE *stream, char *buf, int mode, size_t size);
+int fputs(const char *s, FILE *stream);
+
+FILE *fopen(const char *path, const char *mode);
+FILE *fdopen(int fd, const char *mode);
+int fclose(FILE *stream);
+
+int fgetc(FILE *stream);
+int ungetc(int c, FILE *stream);
+char *fgets(char *s, int n, FILE *stream);
+
+// Flushes through an io_uring instead of write(), see printf.c
+int uring_start(void);
+int uring_wait(void);
+int uring_stop(void);
+
+typedef struct thread thread;
+
+thread *thread_create(int (*fn)(void *), void *arg);
+int thread_join(thread *t);
+
+// Bump allocator over mmap() blocks, see printf.c
+typedef struct arena_block arena_block;
+
+typedef struct {
+    arena_block *blocks; // Newest first
+    char *ptr;           // Next free byte in the newest block
+    char *end;
+    size_t size; // Bytes mapped in all blocks
+} arena;
+
+void arena_init(arena *a);
+void *arena_alloc(arena *a, size_t n);
+void arena_reset(arena *a);
+void arena_release(arena *a);
+arena *thread_arena(void);
+
+// Flags for format specifiers, one word of bits plus width and precision
+typedef struct {
+    unsigned left_justify : 1;    // '-'
+    unsigned always_sign : 1;     // '+'
+    unsigned space_sign : 1;      // ' '
+    unsigned zero_pad : 1;        // '0'
+    unsigned alternate_form : 1;  // '#'
+    unsigned length_modifier : 8; // h, hh, l, ll, z, t, j, L
+    unsigned specifier : 8;       // d i u o x X f F e E g G c s p n %
+    int width;                    // field width
+    int precision;                // precision (-1 means unspecified)
+} format_flags;
+
+/*
+ * Output sinks, see printf.c for the callback rules
+ */
+typedef struct {
+    int (*put_char)(void *ctx, char c);
+    int (*put_span)(void *ctx, const char *data, size_t n);
+    int (*put_ref)(void *ctx, const char *data, size_t n);
+    void *ctx;
+    size_t count; // Total bytes produced so far
+    int error;    // Set once a callback failed
+} sink;
+
+// Bounded buffer, bytes past size are dropped
+typedef struct {
+    char *buf;
+    size_t size; // Capacity, not counting room for the terminator
+    size_t len;  // Bytes stored
+} memory_sink;
+
+// Appends to a FILE buffer
+typedef struct {
+    FILE *stream;
+    int newline; // A '\n' went in (only tracked for line buffered streams)
+    int refused;  // A put failed, the rest of the call is dropped
+    size_t start; // Where the call began, in bytes through the stream
+} stream_sink;
+
+// Writes into a shared mapping of a file, see printf.c
+typedef struct {
+    int fd;
+    char *map;     // Current window, NULL before the first one
+    size_t offset; // File offset of the window
+    size_t window; // Window size
+    size_t len;    // Bytes used in the window
+} map_sink;
+
+// Grows a string in an arena
+typedef struct {
+    arena *arena;
+    char *buf; // NULL until the first byte
+    size_t len;
+    size_t cap; // Bytes taken from the arena
+} arena_sink;
+
+void memory_sink_init(sink *out, memory_sink *mem, char *buf, size_t n);
+int memory_sink_finish(sink *out, memory_sink *mem);
+void stream_sink_init(sink *out, stream_sink *ss, FILE *stream);
+int stream_sink_finish(sink *out, stream_sink *ss);
+int map_sink_open(sink *out, map_sink *ms, const char *path);
+ssize_t map_sink_close(sink *out, map_sink *ms);
+void arena_sink_init(sink *out, arena_sink *as, arena *a);
+char *arena_sink_finish(sink *out, arena_sink *as);
+
+// Conversions of values that were already read, see printf.c
+void format_char(sink *out, const format_flags *flags, int c);
+void format_string(sink *out, const format_flags *flags, const char *str);
+void format_signed(sink *out, const format_flags *flags, int64_t value);
+void format_unsigned(sink *out, const format_flags *flags, uint64_t value);
+void format_double(sink *out, const format_flags *flags, double value);
+
+// Arrays with one spec ("%d", "%.3f") for every element, see printf.c
+int format_int_array(sink *out,
+                     const int64_t *values,
+                     size_t n,
+                     const char *spec,
+                     const char *sep);
+int format_double_array(sink *out,
+                        const double *values,
+                        size_t n,
+                        const char *spec,
+                        const char *sep);
+
+int dtoa_shortest(double value, char *buf);
+
+// Pre-compiled formats, see printf_compile() in printf.c
+#define FORMAT_MAX_OPS 16
+
+typedef struct {
+    const char *literal; // Text written before the specifier
+    size_t literal_len;
+    format_flags flags; // specifier 0 means literal text only
+} format_op;
+
+typedef struct {
+    int count;
+    format_op ops[FORMAT_MAX_OPS];
+} printf_format;
+
+int printf_compile(printf_format *compiled, const char *format);
+const printf_format *printf_compile_cached(const char *format);
+int printf_compiled(const printf_format *compiled, ...);
+int sink_printf_compiled(sink *out, const printf_format *compiled, ...);
+
+// The printf family
+__attribute__((format(printf, 1, 2))) //
+ssize_t printf(const char *format, ...);
+__attribute__((format(printf, 2, 3))) //
+int fprintf(FILE *stream, const char *format, ...);
+__attribute__((format(printf, 2, 3))) //
+int dprintf(int fd, const char *format, ...);
+// dprintf() through one writev(), %s arguments are not copied
+__attribute__((format(printf, 2, 3))) //
+int dprintfv(int fd, const char *format, ...);
+__attribute__((format(printf, 3, 4))) //
+int snprintf(char *buf, size_t n, const char *format, ...);
+__attribute__((format(printf, 2, 3))) //
+int sprintf(char *buf, const char *format, ...);
+__attribute__((format(printf, 2, 3))) //
+int sink_printf(sink *out, const char *format, ...);
+__attribute__((format(printf, 2, 3))) //
+char *arena_printf(arena *a, const char *format, ...);
+__attribute__((format(printf, 2, 3))) //
+int asprintf(char **strp, const char *format, ...);
+
+int vfprintf(FILE *stream, const char *format, va_list ap);
+int vdprintf(int fd, const char *format, va_list ap);
+int vdprintfv(int fd, const char *format, va_list ap);
+int vsnprintf(char *buf, size_t n, const char *format, va_list ap);
+int vsprintf(char *buf, const char *format, va_list ap);
+int sink_vprintf(sink *out, const char *format, va_list ap);
+char *arena_vprintf(arena *a, const char *format, va_list ap);
+int vasprintf(char **strp, const char *format, va_list ap);
+
+// Formatter counters, only kept when built with -DPRINTF_STATS
+int printf_stats_dump(int fd);
+
+// Number parsing and the scanf family
+long strtol(const char *s, char **end, int base);
+unsigned long strtoul(const char *s, char **end, int base);
+double strtod(const char *s, char **end);
+
+__attribute__((format(scanf, 1, 2))) //
+int scanf(const char *format, ...);
+__attribute__((format(scanf, 2, 3))) //
+int fscanf(FILE *stream, const char *format, ...);
+__attribute__((format(scanf, 2, 3))) //
+int sscanf(const char *s, const char *format, ...);
+
+int vscanf(const char *format, va_list ap);
+int vfscanf(FILE *stream, const char *format, va_list ap);
+int vsscanf(const char *s, const char *format, va_list ap);
+
+// Binary log files that make decode turns back into text, see printf.c
+#define LOG_FORMATS_BITS 10 // Formats one writer can give ids to
+#define LOG_FORMATS      (1 << LOG_FORMATS_BITS)
+#define LOG_BUFSIZ       65536
+
+typedef struct {
+    int fd;
+    int error;
+    size_t bytes; // Handed to write() so far
+    uint32_t format_count;
+    struct {
+        const char *format;
+        uint32_t id;
+    } formats[LOG_FORMATS];
+    size_t len;
+    char buf[LOG_BUFSIZ];
+} log_writer;
+
+int log_writer_open(log_writer *w, int fd);
+__attribute__((format(printf, 2, 3))) //
+int log_writer_printf(log_writer *w, const char *format, ...);
+int log_writer_vprintf(log_writer *w, const char *format, va_list ap);
+int log_writer_text(log_writer *w, const char *text, size_t len);
+int log_writer_flush(log_writer *w);
+
+// Asynchronous logging
+typedef struct {
+    size_t depth;      // Messages waiting right now
+    size_t high_water; // Largest depth seen
+    size_t written;    // Messages handed to write()
+    size_t dropped;    // Messages lost because the ring was full
+    size_t truncated;  // Messages cut to fit a slot
+    size_t errors;     // Failed write() calls
+    size_t wakes;      // Times a producer had to wake the flusher
+    size_t bytes;      // Bytes handed to write()
+} async_stats;
+
+int async_start(int fd);
+int async_start_binary(int fd);
+void async_stop(void);
+__attribute__((format(printf, 1, 2))) //
+int async_printf(const char *format, ...);
+__attribute__((format(printf, 1, 2))) //
+int async_logf(const char *format, ...);
+int async_vprintf(const char *format, va_list ap);
+int async_vlogf(const char *format, va_list ap);
+void async_get_stats(async_stats *stats);
+
+// Process environment, set up before main(), see printf.c
+extern char **environ;
+char *getenv(const char *name);
+unsigned long getauxval(unsigned long type);
+
+// getauxval() types, as in <elf.h>
+#define AT_PHDR   3
+#define AT_PHNUM  5
+#define AT_PAGESZ 6
+#define AT_BASE   7
+#define AT_HWCAP  16
+#define AT_HWCAP2 26
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PRINTF_H
@@ -0,0 +1,469 @@
+// Typed front end for C++ callers, header only
+//
+// pf::print<"%d %s\n">(x, s) parses the format while compiling, checks it
+// against the argument types and turns into one call per conversion into
+// the converters printf() itself uses (format_signed() and friends in
+// printf.c). There is no va_list, no format scanning and no dispatch on
+// the specifier at run time.
+//
+// Needs C++20 (the format is a template argument), no exceptions, no RTTI
+// and no C++ library. Link against printf.c built with -DPRINTF_NO_MAIN
+// (make lib), the program's own main() is called from _start as usual.
+//
+// Differences from printf(), all caught at compile time:
+//   - the argument type decides how much is read, so %d takes any integer
+//     and l, ll, z, j, t change nothing. hh and h still truncate
+//   - %u, %o, %x and %X show a signed value as its unsigned type, like
+//     printf() does for the matching length modifier
+//   - floating point conversions take float and double only, %s wants a
+//     char pointer, %p any pointer, '*' an integer
+//   - unknown conversions, %n and a lone '%' at the end are errors
+
+#ifndef PRINTF_HPP
+#define PRINTF_HPP
+
+#include "printf.h"
+
+namespace pf {
+
+// A format string as a template argument
+template <size_t N> struct format_string {
+    char text[N];
+
+    constexpr format_string(const char (&s)[N]) {
+        for (size_t i = 0; i < N; i++) {
+            text[i] = s[i];
+        }
+    }
+};
+
+namespace detail {
+
+/*
+ * Parsing
+ * The same grammar as parse_format() in printf.c, with the same markers:
+ * width -1 for '*', precision -1 unspecified and -2 for '*', 'H' for hh
+ * and 'B' for L
+ */
+constexpr bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+constexpr size_t parse(const char *format, format_flags &flags) {
+    const char *start = format;
+    flags = format_flags{};
+    flags.precision = -1;
+
+    for (;; format++) {
+        if (*format == '-') {
+            flags.left_justify = 1;
+        } else if (*format == '+') {
+            flags.always_sign = 1;
+        } else if (*format == ' ') {
+            flags.space_sign = 1;
+        } else if (*format == '0') {
+            flags.zero_pad = 1;
+        } else if (*format == '#') {
+            flags.alternate_form = 1;
+        } else {
+            break;
+        }
+    }
+
+    if (is_digit(*format)) {
+        while (is_digit(*format)) {
+            flags.width = flags.width * 10 + (*format++ - '0');
+        }
+    } else if (*format == '*') {
+        format++;
+        flags.width = -1;
+    }
+
+    if (*format == '.') {
+        format++;
+        flags.precision = 0;
+        if (is_digit(*format)) {
+            while (is_digit(*format)) {
+                flags.precision = flags.precision * 10 + (*format++ - '0');
+            }
+        } else if (*format == '*') {
+            format++;
+            flags.precision = -2;
+        }
+    }
+
+    switch (*format) {
+    case 'h':
+        flags.length_modifier = format[1] == 'h' ? 'H' : 'h';
+        format += format[1] == 'h' ? 2 : 1;
+        break;
+    case 'l':
+        flags.length_modifier = format[1] == 'l' ? 'L' : 'l';
+        format += format[1] == 'l' ? 2 : 1;
+        break;
+    case 'j':
+    case 'z':
+    case 't':
+        flags.length_modifier = *format++;
+        break;
+    case 'L':
+        flags.length_modifier = 'B';
+        format++;
+        break;
+    }
+
+    flags.specifier = *format++;
+    return (size_t)(format - start);
+}
+
+/*
+ * Compiled formats
+ * Like printf_compile(): a list of literal spans, each one followed by
+ * a conversion (specifier 0 for the last span, or for "%%" which keeps
+ * one '%' in its span). Stars counts the '*' arguments
+ */
+struct op {
+    size_t literal; // Offset into the format
+    size_t literal_len;
+    format_flags flags;
+    int stars;
+    bool lone; // A '%' at the very end, nothing is converted
+};
+
+template <size_t N> struct program {
+    op ops[N];
+};
+
+// The walk both passes share, calls add(op) for every op
+template <class Add> constexpr void walk(const char *format, Add add) {
+    size_t pos = 0;
+    for (;;) {
+        size_t begin = pos;
+        while (format[pos] != '\0' && format[pos] != '%') {
+            pos++;
+        }
+
+        op o{begin, pos - begin, format_flags{}, 0, false};
+        if (format[pos] == '\0') {
+            add(o);
+            return;
+        }
+
+        if (format[pos + 1] == '%') {
+            o.literal_len++; // Keep one '%'
+            pos += 2;
+            add(o);
+            continue;
+        }
+
+        pos += 1 + parse(format + pos + 1, o.flags);
+        o.stars = (o.flags.width == -1) + (o.flags.precision == -2);
+        o.lone = o.flags.specifier == '\0';
+        add(o);
+        if (o.lone) {
+            return; // Reported by check()
+        }
+    }
+}
+
+template <format_string F> constexpr size_t count_ops() {
+    size_t count = 0;
+    walk(F.text, [&](const op &) { count++; });
+    return count;
+}
+
+template <format_string F> constexpr program<count_ops<F>()> compile() {
+    program<count_ops<F>()> result{};
+    size_t count = 0;
+    walk(F.text, [&](const op &o) { result.ops[count++] = o; });
+    return result;
+}
+
+template <format_string F> inline constexpr auto compiled = compile<F>();
+
+/*
+ * Argument types
+ */
+enum class kind { other, integer, floating, string, pointer };
+
+template <class T> struct kind_of {
+    static constexpr kind value = kind::other;
+};
+
+#define PF_KIND(type, k)                                                     \
+    template <> struct kind_of<type> {                                       \
+        static constexpr kind value = kind::k;                               \
+    }
+
+PF_KIND(bool, integer);
+PF_KIND(char, integer);
+PF_KIND(signed char, integer);
+PF_KIND(unsigned char, integer);
+PF_KIND(short, integer);
+PF_KIND(unsigned short, integer);
+PF_KIND(int, integer);
+PF_KIND(unsigned int, integer);
+PF_KIND(long, integer);
+PF_KIND(unsigned long, integer);
+PF_KIND(long long, integer);
+PF_KIND(unsigned long long, integer);
+PF_KIND(float, floating);
+PF_KIND(double, floating);
+PF_KIND(long double, floating); // Converted to double like %Lf in printf.c
+PF_KIND(char *, string);
+PF_KIND(const char *, string);
+PF_KIND(decltype(nullptr), pointer);
+
+#undef PF_KIND
+
+template <class T> struct kind_of<T *> {
+    static constexpr kind value = kind::pointer;
+};
+
+constexpr bool accepts(char specifier, kind k) {
+    switch (specifier) {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'c':
+        return k == kind::integer;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+        return k == kind::floating;
+    case 's':
+        return k == kind::string;
+    case 'p':
+        return k == kind::pointer || k == kind::string;
+    default:
+        return false;
+    }
+}
+
+constexpr bool is_conversion(char specifier) {
+    for (const char *p = "diuoxXcfFeEgGsp"; *p != '\0'; p++) {
+        if (*p == specifier) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Checking
+ * The first problem found, each with its own static_assert message
+ */
+enum class error {
+    none,
+    lone_percent,
+    unknown_conversion,
+    too_few_arguments,
+    too_many_arguments,
+    star_not_integer,
+    wrong_type,
+};
+
+template <format_string F, class... Args> constexpr error check() {
+    constexpr kind kinds[] = {kind_of<Args>::value..., kind::other};
+    constexpr size_t argc = sizeof...(Args);
+
+    size_t arg = 0;
+    for (const op &o : compiled<F>.ops) {
+        char specifier = o.flags.specifier;
+        if (o.lone) {
+            return error::lone_percent;
+        }
+        if (specifier == '\0') {
+            continue; // The last literal, or a "%%"
+        }
+        if (!is_conversion(specifier)) {
+            return error::unknown_conversion;
+        }
+
+        for (int i = 0; i < o.stars; i++, arg++) {
+            if (arg == argc) {
+                return error::too_few_arguments;
+            }
+            if (kinds[arg] != kind::integer) {
+                return error::star_not_integer;
+            }
+        }
+
+        if (arg == argc) {
+            return error::too_few_arguments;
+        }
+        if (!accepts(specifier, kinds[arg++])) {
+            return error::wrong_type;
+        }
+    }
+    return arg == argc ? error::none : error::too_many_arguments;
+}
+
+/*
+ * Conversion of one argument, the specifier is known at compile time
+ */
+template <size_t I, class T, class... Rest>
+inline const auto &nth(const T &first, const Rest &...rest) {
+    if constexpr (I == 0) {
+        return first;
+    } else {
+        return nth<I - 1>(rest...);
+    }
+}
+
+// All bits of an integer as its unsigned type, widened
+template <class T> inline uint64_t bits_of(T value) {
+    if constexpr (sizeof(T) >= sizeof(uint64_t)) {
+        return (uint64_t)value;
+    } else {
+        return (uint64_t)value & ((1UL << (8 * sizeof(T))) - 1);
+    }
+}
+
+template <char Specifier, int Length, class T>
+inline void convert(sink *out, const format_flags *flags, T value) {
+    if constexpr (Specifier == 'd' || Specifier == 'i') {
+        int64_t v = (int64_t)value;
+        if constexpr (Length == 'H') {
+            v = (signed char)v;
+        } else if constexpr (Length == 'h') {
+            v = (short)v;
+        }
+        ::format_signed(out, flags, v);
+    } else if constexpr (Specifier == 'u' || Specifier == 'o' ||
+                         Specifier == 'x' || Specifier == 'X') {
+        uint64_t v = bits_of(value);
+        if constexpr (Length == 'H') {
+            v = (unsigned char)v;
+        } else if constexpr (Length == 'h') {
+            v = (unsigned short)v;
+        }
+        ::format_unsigned(out, flags, v);
+    } else if constexpr (Specifier == 'c') {
+        ::format_char(out, flags, (int)value);
+    } else if constexpr (Specifier == 's') {
+        ::format_string(out, flags, value);
+    } else if constexpr (Specifier == 'p') {
+        ::format_unsigned(out, flags, (uint64_t)(const void *)value);
+    } else {
+        ::format_double(out, flags, (double)value);
+    }
+}
+
+// Same as sink_ref() in printf.c, the text lives in the template argument
+inline void literal(sink *out, const char *data, size_t n) {
+    int ret = out->put_ref ? out->put_ref(out->ctx, data, n)
+                           : out->put_span(out->ctx, data, n);
+    if (ret != 0) {
+        out->error = 1;
+    }
+    out->count += n;
+}
+
+// Op I, with argument A as the first one it reads, then the rest
+template <format_string F, size_t I, size_t A, class... Args>
+inline void run(sink *out, const Args &...args) {
+    constexpr const op &o = compiled<F>.ops[I];
+
+    if constexpr (o.literal_len > 0) {
+        literal(out, F.text + o.literal, o.literal_len);
+    }
+
+    constexpr char specifier = o.flags.specifier;
+    if constexpr (specifier != '\0' && o.stars == 0) {
+        // Constant flags, straight from the compiled format
+        convert<specifier, o.flags.length_modifier>(
+            out, &o.flags, nth<A>(args...));
+    } else if constexpr (specifier != '\0') {
+        // Width and precision from arguments, as format_arg() does it
+        format_flags flags = o.flags;
+        if constexpr (o.flags.width == -1) {
+            flags.width = (int)nth<A>(args...);
+            if (flags.width < 0) {
+                flags.left_justify = 1;
+                flags.width = -flags.width;
+            }
+        }
+        if constexpr (o.flags.precision == -2) {
+            flags.precision = (int)nth<A + o.stars - 1>(args...);
+            if (flags.precision < 0) {
+                flags.precision = -1;
+            }
+        }
+        convert<specifier, o.flags.length_modifier>(
+            out, &flags, nth<A + o.stars>(args...));
+    }
+
+    if constexpr (I + 1 < count_ops<F>()) {
+        constexpr size_t used = specifier != '\0' ? o.stars + 1 : 0;
+        run<F, I + 1, A + used>(out, args...);
+    }
+}
+
+} // namespace detail
+
+/*
+ * Format into a sink
+ * Returns the sink's byte count, like sink_printf()
+ */
+template <format_string F, class... Args>
+inline int format_to(sink *out, Args... args) {
+    using detail::error;
+    constexpr error e = detail::check<F, Args...>();
+
+    static_assert(e != error::lone_percent, "pf: lone '%' in format");
+    static_assert(e != error::unknown_conversion,
+                  "pf: unknown conversion (or %n) in format");
+    static_assert(e != error::too_few_arguments,
+                  "pf: format wants more arguments");
+    static_assert(e != error::too_many_arguments,
+                  "pf: more arguments than the format uses");
+    static_assert(e != error::star_not_integer,
+                  "pf: '*' width and precision take integers");
+    static_assert(e != error::wrong_type,
+                  "pf: argument type does not match its conversion");
+
+    if constexpr (e == error::none) {
+        detail::run<F, 0, 0>(out, args...);
+    }
+    return (int)out->count;
+}
+
+/*
+ * Format into buf like snprintf(), at most n bytes with the terminator
+ * Returns the length the text would have without the limit
+ */
+template <format_string F, class... Args>
+inline int format(char *buf, size_t n, Args... args) {
+    memory_sink mem;
+    sink out;
+    memory_sink_init(&out, &mem, buf, n);
+    format_to<F>(&out, args...);
+    return memory_sink_finish(&out, &mem);
+}
+
+/*
+ * Print to a stream like fprintf()
+ * Returns the number of bytes, or EOF on error
+ */
+template <format_string F, class... Args>
+inline int fprint(FILE *stream, Args... args) {
+    stream_sink ss;
+    sink out;
+    stream_sink_init(&out, &ss, stream);
+    format_to<F>(&out, args...);
+    return stream_sink_finish(&out, &ss);
+}
+
+// Print to the calling thread's stdout like printf()
+template <format_string F, class... Args> inline int print(Args... args) {
+    return fprint<F>(stdout, args...);
+}
+
+} // namespace pf
+
+#endif // PRINTF_HPP
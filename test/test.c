@@ -0,0 +1,917 @@
+// printf.c checked against the host C library, see "make test"
+// printf.c and glibc cannot be linked into one program as they are, both
+// define printf(), strtod() and the rest. The Makefile builds printf.c as
+// an object and renames every one of its symbols with a pc_ prefix, so
+// this is a normal hosted program that calls pc_snprintf() next to
+// snprintf(). glibc's output is the reference: every result has to match
+// byte for byte, and both are timed on the same inputs
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The parts of printf.c under test, with their new names
+int pc_snprintf(char *buf, size_t n, const char *format, ...);
+double pc_strtod(const char *s, char **end);
+long pc_strtol(const char *s, char **end, int base);
+unsigned long pc_strtoul(const char *s, char **end, int base);
+int pc_sscanf(const char *s, const char *format, ...);
+
+#define BATCH   1024
+#define REPORTS 10 // Mismatches printed in all, every one is counted
+
+static size_t mismatches;
+
+static uint64_t test_random(void) {
+    static uint64_t state = 88172645463325252UL;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// Random number in [0, n)
+static uint64_t below(uint64_t n) {
+    return test_random() % n;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// One line of a timing table, the ratio is glibc's time over ours
+static void report_times(const char *name,
+                         size_t cases,
+                         double ours_ns,
+                         double glibc_ns) {
+    printf("%-10s %9zu %9.2f ns %9.2f ns %7.2fx\n",
+           name,
+           cases,
+           ours_ns / (double)cases,
+           glibc_ns / (double)cases,
+           glibc_ns / ours_ns);
+}
+
+static void report_header(void) {
+    printf("%-10s %9s %12s %12s %8s\n",
+           "kind",
+           "cases",
+           "printf.c",
+           "glibc",
+           "speedup");
+}
+
+// Counts a mismatch, true while it should still be printed
+static int mismatch(void) {
+    return mismatches++ < REPORTS;
+}
+
+/*
+ * Random formats
+ * Flags, width and precision (also through '*', negative ones included),
+ * every length modifier, literal text around the spec, and values biased
+ * towards the edges (limits, zero, ties, subnormals, inf and nan). Only
+ * defined combinations are made, so no '#' on %d or '0' on %s. Each case
+ * also runs with a short buffer, where the return value and the
+ * truncated text have to match too
+ */
+#define FORMAT_CASES (3 * 1024 * 1024)
+#define FORMAT_OUT   512 // Widest case: 309 integer digits, 69 decimals
+
+typedef struct {
+    char format[48];
+    int star_width;
+    int star_precision;
+    int arg_width;
+    int arg_precision;
+    int precision; // As given, -1 when there is none
+    const char *length; // "", "hh", "h", "l", "ll", "j", "z", "t" or "L"
+    char conv;
+    long i; // %d %i %u %o %x %X %c
+    double d;
+    const char *s;
+} format_case;
+
+static const char *const string_pool[] = {
+    "",
+    "ok",
+    "worker",
+    "connection reset",
+    "/usr/local/share/applications",
+    "the quick brown fox jumps over the lazy dog, again and again",
+};
+
+static const double double_edges[] = {
+    0.0,
+    -0.0,
+    0.5,
+    1.5,
+    2.5,
+    -2.5,
+    0.125,
+    0.375,
+    9.5,
+    99.5,
+    0.05,
+    0.15,
+    0.95,
+    9.96,
+    1e-5,
+    9.9999999e-5,
+    123456.789,
+    1e15,
+    1e16,
+    1e17,
+    1e21,
+    1e22,
+    1e23,
+    9007199254740992.0,
+    9007199254740993.0,
+    0.99999999999999989,
+    DBL_MAX,
+    DBL_MIN,
+    2.2250738585072009e-308, // Largest subnormal
+    4.9406564584124654e-324, // Smallest subnormal
+    INFINITY,
+    -INFINITY,
+    NAN,
+    -NAN,
+};
+
+static long random_int(void) {
+    static const long edges[] = {
+        0,           1,         -1,          7,          9,
+        10,          99,        100,         127,        128,
+        255,         256,       -128,        -129,       32767,
+        32768,       65535,     -32768,      2147483647, -2147483647L - 1,
+        4294967295L, 1L << 32,  1000000000L, 0x7fffffffffffffffL,
+        -0x7fffffffffffffffL - 1,
+    };
+
+    switch (below(3)) {
+    case 0:
+        return edges[below(sizeof(edges) / sizeof(*edges))];
+    case 1:
+        return (long)below(2001) - 1000;
+    default:
+        // All magnitudes, not just 19 digit ones
+        return (long)(test_random() >> below(64));
+    }
+}
+
+static double random_double(void) {
+    uint64_t bits;
+    double value;
+    switch (below(5)) {
+    case 0:
+        return double_edges[below(sizeof(double_edges) /
+                                  sizeof(*double_edges))];
+    case 1:
+        // Any bit pattern, so every exponent
+        bits = test_random();
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    case 2:
+        // Exact binary fractions, the ties of the shorter precisions
+        return (double)((long)below(200001) - 100000) /
+               (double)(1L << below(12));
+    case 3:
+        // Short decimals, which sit right next to a rounding boundary
+        return (double)((long)below(2000001) - 1000000) /
+               pow(10, (double)below(8));
+    default:
+        // Ordinary magnitudes
+        bits = (test_random() & 0xfffffffffffffUL) |
+               (uint64_t)(1023 - 40 + below(80)) << 52;
+        memcpy(&value, &bits, sizeof(value));
+        return below(2) ? value : -value;
+    }
+}
+
+// Builds a random spec and the value for it
+static void format_make(format_case *fc) {
+    static const char convs[] = "diuoxXcsfFeEgG";
+    static const char *lengths[] = {"", "hh", "h", "l", "ll", "j", "z", "t"};
+    static const char *before[] = {"", "v=", "[", "%% "};
+    static const char *after[] = {"", "]", " units\n"};
+    const char *allowed; // Flags that are defined for the conversion
+
+    fc->conv = convs[below(sizeof(convs) - 1)];
+    switch (fc->conv) {
+    case 'd':
+    case 'i':
+        allowed = "-+ 0";
+        break;
+    case 'u':
+        allowed = "-0";
+        break;
+    case 'o':
+    case 'x':
+    case 'X':
+        allowed = "-0#";
+        break;
+    case 'c':
+    case 's':
+        allowed = "-";
+        break;
+    default:
+        allowed = "-+ 0#";
+        break;
+    }
+
+    char *p = fc->format;
+    p += sprintf(p, "%s%%", before[below(4)]);
+    for (const char *f = allowed; *f != '\0'; f++) {
+        if (below(4) == 0) {
+            *p++ = *f;
+        }
+    }
+
+    // Width and precision: none, a number or '*'
+    fc->star_width = 0;
+    switch (below(4)) {
+    case 0:
+        p += sprintf(p, "%d", (int)below(30) + 1);
+        break;
+    case 1:
+        fc->star_width = 1;
+        fc->arg_width = (int)below(61) - 30;
+        *p++ = '*';
+        break;
+    }
+
+    fc->star_precision = 0;
+    fc->precision = -1;
+    if (fc->conv != 'c' && below(2)) {
+        *p++ = '.';
+        switch (below(4)) {
+        case 0:
+            fc->star_precision = 1;
+            fc->arg_precision = (int)below(50) - 10;
+            fc->precision = fc->arg_precision;
+            *p++ = '*';
+            break;
+        case 1:
+            fc->precision = 0; // Just the '.'
+            break;
+        default:
+            // Long ones are where the digits of doubles have to be exact
+            fc->precision = (int)below(below(8) ? 20 : 70);
+            p += sprintf(p, "%d", fc->precision);
+            break;
+        }
+    }
+
+    fc->length = "";
+    if (strchr("diuoxX", fc->conv) != NULL) {
+        fc->length = lengths[below(8)];
+    } else if (strchr("fFeEgG", fc->conv) != NULL && below(4) == 0) {
+        fc->length = "L";
+    }
+    sprintf(p, "%s%c%s", fc->length, fc->conv, after[below(3)]);
+
+    fc->i = random_int();
+    if (fc->conv == 'c') {
+        fc->i = (long)below(94) + 32; // Printable
+    }
+    fc->d = random_double();
+    fc->s = string_pool[below(sizeof(string_pool) / sizeof(*string_pool))];
+}
+
+// fn (snprintf or pc_snprintf) with the arguments the spec takes, in order
+#define FORMAT_CALL(fn, buf, n, fc, value)                                     \
+    ((fc)->star_width && (fc)->star_precision                                  \
+         ? fn(buf,                                                             \
+              n,                                                               \
+              (fc)->format,                                                    \
+              (fc)->arg_width,                                                 \
+              (fc)->arg_precision,                                             \
+              value)                                                           \
+     : (fc)->star_width                                                        \
+         ? fn(buf, n, (fc)->format, (fc)->arg_width, value)                    \
+     : (fc)->star_precision                                                    \
+         ? fn(buf, n, (fc)->format, (fc)->arg_precision, value)                \
+         : fn(buf, n, (fc)->format, value))
+
+// int for no length, hh and h (they are promoted), long for the others
+#define FORMAT_RUN(fn, buf, n, fc)                                             \
+    ((fc)->conv == 's' ? FORMAT_CALL(fn, buf, n, fc, (fc)->s)                  \
+     : (fc)->length[0] == 'L'                                                  \
+         ? FORMAT_CALL(fn, buf, n, fc, (long double)(fc)->d)                   \
+     : strchr("fFeEgG", (fc)->conv) ? FORMAT_CALL(fn, buf, n, fc, (fc)->d)     \
+     : (fc)->length[0] == '\0' || (fc)->length[0] == 'h'                       \
+         ? FORMAT_CALL(fn, buf, n, fc, (int)(fc)->i)                           \
+         : FORMAT_CALL(fn, buf, n, fc, (fc)->i))
+
+static int format_ours(char *buf, size_t n, const format_case *fc) {
+    return FORMAT_RUN(pc_snprintf, buf, n, fc);
+}
+
+static int format_glibc(char *buf, size_t n, const format_case *fc) {
+    return FORMAT_RUN(snprintf, buf, n, fc);
+}
+
+/*
+ * glibc's %#g drops a digit when rounding carries into a new one: 99.5
+ * in %#.2g comes out as "1.e+02", "1.0e+02" is right. Those cases are
+ * checked against what C11 7.21.6.1 defines %g as instead, glibc's %e or
+ * %f with the precision that the exponent X of the rounded value picks
+ */
+static int format_alternate_g(char *buf, size_t n, const format_case *fc) {
+    int p = fc->precision < 0 ? 6 : fc->precision == 0 ? 1 : fc->precision;
+    char digits[FORMAT_OUT];
+    snprintf(digits, sizeof(digits), "%.*e", p - 1, fc->d);
+    int x = atoi(strchr(digits, 'e') + 1);
+
+    // The same spec with the conversion and a '*' precision swapped in
+    format_case alt = *fc;
+    char *conv = strchr(alt.format, fc->conv);
+    char *spec = conv - strlen(fc->length);
+    char *digits_start = spec;
+    while (digits_start[-1] == '*' ||
+           (digits_start[-1] >= '0' && digits_start[-1] <= '9')) {
+        digits_start--;
+    }
+    // Without the '.' those were the width
+    if (digits_start[-1] == '.') {
+        spec = digits_start - 1;
+    }
+
+    int upper = fc->conv == 'G';
+    alt.conv = p > x && x >= -4 ? (upper ? 'F' : 'f') : (upper ? 'E' : 'e');
+    alt.star_precision = 1;
+    alt.arg_precision = alt.conv == 'f' || alt.conv == 'F' ? p - 1 - x : p - 1;
+    snprintf(spec,
+             sizeof(alt.format) - (size_t)(spec - alt.format),
+             ".*%s%c%s",
+             fc->length,
+             alt.conv,
+             fc->format + (conv - alt.format) + 1);
+    return format_glibc(buf, n, &alt);
+}
+
+// glibc, except for the cases above
+static int format_expected(char *buf, size_t n, const format_case *fc) {
+    if ((fc->conv == 'g' || fc->conv == 'G') && strchr(fc->format, '#') &&
+        isfinite(fc->d)) {
+        return format_alternate_g(buf, n, fc);
+    }
+    return format_glibc(buf, n, fc);
+}
+
+// Results are kept apart by kind of conversion
+static int format_kind(char conv) {
+    return conv == 'c' || conv == 's' ? 1
+           : strchr("fFeEgG", conv)   ? 2
+                                      : 0;
+}
+
+static format_case format_cases[BATCH];
+static char format_out[2][BATCH][FORMAT_OUT];
+static int format_len[2][BATCH];
+
+static void format_report(const format_case *fc,
+                          size_t n,
+                          const char *ours,
+                          int ours_len,
+                          const char *glibc,
+                          int glibc_len) {
+    printf("mismatch \"%s\"", fc->format);
+    if (fc->star_width) {
+        printf(" width %d", fc->arg_width);
+    }
+    if (fc->star_precision) {
+        printf(" precision %d", fc->arg_precision);
+    }
+    if (format_kind(fc->conv) == 2) {
+        printf(" value %a", fc->d);
+    } else if (fc->conv != 's') {
+        printf(" value %ld", fc->i);
+    }
+    printf(" size %zu\n  ours  %d \"%s\"\n  glibc %d \"%s\"\n",
+           n,
+           ours_len,
+           ours,
+           glibc_len,
+           glibc);
+}
+
+static int format_check(const format_case *fc,
+                        size_t n,
+                        const char *ours,
+                        int ours_len,
+                        const char *glibc,
+                        int glibc_len) {
+    if (ours_len == glibc_len && strcmp(ours, glibc) == 0) {
+        return 0;
+    }
+    if (mismatch()) {
+        format_report(fc, n, ours, ours_len, glibc, glibc_len);
+    }
+    return 1;
+}
+
+static void test_format(void) {
+    static const char *kinds[] = {"integer", "string", "double"};
+    double ours_ns[3] = {0};
+    double glibc_ns[3] = {0};
+    size_t cases[3] = {0};
+
+    // A batch of one kind at a time, so the clock is read per batch
+    for (size_t done = 0; done < FORMAT_CASES; done += BATCH) {
+        int kind = (int)(done / BATCH % 3);
+        for (size_t i = 0; i < BATCH; i++) {
+            do {
+                format_make(&format_cases[i]);
+            } while (format_kind(format_cases[i].conv) != kind);
+        }
+
+        double start = now_ns();
+        for (size_t i = 0; i < BATCH; i++) {
+            format_len[0][i] =
+                format_ours(format_out[0][i], FORMAT_OUT, &format_cases[i]);
+        }
+        double middle = now_ns();
+        for (size_t i = 0; i < BATCH; i++) {
+            format_len[1][i] =
+                format_glibc(format_out[1][i], FORMAT_OUT, &format_cases[i]);
+        }
+        double end = now_ns();
+
+        ours_ns[kind] += middle - start;
+        glibc_ns[kind] += end - middle;
+        cases[kind] += BATCH;
+
+        for (size_t i = 0; i < BATCH; i++) {
+            const format_case *fc = &format_cases[i];
+            format_len[1][i] =
+                format_expected(format_out[1][i], FORMAT_OUT, fc);
+            if (format_check(fc,
+                             FORMAT_OUT,
+                             format_out[0][i],
+                             format_len[0][i],
+                             format_out[1][i],
+                             format_len[1][i])) {
+                continue;
+            }
+
+            // Again into a buffer that may be too short, not timed
+            char ours[FORMAT_OUT], glibc[FORMAT_OUT];
+            size_t n = below(24);
+            int ours_len = format_ours(ours, n, fc);
+            int glibc_len = format_expected(glibc, n, fc);
+            if (n == 0) {
+                ours[0] = glibc[0] = '\0'; // Nothing is stored
+            }
+            format_check(fc, n, ours, ours_len, glibc, glibc_len);
+        }
+    }
+
+    report_header();
+    for (int k = 0; k < 3; k++) {
+        report_times(kinds[k], cases[k], ours_ns[k], glibc_ns[k]);
+    }
+}
+
+/*
+ * String to double: decimals as glibc prints them (so every exponent and
+ * the shortest round trip forms), long random digit strings that need
+ * more than 17 digits to round right, and the edges of the syntax. Hex
+ * floats are left out, printf.c reads them as the 0 before the 'x'
+ */
+#define STRTOD_CASES (1024 * 1024)
+#define STRTOD_TEXT  400
+
+static char strtod_text[BATCH][STRTOD_TEXT];
+static double strtod_value[2][BATCH];
+static char *strtod_end[2][BATCH];
+
+static void strtod_make(char *text) {
+    static const char *const edges[] = {
+        "inf",
+        "-Infinity",
+        "infinit",
+        "nan",
+        "-NAN",
+        "  +1.5",
+        "\t\n-0",
+        "1e",
+        "1e+",
+        "1e-x",
+        ".5",
+        "5.",
+        ".",
+        "-",
+        "+.e1",
+        "00012",
+        "12abc",
+        "1e-400",
+        "1e400",
+        "2.4703282292062327e-324",
+        "2.4703282292062328e-324",
+        "4.9e-324",
+        "2.2250738585072011e-308",
+        "1.7976931348623157e308",
+        "1.7976931348623158e308",
+        "1.7976931348623159e308",
+        "0.000000000000000000000000000000000001e36",
+        "9007199254740993",
+        "9007199254740993.0000000000000000000001",
+        "123456789012345678901234567890e-30",
+    };
+
+    double d = random_double();
+    switch (below(5)) {
+    case 0:
+        snprintf(text, STRTOD_TEXT, "%.*g", (int)below(20) + 1, d);
+        break;
+    case 1:
+        snprintf(text, STRTOD_TEXT, "%.*e", (int)below(25), d);
+        break;
+    case 2:
+        snprintf(text, STRTOD_TEXT, "%.*f", (int)below(30), d);
+        break;
+    case 3: {
+        // Up to 40 digits with the point anywhere and any exponent
+        char *p = text;
+        if (below(2)) {
+            *p++ = below(2) ? '-' : '+';
+        }
+        int digits = (int)below(40) + 1;
+        int point = (int)below((uint64_t)digits + 2) - 1;
+        for (int i = 0; i < digits; i++) {
+            if (i == point) {
+                *p++ = '.';
+            }
+            *p++ = (char)('0' + below(10));
+        }
+        if (below(2)) {
+            p += sprintf(p, "e%d", (int)below(801) - 400);
+        }
+        *p = '\0';
+        break;
+    }
+    default:
+        strcpy(text, edges[below(sizeof(edges) / sizeof(*edges))]);
+        break;
+    }
+}
+
+static int same_double(double a, double b) {
+    if (isnan(a) || isnan(b)) {
+        return isnan(a) && isnan(b) && signbit(a) == signbit(b);
+    }
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static void test_strtod(void) {
+    double ours_ns = 0;
+    double glibc_ns = 0;
+
+    for (size_t done = 0; done < STRTOD_CASES; done += BATCH) {
+        for (size_t i = 0; i < BATCH; i++) {
+            strtod_make(strtod_text[i]);
+        }
+
+        double start = now_ns();
+        for (size_t i = 0; i < BATCH; i++) {
+            strtod_value[0][i] = pc_strtod(strtod_text[i], &strtod_end[0][i]);
+        }
+        double middle = now_ns();
+        for (size_t i = 0; i < BATCH; i++) {
+            strtod_value[1][i] = strtod(strtod_text[i], &strtod_end[1][i]);
+        }
+        double end = now_ns();
+        ours_ns += middle - start;
+        glibc_ns += end - middle;
+
+        for (size_t i = 0; i < BATCH; i++) {
+            if (same_double(strtod_value[0][i], strtod_value[1][i]) &&
+                strtod_end[0][i] == strtod_end[1][i]) {
+                continue;
+            }
+            if (mismatch()) {
+                printf("mismatch strtod(\"%s\")\n"
+                       "  ours  %a end %td\n  glibc %a end %td\n",
+                       strtod_text[i],
+                       strtod_value[0][i],
+                       strtod_end[0][i] - strtod_text[i],
+                       strtod_value[1][i],
+                       strtod_end[1][i] - strtod_text[i]);
+            }
+        }
+    }
+
+    report_header();
+    report_times("strtod", STRTOD_CASES, ours_ns, glibc_ns);
+}
+
+/*
+ * String to long: every base strtol() knows how to guess or is commonly
+ * given, with signs, 0x prefixes, overflowing lengths and trailing junk.
+ * Both clamp out of range values the same way, only errno is missing
+ */
+#define STRTOL_CASES (1024 * 1024)
+
+static void strtol_make(char *text, int *base) {
+    static const int bases[] = {0, 2, 8, 10, 16, 36};
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    *base = bases[below(sizeof(bases) / sizeof(*bases))];
+    int radix = *base == 0 ? (int)"\x0a\x08\x10"[below(3)] : *base;
+
+    char *p = text;
+    for (int i = (int)below(3); i > 0; i--) {
+        *p++ = " \t\n"[below(3)];
+    }
+    switch (below(4)) {
+    case 0:
+        *p++ = '-';
+        break;
+    case 1:
+        *p++ = '+';
+        break;
+    }
+    if (radix == 16 && below(2)) {
+        p += sprintf(p, below(2) ? "0x" : "0X");
+    } else if (radix == 8 && *base == 0) {
+        *p++ = '0';
+    }
+    for (int i = (int)below(below(4) ? 20 : 70); i >= 0; i--) {
+        char c = digits[below((uint64_t)radix)];
+        *p++ = below(8) ? c : (char)(c & ~0x20); // Upper case too
+    }
+    if (below(4) == 0) {
+        *p++ = "z.-9 "[below(5)];
+    }
+    *p = '\0';
+}
+
+static void test_strtol(void) {
+    double ours_ns = 0;
+    double glibc_ns = 0;
+    static char text[BATCH][96];
+    static int base[BATCH];
+    static long value[2][BATCH];
+    static char *end[2][BATCH];
+
+    for (size_t done = 0; done < STRTOL_CASES; done += BATCH) {
+        int is_unsigned = (int)(done / BATCH % 2);
+        for (size_t i = 0; i < BATCH; i++) {
+            strtol_make(text[i], &base[i]);
+        }
+
+        double start = now_ns();
+        for (size_t i = 0; i < BATCH; i++) {
+            value[0][i] = is_unsigned
+                              ? (long)pc_strtoul(text[i], &end[0][i], base[i])
+                              : pc_strtol(text[i], &end[0][i], base[i]);
+        }
+        double middle = now_ns();
+        for (size_t i = 0; i < BATCH; i++) {
+            value[1][i] = is_unsigned
+                              ? (long)strtoul(text[i], &end[1][i], base[i])
+                              : strtol(text[i], &end[1][i], base[i]);
+        }
+        double stop = now_ns();
+        ours_ns += middle - start;
+        glibc_ns += stop - middle;
+
+        for (size_t i = 0; i < BATCH; i++) {
+            if (value[0][i] == value[1][i] && end[0][i] == end[1][i]) {
+                continue;
+            }
+            if (mismatch()) {
+                printf("mismatch %s(\"%s\", %d)\n"
+                       "  ours  %ld end %td\n  glibc %ld end %td\n",
+                       is_unsigned ? "strtoul" : "strtol",
+                       text[i],
+                       base[i],
+                       value[0][i],
+                       end[0][i] - text[i],
+                       value[1][i],
+                       end[1][i] - text[i]);
+            }
+        }
+    }
+
+    report_header();
+    report_times("strtol", STRTOL_CASES, ours_ns, glibc_ns);
+}
+
+/*
+ * scanf family: fixed formats with input made to match them, every tenth
+ * one damaged at a random byte so conversions also stop early. Every
+ * slot a conversion may store to starts zeroed on both sides; the return
+ * value and all the stored bytes have to match
+ */
+#define SSCANF_CASES (512 * 1024)
+#define SSCANF_ARGS  6
+#define SSCANF_TEXT  256
+
+static const char *const sscanf_formats[] = {
+    "%d %u %x %o",
+    "%ld%n %lf %s",
+    "%3d%2x%5s %c",
+    "%hhd %hd %lld %i",
+    "%[a-z]%*d %[^,],%lf",
+    "x=%d y=%le%n",
+    "%i %i %i",
+    "%4c%f %g",
+};
+
+typedef struct {
+    uint64_t slots[SSCANF_ARGS];
+    char strings[SSCANF_ARGS][64];
+} sscanf_result;
+
+// Input for format: something each conversion accepts, the literal text
+// as it is and random amounts of white space where the format has some
+static void sscanf_make(const char *format, char *text) {
+    static const char *const words[] = {"ok", "worker", "abc", "zz", "q"};
+    char *p = text;
+
+    for (const char *f = format; *f != '\0'; f++) {
+        if (*f == ' ') {
+            for (int i = (int)below(3); i > 0; i--) {
+                *p++ = " \t\n"[below(3)];
+            }
+            continue;
+        }
+        if (*f != '%') {
+            *p++ = *f;
+            continue;
+        }
+
+        f++;
+        while (strchr("*0123456789hlL", *f) != NULL) {
+            f++;
+        }
+        long i = random_int();
+        switch (*f) {
+        case 'd':
+            p += sprintf(p, "%ld", i);
+            break;
+        case 'u':
+            p += sprintf(p, "%lu", (unsigned long)i);
+            break;
+        case 'x':
+            p += sprintf(p, below(2) ? "%lx" : "0x%lX", (unsigned long)i);
+            break;
+        case 'o':
+            p += sprintf(p, "%lo", (unsigned long)i);
+            break;
+        case 'i':
+            p += sprintf(p,
+                         below(3) == 0   ? "%ld"
+                         : below(2) == 0 ? "0x%lx"
+                                         : "0%lo",
+                         below(3) == 0 ? i : (long)(i & 0xffff));
+            break;
+        case 'f':
+        case 'g':
+        case 'e':
+            p += sprintf(p, "%.*g", (int)below(18) + 1, random_double());
+            break;
+        case 's':
+        case 'c':
+            p += sprintf(p, "%s", words[below(5)]);
+            break;
+        case '[':
+            // "%[^,]" takes spaces, so two words
+            p += sprintf(p,
+                         f[1] == '^' ? "%s %s" : "%s",
+                         words[below(5)],
+                         words[below(5)]);
+            f = strchr(f, ']');
+            break;
+        }
+    }
+    *p = '\0';
+
+    if (below(10) == 0 && p != text) {
+        text[below((uint64_t)(p - text))] = "q-.9 ,"[below(6)];
+    }
+}
+
+// Where each conversion of format stores, in order
+static void sscanf_targets(const char *format, sscanf_result *r, void **args) {
+    int n = 0;
+    for (const char *f = format; *f != '\0' && n < SSCANF_ARGS; f++) {
+        if (*f != '%') {
+            continue;
+        }
+        f++;
+        if (*f == '*') {
+            continue;
+        }
+        while (strchr("0123456789hlL", *f) != NULL) {
+            f++;
+        }
+        args[n] = strchr("sc[", *f) != NULL ? (void *)r->strings[n]
+                                            : (void *)&r->slots[n];
+        n++;
+    }
+    while (n < SSCANF_ARGS) {
+        args[n++] = NULL;
+    }
+}
+
+static void test_sscanf(void) {
+    double ours_ns = 0;
+    double glibc_ns = 0;
+    static char text[BATCH][SSCANF_TEXT];
+    static int format[BATCH];
+    static sscanf_result result[2][BATCH];
+    static int ret[2][BATCH];
+
+    for (size_t done = 0; done < SSCANF_CASES; done += BATCH) {
+        memset(result, 0, sizeof(result));
+        for (size_t i = 0; i < BATCH; i++) {
+            format[i] = (int)below(sizeof(sscanf_formats) /
+                                   sizeof(*sscanf_formats));
+            sscanf_make(sscanf_formats[format[i]], text[i]);
+        }
+
+        void *args[2][BATCH][SSCANF_ARGS];
+        for (size_t i = 0; i < BATCH; i++) {
+            const char *f = sscanf_formats[format[i]];
+            sscanf_targets(f, &result[0][i], args[0][i]);
+            sscanf_targets(f, &result[1][i], args[1][i]);
+        }
+
+        double start = now_ns();
+        for (size_t i = 0; i < BATCH; i++) {
+            void **a = args[0][i];
+            ret[0][i] = pc_sscanf(text[i],
+                                  sscanf_formats[format[i]],
+                                  a[0],
+                                  a[1],
+                                  a[2],
+                                  a[3],
+                                  a[4],
+                                  a[5]);
+        }
+        double middle = now_ns();
+        for (size_t i = 0; i < BATCH; i++) {
+            void **a = args[1][i];
+            ret[1][i] = sscanf(text[i],
+                               sscanf_formats[format[i]],
+                               a[0],
+                               a[1],
+                               a[2],
+                               a[3],
+                               a[4],
+                               a[5]);
+        }
+        double end = now_ns();
+        ours_ns += middle - start;
+        glibc_ns += end - middle;
+
+        for (size_t i = 0; i < BATCH; i++) {
+            if (ret[0][i] == ret[1][i] &&
+                memcmp(&result[0][i], &result[1][i], sizeof(sscanf_result)) ==
+                    0) {
+                continue;
+            }
+            if (mismatch()) {
+                printf("mismatch sscanf(\"%s\", \"%s\")\n"
+                       "  ours  %d, glibc %d\n",
+                       text[i],
+                       sscanf_formats[format[i]],
+                       ret[0][i],
+                       ret[1][i]);
+                for (int a = 0; a < SSCANF_ARGS; a++) {
+                    printf("  %d: %016lx \"%s\" %016lx \"%s\"\n",
+                           a,
+                           result[0][i].slots[a],
+                           result[0][i].strings[a],
+                           result[1][i].slots[a],
+                           result[1][i].strings[a]);
+                }
+            }
+        }
+    }
+
+    report_header();
+    report_times("sscanf", SSCANF_CASES, ours_ns, glibc_ns);
+}
+
+int main(void) {
+    printf("== snprintf ==\n");
+    test_format();
+    printf("== strtod ==\n");
+    test_strtod();
+    printf("== strtol ==\n");
+    test_strtol();
+    printf("== sscanf ==\n");
+    test_sscanf();
+
+    printf("%zu mismatches\n", mismatches);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}